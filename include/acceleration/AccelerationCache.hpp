@@ -0,0 +1,78 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\MappedFile.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief On-disk cache of a flattened BVH
+*
+* The cache file stores the node array of the tree and, for each entry of
+* the reordered shape list, the index of the shape in the order it was
+* registered with \ref Acceleration::AddMesh(). The reordered list may
+* refer to a shape several times (eg. after spatial splits). It is keyed by a hash of
+* the geometry and of the build parameters. The file is mapped in memory
+* when it is reloaded and the nodes are used in place.
+*/
+class AccelerationCache
+{
+public:
+	AccelerationCache() = default;
+	AccelerationCache(const AccelerationCache &) = delete;
+	AccelerationCache & operator=(const AccelerationCache &) = delete;
+
+	/// Hash the geometry (vertex positions and indices) of the shapes and the build parameters
+	static uint64_t ComputeKey(const std::vector<Shape*> & pShapes, const std::string & Parameters);
+
+	/// Return the path of the cache file of the given key in the directory
+	static std::string GetFilename(const std::string & Directory, uint64_t Key);
+
+	/**
+	* \brief Write a cache file
+	*
+	* \param pOriginalShapes
+	*    The shapes in the order they were registered
+	* \param pOrderedShapes
+	*    The shapes in the order referred by the leaves of the nodes
+	*/
+	static bool Save(
+		const std::string & Filename,
+		uint64_t Key,
+		const void * pNodes,
+		uint32_t NodeSize,
+		uint32_t nNodes,
+		uint32_t nLeafs,
+		const std::vector<Shape*> & pOriginalShapes,
+		const std::vector<Shape*> & pOrderedShapes
+	);
+
+	/**
+	* \brief Map a cache file in memory, fail if the file does not exist or
+	* was written for another key, node layout or number of shapes
+	*/
+	bool Load(const std::string & Filename, uint64_t Key, uint32_t NodeSize, uint32_t nShapes);
+
+	/// Replace the registered shapes by the list referred by the leaves of the nodes
+	void ReorderShapes(std::vector<Shape*> & pShapes) const;
+
+	/// Unmap the cache file
+	void Release();
+
+	/// Return whether a cache file is mapped
+	bool IsLoaded() const;
+
+	/// Return the node array of the mapped cache file
+	void * GetNodes();
+
+	/// Return the number of nodes of the mapped cache file
+	uint32_t GetNodeCount() const;
+
+	/// Return the number of leafs of the mapped cache file
+	uint32_t GetLeafCount() const;
+
+private:
+	MappedFile m_File;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -2,9 +2,14 @@
 
 #include <core\Common.hpp>
 #include <core\Acceleration.hpp>
+#include <acceleration\InlineTriangle.hpp>
+#include <acceleration\TrianglePack.hpp>
+#include <acceleration\AccelerationCache.hpp>
 
 NAMESPACE_BEGIN
 
+struct BVHBinnedNode;
+
 class BVHAcceleration : public Acceleration
 {
 public:
@@ -14,11 +19,17 @@ public:
 
 	virtual void Build() override;
 
+	virtual void Refit() override;
+
 	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const;
 
+	virtual bool Occluded(const Ray3f & Ray) const override;
+
+	virtual void RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const override;
+
 	virtual std::string ToString() const override;
 
-private:
+protected:
 	struct BVHFlatNode
 	{
 		BoundingBox3f BBox;
@@ -27,11 +38,129 @@ private:
 		uint32_t nShapes = 0;
 	};
 
+	/**
+	* \brief Compressed node : the bounds of the two children are quantized to 8 bits
+	* against the bounds of the node, the leafs are stored in their parent
+	*/
+	struct BVHQuantizedNode
+	{
+		/// The bounds of a child are Origin + Q * 2^Exponent (rounded outwards)
+		float Origin[3];
+		int8_t Exponent[3];
+		uint8_t Padding = 0;
+		uint8_t QMin[2][3];
+		uint8_t QMax[2][3];
+
+		/// Index of the child node, or of the first primitive (with LEAF_FLAG set)
+		uint32_t iChild[2];
+
+		/// Number of primitives of a leaf child
+		uint16_t nShapes[2];
+	};
+
+	/// Build the flattened tree and reorder the shapes accordingly
+	void BuildFlatTree();
+
+	void FlattenBVHTree(const BVHBinnedNode * pNode, uint32_t iOffset);
+
+	/// Free the flattened tree, or unmap it when it was loaded from the cache
+	void ReleaseFlatTree();
+
+	/// Bake the triangle packs or the inline triangles of the (reordered) shapes, if enabled
+	void BakeTriangles();
+
+	/**
+	* \brief Compute the SAH cost of the subtree (relative to the surface area
+	* of its root) and of all its nodes into pCosts, the bounds of the nodes
+	* are recomputed from the shapes first if bRefit is true
+	*/
+	float ComputeNodeCost(uint32_t iNode, float * pCosts, bool bRefit);
+
+	/// Collect the roots of the largest subtrees whose cost has grown past the rebuild threshold
+	void FindDegradedSubtrees(uint32_t iNode, const std::vector<float> & Costs, std::vector<uint32_t> & iRoots) const;
+
+	/// Rebuild the given subtrees (in depth-first order) from their shapes
+	void RebuildSubtrees(const std::vector<uint32_t> & iRoots);
+
+	/// Compute the parent of every node of the flattened tree, used by the stackless traversal
+	void ComputeParentIndices();
+
+	/// Return the child of an interior node to visit first along a direction
+	uint32_t GetNearChild(uint32_t iNode, const Vector3f & Direction) const;
+
+	/**
+	* \brief Nearest-hit traversal without a stack (Hapala et al. 2011), the
+	* traversal goes back up through the parent of the nodes instead
+	*/
+	bool RayIntersectStackless(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const;
+
+	bool OccludedStackless(const Ray3f & Ray) const;
+
+	/**
+	* \brief Convert the flattened tree into quantized nodes and the shape pointers
+	* into 32-bit primitive indices, then release both
+	*/
+	void Compress();
+
+	void CompressNode(uint32_t iFlatNode, uint32_t iNode);
+
+	/// Quantize the bounds of a child of a node whose origin and exponents are set
+	void SetQuantizedChild(BVHQuantizedNode & Node, uint32_t iSlot, const BoundingBox3f & BBox, uint32_t iChild, uint32_t nShapes) const;
+
+	/// Restore the shape pointers from the primitive indices and release the quantized nodes
+	void Decompress();
+
+	/// Return the bounds of a child of a quantized node (which contain the exact bounds)
+	BoundingBox3f GetChildBoundingBox(const BVHQuantizedNode & Node, uint32_t iSlot) const;
+
+	/// Return the index of the mesh of a primitive index
+	uint32_t FindPrimitiveMesh(uint32_t iPrimitive) const;
+
+	/// Return the triangle of a primitive index
+	Shape * GetPrimitive(uint32_t iPrimitive) const;
+
+	bool RayIntersectCompressed(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const;
+
+	bool OccludedCompressed(const Ray3f & Ray) const;
+
+	/// Nearest-hit test of the primitives [iStart, iStart + nShapes) of a compressed leaf, Ray.MaxT is shortened on hit
+	bool IntersectCompressedLeaf(Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes, Intersection & Isect) const;
+
+	/// Any-hit test of the primitives [iStart, iStart + nShapes) of a compressed leaf
+	bool OccludedCompressedLeaf(const Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes) const;
+
+	/// Nearest-hit test of the shapes [iStart, iStart + nShapes) of a leaf, Ray.MaxT is shortened on hit
+	bool IntersectLeaf(Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes, Intersection & Isect) const;
+
+	/// Any-hit test of the shapes [iStart, iStart + nShapes) of a leaf
+	bool OccludedLeaf(const Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes) const;
+
 	BVHFlatNode * m_pFlatTree = nullptr;
 	uint32_t m_LeafSize = 0;
 	uint32_t m_nNodes = 0;
 	uint32_t m_nLeafs = 0;
 	std::string m_SplitMethod;
+	float m_DuplicationBudget = 0.0f;
+	float m_RebuildThreshold = 0.0f;
+	std::vector<float> m_NodeCosts;
+	bool m_bInlineTriangle = false;
+	InlineTriangle * m_pInlineTriangles = nullptr;
+	uint32_t m_TrianglePack = 0;
+	bool m_bWatertight = false;
+	TrianglePackArray m_TrianglePacks;
+	std::string m_CacheDirectory;
+	AccelerationCache m_Cache;
+	std::string m_Traversal;
+	std::vector<uint32_t> m_ParentIndices;
+	bool m_bCompressed = false;
+	BVHQuantizedNode * m_pQuantizedTree = nullptr;
+	uint32_t m_nQuantizedNodes = 0;
+
+	/// Compressed layout : the primitives refer to the triangles of the meshes by a 32-bit index
+	std::vector<uint32_t> m_PrimitiveIndices;
+	std::vector<uint32_t> m_iMeshFirstPrimitives;
+	std::vector<const Mesh*> m_pPrimitiveMeshes;
+	std::vector<Triangle*> m_pPrimitiveTriangles;
 };
 
 NAMESPACE_END
\ No newline at end of file
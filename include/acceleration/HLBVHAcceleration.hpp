@@ -3,6 +3,9 @@
 #include <core\Common.hpp>
 #include <core\Acceleration.hpp>
 #include <core\MemoryArena.hpp>
+#include <acceleration\InlineTriangle.hpp>
+#include <acceleration\TrianglePack.hpp>
+#include <acceleration\AccelerationCache.hpp>
 #include <atomic>
 
 NAMESPACE_BEGIN
@@ -20,11 +23,30 @@ public:
 
 	virtual void Build() override;
 
+	virtual void Refit() override;
+
 	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const;
 
+	virtual bool Occluded(const Ray3f & Ray) const override;
+
 	virtual std::string ToString() const override;
 
 private:
+	/// Build the linear tree and reorder the shapes accordingly
+	void BuildLinearTree();
+
+	/// Free the linear tree, or unmap it when it was loaded from the cache
+	void ReleaseLinearTree();
+
+	/// Bake the triangle packs or the inline triangles of the (reordered) shapes, if enabled
+	void BakeTriangles();
+
+	/**
+	* \brief Compute the SAH cost of the subtree (relative to the surface area
+	* of its root), the bounds of the nodes are recomputed from the shapes
+	* first if bRefit is true
+	*/
+	float ComputeNodeCost(uint32_t iNode, uint32_t Depth, bool bRefit);
 	uint32_t LeftShift3(uint32_t X) const;
 	uint32_t EncodeMorton3(const Vector3f & Vec) const;
 	void RadixSort(std::vector<MortonShape> & MortonShapes) const;
@@ -41,16 +63,45 @@ private:
 	BVHBuildNode * BuildUpperSAH(
 		std::vector<BVHBuildNode*> & TreeletRoots,
 		uint32_t iStart,
-		uint32_t iEnd
+		uint32_t iEnd,
+		BVHBuildNode * pUpperNodes
 	);
-	uint32_t FlattenBVHTree(BVHBuildNode * pNode, uint32_t * pOffset);
+	void BuildUpperSAHChildren(
+		std::vector<BVHBuildNode*> & TreeletRoots,
+		uint32_t iStart,
+		uint32_t iMid,
+		uint32_t iEnd,
+		BVHBuildNode * pUpperNodes,
+		BVHBuildNode * pChildren[2]
+	);
+
+	/**
+	* \brief Restructure the treelets of the subtree bottom-up (Karras and Aila 2013),
+	* the SAH cost of the subtree is stored in its root
+	*/
+	void OptimizeTreelets(BVHBuildNode * pNode);
+
+	/// Replace the topology of the treelet rooted at pRoot by the one with the lowest SAH cost
+	void RestructureTreelet(BVHBuildNode * pRoot);
+
+	void FlattenBVHTree(const BVHBuildNode * pNode, uint32_t iOffset);
 
 private:
 	uint32_t m_LeafSize = 0;
 	uint32_t m_nNodes = 0;
 	uint32_t m_nLeafs = 0;
+	float m_RebuildThreshold = 0.0f;
+	float m_BuildCost = 0.0f;
+	uint32_t m_TreeletSize = 0;
 	MemoryArena m_MemoryArena;
-	LinearBVHNode * m_pNodes;
+	LinearBVHNode * m_pNodes = nullptr;
+	bool m_bInlineTriangle = false;
+	InlineTriangle * m_pInlineTriangles = nullptr;
+	uint32_t m_TrianglePack = 0;
+	bool m_bWatertight = false;
+	TrianglePackArray m_TrianglePacks;
+	std::string m_CacheDirectory;
+	AccelerationCache m_Cache;
 };
 
 NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Ray.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Triangle baked into the acceleration data structure
+*
+* The first vertex and the two edges sharing it are stored inline, so that
+* the leaf of a BVH can test its triangles directly without going through
+* the virtual \ref Shape::RayIntersect() and the index/vertex buffers of the
+* mesh. The \ref Shape is still needed for \ref Shape::PostIntersect().
+*/
+struct InlineTriangle
+{
+	Point3f P0;
+	Vector3f Edge1;
+	Vector3f Edge2;
+
+	/// Moller-Trumbore test, gives exactly the same result as \ref Mesh::RayIntersect()
+	bool RayIntersect(const Ray3f & Ray, float & U, float & V, float & T) const
+	{
+		/* Begin calculating determinant - also used to calculate U parameter */
+		Vector3f PVec = Ray.Direction.cross(Edge2);
+
+		/* If determinant is near zero, ray lies in plane of triangle */
+		float Det = Edge1.dot(PVec);
+
+		if (Det > -1e-8f && Det < 1e-8f)
+		{
+			return false;
+		}
+		float InvDet = 1.0f / Det;
+
+		/* Calculate distance from v[0] to ray origin */
+		Vector3f TVec = Ray.Origin - P0;
+
+		/* Calculate U parameter and test bounds */
+		U = TVec.dot(PVec) * InvDet;
+		if (U < 0.0f || U > 1.0f)
+		{
+			return false;
+		}
+
+		/* Prepare to test V parameter */
+		Vector3f QVec = TVec.cross(Edge1);
+
+		/* Calculate V parameter and test bounds */
+		V = Ray.Direction.dot(QVec) * InvDet;
+		if (V < 0.0f || U + V > 1.0f)
+		{
+			return false;
+		}
+
+		/* Ray intersects triangle -> compute t */
+		T = Edge2.dot(QVec) * InvDet;
+
+		return T >= Ray.MinT && T <= Ray.MaxT;
+	}
+};
+
+/**
+* \brief Bake the shapes (in parallel) into an array of \ref InlineTriangle,
+* the i-th entry corresponds to the i-th shape. The returned array should be
+* released with \ref FreeAligned().
+*/
+InlineTriangle * BakeInlineTriangles(const std::vector<Shape*> & pShapes);
+
+NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Acceleration.hpp>
+#include <memory>
+
+NAMESPACE_BEGIN
+
+struct KDTreeEvent;
+struct KDTreeBuildNode;
+struct KDTreeSides;
+
+/// Compact kd-tree node (8 bytes), the below child of an interior node directly follows it
+struct KDTreeNode
+{
+	union
+	{
+		float Split;                // Interior
+		uint32_t iOneShape;         // Leaf with a single shape
+		uint32_t iShapeIndexOffset; // Leaf with several shapes
+	};
+
+	/// The low 2 bits are the split axis (3 for a leaf), the others the number of shapes or the above child
+	uint32_t Flags;
+
+	void InitLeaf(const uint32_t * pShapeIndices, uint32_t nShapes, std::vector<uint32_t> & ShapeIndices);
+	void InitInterior(uint32_t iAxis, uint32_t iAboveChild, float SplitPos);
+
+	bool IsLeaf() const { return (Flags & 3) == 3; }
+	uint32_t GetSplitAxis() const { return Flags & 3; }
+	uint32_t GetShapeCount() const { return Flags >> 2; }
+	uint32_t GetAboveChild() const { return Flags >> 2; }
+};
+
+/**
+* \brief SAH kd-tree
+*
+* The tree is built with the O(N log N) algorithm of Wald and Havran 2006 :
+* the split candidates (the bounds of the shapes on the three axes) are
+* sorted once and the sorted order is kept when the candidates are
+* distributed to the children. Splits that cut off empty space are favoured
+* by the empty bonus, the large subtrees are built in parallel.
+*/
+class KDTreeAcceleration : public Acceleration
+{
+public:
+	KDTreeAcceleration(const PropertyList & PropList);
+
+	virtual void Build() override;
+
+	virtual void Refit() override;
+
+	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const override;
+
+	virtual bool Occluded(const Ray3f & Ray) const override;
+
+	virtual std::string ToString() const override;
+
+private:
+	/**
+	* \brief Build the subtree of the voxel from its sorted events, which are
+	* released, the subtree is a leaf when RemainingDepth is 0
+	*/
+	KDTreeBuildNode * BuildTree(
+		std::vector<KDTreeEvent> & Events,
+		const BoundingBox3f & Voxel,
+		uint32_t nShapes,
+		uint32_t RemainingDepth,
+		KDTreeSides & Sides
+	);
+
+	/// Generate the events of a shape clipped by a voxel
+	void AddEvents(uint32_t iShape, const BoundingBox3f & Voxel, std::vector<KDTreeEvent> & Events) const;
+
+	void FlattenTree(const KDTreeBuildNode * pNode);
+
+private:
+	float m_IntersectionCost = 0.0f;
+	float m_TraversalCost = 0.0f;
+	float m_EmptyBonus = 0.0f;
+	int m_MaxDepth = 0;
+	uint32_t m_nLeafs = 0;
+	uint32_t m_nEmptyLeafs = 0;
+	std::vector<KDTreeNode> m_Nodes;
+	std::vector<uint32_t> m_ShapeIndices;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Ray.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Triangles baked into structure-of-arrays packs of 4 or 8
+*
+* The pack k holds the shapes [k * Width, (k + 1) * Width), so a leaf that
+* refers to a contiguous range of shapes is tested by the packs overlapping
+* the range, with the lanes outside of the range masked off. One ray is
+* tested against all the lanes of a pack at once with SSE/AVX instructions.
+*
+* Two kernels are provided: Moller-Trumbore (packs store the first vertex and
+* two edges) and the watertight test of Woop et al. 2013 (packs store the
+* three vertices), which does not leak rays through the shared edges of
+* adjacent triangles.
+*/
+class TrianglePackArray
+{
+public:
+	/// Per-ray data shared by all the pack tests of a traversal
+	struct RayData
+	{
+		Point3f Origin;
+		Vector3f Direction;
+		float MinT;
+
+		/// Watertight only : axis permutation and shear constants
+		int Kx, Ky, Kz;
+		float Sx, Sy, Sz;
+	};
+
+	TrianglePackArray() = default;
+	TrianglePackArray(const TrianglePackArray &) = delete;
+	TrianglePackArray & operator=(const TrianglePackArray &) = delete;
+
+	~TrianglePackArray();
+
+	/// Bake the shapes (in parallel), Width must be 4 or 8
+	void Build(const std::vector<Shape*> & pShapes, uint32_t Width, bool bWatertight);
+
+	/// Return whether the packs have been baked
+	bool IsBuilt() const { return m_pData != nullptr; }
+
+	/// Precompute the data used by \ref RayIntersect() for a ray
+	void PrepareRay(const Ray3f & Ray, RayData & Data) const;
+
+	/**
+	* \brief Find the nearest intersection with the shapes [iStart, iStart + nShapes)
+	* within [Data.MinT, MaxT]
+	*
+	* \param iShape
+	*    Upon success, the index of the shape that was hit
+	* \param U, V
+	*    Upon success, the barycentric coordinates of the intersection
+	* \param T
+	*    Upon success, the distance from the ray origin to the intersection point
+	*/
+	bool RayIntersect(
+		const RayData & Data,
+		uint32_t iStart,
+		uint32_t nShapes,
+		float MaxT,
+		uint32_t & iShape,
+		float & U,
+		float & V,
+		float & T
+	) const;
+
+	/// Return whether any of the shapes [iStart, iStart + nShapes) is hit within [Data.MinT, MaxT]
+	bool Occluded(const RayData & Data, uint32_t iStart, uint32_t nShapes, float MaxT) const;
+
+	/// Return the size used for the packs
+	size_t GetUsedMemory() const;
+
+private:
+	float * m_pData = nullptr;
+	uint32_t m_Width = 0;
+	uint32_t m_nPacks = 0;
+	bool m_bWatertight = false;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Acceleration.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Two-level acceleration data structure for instanced geometry
+*
+* One bottom-level acceleration (of type "bottomLevel") is built per mesh
+* over its untransformed triangles and shared by all the instances of the
+* mesh, a mesh placed directly in the scene is an instance with the identity
+* transformation. A top-level BVH is built over the world-space bounds of
+* the instances; the rays reaching an instance are transformed into its
+* object space before traversing the bottom-level acceleration.
+*/
+class TwoLevelAcceleration : public Acceleration
+{
+public:
+	TwoLevelAcceleration(const PropertyList & PropList);
+
+	virtual ~TwoLevelAcceleration();
+
+	virtual void AddMesh(Mesh * pMesh) override;
+
+	virtual void AddInstance(Instance * pInstance) override;
+
+	virtual void Build() override;
+
+	virtual void Refit() override;
+
+	virtual size_t GetUsedMemoryForShape() const override;
+
+	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const override;
+
+	virtual bool Occluded(const Ray3f & Ray) const override;
+
+	virtual std::string ToString() const override;
+
+protected:
+	struct TLASInstance
+	{
+		/// The instance, nullptr for a mesh placed directly in the scene (identity)
+		const Instance * pInstance = nullptr;
+		Mesh * pMesh = nullptr;
+		const Acceleration * pBottomLevel = nullptr;
+		BoundingBox3f BBox;
+	};
+
+	struct TLASNode
+	{
+		BoundingBox3f BBox;
+		uint32_t iStart = 0;
+		uint32_t nRightChildOffset = 0;
+		uint32_t nInstances = 0;
+	};
+
+	/// Build the subtree over the instances [iStart, iEnd) and return the index of its root
+	uint32_t RecursiveBuild(uint32_t iStart, uint32_t iEnd);
+
+	/// Nearest-hit test of an instance, Ray is given in world space
+	bool IntersectInstance(const TLASInstance & Inst, const Ray3f & Ray, Intersection & Isect) const;
+
+	std::string m_BottomLevel;
+	std::vector<TLASInstance> m_Instances;
+	std::vector<TLASNode> m_Nodes;
+	std::vector<Acceleration*> m_pBottomLevels;
+};
+
+NAMESPACE_END
\ No newline at end of file
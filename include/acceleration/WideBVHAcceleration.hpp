@@ -0,0 +1,77 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <acceleration\BVHAcceleration.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Multi-branching BVH (QBVH / OBVH)
+*
+* The binary tree produced by \ref BVHAcceleration is collapsed into
+* nodes with \c Width children whose bounding boxes are stored in a
+* structure-of-arrays layout, so that all children of a node can be
+* tested against a ray at once with SSE (4-wide) or AVX (8-wide)
+* instructions. Hit children are visited in front-to-back order.
+*/
+template <uint32_t Width>
+class TWideBVHAcceleration : public BVHAcceleration
+{
+	static_assert(Width == 4 || Width == 8, "Only 4-wide and 8-wide BVH are supported");
+
+public:
+	TWideBVHAcceleration(const PropertyList & PropList);
+
+	virtual ~TWideBVHAcceleration();
+
+	virtual void Build() override;
+
+	virtual void Refit() override;
+
+	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const override;
+
+	virtual bool Occluded(const Ray3f & Ray) const override;
+
+	virtual void RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const override;
+
+	virtual std::string ToString() const override;
+
+protected:
+	struct WideBVHNode
+	{
+		/// Children bounding boxes, stored as [Axis][Child]
+		float BBoxMin[3][Width];
+		float BBoxMax[3][Width];
+
+		/// Index of the child node, or the first shape (with LEAF_FLAG set)
+		uint32_t iChild[Width];
+
+		/// Number of shapes of a leaf child
+		uint32_t nShapes[Width];
+	};
+
+	/// Collapse the binary tree into the wide tree, then release the binary tree
+	void Collapse();
+
+	uint32_t CollapseNode(uint32_t iFlatNode, std::vector<WideBVHNode> & WideNodes);
+
+	/**
+	* \brief Compute the SAH cost of the subtree (relative to the surface area
+	* of its bounds) and its bounds, the bounds of the children are recomputed
+	* from the shapes first if bRefit is true
+	*/
+	float ComputeWideNodeCost(uint32_t iNode, uint32_t Depth, bool bRefit, BoundingBox3f & BBox);
+
+	void SetChild(WideBVHNode & Node, uint32_t iSlot, const BoundingBox3f & BBox, uint32_t iChild, uint32_t nShapes) const;
+	const char * GetName() const;
+
+	WideBVHNode * m_pWideTree = nullptr;
+	uint32_t m_nWideNodes = 0;
+	uint32_t m_nWideLeafs = 0;
+	float m_WideCost = 0.0f;
+};
+
+using QBVHAcceleration = TWideBVHAcceleration<4>;
+using OBVHAcceleration = TWideBVHAcceleration<8>;
+
+NAMESPACE_END
\ No newline at end of file
@@ -7,6 +7,49 @@
 
 NAMESPACE_BEGIN
 
+/// Maximal number of rays traced together by \ref Acceleration::RayIntersectPacket()
+#define HIKARI_RAY_PACKET_SIZE 16
+
+/// Work done by the ray queries of the accelerations, counted per thread
+struct TraversalStatistics
+{
+	struct Counters
+	{
+		uint64_t nRays = 0;
+		uint64_t nNodes = 0;
+		uint64_t nBoxTests = 0;
+		uint64_t nTriangleTests = 0;
+	};
+
+	/// Nearest-hit queries
+	Counters ClosestHit;
+
+	/// Shadow ray (any-hit) queries
+	Counters Shadow;
+
+	TraversalStatistics & operator+=(const TraversalStatistics & Other);
+
+	/// Return a human-readable summary
+	std::string ToString() const;
+};
+
+/**
+* \brief Count the work of a single ray query, which is added to the
+* statistics of the calling thread on destruction if they are enabled
+*/
+struct TraversalCounter
+{
+	TraversalCounter(bool bShadowRay) : bShadowRay(bShadowRay) { }
+
+	~TraversalCounter();
+
+	bool bShadowRay;
+	uint32_t nRays = 1;
+	uint32_t nNodes = 0;
+	uint32_t nBoxTests = 0;
+	uint32_t nTriangleTests = 0;
+};
+
 /**
 * \brief Acceleration data structure for ray intersection queries
 *
@@ -24,16 +67,37 @@ public:
 	*
 	* This function can only be used before \ref Build() is called
 	*/
-	void AddMesh(Mesh * pMesh);
+	virtual void AddMesh(Mesh * pMesh);
+
+	/**
+	* \brief Register an instance (a transformed mesh) for inclusion in the
+	* acceleration data structure
+	*
+	* This function can only be used before \ref Build() is called. Only
+	* the two-level acceleration supports instances, the default
+	* implementation throws an exception.
+	*/
+	virtual void AddInstance(Instance * pInstance);
 
 	/// Build the acceleration data structure (currently a no-op)
 	virtual void Build();
 
+	/**
+	* \brief Update the acceleration data structure after the vertex
+	* positions of the meshes have changed (see \ref Mesh::SetVertexPositions())
+	*
+	* The topology of the data structure is kept and only the bounds are
+	* recomputed, when this degrades the data structure too much, it is
+	* (partially) rebuilt. This function can only be used after \ref Build()
+	* is called. The default implementation only updates the bounding box.
+	*/
+	virtual void Refit();
+
 	/// Return an axis-aligned box that bounds the scene
 	const BoundingBox3f & GetBoundingBox() const;
 
 	/// Return the size used for store the Shape (eg. triangles of the mesh)
-	size_t GetUsedMemoryForShape() const;
+	virtual size_t GetUsedMemoryForShape() const;
 
 	/**
 	* \brief Intersect a ray against all triangles stored in the scene and
@@ -56,6 +120,43 @@ public:
 	*/
 	virtual bool RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const;
 
+	/**
+	* \brief Test whether a ray is blocked by any triangle stored in the scene
+	*
+	* Unlike \ref RayIntersect(), the query stops at the first intersection
+	* found (in any order) and no intersection record is filled.
+	*
+	* \param Ray
+	*    A 3-dimensional ray data structure with minimum/maximum extent
+	*    information
+	*
+	* \return \c true if the ray is occluded
+	*/
+	virtual bool Occluded(const Ray3f & Ray) const;
+
+	/**
+	* \brief Intersect a packet of coherent rays (eg. the camera rays of
+	* neighbouring pixels) against all triangles stored in the scene
+	*
+	* The result is the same as calling \ref RayIntersect() for each ray,
+	* but the data structure may traverse the rays together. The default
+	* implementation simply loops over the rays.
+	*
+	* \param pRays
+	*    The rays of the packet
+	*
+	* \param pIsects
+	*    The intersection records of the rays (with default values)
+	*
+	* \param pbHits
+	*    Upon return, whether each ray found an intersection
+	*
+	* \param nRays
+	*    The number of rays, packets larger than \ref HIKARI_RAY_PACKET_SIZE
+	*    are split
+	*/
+	virtual void RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const;
+
 	/**
 	* \brief Return the type of object (i.e. Mesh/BSDF/etc.)
 	* provided by this instance
@@ -65,6 +166,22 @@ public:
 	/// Return a brief string summary of the instance (for debugging purposes)
 	virtual std::string ToString() const override;
 
+	/**
+	* \brief Enable or disable the traversal statistics of all the
+	* accelerations (disabled by default). The accelerations that do not
+	* count their work leave the statistics untouched.
+	*/
+	static void SetStatisticsEnabled(bool bEnabled);
+
+	/// Return whether the traversal statistics are enabled
+	static bool IsStatisticsEnabled();
+
+	/// Return the traversal statistics of the calling thread
+	static TraversalStatistics & GetThreadStatistics();
+
+	/// Return the traversal statistics summed over all the threads
+	static TraversalStatistics GetStatistics();
+
 protected:
 	std::vector<Shape *> m_pShapes;
 	BoundingBox3f m_BBox;
@@ -14,6 +14,35 @@ This file contains classes for parallel rendering of "image blocks".
 
 NAMESPACE_BEGIN
 
+/**
+* \brief Running statistics of the luminance of the samples generated
+* for a pixel, which are used to estimate the error of the pixel
+* (Welford's online algorithm)
+*/
+struct PixelStatistics
+{
+	uint32_t nSamples = 0;
+	float Mean = 0.0f;
+
+	/// Sum of the squared differences to the mean
+	float M2 = 0.0f;
+
+	/// Record the luminance of a sample
+	void Put(float Value);
+
+	/// Merge the statistics of another set of samples of the same pixel
+	void Put(const PixelStatistics & Stats);
+
+	/**
+	* \brief Return the relative standard error of the mean
+	*
+	* The mean is clamped to 1e-2 so that dark pixels are compared
+	* against an absolute error instead of never converging. Return
+	* infinity when less than 2 samples were recorded.
+	*/
+	float GetRelativeError() const;
+};
+
 /**
 * \brief Weighted pixel storage for a rectangular subregion of an image
 *
@@ -67,9 +96,36 @@ public:
 	/// Convert a bitmap into an image block
 	void FromBitmap(const Bitmap & Bitmap);
 
-	/// Clear all contents
+	/// Clear all contents (and the pixel statistics)
 	void Clear();
 
+	/**
+	* \brief Record the statistics of the samples of each pixel
+	*
+	* The statistics only cover the samples generated inside the
+	* pixel (the border region is discarded), they are used by the
+	* adaptive sampling to decide which pixels need more samples.
+	*/
+	void EnableStatistics();
+
+	/// Return whether the pixel statistics are recorded
+	bool IsStatisticsEnabled() const;
+
+	/// Return the statistics of a pixel given in block coordinates (without the border)
+	const PixelStatistics & GetStatistics(int x, int y) const;
+
+	/// Turn the number of samples of each pixel into a bitmap (for inspection)
+	std::unique_ptr<Bitmap> ToSampleCountBitmap() const;
+
+	/**
+	* \brief Write the unnormalized contents (including the border
+	* region and the filter weights) and the pixel statistics
+	*/
+	void Save(std::ostream & Stream) const;
+
+	/// Read the contents written by \ref Save() into a block of the same size
+	void Load(std::istream & Stream);
+
 	/// Record a sample with the given position and radiance value
 	void Put(const Point2f & Pos, const Color3f & Value);
 
@@ -77,7 +133,8 @@ public:
 	* \brief Merge another image block into this one
 	*
 	* During the merge operation, this function locks
-	* the destination block using a mutex.
+	* the destination block using a mutex. The pixel statistics
+	* are merged when both blocks record them.
 	*/
 	void Put(ImageBlock & Block);
 
@@ -99,6 +156,8 @@ protected:
 	std::unique_ptr<float[]> m_pWeightsX = nullptr;
 	std::unique_ptr<float[]> m_pWeightsY = nullptr;
 	float m_LookupFactor = 0;
+	std::vector<PixelStatistics> m_Statistics;
+	int m_StatisticsStride = 0;
 	mutable tbb::mutex m_Mutex;
 };
 
@@ -131,6 +190,12 @@ public:
 	*/
 	bool Next(ImageBlock & Block);
 
+	/// Restart from the center block, e.g. for another rendering pass
+	void Reset();
+
+	/// Return the index of a block in the row-major grid of the blocks
+	int GetBlockIndex(const ImageBlock & Block) const;
+
 	/// Return the total number of blocks
 	int GetBlockCount() const;
 
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Block.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Header of the checkpoint files
+*
+* The header is followed by the completed block flags (nBlocks bytes),
+* the number of samples of each pixel during the current pass (Width x
+* Height uint32_t) and the contents of the image block (see
+* \ref ImageBlock::Save()). All the values are stored in the native byte
+* order, the files written on a machine of the other byte order are
+* rejected when they are loaded (see ByteOrder).
+*/
+struct CheckpointHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	int32_t Width;
+	int32_t Height;
+	int32_t BorderSize;
+	uint32_t nSampleCount;
+	uint32_t nPassSamples;
+	uint32_t iPass;
+	uint32_t nBlocks;
+	uint32_t bStatistics;
+
+	/// CHECKPOINT_BYTE_ORDER as written by the machine that saved the file
+	uint32_t ByteOrder;
+
+	/// 64-bit FNV-1a hash of the description of the reconstruction filter
+	uint64_t FilterHash;
+};
+
+/**
+* \brief State of an in-progress rendering, which is periodically saved
+* so that a preempted rendering can be resumed
+*
+* Besides the unnormalized image (including the filter weights and the
+* pixel statistics), the state is the index of the current pass, the
+* blocks of the pass already merged into the image and the number of
+* samples of each pixel during the pass. The sampler is deterministically
+* initialized from the block and the pass index (see \ref Sampler::Prepare()),
+* so the remaining blocks are rendered exactly as without the interruption.
+*/
+struct Checkpoint
+{
+	/// Number of samples per pixel of the whole rendering
+	uint32_t nSampleCount = 0;
+
+	/// Number of samples per pixel of each pass
+	uint32_t nPassSamples = 0;
+
+	/// Index of the pass being rendered
+	uint32_t iPass = 0;
+
+	/// Description of the reconstruction filter (see \ref ReconstructionFilter::ToString())
+	std::string Filter;
+
+	/// Whether each block of the current pass is merged into the image (see \ref BlockGenerator::GetBlockIndex())
+	std::vector<uint8_t> bCompletedBlocks;
+
+	/// Number of samples of each pixel during the current pass
+	std::vector<uint32_t> PixelSampleCounts;
+
+	/**
+	* \brief Save the state and the image
+	*
+	* The file is first written to a temporary file, so that a rendering
+	* preempted while writing keeps the previous checkpoint.
+	*/
+	void Save(const std::string & Filename, const ImageBlock & Result) const;
+
+	/**
+	* \brief Restore the state and the image
+	*
+	* Throw an exception if the checkpoint was saved for a rendering with
+	* another image size, filter or number of samples.
+	*/
+	void Load(const std::string & Filename, ImageBlock & Result);
+};
+
+NAMESPACE_END
\ No newline at end of file
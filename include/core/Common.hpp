@@ -90,10 +90,20 @@
 #define XML_INTEGRATOR_PATH_MATS_DEPTH           "depth"
 #define XML_INTEGRATOR_PATH_MIS                  "pathMIS"
 #define XML_INTEGRATOR_PATH_MIS_DEPTH            "depth"
+#define XML_INTEGRATOR_HEATMAP                   "heatmap"
+#define XML_INTEGRATOR_HEATMAP_METRIC            "metric"
+#define XML_INTEGRATOR_HEATMAP_METRIC_NODES      "nodes"
+#define XML_INTEGRATOR_HEATMAP_METRIC_BOX_TESTS  "boxTests"
+#define XML_INTEGRATOR_HEATMAP_METRIC_TRIANGLE_TESTS "triangleTests"
+#define XML_INTEGRATOR_HEATMAP_METRIC_TOTAL      "total"
+#define XML_INTEGRATOR_HEATMAP_MAX_COST          "maxCost"
 
 #define XML_EMITTER                              "emitter"
 #define XML_EMITTER_AREA_LIGHT                   "area"
 #define XML_EMITTER_AREA_LIGHT_RADIANCE          "radiance"
+#define XML_EMITTER_AREA_LIGHT_SAMPLING          "sampling"
+#define XML_EMITTER_AREA_LIGHT_SAMPLING_AREA     "area"
+#define XML_EMITTER_AREA_LIGHT_SAMPLING_SOLID_ANGLE "solidAngle"
 #define XML_EMITTER_POINT_LIGHT                  "point"
 #define XML_EMITTER_POINT_LIGHT_POSITION         "position"
 #define XML_EMITTER_POINT_LIGHT_POWER            "power"
@@ -169,23 +179,70 @@
 #define XML_TEXTURE_SCALE_SCALE                  "scale"
 
 #define XML_ACCELERATION                         "acceleration"
+#define XML_ACCELERATION_STATISTICS              "statistics"
 #define XML_ACCELERATION_BRUTO_LOOP              "bruto"
 #define XML_ACCELERATION_BVH                     "bvh"
 #define XML_ACCELERATION_BVH_LEAF_SIZE           "leafSize"
 #define XML_ACCELERATION_BVH_SPLIT_METHOD        "splitMethod"
 #define XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER "center"
 #define XML_ACCELERATION_BVH_SPLIT_METHOD_SAH    "sah"
+#define XML_ACCELERATION_BVH_SPLIT_METHOD_SBVH   "sbvh"
+#define XML_ACCELERATION_BVH_DUPLICATION_BUDGET  "duplicationBudget"
+#define XML_ACCELERATION_BVH_REBUILD_THRESHOLD   "rebuildThreshold"
+#define XML_ACCELERATION_BVH_INLINE_TRIANGLE     "inlineTriangle"
+#define XML_ACCELERATION_BVH_TRIANGLE_PACK       "trianglePack"
+#define XML_ACCELERATION_BVH_WATERTIGHT          "watertight"
+#define XML_ACCELERATION_BVH_CACHE_DIRECTORY     "cacheDirectory"
+#define XML_ACCELERATION_BVH_COMPRESSED          "compressed"
+#define XML_ACCELERATION_BVH_TRAVERSAL           "traversal"
+#define XML_ACCELERATION_BVH_TRAVERSAL_STACK     "stack"
+#define XML_ACCELERATION_BVH_TRAVERSAL_STACKLESS "stackless"
 #define XML_ACCELERATION_HLBVH                   "hlbvh"
 #define XML_ACCELERATION_HLBVH_LEAF_SIZE         "leafSize"
+#define XML_ACCELERATION_HLBVH_REBUILD_THRESHOLD "rebuildThreshold"
+#define XML_ACCELERATION_HLBVH_TREELET_SIZE      "treeletSize"
+#define XML_ACCELERATION_HLBVH_INLINE_TRIANGLE   "inlineTriangle"
+#define XML_ACCELERATION_HLBVH_TRIANGLE_PACK     "trianglePack"
+#define XML_ACCELERATION_HLBVH_WATERTIGHT        "watertight"
+#define XML_ACCELERATION_HLBVH_CACHE_DIRECTORY   "cacheDirectory"
+#define XML_ACCELERATION_KDTREE                  "kdtree"
+#define XML_ACCELERATION_KDTREE_INTERSECTION_COST "intersectionCost"
+#define XML_ACCELERATION_KDTREE_TRAVERSAL_COST   "traversalCost"
+#define XML_ACCELERATION_KDTREE_EMPTY_BONUS      "emptyBonus"
+#define XML_ACCELERATION_KDTREE_MAX_DEPTH        "maxDepth"
+#define XML_ACCELERATION_QBVH                    "qbvh"
+#define XML_ACCELERATION_OBVH                    "obvh"
+#define XML_ACCELERATION_TWO_LEVEL               "twoLevel"
+#define XML_ACCELERATION_TWO_LEVEL_BOTTOM_LEVEL  "bottomLevel"
 
 #define XML_SCENE                                "scene"
 #define XML_SCENE_BACKGROUND                     "background"
 #define XML_SCENE_FORCE_BACKGROUND               "forceBackground"
+#define XML_SCENE_EMITTER_SAMPLER                "emitterSampler"
+#define XML_SCENE_EMITTER_SAMPLER_UNIFORM        "uniform"
+#define XML_SCENE_EMITTER_SAMPLER_POWER          "power"
+#define XML_SCENE_EMITTER_SAMPLER_BVH            "bvh"
+#define XML_SCENE_EMITTER_SAMPLES                "emitterSamples"
+#define XML_SCENE_ADAPTIVE_THRESHOLD             "adaptiveThreshold"
+#define XML_SCENE_PASS_SAMPLES                   "passSamples"
+#define XML_SCENE_PROGRESSIVE                    "progressive"
+#define XML_SCENE_TIME_BUDGET                    "timeBudget"
+#define XML_SCENE_CHECKPOINT_INTERVAL            "checkpointInterval"
 
 #define XML_MESH                                 "mesh"
 #define XML_MESH_WAVEFRONG_OBJ                   "obj"
 #define XML_MESH_WAVEFRONG_OBJ_FILENAME          "filename"
 #define XML_MESH_WAVEFRONG_OBJ_TO_WORLD          "toWorld"
+#define XML_MESH_BINARY                          "binary"
+#define XML_MESH_BINARY_FILENAME                 "filename"
+#define XML_MESH_BINARY_TO_WORLD                 "toWorld"
+#define XML_MESH_PLY                             "ply"
+#define XML_MESH_PLY_FILENAME                    "filename"
+#define XML_MESH_PLY_TO_WORLD                    "toWorld"
+
+#define XML_INSTANCE                             "instance"
+#define XML_INSTANCE_MESH                        "mesh"
+#define XML_INSTANCE_MESH_TO_WORLD               "toWorld"
 
 #define XML_BSDF                                 "bsdf"
 #define XML_BSDF_GGX                             "ggx"
@@ -312,12 +369,36 @@
 #define XML_SHAPE                                "shape"
 
 /* Default setting */
+#define DEFAULT_ACCELERATION_STATISTICS            false
+
 #define DEFAULT_ACCELERATION_BVH_LEAF_SIZE         10
 #define DEFAULT_ACCELERATION_BVH_SPLIT_METHOD      XML_ACCELERATION_BVH_SPLIT_METHOD_SAH
+#define DEFAULT_ACCELERATION_BVH_DUPLICATION_BUDGET 0.3f
+#define DEFAULT_ACCELERATION_BVH_REBUILD_THRESHOLD  1.5f
+#define DEFAULT_ACCELERATION_BVH_INLINE_TRIANGLE   false
+#define DEFAULT_ACCELERATION_BVH_TRIANGLE_PACK     0
+#define DEFAULT_ACCELERATION_BVH_WATERTIGHT        false
+#define DEFAULT_ACCELERATION_BVH_CACHE_DIRECTORY   ""
+#define DEFAULT_ACCELERATION_BVH_COMPRESSED        false
+#define DEFAULT_ACCELERATION_BVH_TRAVERSAL         XML_ACCELERATION_BVH_TRAVERSAL_STACK
 
 #define DEFAULT_ACCELERATION_HLBVH_LEAF_SIZE       10
+#define DEFAULT_ACCELERATION_HLBVH_REBUILD_THRESHOLD 1.5f
+#define DEFAULT_ACCELERATION_HLBVH_TREELET_SIZE    0
+#define DEFAULT_ACCELERATION_HLBVH_INLINE_TRIANGLE false
+#define DEFAULT_ACCELERATION_HLBVH_TRIANGLE_PACK   0
+#define DEFAULT_ACCELERATION_HLBVH_WATERTIGHT      false
+#define DEFAULT_ACCELERATION_HLBVH_CACHE_DIRECTORY ""
+
+#define DEFAULT_ACCELERATION_KDTREE_INTERSECTION_COST 80.0f
+#define DEFAULT_ACCELERATION_KDTREE_TRAVERSAL_COST 1.0f
+#define DEFAULT_ACCELERATION_KDTREE_EMPTY_BONUS    0.5f
+#define DEFAULT_ACCELERATION_KDTREE_MAX_DEPTH      0
+
+#define DEFAULT_ACCELERATION_TWO_LEVEL_BOTTOM_LEVEL XML_ACCELERATION_QBVH
 
 #define DEFAULT_SCENE_ACCELERATION                 XML_ACCELERATION_BRUTO_LOOP
+#define DEFAULT_SCENE_INSTANCE_ACCELERATION        XML_ACCELERATION_TWO_LEVEL
 
 #define DEFAULT_SCENE_SAMPLER                      XML_SAMPLER_INDEPENDENT
 
@@ -397,14 +478,20 @@
 
 #define DEFAULT_MESH_TO_WORLD                      Transform()
 
+#define DEFAULT_INSTANCE_TO_WORLD                  Transform()
+
 #define DEFAULT_INTEGRATOR_AO_ALPHA                1e6f
 #define DEFAULT_INTEGRATOR_AO_SAMPLE_COUNT         16
 #define DEFAULT_INTEGRATOR_WHITTED_DEPTH           -1
+#define DEFAULT_INTEGRATOR_HEATMAP_METRIC          XML_INTEGRATOR_HEATMAP_METRIC_TOTAL
+#define DEFAULT_INTEGRATOR_HEATMAP_MAX_COST        0.0f
 
 #define DEFAULT_SAMPLER_INDEPENDENT_SAMPLE_COUNT   1
 
 #define DEFAULT_MESH_BSDF                          XML_BSDF_DIFFUSE
 
+#define DEFAULT_EMITTER_AREA_LIGHT_SAMPLING        XML_EMITTER_AREA_LIGHT_SAMPLING_AREA
+
 #define DEFAULT_EMITTER_ENVIRONMENT_SCALE          1.0f
 #define DEFAULT_EMITTER_ENVIRONMENT_TO_WORLD       Transform()
 
@@ -421,6 +508,13 @@
 
 #define DEFAULT_SCENE_BACKGROUND                   Color3f(0.0f)
 #define DEFAULT_SCENE_FORCE_BACKGROUND             false
+#define DEFAULT_SCENE_EMITTER_SAMPLER              XML_SCENE_EMITTER_SAMPLER_BVH
+#define DEFAULT_SCENE_EMITTER_SAMPLES              1
+#define DEFAULT_SCENE_ADAPTIVE_THRESHOLD           0.0f
+#define DEFAULT_SCENE_PASS_SAMPLES                 16
+#define DEFAULT_SCENE_PROGRESSIVE                  false
+#define DEFAULT_SCENE_TIME_BUDGET                  0.0f
+#define DEFAULT_SCENE_CHECKPOINT_INTERVAL          0.0f
 
 #define DEFAULT_TEXTURE_BITMAP_GAMMA               1.0f
 #define DEFAULT_TEXTURE_BITMAP_WRAP_MODE           XML_TEXTURE_BITMAP_WRAP_MODE_REPEAT
@@ -489,12 +583,16 @@ class BlockGenerator;
 class BSDF;
 struct BSDFQueryRecord;
 class Camera;
+struct Checkpoint;
 struct Color3f;
 struct Color4f;
 struct DiscretePDF1D;
 struct DiscretePDF2D;
 class Emitter;
+struct EmitterBounds;
+class EmitterSampler;
 struct Frame;
+class Instance;
 class Integrator;
 class Mesh;
 struct Intersection;
@@ -561,6 +659,8 @@ using Ray2f         = TRay<Point2f, Vector2f>;
 using Ray3f         = TRay<Point3f, Vector3f>;
 using MatrixXf      = Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>;
 using MatrixXu      = Eigen::Matrix<uint32_t, Eigen::Dynamic, Eigen::Dynamic>;
+using MatrixXfMap   = Eigen::Map<MatrixXf>;
+using MatrixXuMap   = Eigen::Map<MatrixXu>;
 using MipMap3f      = MipMap<Color3f>;
 using MipMap1f      = MipMap<float>;
 
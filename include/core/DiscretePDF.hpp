@@ -18,8 +18,17 @@ public:
 
 	DiscretePDF1D(const float * pFunc, int Count);
 
+	/// Construct the distribution from a precomputed (normalized) cdf with Count + 1 entries
+	DiscretePDF1D(const float * pFunc, const float * pCdf, float FuncIntegral, int Count);
+
 	int Count() const;
 
+	/// Return the normalized cdf (Count + 1 entries)
+	const std::vector<float> & GetCdf() const;
+
+	/// Return the integral of the function (before normalization)
+	float GetFuncIntegral() const;
+
 	float SampleContinuous(float Sample, float * pPdf = nullptr, int * pIdx = nullptr) const;
 
 	int SampleDiscrete(float Sample, float * pPdf = nullptr, float * pSampleRemapped = nullptr) const;
@@ -2,6 +2,7 @@
 
 #include <core\Common.hpp>
 #include <core\Object.hpp>
+#include <core\BoundingBox.hpp>
 
 NAMESPACE_BEGIN
 
@@ -35,6 +36,11 @@ struct EmitterQueryRecord
 	/// the whole scene before CALLING Sample().
 	float Distance;
 
+	/// Index of the sampled (or intersected) facet of the mesh of an area
+	/// emitter, uint32_t(-1) if unknown. It must be set before calling
+	/// Pdf() of an area emitter sampling the solid angle of its facets
+	uint32_t iFacet = uint32_t(-1);
+
 	/// Create an unitialized query record
 	EmitterQueryRecord();
 
@@ -51,6 +57,47 @@ struct EmitterQueryRecord
 	std::string ToString() const;
 };
 
+/**
+* \brief Spatial and directional bounds of the emission of an emitter
+* (or of a cluster of emitters), used to estimate its contribution at a
+* shading point for emitter selection
+*
+* Ref : Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+* Adaptive Tree Splitting" and PBRT-v4 (light BVH)
+*/
+struct EmitterBounds
+{
+	/// Bounding box of the emitting positions
+	BoundingBox3f BBox;
+
+	/// Axis of the cone bounding the emitting normals
+	Vector3f W = Vector3f(0.0f, 0.0f, 1.0f);
+
+	/// Cosine of the half angle of the cone bounding the emitting normals
+	float CosThetaO = 1.0f;
+
+	/// Cosine of the angle around each normal in which light is emitted
+	float CosThetaE = 0.0f;
+
+	/// Bound of the emitted intensity (the contribution at distance d is about Phi / d^2)
+	float Phi = 0.0f;
+
+	/// Whether the emitter emits on both sides of its normals
+	bool bTwoSided = false;
+
+	/**
+	* \brief Return a conservative estimate of the contribution at a
+	* point, the cosine at the surface is accounted for if N is not zero
+	*/
+	float Importance(const Point3f & P, const Normal3f & N) const;
+
+	/// Return the bounds of the union of two emitters
+	static EmitterBounds Union(const EmitterBounds & Bounds1, const EmitterBounds & Bounds2);
+
+	/// Return a human-readable string summary
+	std::string ToString() const;
+};
+
 /**
 * \brief Superclass of all emitters
 * It is assumed that the visibility test has been done by intergrator.
@@ -103,6 +150,30 @@ public:
 	*/
 	virtual Color3f Eval(const EmitterQueryRecord & Record) const = 0;
 
+	/**
+	* \brief Return the luminance of the total power emitted, used to
+	* choose between the emitters
+	*
+	* \param SceneRadius  The radius of the bounding sphere of the entire
+	*                     scene, needed by the infinite emitters
+	*/
+	virtual float GetPower(float SceneRadius) const = 0;
+
+	/**
+	* \brief Compute the bounds of the emission, return false for the
+	* infinite emitters (environment or directional emitters) which
+	* are not bounded. The default implementation returns false.
+	*/
+	virtual bool GetBounds(EmitterBounds & Bounds) const;
+
+	/**
+	* \brief Update the sampling data structures after the geometry of
+	* the attached mesh has been loaded or changed. It is called by
+	* \ref Mesh::Activate() and \ref Mesh::SetVertexPositions(). The
+	* default implementation does nothing.
+	*/
+	virtual void UpdateSamplingData();
+
 	/**
 	* \brief Return the type of object (i.e. Mesh/Emitter/etc.)
 	* provided by this instance
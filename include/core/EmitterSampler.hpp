@@ -0,0 +1,206 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Emitter.hpp>
+#include <core\BoundingBox.hpp>
+#include <unordered_map>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Superclass of all emitter selection strategies
+*
+* Instead of computing the direct illumination of every emitter at each
+* shading point, the integrators select one (or a few) emitters with a
+* probability ideally proportional to their contribution.
+*/
+class EmitterSampler
+{
+public:
+	virtual ~EmitterSampler() = default;
+
+	/// Build the internal data structures for the emitters of the scene
+	virtual void Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox) = 0;
+
+	/**
+	* \brief Select an emitter for a shading point
+	*
+	* \param P
+	*     The position of the shading point
+	*
+	* \param N
+	*     The normal of the shading point, which can be zero if the
+	*     shading point is not on a surface
+	*
+	* \param Sample1D
+	*     A uniformly distributed sample on [0, 1]
+	*
+	* \param Pdf
+	*     Upon return, the probability of selecting the returned emitter
+	*
+	* \return The selected emitter or nullptr if no emitter can contribute
+	*/
+	virtual const Emitter * Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const = 0;
+
+	/// Return the probability of selecting an emitter for a shading point
+	virtual float Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const = 0;
+
+	/// Return the memory used by the internal data structures
+	virtual size_t GetUsedMemory() const = 0;
+
+	/// Return a human-readable string summary
+	virtual std::string ToString() const = 0;
+
+	/// Create an emitter sampler with its name (see the XML_SCENE_EMITTER_SAMPLER_* defines)
+	static EmitterSampler * Create(const std::string & Name);
+};
+
+/// Select each emitter with the same probability
+class UniformEmitterSampler : public EmitterSampler
+{
+public:
+	virtual void Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox) override;
+
+	virtual const Emitter * Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const override;
+
+	virtual float Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const override;
+
+	virtual size_t GetUsedMemory() const override;
+
+	virtual std::string ToString() const override;
+
+protected:
+	std::vector<const Emitter*> m_pEmitters;
+	std::unordered_map<const Emitter*, uint32_t> m_EmitterToIndex;
+};
+
+/**
+* \brief Select each emitter with a probability proportional to its
+* power, the selection is done in constant time with an alias table
+*
+* Ref : Vose, "A Linear Algorithm For Generating Random Numbers With a
+* Given Distribution"
+*/
+class PowerEmitterSampler : public EmitterSampler
+{
+public:
+	virtual void Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox) override;
+
+	virtual const Emitter * Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const override;
+
+	virtual float Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const override;
+
+	virtual size_t GetUsedMemory() const override;
+
+	virtual std::string ToString() const override;
+
+protected:
+	struct AliasBin
+	{
+		/// Probability of selecting the emitter of the bin
+		float Pdf;
+
+		/// Probability of keeping the emitter of the bin instead of its alias
+		float Threshold;
+
+		/// Index of the alias emitter
+		uint32_t iAlias;
+	};
+
+	std::vector<const Emitter*> m_pEmitters;
+	std::vector<AliasBin> m_AliasTable;
+	std::unordered_map<const Emitter*, uint32_t> m_EmitterToIndex;
+};
+
+/**
+* \brief A BVH over the emission bounds of a set of items (the emitters
+* of the scene or the triangles of an area emitter). An item is selected
+* by descending the tree, at each node the child is chosen with a
+* probability proportional to its estimated contribution at the shading
+* point.
+*
+* Ref : Conty Estevez and Kulla, "Importance Sampling of Many Lights with
+* Adaptive Tree Splitting" and PBRT-v4 (light BVH)
+*/
+class EmitterBVH
+{
+public:
+	/// Build the BVH over the bounds of the items, the items with zero intensity are never selected
+	void Build(const std::vector<EmitterBounds> & Bounds);
+
+	/// Return whether no item can be selected
+	bool IsEmpty() const;
+
+	/**
+	* \brief Select an item for a shading point (see \ref EmitterSampler::Sample())
+	*
+	* \return The index of the selected item or uint32_t(-1) if no item can contribute
+	*/
+	uint32_t Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const;
+
+	/// Return the probability of selecting an item for a shading point
+	float Pdf(const Point3f & P, const Normal3f & N, uint32_t Index) const;
+
+	/// Return the number of nodes of the BVH
+	uint32_t GetNodeCount() const;
+
+	/// Return the memory used by the BVH
+	size_t GetUsedMemory() const;
+
+protected:
+	struct Node
+	{
+		EmitterBounds Bounds;
+
+		/// Index of the item for a leaf, index of the second child for an interior node (the first child follows the node)
+		uint32_t iChildOrItem;
+
+		bool bLeaf;
+	};
+
+	/**
+	* \brief Build the subtree of the items in [iBegin, iEnd) recursively
+	*
+	* \param BitTrail
+	*     The path from the root to the subtree, bit i is the child chosen at depth i
+	*
+	* \return The index of the root of the subtree
+	*/
+	uint32_t BuildRecursive(std::vector<std::pair<uint32_t, EmitterBounds>> & Items, uint32_t iBegin, uint32_t iEnd, uint64_t BitTrail, uint32_t Depth);
+
+	/// Estimate the cost of a split (the surface area orientation heuristic)
+	static float EvaluateCost(const EmitterBounds & Bounds, const BoundingBox3f & ParentBBox, int Dim);
+
+	std::vector<Node> m_Nodes;
+
+	/// The path to the leaf of each item, uint64_t(-1) if the item is not in the BVH
+	std::vector<uint64_t> m_BitTrails;
+};
+
+/**
+* \brief Select the area and point emitters with a BVH over the bounds
+* of their emission (see \ref EmitterBVH). The infinite emitters
+* (environment and directional emitters) are selected uniformly beside
+* the BVH.
+*/
+class BVHEmitterSampler : public EmitterSampler
+{
+public:
+	virtual void Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox) override;
+
+	virtual const Emitter * Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const override;
+
+	virtual float Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const override;
+
+	virtual size_t GetUsedMemory() const override;
+
+	virtual std::string ToString() const override;
+
+protected:
+	std::vector<const Emitter*> m_pBoundedEmitters;
+	std::vector<const Emitter*> m_pInfiniteEmitters;
+	std::unordered_map<const Emitter*, uint32_t> m_EmitterToIndex;
+	EmitterBVH m_BVH;
+};
+
+NAMESPACE_END
\ No newline at end of file
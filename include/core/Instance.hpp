@@ -0,0 +1,63 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Object.hpp>
+#include <core\Transform.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Placement of a triangle mesh in the scene with a transformation
+*
+* An instance is declared inside of the mesh it refers to, e.g.
+*
+*   <mesh type="obj">
+*     <string name="filename" value="tree.obj"/>
+*     <instance type="mesh">
+*       <transform name="toWorld"> ... </transform>
+*     </instance>
+*   </mesh>
+*
+* All the instances of a mesh share its geometry (and its bottom-level
+* acceleration data structure, see \ref TwoLevelAcceleration). A mesh with
+* instances is only rendered through its instances.
+*/
+class Instance : public Object
+{
+public:
+	Instance(const PropertyList & PropList);
+
+	/// Return the object-to-world transformation
+	const Transform & GetObjectToWorld() const;
+
+	/// Return the world-to-object transformation
+	const Transform & GetWorldToObject() const;
+
+	/// Return the mesh referenced by the instance
+	const Mesh * GetMesh() const;
+
+	/// Return the mesh referenced by the instance
+	Mesh * GetMesh();
+
+	/// Return an axis-aligned box that bounds the transformed mesh
+	BoundingBox3f GetBoundingBox() const;
+
+	/// Register the mesh referenced by the instance (the parent in the XML file)
+	virtual void SetParent(Object * pParentObj, const std::string & Name) override;
+
+	/// Return a human-readable summary of this instance
+	virtual std::string ToString() const override;
+
+	/**
+	* \brief Return the type of object (i.e. Mesh/BSDF/etc.)
+	* provided by this instance
+	* */
+	virtual EClassType GetClassType() const override;
+
+protected:
+	Transform m_ObjectToWorld;
+	Transform m_WorldToObject;
+	Mesh * m_pMesh = nullptr;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -34,6 +34,33 @@ public:
 	*/
 	virtual Color3f Li(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray) const = 0;
 
+	/**
+	* \brief Return whether the integrator implements \ref LiPrimary(), in
+	* which case the camera rays are traced in coherent packets before
+	* being handed to the integrator
+	*/
+	virtual bool IsPrimaryRayPacketSupported() const;
+
+	/**
+	* \brief Sample the incident radiance along a camera ray whose first
+	* intersection has already been found. The default implementation
+	* ignores the intersection and calls \ref Li().
+	*
+	* \param pScene
+	*    A pointer to the underlying scene
+	* \param pSampler
+	*    A pointer to a sample generator
+	* \param Ray
+	*    The ray in question
+	* \param Isect
+	*    The first intersection of the ray (only valid if bHit is true)
+	* \param bHit
+	*    Whether the ray hit the scene
+	* \return
+	*    A (usually) unbiased estimate of the radiance in this direction
+	*/
+	virtual Color3f LiPrimary(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray, const Intersection & Isect, bool bHit) const;
+
 	/**
 	* \brief Return the type of object (i.e. Mesh/BSDF/etc.)
 	* provided by this instance
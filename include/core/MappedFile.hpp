@@ -0,0 +1,50 @@
+#pragma once
+
+#include <core\Common.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief File mapped in memory
+*
+* The whole file is mapped privately (copy-on-write) : the memory can be
+* read in place without loading the file, and modified without altering
+* the file on disk.
+*/
+class MappedFile
+{
+public:
+	MappedFile() = default;
+	MappedFile(const MappedFile &) = delete;
+	MappedFile & operator=(const MappedFile &) = delete;
+
+	/// Unmap the file
+	~MappedFile();
+
+	/// Map the whole file, return false if it does not exist or can not be mapped
+	bool Open(const std::string & Filename);
+
+	/// Unmap the file
+	void Close();
+
+	/// Return whether a file is mapped
+	bool IsOpen() const;
+
+	/// Hint that the whole file will be read soon, the pages are read ahead asynchronously
+	void Prefetch() const;
+
+	/// Return a pointer to the content of the file
+	uint8_t * GetData();
+
+	/// Return a pointer to the content of the file (const version)
+	const uint8_t * GetData() const;
+
+	/// Return the size of the file
+	size_t GetSize() const;
+
+private:
+	uint8_t * m_pData = nullptr;
+	size_t m_Size = 0;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -19,7 +19,7 @@ class Triangle : public Shape
 public:
 	Triangle();
 
-	Triangle(Mesh * pMesh, uint32_t * pFacet, uint32_t iFacet);
+	Triangle(Mesh * pMesh, uint32_t iFacet);
 
 	/**
 	* \brief Uniformly sample a position on the mesh with
@@ -88,7 +88,6 @@ public:
 	virtual std::string ToString() const override;
 
 	Mesh * m_pMesh = nullptr;
-	uint32_t * m_pFacet = nullptr;
 	uint32_t m_iFacet = 0;
 };
 
@@ -104,6 +103,9 @@ public:
 class Mesh : public Object
 {
 public:
+	/// Buffers of a mesh file shared by the meshes loading it (see \ref ShareGeometry())
+	struct SharedGeometry;
+
 	/// Release all memory
 	virtual ~Mesh();
 
@@ -168,16 +170,26 @@ public:
 	bool RayIntersect(uint32_t Index, const Ray3f & Ray, float & U, float & V, float & T) const;
 
 	/// Return a pointer to the vertex positions
-	const MatrixXf & GetVertexPositions() const;
+	const MatrixXfMap & GetVertexPositions() const;
 
 	/// Return a pointer to the vertex normals (or \c nullptr if there are none)
-	const MatrixXf & GetVertexNormals() const;
+	const MatrixXfMap & GetVertexNormals() const;
 
 	/// Return a pointer to the texture coordinates (or \c nullptr if there are none)
-	const MatrixXf & GetVertexTexCoords() const;
+	const MatrixXfMap & GetVertexTexCoords() const;
 
 	/// Return a pointer to the triangle vertex index list
-	const MatrixXu & GetIndices() const;
+	const MatrixXuMap & GetIndices() const;
+
+	/**
+	* \brief Replace the vertex positions (e.g. the next frame of a vertex
+	* animation), the triangles are unchanged
+	*
+	* The bounding box and the area distribution are updated, the vertex
+	* normals are replaced when \c Normals is not empty. The acceleration
+	* containing the mesh must then be refitted, see \ref Scene::Refit().
+	*/
+	void SetVertexPositions(const MatrixXf & Positions, const MatrixXf & Normals);
 
 	/// Is this mesh an area emitter?
 	bool IsEmitter() const;
@@ -191,6 +203,9 @@ public:
 	/// Return a pointer to the BSDF associated with this mesh
 	const BSDF * GetBSDF() const;
 
+	/// Return the instances of this mesh (empty if the mesh is placed directly in the scene)
+	const std::vector<Instance*> & GetInstances() const;
+
 	/// Return the name of this mesh
 	const std::string & GetName() const;
 
@@ -210,14 +225,54 @@ protected:
 	/// Create an empty mesh
 	Mesh();
 
+	/// Compute the surface area and the area distribution of the triangles
+	void ComputeAreaDistribution();
+
+	/**
+	* \brief Allocate the buffers of the mesh (owned by the mesh), the normals
+	* and the texture coordinates are left empty if they are not requested
+	*/
+	void AllocateBuffers(uint32_t nVertices, uint32_t nTriangles, bool bNormals, bool bTexCoords);
+
+	/**
+	* \brief Use buffers which are not owned by the mesh (e.g. a mapped file)
+	* and outlive it, \c pN and \c pUV are \c nullptr if there are none
+	*/
+	void SetExternalBuffers(float * pV, float * pN, float * pUV, uint32_t * pF, uint32_t nVertices, uint32_t nTriangles);
+
+	/// Return the key of a mesh file (loaded by the given mesh type and transformed) in the geometry cache
+	static std::string GetGeometryKey(const std::string & Type, const filesystem::path & Filename, const Transform & Trans);
+
+	/**
+	* \brief Use the buffers and the bounding box of a mesh loaded previously
+	* with the same key, return false if there is none (anymore)
+	*/
+	bool AttachSharedGeometry(const std::string & Key);
+
+	/**
+	* \brief Move the (owned) buffers of the mesh into the geometry cache so
+	* that the meshes loaded later with the same key share them
+	*/
+	void ShareGeometry(const std::string & Key);
+
+	/// Copy the shared buffers before the mesh is modified
+	void DetachSharedGeometry();
+
 protected:
+
 	std::string m_Name;                            ///< Identifying name
-	MatrixXf m_V;                                  ///< Vertex positions
-	MatrixXf m_N;                                  ///< Vertex normals
-	MatrixXf m_UV;                                 ///< Vertex texture coordinates
-	MatrixXu m_F;                                  ///< Faces
+	MatrixXfMap m_V = MatrixXfMap(nullptr, 3, 0);  ///< Vertex positions
+	MatrixXfMap m_N = MatrixXfMap(nullptr, 3, 0);  ///< Vertex normals
+	MatrixXfMap m_UV = MatrixXfMap(nullptr, 2, 0); ///< Vertex texture coordinates
+	MatrixXuMap m_F = MatrixXuMap(nullptr, 3, 0);  ///< Faces
+	MatrixXf m_VStorage;                           ///< Storage of the vertex positions, unless external
+	MatrixXf m_NStorage;                           ///< Storage of the vertex normals, unless external
+	MatrixXf m_UVStorage;                          ///< Storage of the texture coordinates, unless external
+	MatrixXu m_FStorage;                           ///< Storage of the faces, unless external
+	std::shared_ptr<SharedGeometry> m_pSharedGeometry; ///< Immutable buffers shared with other meshes, if any
 	BSDF * m_pBSDF = nullptr;                      ///< BSDF of the surface
 	Emitter * m_pEmitter = nullptr;                ///< Associated emitter, if any
+	std::vector<Instance*> m_pInstances;           ///< Instances of the mesh, if any
 	BoundingBox3f m_BBox;                          ///< Bounding box of the mesh
 	std::unique_ptr<DiscretePDF1D> m_pPDF;         ///< Used for sampling triangle of the mesh weighted by its area
 	float m_MeshArea = 0.0f;                       ///< Total surface area of the mesh
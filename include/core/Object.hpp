@@ -34,7 +34,8 @@ public:
 		EReconstructionFilter = 11,
 		EAcceleration         = 12,
 		EShape                = 13,
-		EClassTypeCount       = 14
+		EInstance             = 14,
+		EClassTypeCount       = 15
 	};
 
 	/// Virtual destructor
@@ -52,8 +52,12 @@ public:
 	* a new image block. This can be used to deterministically
 	* initialize the sampler so that repeated program runs
 	* always create the same image.
+	*
+	* \param iPass
+	*     The index of the rendering pass over the block, the
+	*     samples of different passes must be independent
 	*/
-	virtual void Prepare(const ImageBlock & Block) = 0;
+	virtual void Prepare(const ImageBlock & Block, uint32_t iPass = 0) = 0;
 
 	/**
 	* \brief Prepare to generate new samples
@@ -44,6 +44,22 @@ public:
 	/// Probability density of \ref SquareToCosineHemisphere()
 	static float SquareToCosineHemispherePdf(const Vector3f & V);
 
+	/**
+	* \brief Uniformly sample a direction with respect to solid angles in the
+	* spherical triangle subtended by the triangle (P0, P1, P2) at Ref. Return
+	* the barycentric coordinates (of P1 and P2) of the point of the triangle
+	* in the sampled direction.
+	*
+	* Ref : Arvo, "Stratified Sampling of Spherical Triangles" and PBRT-v4
+	*/
+	static Point2f SquareToSphericalTriangle(const Point2f & Sample, const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2);
+
+	/// Probability density of \ref SquareToSphericalTriangle() (i.e. the inverse of the solid angle of the triangle)
+	static float SquareToSphericalTrianglePdf(const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2);
+
+	/// Return the solid angle subtended by the triangle (P0, P1, P2) at Ref
+	static float SphericalTriangleSolidAngle(const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2);
+
 	/// Warp a uniformly distributed square sample to a Beckmann distribution * cosine for the given 'alpha' parameter
 	/// (Deprecated : Sampling methods relevant to microfacet are wrapped in MicrofacetDistribution class now.)
 	static Vector3f SquareToBeckmann(const Point2f & Sample, float Alpha);
@@ -57,6 +57,66 @@ public:
 	/// Return a pointer to the scene's environment emitter
 	Emitter * GetEnvironmentEmitter();
 
+	/**
+	* \brief Select an emitter for the direct illumination of a shading
+	* point, see \ref EmitterSampler::Sample()
+	*
+	* \param P
+	*     The position of the shading point
+	*
+	* \param N
+	*     The normal of the shading point (can be zero)
+	*
+	* \param Sample1D
+	*     A uniformly distributed sample on [0, 1]
+	*
+	* \param Pdf
+	*     Upon return, the probability of selecting the returned emitter
+	*
+	* \return The selected emitter or nullptr if no emitter can contribute
+	*/
+	const Emitter * SampleEmitter(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const;
+
+	/// Return the probability of selecting an emitter for a shading point
+	float EmitterPdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const;
+
+	/// Return the number of emitters selected (i.e. shadow rays traced) for each shading point
+	uint32_t GetEmitterSampleCount() const;
+
+	/// Return the relative error under which a pixel stops receiving samples
+	float GetAdaptiveThreshold() const;
+
+	/**
+	* \brief Return whether the pixels stop receiving samples once their
+	* relative error falls below the adaptive threshold. The image is
+	* then rendered in several passes over the image blocks.
+	*/
+	bool IsAdaptiveSamplingEnabled() const;
+
+	/// Return the number of samples per pixel of each rendering pass
+	uint32_t GetPassSampleCount() const;
+
+	/**
+	* \brief Return whether the image is rendered progressively, i.e.
+	* in passes over all the image blocks, the current image being
+	* written after each pass
+	*/
+	bool IsProgressive() const;
+
+	/**
+	* \brief Return the wall-clock budget of the rendering in seconds
+	* (0 if unlimited). No new pass is started if it would end after
+	* the budget, and the blocks of the current pass which are not
+	* started yet when it runs out are left unrendered.
+	*/
+	float GetTimeBudget() const;
+
+	/**
+	* \brief Return the minimum time in seconds between two checkpoints
+	* of the rendering (0 if the checkpoints are disabled)
+	*/
+	float GetCheckpointInterval() const;
+
 	/// Return a axis-aligned box that bounds the scene
 	BoundingBox3f GetBoundingBox() const;
 
@@ -76,6 +136,24 @@ public:
 	*/
 	bool RayIntersect(const Ray3f & Ray, Intersection & Isect) const;
 
+	/**
+	* \brief Intersect a packet of coherent rays against all triangles
+	* stored in the scene, see \ref Acceleration::RayIntersectPacket()
+	*
+	* \param pRays
+	*    The rays of the packet
+	*
+	* \param pIsects
+	*    The intersection records of the rays
+	*
+	* \param pbHits
+	*    Upon return, whether each ray found an intersection
+	*
+	* \param nRays
+	*    The number of rays of the packet
+	*/
+	void RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const;
+
 	/**
 	* \brief Intersect a ray against all triangles stored in the scene
 	*
@@ -95,6 +173,12 @@ public:
 	*/
 	virtual void Activate() override;
 
+	/**
+	* \brief Update the acceleration structure after the vertex positions
+	* of some meshes have changed, see \ref Acceleration::Refit()
+	*/
+	void Refit();
+
 	/// Add a child object to the scene (meshes, integrators etc.)
 	virtual void AddChild(Object * pChildObj, const std::string & Name) override;
 
@@ -106,6 +190,13 @@ public:
 protected:
 	Color3f m_Background;
 	bool m_bForceBackground;
+	std::string m_EmitterSamplerName;
+	uint32_t m_nEmitterSamples;
+	float m_AdaptiveThreshold;
+	uint32_t m_nPassSamples;
+	bool m_bProgressive;
+	float m_TimeBudget;
+	float m_CheckpointInterval;
 
 	std::vector<Mesh *> m_pMeshes;
 	Integrator * m_pIntegrator = nullptr;
@@ -114,6 +205,7 @@ protected:
 	Acceleration * m_pAcceleration = nullptr;
 	std::vector<Emitter*> m_pEmitters;
 	Emitter * m_pEnvironmentEmitter = nullptr;
+	std::unique_ptr<EmitterSampler> m_pEmitterSampler;
 	BoundingBox3f m_BBox;
 };
 
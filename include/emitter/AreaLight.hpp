@@ -2,6 +2,7 @@
 
 #include <core\Emitter.hpp>
 #include <core\Common.hpp>
+#include <core\EmitterSampler.hpp>
 
 NAMESPACE_BEGIN
 
@@ -16,12 +17,28 @@ public:
 
 	virtual Color3f Eval(const EmitterQueryRecord & Record) const override;
 
+	virtual float GetPower(float SceneRadius) const override;
+
+	virtual bool GetBounds(EmitterBounds & Bounds) const override;
+
+	virtual void UpdateSamplingData() override;
+
 	virtual void SetParent(Object * pParentObj, const std::string & Name) override;
 	
 	virtual std::string ToString() const;
 
 protected:
+	/**
+	* \brief Return the solid angle density of sampling the point P of a
+	* facet from Ref once the facet has been selected
+	*/
+	float FacetPdf(uint32_t iFacet, const Point3f & Ref, const Point3f & P) const;
+
 	Color3f m_Radiance;
+
+	/// Sample the solid angle subtended by a facet selected with m_FacetBVH instead of the area of the mesh
+	bool m_bSolidAngleSampling;
+	EmitterBVH m_FacetBVH;
 };
 
 NAMESPACE_END
\ No newline at end of file
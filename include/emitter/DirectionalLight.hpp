@@ -16,6 +16,8 @@ public:
 
 	virtual Color3f Eval(const EmitterQueryRecord & Record) const override;
 
+	virtual float GetPower(float SceneRadius) const override;
+
 	virtual std::string ToString() const;
 
 protected:
@@ -20,11 +20,14 @@ public:
 
 	virtual Color3f Eval(const EmitterQueryRecord & Record) const override;
 
+	virtual float GetPower(float SceneRadius) const override;
+
 	virtual std::string ToString() const;
 
 protected:
 	std::string m_Name;
 	float m_Scale;
+	float m_LuminanceIntegral;
 	Transform m_ToWorld;
 	Transform m_ToLocal;
 	Bitmap * m_pEnvironmentMap = nullptr;
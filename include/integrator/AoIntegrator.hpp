@@ -16,6 +16,12 @@ public:
 	/// Compute the radiance value for a given ray. Just return green here
 	virtual Color3f Li(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray) const override;
 
+	/// The camera rays can be traced in packets
+	virtual bool IsPrimaryRayPacketSupported() const override;
+
+	/// Compute the radiance value for a camera ray whose first intersection is known
+	virtual Color3f LiPrimary(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray, const Intersection & Isect, bool bHit) const override;
+
 	/// Return a human-readable description for debugging purposes
 	virtual std::string ToString() const override;
 
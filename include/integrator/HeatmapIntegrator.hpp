@@ -0,0 +1,43 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Integrator.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief This integrator visualizes the traversal cost of the camera rays,
+* i.e. the number of nodes visited, bounding boxes or triangles tested by
+* the acceleration for the nearest intersection. When maxCost is positive
+* the cost is mapped onto a blue-green-red ramp, otherwise the raw cost is
+* written to all the channels.
+*/
+class HeatmapIntegrator : public Integrator
+{
+public:
+	HeatmapIntegrator(const PropertyList & PropList);
+
+	/// Enable the traversal statistics of the accelerations
+	virtual void Preprocess(const Scene * pScene) override;
+
+	/// Compute the traversal cost of a given ray
+	virtual Color3f Li(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray) const override;
+
+	/// Return a human-readable description for debugging purposes
+	virtual std::string ToString() const override;
+
+protected:
+	enum class EMetric
+	{
+		ENodes = 0,
+		EBoxTests = 1,
+		ETriangleTests = 2,
+		ETotal = 3
+	};
+
+	std::string m_MetricName;
+	EMetric m_Metric;
+	float m_MaxCost;
+};
+
+NAMESPACE_END
\ No newline at end of file
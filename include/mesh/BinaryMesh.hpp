@@ -0,0 +1,68 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Mesh.hpp>
+#include <core\MappedFile.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Header of the binary mesh files
+*
+* The header is followed by the arrays of the mesh, each one starting at
+* an offset aligned to 64 bytes (0 if it is absent) :
+* positions (3 x nVertices floats), normals (3 x nVertices floats),
+* texture coordinates (2 x nVertices floats), indices (3 x nTriangles
+* uint32_t) and optionally the area distribution, i.e. the area of the
+* triangles (nTriangles floats) and its normalized cdf (nTriangles + 1
+* floats). All the values are stored in the native byte order, the
+* files written on a machine of the other byte order are rejected when
+* they are loaded (see ByteOrder).
+*/
+struct BinaryMeshHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t nVertices;
+	uint32_t nTriangles;
+
+	/// BINARY_MESH_BYTE_ORDER as written by the machine that saved the file
+	uint32_t ByteOrder;
+	float BBoxMin[3];
+	float BBoxMax[3];
+	float MeshArea;
+	float AreaIntegral;
+	uint64_t PositionsOffset;
+	uint64_t NormalsOffset;
+	uint64_t TexCoordsOffset;
+	uint64_t IndicesOffset;
+	uint64_t AreasOffset;
+	uint64_t CdfOffset;
+};
+
+/**
+* \brief Loader for binary triangle meshes
+*
+* The file is mapped in memory and the buffers of the mesh point directly
+* into the mapping, so that nothing is parsed nor copied and the pages
+* are only read when they are first used. The mapping is copy-on-write :
+* several processes loading the same file share its pages in the page
+* cache, unless a transformation is given (the transformed positions and
+* normals are private to the process).
+*/
+class BinaryMesh : public Mesh
+{
+public:
+	BinaryMesh(const PropertyList & PropList);
+
+	/**
+	* \brief Write a mesh into a binary mesh file, the area distribution
+	* of the triangles is also stored if bAreaDistribution is true
+	*/
+	static void Save(const Mesh * pMesh, const std::string & Filename, bool bAreaDistribution);
+
+protected:
+	MappedFile m_File;
+};
+
+NAMESPACE_END
\ No newline at end of file
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <core\Common.hpp>
+#include <core\Mesh.hpp>
+
+NAMESPACE_BEGIN
+
+/**
+* \brief Loader for binary (little-endian or big-endian) PLY triangle meshes
+*
+* The file is mapped in memory. The records of the vertex element are
+* decoded in parallel, the records of the face element are located (in
+* parallel when all the faces have the same size, which is the common
+* case), then the polygons are triangulated as fans in parallel. The
+* transformation is applied to all the vertices at once afterwards.
+*/
+class PlyMesh : public Mesh
+{
+public:
+	PlyMesh(const PropertyList & PropList);
+
+protected:
+	enum class EPlyType
+	{
+		EInvalid = 0,
+		EInt8    = 1,
+		EUInt8   = 2,
+		EInt16   = 3,
+		EUInt16  = 4,
+		EInt32   = 5,
+		EUInt32  = 6,
+		EFloat32 = 7,
+		EFloat64 = 8
+	};
+
+	struct PlyProperty
+	{
+		std::string Name;
+		EPlyType Type = EPlyType::EInvalid;
+
+		/// Type of the number of items of a list property (EInvalid for a scalar property)
+		EPlyType CountType = EPlyType::EInvalid;
+
+		/// Offset of the property in the records (only valid if the records have a fixed size)
+		size_t Offset = 0;
+	};
+
+	struct PlyElement
+	{
+		std::string Name;
+		size_t Count = 0;
+		std::vector<PlyProperty> Properties;
+
+		/// Size of the records if they all have the same size, 0 otherwise
+		size_t RecordSize = 0;
+
+		/// Offset of each record in the file (only used if the records have different sizes)
+		std::vector<size_t> RecordOffsets;
+
+		/// Range of the element in the file
+		size_t Begin = 0;
+		size_t End = 0;
+	};
+
+	/// Parse the name of a type (e.g. "uchar" or "uint8")
+	static EPlyType ParseType(const std::string & Name, const std::string & Filename);
+
+	/// Return the size of a type in bytes
+	static size_t GetTypeSize(EPlyType Type);
+
+	/// Read a value of the given type and convert it to T
+	template <typename T>
+	static T ReadValue(const uint8_t * pData, EPlyType Type, bool bSwap);
+
+	/// Return the property with the given name (or \c nullptr if there is none)
+	static const PlyProperty * FindProperty(const PlyElement & Element, const std::string & Name);
+
+	/// Parse the header, return the offset of the body
+	static size_t ParseHeader(const char * pData, size_t Size, const std::string & Filename, bool & bSwap, std::vector<PlyElement> & Elements);
+
+	/// Find the records of an element which begins at Element.Begin
+	static void LocateRecords(PlyElement & Element, const uint8_t * pData, size_t Size, bool bSwap, const std::string & Filename);
+
+	/**
+	* \brief Return the offset of a property in a record (or the size of the
+	* record if iProperty is the number of properties), size_t(-1) if the
+	* record is larger than MaxSize
+	*/
+	static size_t GetPropertyOffset(const PlyElement & Element, const uint8_t * pRecord, size_t iProperty, size_t MaxSize, bool bSwap);
+
+	/// Return the first triangle of each block of faces (and the number of triangles at the end)
+	static std::vector<uint32_t> CountTriangles(const PlyElement & Element, size_t iIndexProperty, const uint8_t * pData, bool bSwap, const std::string & Filename);
+
+	/// Decode the positions, normals and texture coordinates
+	void DecodeVertices(const PlyElement & Element, const uint8_t * pData, bool bSwap);
+
+	/// Triangulate the faces
+	void DecodeFaces(const PlyElement & Element, size_t iIndexProperty, const uint8_t * pData, bool bSwap, const std::vector<uint32_t> & BlockTriangleOffsets, const std::string & Filename);
+
+	/// Apply the transformation to the vertices and compute the bounding box
+	void TransformVertices(const Transform & Trans);
+};
+
+NAMESPACE_END
\ No newline at end of file
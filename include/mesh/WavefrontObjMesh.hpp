@@ -7,6 +7,11 @@ NAMESPACE_BEGIN
 
 /**
 * \brief Loader for Wavefront OBJ triangle meshes
+*
+* The file is mapped in memory and split into chunks of whole lines which
+* are parsed in parallel. The vertices (distinct position / texture
+* coordinate / normal triples) are then numbered in the order of their first
+* use by the faces with a parallel sort.
 */
 class WavefrontObjMesh : public Mesh
 {
@@ -22,15 +27,18 @@ protected:
 
 		ObjVertex();
 
-		ObjVertex(const std::string & String);
-
 		bool operator==(const ObjVertex & Rhs) const;
-	};
 
-	struct ObjVertexHash 
-	{
-		size_t operator()(const ObjVertex & Rhs) const;
+		bool operator<(const ObjVertex & Rhs) const;
 	};
+
+	struct ObjChunk;
+
+	/// Parse the lines of a chunk of the file
+	static void ParseChunk(ObjChunk & Chunk, const Transform & Trans);
+
+	/// Parse a vertex of a face ("P", "P/UV", "P//N" or "P/UV/N")
+	static ObjVertex ParseVertex(const char * pBegin, const char * pEnd);
 };
 
 NAMESPACE_END
\ No newline at end of file
@@ -22,7 +22,7 @@ public:
 
 	virtual std::unique_ptr<Sampler> Clone() const override;
 
-	virtual void Prepare(const ImageBlock & Block) override;
+	virtual void Prepare(const ImageBlock & Block, uint32_t iPass = 0) override;
 
 	virtual void Generate() override;
 
@@ -1,4 +1,7 @@
 #include <core\Screen.hpp>
+#include <core\Acceleration.hpp>
+#include <core\Checkpoint.hpp>
+#include <mesh\BinaryMesh.hpp>
 #include <thread>
 #include <mutex>
 #include <algorithm>
@@ -8,23 +11,155 @@ NAMESPACE_BEGIN
 
 static std::mutex Lock;
 
-static void RenderBlock(const Scene * pScene, Sampler * pSampler, ImageBlock & Block)
+/**
+* \brief Compute the number of samples of each pixel for the next pass
+*
+* With adaptive sampling, a pixel stops receiving samples once its relative
+* error falls below the threshold. The pixels within the radius of the
+* reconstruction filter around an unconverged pixel keep receiving samples
+* too, otherwise the samples of the unconverged pixel would get more and more
+* weight in the filtered neighbourhood and bias the image.
+*
+* \param iPass
+*     The index of the next pass
+*
+* \return The number of pixels receiving samples
+*/
+static int ComputePixelSampleCounts(const Scene * pScene, const ImageBlock & Result, uint32_t iPass, uint32_t nPassSamples, std::vector<uint32_t> & PixelSampleCounts)
+{
+	Vector2i Size = Result.GetSize();
+	uint32_t nSampleCount = uint32_t(pScene->GetSampler()->GetSampleCount());
+
+	if (!Result.IsStatisticsEnabled())
+	{
+		/* Every pixel receives the same number of samples */
+		uint32_t nRenderedSamples = std::min(iPass * nPassSamples, nSampleCount);
+		PixelSampleCounts.assign(size_t(Size.x()) * size_t(Size.y()), std::min(nPassSamples, nSampleCount - nRenderedSamples));
+		return PixelSampleCounts[0] > 0 ? Size.x() * Size.y() : 0;
+	}
+
+	PixelSampleCounts.resize(size_t(Size.x()) * size_t(Size.y()));
+
+	std::vector<uint8_t> bUnconverged(PixelSampleCounts.size());
+	for (int y = 0; y < Size.y(); ++y)
+	{
+		for (int x = 0; x < Size.x(); ++x)
+		{
+			const PixelStatistics & Stats = Result.GetStatistics(x, y);
+			bUnconverged[y * Size.x() + x] = Stats.nSamples < nSampleCount && Stats.GetRelativeError() > pScene->GetAdaptiveThreshold();
+		}
+	}
+
+	int Radius = Result.GetBorderSize();
+	int nActivePixels = 0;
+	for (int y = 0; y < Size.y(); ++y)
+	{
+		for (int x = 0; x < Size.x(); ++x)
+		{
+			bool bActive = false;
+			for (int yy = std::max(y - Radius, 0); yy <= std::min(y + Radius, Size.y() - 1) && !bActive; ++yy)
+			{
+				for (int xx = std::max(x - Radius, 0); xx <= std::min(x + Radius, Size.x() - 1) && !bActive; ++xx)
+				{
+					bActive = bUnconverged[yy * Size.x() + xx] != 0;
+				}
+			}
+
+			uint32_t nSamples = Result.GetStatistics(x, y).nSamples;
+			uint32_t & nPixelSamples = PixelSampleCounts[y * Size.x() + x];
+			nPixelSamples = (bActive && nSamples < nSampleCount) ? std::min(nPassSamples, nSampleCount - nSamples) : 0;
+			nActivePixels += nPixelSamples > 0 ? 1 : 0;
+		}
+	}
+
+	return nActivePixels;
+}
+
+static void RenderBlock(const Scene * pScene, Sampler * pSampler, ImageBlock & Block, const std::vector<uint32_t> & PixelSampleCounts)
 {
 	const Camera * pCamera = pScene->GetCamera();
 	const Integrator * pIntegrator = pScene->GetIntegrator();
 
 	Point2i Offset = Block.GetOffset();
 	Vector2i Size = Block.GetSize();
+	int Width = pCamera->GetOutputSize().x();
 
 	/* Clear the block contents */
 	Block.Clear();
 
+	/* Trace the camera rays of neighbouring pixels in coherent packets */
+	if (pIntegrator->IsPrimaryRayPacketSupported())
+	{
+		const int PACKET_TILE_SIZE = 4;
+		static_assert(PACKET_TILE_SIZE * PACKET_TILE_SIZE <= HIKARI_RAY_PACKET_SIZE, "The packet tile is too large");
+
+		/* For each tile of pixels and pixel sample sample */
+		for (int TileY = 0; TileY < Size.y(); TileY += PACKET_TILE_SIZE)
+		{
+			for (int TileX = 0; TileX < Size.x(); TileX += PACKET_TILE_SIZE)
+			{
+				uint32_t nPixelSamples[PACKET_TILE_SIZE][PACKET_TILE_SIZE] = {};
+				uint32_t nMaxPixelSamples = 0;
+				for (int y = TileY; y < std::min(TileY + PACKET_TILE_SIZE, Size.y()); ++y)
+				{
+					for (int x = TileX; x < std::min(TileX + PACKET_TILE_SIZE, Size.x()); ++x)
+					{
+						nPixelSamples[y - TileY][x - TileX] = PixelSampleCounts[(y + Offset.y()) * Width + x + Offset.x()];
+						nMaxPixelSamples = std::max(nMaxPixelSamples, nPixelSamples[y - TileY][x - TileX]);
+					}
+				}
+
+				for (uint32_t i = 0; i < nMaxPixelSamples; ++i)
+				{
+					Ray3f Rays[HIKARI_RAY_PACKET_SIZE];
+					Color3f Values[HIKARI_RAY_PACKET_SIZE];
+					Point2f PixelSamples[HIKARI_RAY_PACKET_SIZE];
+					Intersection Isects[HIKARI_RAY_PACKET_SIZE];
+					bool bHits[HIKARI_RAY_PACKET_SIZE];
+					uint32_t nRays = 0;
+
+					/* Sample a ray from the camera for each pixel of the tile which still needs samples */
+					for (int y = TileY; y < std::min(TileY + PACKET_TILE_SIZE, Size.y()); ++y)
+					{
+						for (int x = TileX; x < std::min(TileX + PACKET_TILE_SIZE, Size.x()); ++x)
+						{
+							if (i >= nPixelSamples[y - TileY][x - TileX])
+							{
+								continue;
+							}
+
+							PixelSamples[nRays] = Point2f(float(x + Offset.x()), float(y + Offset.y())) + pSampler->Next2D();
+							Point2f ApertureSample = pSampler->Next2D();
+							Values[nRays] = pCamera->SampleRay(Rays[nRays], PixelSamples[nRays], ApertureSample);
+							nRays++;
+						}
+					}
+
+					/* Find the first intersections of the whole packet */
+					pScene->RayIntersectPacket(Rays, Isects, bHits, nRays);
+
+					for (uint32_t iRay = 0; iRay < nRays; iRay++)
+					{
+						/* Compute the incident radiance */
+						Color3f Value = Values[iRay] * pIntegrator->LiPrimary(pScene, pSampler, Rays[iRay], Isects[iRay], bHits[iRay]);
+
+						/* Store in the image block */
+						Block.Put(PixelSamples[iRay], Value);
+					}
+				}
+			}
+		}
+
+		return;
+	}
+
 	/* For each pixel and pixel sample sample */
 	for (int y = 0; y < Size.y(); ++y)
 	{
 		for (int x = 0; x < Size.x(); ++x)
 		{
-			for (uint32_t i = 0; i < pSampler->GetSampleCount(); ++i)
+			uint32_t nPixelSamples = PixelSampleCounts[(y + Offset.y()) * Width + x + Offset.x()];
+			for (uint32_t i = 0; i < nPixelSamples; ++i)
 			{
 				Point2f PixelSample = Point2f(float(x + Offset.x()), float(y + Offset.y())) + pSampler->Next2D();
 				Point2f ApertureSample = pSampler->Next2D();
@@ -43,7 +178,37 @@ static void RenderBlock(const Scene * pScene, Sampler * pSampler, ImageBlock & B
 	}
 }
 
-static void Render(Scene * pScene, const std::string & Filename) 
+/**
+* \brief Turn the rendered image block into a properly normalized bitmap
+* and save it (and the number of samples of each pixel when recorded)
+* using the OpenEXR format
+*
+* The bitmap is first written to a temporary file, so that a rendering
+* job killed while writing keeps the previously saved image.
+*/
+static void SaveImage(const ImageBlock & Result, const std::string & OutputName)
+{
+	auto Save = [](Bitmap & Bitmap, const std::string & Filename)
+	{
+		std::string TempFilename = Filename + ".tmp.exr";
+		Bitmap.Save(TempFilename);
+		std::remove(Filename.c_str());
+		if (std::rename(TempFilename.c_str(), Filename.c_str()) != 0)
+		{
+			LOG(WARNING) << "Unable to rename \"" << TempFilename << "\" to \"" << Filename << "\"";
+		}
+	};
+
+	Save(*Result.ToBitmap(), OutputName + ".exr");
+
+	/* Save the number of samples of each pixel for inspection */
+	if (Result.IsStatisticsEnabled())
+	{
+		Save(*Result.ToSampleCountBitmap(), OutputName + "_spp.exr");
+	}
+}
+
+static void Render(Scene * pScene, const std::string & Filename, bool bResume) 
 {
 	const Camera * pCamera = pScene->GetCamera();
 	Vector2i OutputSize = pCamera->GetOutputSize();
@@ -52,13 +217,58 @@ static void Render(Scene * pScene, const std::string & Filename)
 	/* Create a block generator (i.e. a work scheduler) */
 	BlockGenerator BlockGenerator(OutputSize, HIKARI_BLOCK_SIZE);
 
-	int TotalBlock = BlockGenerator.GetBlockCount();
-	std::atomic<int> RenderedBlock = 0;
-
 	/* Allocate memory for the entire output image and clear it */
 	ImageBlock Result(OutputSize, pCamera->GetReconstructionFilter());
+
+	/* With adaptive sampling or progressive rendering, the blocks are revisited in
+	several passes. The pixels stop receiving samples once they have converged with
+	adaptive sampling, the current image is written after each pass with progressive
+	rendering. */
+	uint32_t nSampleCount = uint32_t(pScene->GetSampler()->GetSampleCount());
+	uint32_t nPassSamples = nSampleCount;
+	if (pScene->IsAdaptiveSamplingEnabled() || pScene->IsProgressive())
+	{
+		nPassSamples = std::min(pScene->GetPassSampleCount(), nSampleCount);
+	}
+	if (pScene->IsAdaptiveSamplingEnabled())
+	{
+		Result.EnableStatistics();
+	}
+	uint32_t nPasses = (nSampleCount + nPassSamples - 1) / nPassSamples;
 	Result.Clear();
 
+	/* Determine the filename of the output bitmap */
+	std::string OutputName = Filename;
+	size_t iLastDot = OutputName.find_last_of(".");
+	if (iLastDot != std::string::npos)
+	{
+		OutputName.erase(iLastDot, std::string::npos);
+	}
+
+	/* The state of the rendering, which is periodically saved when checkpoints are enabled */
+	std::string CheckpointName = OutputName + ".checkpoint";
+	Checkpoint State;
+	State.nSampleCount = nSampleCount;
+	State.nPassSamples = nPassSamples;
+	State.Filter = pCamera->GetReconstructionFilter()->ToString();
+	State.bCompletedBlocks.assign(BlockGenerator.GetBlockCount(), 0);
+	if (bResume && filesystem::path(CheckpointName).exists())
+	{
+		State.Load(CheckpointName, Result);
+	}
+	else
+	{
+		if (bResume)
+		{
+			LOG(WARNING) << "No checkpoint \"" << CheckpointName << "\" to resume from, start from scratch";
+		}
+		ComputePixelSampleCounts(pScene, Result, 0, nPassSamples, State.PixelSampleCounts);
+	}
+	std::mutex CheckpointLock;
+
+	int TotalBlock = BlockGenerator.GetBlockCount() * int(nPasses);
+	std::atomic<int> RenderedBlock = BlockGenerator.GetBlockCount() * int(State.iPass);
+
 	/* Create a window that visualizes the partially rendered result */
 	std::unique_ptr<Screen> pScreen(new Screen(Result));
 	std::vector<const ImageBlock *> & RenderingBlocks = pScreen->GetRenderingBlocks();
@@ -71,56 +281,180 @@ static void Render(Scene * pScene, const std::string & Filename)
 		LOG(INFO) << "Rendering ... ";
 		Timer RenderTimer;
 
-		tbb::blocked_range<int> Range(0, BlockGenerator.GetBlockCount());
-
-		auto Map = [&](const tbb::blocked_range<int> & Range)
+		/* A failed checkpoint does not stop the rendering */
+		Timer CheckpointTimer;
+		auto SaveCheckpoint = [&]()
 		{
-			/* Allocate memory for a small image block to be rendered
-			by the current thread */
-			ImageBlock Block(Vector2i(HIKARI_BLOCK_SIZE), pCamera->GetReconstructionFilter());
+			try
+			{
+				State.Save(CheckpointName, Result);
+			}
+			catch (const std::exception & Ex)
+			{
+				LOG(WARNING) << "Unable to save the checkpoint: " << Ex.what();
+			}
+			CheckpointTimer.Reset();
+		};
 
-			/* Create a clone of the sampler for the current thread */
-			std::unique_ptr<Sampler> pSampler(pScene->GetSampler()->Clone());
+		uint32_t iFirstPass = State.iPass;
+		bool bFinished = true;
 
-			for (int i = Range.begin(); i < Range.end(); ++i)
+		for (uint32_t iPass = iFirstPass; iPass < nPasses; iPass++)
+		{
+			/* Do not start a pass which would end after the time budget */
+			if (iPass > iFirstPass && pScene->GetTimeBudget() > 0.0f)
 			{
-				/* Request an image block from the block generator */
-				BlockGenerator.Next(Block);
+				double PassTime = RenderTimer.Elapsed() / (iPass - iFirstPass);
+				if (RenderTimer.Elapsed() + PassTime > pScene->GetTimeBudget() * 1000.0)
+				{
+					LOG(INFO) << tfm::format("Stop after %u/%u passes to meet the time budget of %.1fs", iPass, nPasses, pScene->GetTimeBudget());
+					Lock.lock();
+					Progress = 1.0f;
+					Lock.unlock();
+
+					/* Save the state at the end of the pass so that the rendering can be continued */
+					if (pScene->GetCheckpointInterval() > 0.0f)
+					{
+						SaveCheckpoint();
+					}
+					bFinished = false;
+					break;
+				}
+			}
+
+			BlockGenerator.Reset();
 
-				/* Inform the sampler about the block to be rendered */
-				pSampler->Prepare(Block);
+			tbb::blocked_range<int> Range(0, BlockGenerator.GetBlockCount());
+			std::atomic<bool> bOutOfTime(false);
 
-				/* Add this block to the rendering blocks vector in the Screen class to display it. */
+			auto Map = [&](const tbb::blocked_range<int> & Range)
+			{
+				/* Allocate memory for a small image block to be rendered
+				by the current thread */
+				ImageBlock Block(Vector2i(HIKARI_BLOCK_SIZE), pCamera->GetReconstructionFilter());
+				if (Result.IsStatisticsEnabled())
+				{
+					Block.EnableStatistics();
+				}
+
+				/* Create a clone of the sampler for the current thread */
+				std::unique_ptr<Sampler> pSampler(pScene->GetSampler()->Clone());
+
+				for (int i = Range.begin(); i < Range.end(); ++i)
+				{
+					/* Request an image block from the block generator */
+					BlockGenerator.Next(Block);
+
+					/* Skip the blocks merged into the image before the checkpoint */
+					int iBlock = BlockGenerator.GetBlockIndex(Block);
+					if (State.bCompletedBlocks[iBlock] != 0)
+					{
+						RenderedBlock++;
+						continue;
+					}
+
+					/* Leave the remaining blocks of the pass once the time budget is exhausted */
+					if (pScene->GetTimeBudget() > 0.0f && RenderTimer.Elapsed() > pScene->GetTimeBudget() * 1000.0)
+					{
+						bOutOfTime = true;
+						continue;
+					}
+
+					/* Inform the sampler about the block to be rendered */
+					pSampler->Prepare(Block, iPass);
+
+					/* Add this block to the rendering blocks vector in the Screen class to display it. */
+					Lock.lock();
+					RenderingBlocks.push_back(&Block);
+					Lock.unlock();
+
+					/* Render all contained pixels */
+					RenderBlock(pScene, pSampler.get(), Block, State.PixelSampleCounts);
+
+					/* Update progress */
+					RenderedBlock++;
+
+					/* Render task is done, remove it. */
+					Lock.lock();
+					RenderingBlocks.erase(std::remove(RenderingBlocks.begin(), RenderingBlocks.end(), &Block), RenderingBlocks.end());
+					Progress = float(RenderedBlock) / float(TotalBlock);
+					RenderTimeString = RenderTimer.ElapsedString();
+					Lock.unlock();
+
+					/* The image block has been processed. Now add it to
+					the "big" block that represents the entire image */
+					CheckpointLock.lock();
+					Result.Put(Block);
+					State.bCompletedBlocks[iBlock] = 1;
+
+					/* Periodically save the state of the rendering */
+					if (pScene->GetCheckpointInterval() > 0.0f && CheckpointTimer.Elapsed() > pScene->GetCheckpointInterval() * 1000.0)
+					{
+						SaveCheckpoint();
+					}
+					CheckpointLock.unlock();
+				}
+			};
+
+			/// Uncomment the following line for single threaded rendering
+			//Map(Range);
+
+			/// Default: parallel rendering
+			tbb::parallel_for(Range, Map);
+
+			/* The pass was interrupted, the completed blocks are kept so that a checkpoint resumes it */
+			if (bOutOfTime)
+			{
+				LOG(WARNING) << tfm::format("Stop during pass %u/%u to meet the time budget of %.1fs", iPass + 1, nPasses, pScene->GetTimeBudget());
 				Lock.lock();
-				RenderingBlocks.push_back(&Block);
+				Progress = 1.0f;
 				Lock.unlock();
 
-				/* Render all contained pixels */
-				RenderBlock(pScene, pSampler.get(), Block);
+				SaveImage(Result, OutputName);
+				if (pScene->GetCheckpointInterval() > 0.0f)
+				{
+					SaveCheckpoint();
+				}
+				bFinished = false;
+				break;
+			}
 
-				/* Update progress */
-				RenderedBlock++;
+			/* Stop as soon as all the pixels have converged or received all their samples */
+			int nActivePixels = ComputePixelSampleCounts(pScene, Result, iPass + 1, nPassSamples, State.PixelSampleCounts);
+			State.iPass = iPass + 1;
+			std::fill(State.bCompletedBlocks.begin(), State.bCompletedBlocks.end(), 0);
 
-				/* Render task is done, remove it. */
+			if (pScene->IsProgressive())
+			{
+				SaveImage(Result, OutputName);
+			}
+
+			if (nPasses > 1)
+			{
+				LOG(INFO) << tfm::format("Pass %u/%u done, %i pixels still need samples (took %s)", iPass + 1, nPasses, nActivePixels, RenderTimer.ElapsedString());
+			}
+
+			if (nActivePixels == 0)
+			{
 				Lock.lock();
-				RenderingBlocks.erase(std::remove(RenderingBlocks.begin(), RenderingBlocks.end(), &Block), RenderingBlocks.end());
-				Progress = float(RenderedBlock) / float(TotalBlock);
-				RenderTimeString = RenderTimer.ElapsedString();
+				Progress = 1.0f;
 				Lock.unlock();
-
-				/* The image block has been processed. Now add it to
-				the "big" block that represents the entire image */
-				Result.Put(Block);
+				break;
 			}
-		};
+		}
 
-		/// Uncomment the following line for single threaded rendering
-		//Map(Range);
+		LOG(INFO) << "Done. (took " << RenderTimer.ElapsedString() << ")";
 
-		/// Default: parallel rendering
-		tbb::parallel_for(Range, Map);
+		/* Keep the checkpoint of a rendering stopped by the time budget so that it can be continued */
+		if (bFinished && pScene->GetCheckpointInterval() > 0.0f)
+		{
+			std::remove(CheckpointName.c_str());
+		}
 
-		LOG(INFO) << "Done. (took " << RenderTimer.ElapsedString() << ")";
+		if (Acceleration::IsStatisticsEnabled())
+		{
+			LOG(INFO) << Acceleration::GetStatistics().ToString();
+		}
 	});
 
 	/* Enter the application main loop */
@@ -129,21 +463,12 @@ static void Render(Scene * pScene, const std::string & Filename)
 	/* Shut down the user interface */
 	RenderThread.join();
 
-	/* Now turn the rendered image block into
-	a properly normalized bitmap */
-	std::unique_ptr<Bitmap> pBitmap(Result.ToBitmap());
-
-	/* Determine the filename of the output bitmap */
-	std::string OutputName = Filename;
-	size_t iLastDot = OutputName.find_last_of(".");
-	if (iLastDot != std::string::npos)
+	/* Now turn the rendered image block into a properly normalized bitmap and save it
+	(the progressive rendering already saved it after the last pass) */
+	if (!pScene->IsProgressive())
 	{
-		OutputName.erase(iLastDot, std::string::npos);
+		SaveImage(Result, OutputName);
 	}
-	OutputName += ".exr";
-
-	/* Save using the OpenEXR format */
-	pBitmap->Save(OutputName);
 }
 
 NAMESPACE_END
@@ -153,9 +478,9 @@ int main(int argc, char ** argv)
 	google::InitGoogleLogging("Hikari");
 	google::SetStderrLogging(google::GLOG_INFO);
 
-	if (argc != 2)
+	if (argc != 2 && argc != 3)
 	{
-		LOG(ERROR) << "Syntax: " << argv[0] << " <scene.xml> or <image.exr>";
+		LOG(ERROR) << "Syntax: " << argv[0] << " <scene.xml> [--resume] or <image.exr> or <mesh.obj> <mesh.bin>";
 		return -1;
 	}
 
@@ -163,7 +488,28 @@ int main(int argc, char ** argv)
 
 	try
 	{
-		if (Path.extension() == "xml")
+		if (argc == 3 && Path.extension() != "xml")
+		{
+			if (Path.extension() != "obj")
+			{
+				LOG(ERROR) << "Fatal error: unknown file \"" << argv[1] << "\", expected an extension of type .obj";
+			}
+			else
+			{
+				/* Convert a Wavefront OBJ mesh into a binary mesh */
+				Hikari::GetFileResolver()->prepend(Path.parent_path());
+
+				Hikari::PropertyList PropList;
+				PropList.SetString(XML_MESH_WAVEFRONG_OBJ_FILENAME, Path.filename());
+				std::unique_ptr<Hikari::Object> pMesh(Hikari::ObjectFactory::CreateInstance(XML_MESH_WAVEFRONG_OBJ, PropList));
+				Hikari::BinaryMesh::Save((Hikari::Mesh *)(pMesh.get()), argv[2], true);
+			}
+		}
+		else if (argc == 3 && std::string(argv[2]) != "--resume")
+		{
+			LOG(ERROR) << "Fatal error: unknown option \"" << argv[2] << "\", expected --resume";
+		}
+		else if (Path.extension() == "xml")
 		{
 			/* Add the parent directory of the scene file to the
 			file resolver. That way, the XML file can reference
@@ -175,7 +521,8 @@ int main(int argc, char ** argv)
 			/* When the XML root object is a scene, start rendering it .. */
 			if (Root->GetClassType() == Hikari::Object::EClassType::EScene)
 			{
-				Hikari::Render((Hikari::Scene *)(Root.get()), argv[1]);
+				/* Restart from the last checkpoint of the rendering when resuming */
+				Hikari::Render((Hikari::Scene *)(Root.get()), argv[1], argc == 3);
 			}
 		}
 		else if (Path.extension() == "exr")
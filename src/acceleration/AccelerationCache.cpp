@@ -0,0 +1,232 @@
+#include <acceleration\AccelerationCache.hpp>
+#include <core\Shape.hpp>
+#include <core\Mesh.hpp>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <unordered_map>
+
+NAMESPACE_BEGIN
+
+constexpr char ACCELERATION_CACHE_MAGIC[8] = { 'H', 'K', 'B', 'V', 'H', 'C', 'H', 'E' };
+constexpr uint32_t ACCELERATION_CACHE_VERSION = 2;
+
+struct AccelerationCacheHeader
+{
+	char Magic[8];
+	uint32_t Version;
+	uint32_t NodeSize;
+	uint64_t Key;
+	uint32_t nNodes;
+	uint32_t nLeafs;
+	uint32_t nShapes;
+	uint32_t nReferences;
+	uint32_t Padding[6];
+};
+
+static_assert(sizeof(AccelerationCacheHeader) == 64, "The header of the cache file must be 64 bytes");
+
+/// 64-bit FNV-1a over a block of memory
+static uint64_t HashBytes(uint64_t Hash, const void * pData, size_t Size)
+{
+	const uint8_t * pBytes = (const uint8_t*)(pData);
+	for (size_t i = 0; i < Size; i++)
+	{
+		Hash ^= uint64_t(pBytes[i]);
+		Hash *= 0x100000001B3ULL;
+	}
+	return Hash;
+}
+
+uint64_t AccelerationCache::ComputeKey(const std::vector<Shape*> & pShapes, const std::string & Parameters)
+{
+	uint64_t Hash = 0xCBF29CE484222325ULL;
+
+	uint32_t nShapes = uint32_t(pShapes.size());
+	Hash = HashBytes(Hash, &nShapes, sizeof(uint32_t));
+	Hash = HashBytes(Hash, Parameters.data(), Parameters.size());
+
+	// The shapes of a mesh are registered together, hash every mesh once
+	const Mesh * pLastMesh = nullptr;
+	for (const Shape * pShape : pShapes)
+	{
+		const Mesh * pMesh = pShape->GetMesh();
+		if (pMesh == nullptr)
+		{
+			BoundingBox3f BBox = pShape->GetBoundingBox();
+			Hash = HashBytes(Hash, BBox.Min.data(), sizeof(float) * 3);
+			Hash = HashBytes(Hash, BBox.Max.data(), sizeof(float) * 3);
+			continue;
+		}
+
+		if (pMesh == pLastMesh)
+		{
+			continue;
+		}
+		pLastMesh = pMesh;
+
+		const MatrixXfMap & V = pMesh->GetVertexPositions();
+		const MatrixXuMap & F = pMesh->GetIndices();
+		uint64_t Sizes[2] = { uint64_t(V.size()), uint64_t(F.size()) };
+		Hash = HashBytes(Hash, Sizes, sizeof(Sizes));
+		Hash = HashBytes(Hash, V.data(), sizeof(float) * V.size());
+		Hash = HashBytes(Hash, F.data(), sizeof(uint32_t) * F.size());
+	}
+
+	return Hash;
+}
+
+std::string AccelerationCache::GetFilename(const std::string & Directory, uint64_t Key)
+{
+	return tfm::format("%s/%016llx.bvhcache", Directory, (unsigned long long)(Key));
+}
+
+bool AccelerationCache::Save(
+	const std::string & Filename,
+	uint64_t Key,
+	const void * pNodes,
+	uint32_t NodeSize,
+	uint32_t nNodes,
+	uint32_t nLeafs,
+	const std::vector<Shape*> & pOriginalShapes,
+	const std::vector<Shape*> & pOrderedShapes
+)
+{
+	std::unordered_map<const Shape*, uint32_t> ShapeIndices;
+	ShapeIndices.reserve(pOriginalShapes.size());
+	for (uint32_t i = 0; i < uint32_t(pOriginalShapes.size()); i++)
+	{
+		ShapeIndices[pOriginalShapes[i]] = i;
+	}
+
+	std::vector<uint32_t> Indices(pOrderedShapes.size());
+	for (size_t i = 0; i < pOrderedShapes.size(); i++)
+	{
+		auto Iter = ShapeIndices.find(pOrderedShapes[i]);
+		CHECK(Iter != ShapeIndices.end());
+		Indices[i] = Iter->second;
+	}
+
+	AccelerationCacheHeader Header;
+	memset(&Header, 0, sizeof(AccelerationCacheHeader));
+	memcpy(Header.Magic, ACCELERATION_CACHE_MAGIC, sizeof(Header.Magic));
+	Header.Version = ACCELERATION_CACHE_VERSION;
+	Header.NodeSize = NodeSize;
+	Header.Key = Key;
+	Header.nNodes = nNodes;
+	Header.nLeafs = nLeafs;
+	Header.nShapes = uint32_t(pOriginalShapes.size());
+	Header.nReferences = uint32_t(Indices.size());
+
+	// Write to a temporary file first, so a concurrent run never maps a partial file
+	std::string TempFilename = Filename + ".tmp";
+	{
+		std::ofstream FileOut(TempFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (FileOut.fail())
+		{
+			return false;
+		}
+		FileOut.write((const char*)(&Header), sizeof(AccelerationCacheHeader));
+		FileOut.write((const char*)(pNodes), std::streamsize(size_t(NodeSize) * nNodes));
+		FileOut.write((const char*)(Indices.data()), std::streamsize(sizeof(uint32_t) * Indices.size()));
+		if (FileOut.fail())
+		{
+			FileOut.close();
+			std::remove(TempFilename.c_str());
+			return false;
+		}
+	}
+
+	std::remove(Filename.c_str());
+	if (std::rename(TempFilename.c_str(), Filename.c_str()) != 0)
+	{
+		std::remove(TempFilename.c_str());
+		return false;
+	}
+
+	return true;
+}
+
+bool AccelerationCache::Load(const std::string & Filename, uint64_t Key, uint32_t NodeSize, uint32_t nShapes)
+{
+	Release();
+
+	if (!m_File.Open(Filename))
+	{
+		return false;
+	}
+
+	if (m_File.GetSize() < sizeof(AccelerationCacheHeader))
+	{
+		Release();
+		return false;
+	}
+
+	const AccelerationCacheHeader * pHeader = (const AccelerationCacheHeader*)(m_File.GetData());
+	if (memcmp(pHeader->Magic, ACCELERATION_CACHE_MAGIC, sizeof(pHeader->Magic)) != 0 ||
+		pHeader->Version != ACCELERATION_CACHE_VERSION ||
+		pHeader->NodeSize != NodeSize ||
+		pHeader->Key != Key ||
+		pHeader->nShapes != nShapes ||
+		pHeader->nNodes == 0 ||
+		m_File.GetSize() != sizeof(AccelerationCacheHeader) + size_t(NodeSize) * pHeader->nNodes + sizeof(uint32_t) * pHeader->nReferences)
+	{
+		Release();
+		return false;
+	}
+
+	const uint32_t * pIndices = (const uint32_t*)(m_File.GetData() + sizeof(AccelerationCacheHeader) + size_t(NodeSize) * pHeader->nNodes);
+	for (uint32_t i = 0; i < pHeader->nReferences; i++)
+	{
+		if (pIndices[i] >= nShapes)
+		{
+			Release();
+			return false;
+		}
+	}
+
+	return true;
+}
+
+void AccelerationCache::ReorderShapes(std::vector<Shape*> & pShapes) const
+{
+	CHECK(IsLoaded());
+
+	const AccelerationCacheHeader * pHeader = (const AccelerationCacheHeader*)(m_File.GetData());
+	const uint32_t * pIndices = (const uint32_t*)(m_File.GetData() + sizeof(AccelerationCacheHeader) + size_t(pHeader->NodeSize) * pHeader->nNodes);
+	CHECK(pShapes.size() == pHeader->nShapes);
+
+	std::vector<Shape*> pOriginalShapes(pShapes);
+	pShapes.resize(pHeader->nReferences);
+	for (uint32_t i = 0; i < pHeader->nReferences; i++)
+	{
+		pShapes[i] = pOriginalShapes[pIndices[i]];
+	}
+}
+
+void AccelerationCache::Release()
+{
+	m_File.Close();
+}
+
+bool AccelerationCache::IsLoaded() const
+{
+	return m_File.IsOpen();
+}
+
+void * AccelerationCache::GetNodes()
+{
+	return IsLoaded() ? m_File.GetData() + sizeof(AccelerationCacheHeader) : nullptr;
+}
+
+uint32_t AccelerationCache::GetNodeCount() const
+{
+	return IsLoaded() ? ((const AccelerationCacheHeader*)(m_File.GetData()))->nNodes : 0;
+}
+
+uint32_t AccelerationCache::GetLeafCount() const
+{
+	return IsLoaded() ? ((const AccelerationCacheHeader*)(m_File.GetData()))->nLeafs : 0;
+}
+
+NAMESPACE_END
@@ -1,6 +1,13 @@
 #include <acceleration\BVHAcceleration.hpp>
 #include <core\Timer.hpp>
 #include <core\Shape.hpp>
+#include <core\Mesh.hpp>
+#include <core\MemoryArena.hpp>
+#include <tbb\tbb.h>
+#include <array>
+#include <functional>
+#include <map>
+#include <cstring>
 
 NAMESPACE_BEGIN
 
@@ -14,351 +21,2314 @@ struct BVHTraversal
 	BVHTraversal(uint32_t Idx, float MinT) : Idx(Idx), MinT(MinT) { }
 };
 
-struct BVHBuildEntry
+struct BVHPacketTraversal
 {
-	uint32_t iParent = 0;
-	uint32_t iStart = 0, iEnd = 0;
+	uint32_t Idx;
+	uint32_t iFirstActive;
+	BVHPacketTraversal() { Idx = 0; iFirstActive = 0; }
+	BVHPacketTraversal(uint32_t Idx, uint32_t iFirstActive) : Idx(Idx), iFirstActive(iFirstActive) { }
+};
+
+/// Intervals bounding the origins and the reciprocal directions of a packet
+struct BVHPacketBounds
+{
+	float OriginMin[3], OriginMax[3];
+	float InvDirMin[3], InvDirMax[3];
+	float MinT, MaxT;
+};
+
+/// Interval product [ALo, AHi] * [BLo, BHi]
+static inline void IntervalMul(float ALo, float AHi, float BLo, float BHi, float & Lo, float & Hi)
+{
+	float P0 = ALo * BLo, P1 = ALo * BHi, P2 = AHi * BLo, P3 = AHi * BHi;
+	Lo = std::min(std::min(P0, P1), std::min(P2, P3));
+	Hi = std::max(std::max(P0, P1), std::max(P2, P3));
+}
+
+/**
+* Conservative test of a whole packet against a bounding box with interval
+* arithmetic : when it fails, no ray of the packet can hit the box. Rounding
+* is monotonic, so the bounds also hold for the per-ray slab test.
+*/
+static inline bool PacketIntersectBBox(const BoundingBox3f & BBox, const BVHPacketBounds & Bounds)
+{
+	float NearT = Bounds.MinT, FarT = Bounds.MaxT;
+
+	for (int i = 0; i < 3; i++)
+	{
+		float T1Lo, T1Hi, T2Lo, T2Hi;
+		IntervalMul(BBox.Min[i] - Bounds.OriginMax[i], BBox.Min[i] - Bounds.OriginMin[i], Bounds.InvDirMin[i], Bounds.InvDirMax[i], T1Lo, T1Hi);
+		IntervalMul(BBox.Max[i] - Bounds.OriginMax[i], BBox.Max[i] - Bounds.OriginMin[i], Bounds.InvDirMin[i], Bounds.InvDirMax[i], T2Lo, T2Hi);
+
+		NearT = std::max(NearT, std::min(T1Lo, T2Lo));
+		FarT = std::min(FarT, std::max(T1Hi, T2Hi));
+
+		if (!(NearT <= FarT))
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+struct BVHPrimitive
+{
+	BoundingBox3f BBox;
+	Point3f Centroid;
+	Shape * pShape = nullptr;
 };
 
-struct BVHBucket
+struct BVHBin
 {
 	uint32_t nShape = 0;
 	BoundingBox3f BBox;
+	BoundingBox3f Centroid;
+
+	void ExpandBy(const BVHPrimitive & Primitive)
+	{
+		nShape++;
+		BBox.ExpandBy(Primitive.BBox);
+		Centroid.ExpandBy(Primitive.Centroid);
+	}
+
+	void ExpandBy(const BVHBin & Bin)
+	{
+		nShape += Bin.nShape;
+		BBox.ExpandBy(Bin.BBox);
+		Centroid.ExpandBy(Bin.Centroid);
+	}
+};
+
+struct BVHBinnedNode
+{
+	BoundingBox3f BBox;
+	BVHBinnedNode * pChildren[2] = { nullptr, nullptr };
+	uint32_t iStart = 0;
+	uint32_t nShapes = 0;
+	uint32_t nNodes = 1; // Number of nodes in the subtree
+	Shape ** ppShapes = nullptr; // Spatial split only : the shapes of the leaf
 };
 
-BVHAcceleration::BVHAcceleration(const PropertyList & PropList) : 
-	Acceleration(PropList)
-{
-	m_LeafSize = uint32_t(PropList.GetInteger(XML_ACCELERATION_BVH_LEAF_SIZE, DEFAULT_ACCELERATION_BVH_LEAF_SIZE));
-	m_SplitMethod = PropList.GetString(XML_ACCELERATION_BVH_SPLIT_METHOD, DEFAULT_ACCELERATION_BVH_SPLIT_METHOD);
-	if (m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER && m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_SAH)
+constexpr uint32_t BVH_BUCKET_NUM = 12;
+
+/// Ranges larger than this are binned with a parallel reduction
+constexpr uint32_t BVH_PARALLEL_BINNING_THRESHOLD = 65536;
+
+/// Subtrees larger than this are built (and flattened) as separate tasks
+constexpr uint32_t BVH_PARALLEL_BUILD_THRESHOLD = 4096;
+
+/// Number of bins of the spatial splits
+constexpr uint32_t SBVH_SPATIAL_BIN_NUM = 32;
+
+/// Spatial splits are only tried when the children of the best object split overlap more than this fraction of the root surface area
+constexpr float SBVH_OVERLAP_THRESHOLD = 1e-5f;
+
+/// Deeper nodes only use object splits
+constexpr uint32_t SBVH_MAX_DEPTH = 64;
+
+/// Marks a leaf child of a quantized node (the index is the one of its first primitive)
+constexpr uint32_t BVH_QUANTIZED_LEAF_FLAG = 0x80000000;
+
+/// Marks the unused child of the root of a tree made of a single leaf
+constexpr uint32_t BVH_QUANTIZED_EMPTY_CHILD = 0xffffffff;
+
+/// Largest leaf of a quantized node, its number of primitives is stored on 16 bits
+constexpr uint32_t BVH_QUANTIZED_MAX_LEAF_SIZE = 65535;
+
+/// Return 2^Exponent for an exponent in [-126, 127], the quantized coordinates are multiples of it
+inline float ExponentToScale(int8_t Exponent)
+{
+	uint32_t Bits = uint32_t(int32_t(Exponent) + 127) << 23;
+	float Scale;
+	std::memcpy(&Scale, &Bits, sizeof(float));
+	return Scale;
+}
+
+struct BVHBuildContext
+{
+	BVHPrimitive * pPrimitives = nullptr;
+	uint32_t LeafSize = 0;
+	bool bSAH = true;
+	float RootSurfaceArea = 0.0f;
+	tbb::enumerable_thread_specific<MemoryArena> Arenas;
+};
+
+using BVHBins = std::array<BVHBin, BVH_BUCKET_NUM>;
+
+/// Best binned SAH split of a range of primitives along one axis
+struct BVHObjectSplit
+{
+	float Cost = std::numeric_limits<float>::infinity();
+	uint32_t SplitDim = 0;
+	uint32_t iBucket = 0;
+	float Min = 0.0f;
+	float InvNorm = 0.0f;
+	BVHBin LeftBounds, RightBounds;
+};
+
+struct SBVHSpatialBin
+{
+	BoundingBox3f BBox;
+	uint32_t nEnter = 0;
+	uint32_t nExit = 0;
+};
+
+/// Best spatial split of a node
+struct SBVHSpatialSplit
+{
+	float Cost = std::numeric_limits<float>::infinity();
+	uint32_t SplitDim = 0;
+	float SplitPos = 0.0f;
+	BoundingBox3f LeftBBox, RightBBox;
+	uint32_t nLeft = 0, nRight = 0;
+};
+
+static BVHBin ComputeBounds(const BVHPrimitive * pPrimitives, uint32_t iStart, uint32_t iEnd)
+{
+	if (iEnd - iStart < BVH_PARALLEL_BINNING_THRESHOLD)
+	{
+		BVHBin Bounds;
+		for (uint32_t i = iStart; i < iEnd; i++)
+		{
+			Bounds.ExpandBy(pPrimitives[i]);
+		}
+		return Bounds;
+	}
+
+	return tbb::parallel_reduce(
+		tbb::blocked_range<uint32_t>(iStart, iEnd),
+		BVHBin(),
+		[&](const tbb::blocked_range<uint32_t> & Range, BVHBin Bounds)
+		{
+			for (uint32_t i = Range.begin(); i < Range.end(); i++)
+			{
+				Bounds.ExpandBy(pPrimitives[i]);
+			}
+			return Bounds;
+		},
+		[](BVHBin Left, const BVHBin & Right)
+		{
+			Left.ExpandBy(Right);
+			return Left;
+		}
+	);
+}
+
+static inline uint32_t ComputeBucketIdx(const BVHPrimitive & Primitive, uint32_t SplitDim, float Min, float InvNorm)
+{
+	uint32_t BucketIdx = uint32_t((BVH_BUCKET_NUM - 1) * (Primitive.Centroid[SplitDim] - Min) * InvNorm);
+	return std::min(BucketIdx, BVH_BUCKET_NUM - 1);
+}
+
+static BVHBins ComputeBins(const BVHPrimitive * pPrimitives, uint32_t iStart, uint32_t iEnd, uint32_t SplitDim, float Min, float InvNorm)
+{
+	auto BinRange = [&](const tbb::blocked_range<uint32_t> & Range, BVHBins Bins)
+	{
+		for (uint32_t i = Range.begin(); i < Range.end(); i++)
+		{
+			Bins[ComputeBucketIdx(pPrimitives[i], SplitDim, Min, InvNorm)].ExpandBy(pPrimitives[i]);
+		}
+		return Bins;
+	};
+
+	if (iEnd - iStart < BVH_PARALLEL_BINNING_THRESHOLD)
+	{
+		return BinRange(tbb::blocked_range<uint32_t>(iStart, iEnd), BVHBins());
+	}
+
+	return tbb::parallel_reduce(
+		tbb::blocked_range<uint32_t>(iStart, iEnd),
+		BVHBins(),
+		BinRange,
+		[](BVHBins Left, const BVHBins & Right)
+		{
+			for (uint32_t i = 0; i < BVH_BUCKET_NUM; i++)
+			{
+				Left[i].ExpandBy(Right[i]);
+			}
+			return Left;
+		}
+	);
+}
+
+static BVHObjectSplit FindObjectSplit(
+	const BVHPrimitive * pPrimitives,
+	uint32_t iStart,
+	uint32_t iEnd,
+	uint32_t SplitDim,
+	const BoundingBox3f & Centroid,
+	float InvSurfaceArea
+)
+{
+	BVHObjectSplit Split;
+	Split.SplitDim = SplitDim;
+	Split.Min = Centroid.Min[SplitDim];
+	Split.InvNorm = 1.0f / (Centroid.Max[SplitDim] - Split.Min);
+
+	// Divide the bounding box into several buckets
+	BVHBins Buckets = ComputeBins(pPrimitives, iStart, iEnd, SplitDim, Split.Min, Split.InvNorm);
+
+	// Sweep from both sides, so the cost of every split is computed in O(B)
+	BVHBin Prefix[BVH_BUCKET_NUM], Suffix[BVH_BUCKET_NUM];
+	Prefix[0] = Buckets[0];
+	Suffix[BVH_BUCKET_NUM - 1] = Buckets[BVH_BUCKET_NUM - 1];
+	for (uint32_t i = 1; i < BVH_BUCKET_NUM; i++)
+	{
+		Prefix[i] = Prefix[i - 1];
+		Prefix[i].ExpandBy(Buckets[i]);
+		Suffix[BVH_BUCKET_NUM - 1 - i] = Suffix[BVH_BUCKET_NUM - i];
+		Suffix[BVH_BUCKET_NUM - 1 - i].ExpandBy(Buckets[BVH_BUCKET_NUM - 1 - i]);
+	}
+
+	// Find bucket whose cost is minimal
+	for (uint32_t i = 0; i < BVH_BUCKET_NUM - 1; i++)
+	{
+		float Cost = 0.125f + (
+			Prefix[i].BBox.GetSurfaceArea() * Prefix[i].nShape +
+			Suffix[i + 1].BBox.GetSurfaceArea() * Suffix[i + 1].nShape
+			) * InvSurfaceArea;
+
+		if (Cost < Split.Cost)
+		{
+			Split.Cost = Cost;
+			Split.iBucket = i;
+		}
+	}
+
+	Split.LeftBounds = Prefix[Split.iBucket];
+	Split.RightBounds = Suffix[Split.iBucket + 1];
+	return Split;
+}
+
+static BVHBinnedNode * RecursiveBuild(BVHBuildContext & Context, uint32_t iStart, uint32_t iEnd, const BVHBin & Bounds)
+{
+	BVHBinnedNode * pNode = Context.Arenas.local().Alloc<BVHBinnedNode>();
+	pNode->BBox = Bounds.BBox;
+	pNode->iStart = iStart;
+	pNode->nShapes = iEnd - iStart;
+
+	// If the number of shapes at this point is less than the leaf
+	// size, then this will become a leaf.
+	if (pNode->nShapes <= Context.LeafSize)
+	{
+		return pNode;
+	}
+
+	BVHPrimitive * pPrimitives = Context.pPrimitives;
+	const BoundingBox3f & Centroid = Bounds.Centroid;
+
+	// Set the split dimensions
+	uint32_t SplitDim = Centroid.GetMajorAxis();
+	uint32_t iMid = iStart;
+	BVHBin LeftBounds, RightBounds;
+	bool bBoundsKnown = false;
+
+	if (Centroid.Max[SplitDim] == Centroid.Min[SplitDim])
+	{
+		// All the centroids coincide, just choose the center...
+		iMid = iStart + (iEnd - iStart) / 2;
+	}
+	else if (!Context.bSAH)
+	{
+		// Split on the center of the longest axis
+		float SplitCoord = 0.5f * (Centroid.Min[SplitDim] + Centroid.Max[SplitDim]);
+
+		BVHPrimitive * pMid = std::partition(
+			pPrimitives + iStart,
+			pPrimitives + iEnd,
+			[=](const BVHPrimitive & Primitive)
+			{
+				return Primitive.Centroid[SplitDim] < SplitCoord;
+			}
+		);
+		iMid = uint32_t(pMid - pPrimitives);
+
+		// If we get a bad split, just choose the center...
+		if (iMid == iStart || iMid == iEnd)
+		{
+			iMid = iStart + (iEnd - iStart) / 2;
+		}
+	}
+	else
+	{
+		BVHObjectSplit Split = FindObjectSplit(pPrimitives, iStart, iEnd, SplitDim, Centroid, 1.0f / Bounds.BBox.GetSurfaceArea());
+		float Min = Split.Min, InvNorm = Split.InvNorm;
+		uint32_t iMinCostSplitBucket = Split.iBucket;
+
+		// Split nodes
+		BVHPrimitive * pMid = std::partition(
+			pPrimitives + iStart,
+			pPrimitives + iEnd,
+			[=](const BVHPrimitive & Primitive)
+			{
+				return ComputeBucketIdx(Primitive, SplitDim, Min, InvNorm) <= iMinCostSplitBucket;
+			}
+		);
+		iMid = uint32_t(pMid - pPrimitives);
+
+		// The bounds of both children have been computed while binning
+		LeftBounds = Split.LeftBounds;
+		RightBounds = Split.RightBounds;
+		bBoundsKnown = true;
+	}
+
+	if (!bBoundsKnown)
+	{
+		LeftBounds = ComputeBounds(pPrimitives, iStart, iMid);
+		RightBounds = ComputeBounds(pPrimitives, iMid, iEnd);
+	}
+
+	if (pNode->nShapes > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { pNode->pChildren[0] = RecursiveBuild(Context, iStart, iMid, LeftBounds); },
+			[&]() { pNode->pChildren[1] = RecursiveBuild(Context, iMid, iEnd, RightBounds); }
+		);
+	}
+	else
+	{
+		pNode->pChildren[0] = RecursiveBuild(Context, iStart, iMid, LeftBounds);
+		pNode->pChildren[1] = RecursiveBuild(Context, iMid, iEnd, RightBounds);
+	}
+
+	pNode->nNodes = 1 + pNode->pChildren[0]->nNodes + pNode->pChildren[1]->nNodes;
+	return pNode;
+}
+
+/// Clip a reference by the plane at Pos along SplitDim, a side is invalid if the reference does not overlap it
+static void SplitReference(const BVHPrimitive & Reference, uint32_t SplitDim, float SplitPos, BVHPrimitive & Left, BVHPrimitive & Right)
+{
+	Left.pShape = Right.pShape = Reference.pShape;
+	Left.BBox.Reset();
+	Right.BBox.Reset();
+
+	const Mesh * pMesh = Reference.pShape->GetMesh();
+	if (pMesh != nullptr)
+	{
+		// Bound the parts of the triangle on each side of the plane
+		const MatrixXuMap & F = pMesh->GetIndices();
+		const MatrixXfMap & V = pMesh->GetVertexPositions();
+		const uint32_t iFacet = Reference.pShape->GetFacetIndex();
+		const Point3f P[3] = { V.col(F(0, iFacet)), V.col(F(1, iFacet)), V.col(F(2, iFacet)) };
+
+		for (int i = 0; i < 3; i++)
+		{
+			const Point3f & P0 = P[i];
+			const Point3f & P1 = P[(i + 1) % 3];
+			float V0 = P0[SplitDim], V1 = P1[SplitDim];
+
+			if (V0 <= SplitPos)
+			{
+				Left.BBox.ExpandBy(P0);
+			}
+			if (V0 >= SplitPos)
+			{
+				Right.BBox.ExpandBy(P0);
+			}
+
+			// The edge crosses the plane
+			if ((V0 < SplitPos && V1 > SplitPos) || (V0 > SplitPos && V1 < SplitPos))
+			{
+				Point3f T = P0 + (P1 - P0) * Clamp((SplitPos - V0) / (V1 - V0), 0.0f, 1.0f);
+				T[SplitDim] = SplitPos;
+				Left.BBox.ExpandBy(T);
+				Right.BBox.ExpandBy(T);
+			}
+		}
+	}
+	else
+	{
+		Left.BBox = Right.BBox = Reference.BBox;
+	}
+
+	// The reference may already have been clipped by previous splits
+	Left.BBox.Max[SplitDim] = std::min(Left.BBox.Max[SplitDim], SplitPos);
+	Right.BBox.Min[SplitDim] = std::max(Right.BBox.Min[SplitDim], SplitPos);
+	Left.BBox.Clip(Reference.BBox);
+	Right.BBox.Clip(Reference.BBox);
+	Left.Centroid = Left.BBox.GetCenter();
+	Right.Centroid = Right.BBox.GetCenter();
+}
+
+/// Find the best spatial split of a node by clipping the references into bins along each axis
+static SBVHSpatialSplit FindSpatialSplit(const std::vector<BVHPrimitive> & References, const BoundingBox3f & BBox, float InvSurfaceArea)
+{
+	SBVHSpatialSplit Split;
+
+	for (uint32_t SplitDim = 0; SplitDim < 3; SplitDim++)
+	{
+		float Origin = BBox.Min[SplitDim];
+		float BinSize = (BBox.Max[SplitDim] - Origin) / SBVH_SPATIAL_BIN_NUM;
+		if (!(BinSize > 0.0f))
+		{
+			continue;
+		}
+		float InvBinSize = 1.0f / BinSize;
+
+		SBVHSpatialBin Bins[SBVH_SPATIAL_BIN_NUM];
+		for (const BVHPrimitive & Reference : References)
+		{
+			uint32_t iFirstBin = uint32_t(Clamp(int((Reference.BBox.Min[SplitDim] - Origin) * InvBinSize), 0, int(SBVH_SPATIAL_BIN_NUM) - 1));
+			uint32_t iLastBin = uint32_t(Clamp(int((Reference.BBox.Max[SplitDim] - Origin) * InvBinSize), int(iFirstBin), int(SBVH_SPATIAL_BIN_NUM) - 1));
+
+			// Chop the reference into the bins it straddles
+			BVHPrimitive Current = Reference;
+			for (uint32_t i = iFirstBin; i < iLastBin; i++)
+			{
+				BVHPrimitive Left, Right;
+				SplitReference(Current, SplitDim, Origin + BinSize * (i + 1), Left, Right);
+				if (Left.BBox.IsValid())
+				{
+					Bins[i].BBox.ExpandBy(Left.BBox);
+				}
+				Current = Right;
+			}
+			if (Current.BBox.IsValid())
+			{
+				Bins[iLastBin].BBox.ExpandBy(Current.BBox);
+			}
+
+			Bins[iFirstBin].nEnter++;
+			Bins[iLastBin].nExit++;
+		}
+
+		// Sweep from the right, then evaluate the splits from the left
+		BoundingBox3f RightBBoxes[SBVH_SPATIAL_BIN_NUM];
+		RightBBoxes[SBVH_SPATIAL_BIN_NUM - 1] = Bins[SBVH_SPATIAL_BIN_NUM - 1].BBox;
+		for (uint32_t i = SBVH_SPATIAL_BIN_NUM - 1; i > 0; i--)
+		{
+			RightBBoxes[i - 1] = RightBBoxes[i];
+			RightBBoxes[i - 1].ExpandBy(Bins[i - 1].BBox);
+		}
+
+		BoundingBox3f LeftBBox;
+		uint32_t nLeft = 0, nRight = uint32_t(References.size());
+		for (uint32_t i = 0; i < SBVH_SPATIAL_BIN_NUM - 1; i++)
+		{
+			LeftBBox.ExpandBy(Bins[i].BBox);
+			nLeft += Bins[i].nEnter;
+			nRight -= Bins[i].nExit;
+
+			if (nLeft == 0 || nRight == 0)
+			{
+				continue;
+			}
+
+			float Cost = 0.125f + (
+				LeftBBox.GetSurfaceArea() * nLeft +
+				RightBBoxes[i + 1].GetSurfaceArea() * nRight
+				) * InvSurfaceArea;
+
+			if (Cost < Split.Cost)
+			{
+				Split.Cost = Cost;
+				Split.SplitDim = SplitDim;
+				Split.SplitPos = Origin + BinSize * (i + 1);
+				Split.LeftBBox = LeftBBox;
+				Split.RightBBox = RightBBoxes[i + 1];
+				Split.nLeft = nLeft;
+				Split.nRight = nRight;
+			}
+		}
+	}
+
+	return Split;
+}
+
+/// Distribute the references of a node to its children according to a spatial split
+static void PerformSpatialSplit(
+	const std::vector<BVHPrimitive> & References,
+	const SBVHSpatialSplit & Split,
+	uint32_t & Budget,
+	std::vector<BVHPrimitive> & LeftReferences,
+	std::vector<BVHPrimitive> & RightReferences
+)
+{
+	const uint32_t SplitDim = Split.SplitDim;
+	const float SplitPos = Split.SplitPos;
+
+	const float LeftArea = Split.LeftBBox.GetSurfaceArea();
+	const float RightArea = Split.RightBBox.GetSurfaceArea();
+	uint32_t nLeft = Split.nLeft, nRight = Split.nRight;
+
+	for (const BVHPrimitive & Reference : References)
+	{
+		if (Reference.BBox.Max[SplitDim] <= SplitPos)
+		{
+			LeftReferences.push_back(Reference);
+			continue;
+		}
+		if (Reference.BBox.Min[SplitDim] >= SplitPos)
+		{
+			RightReferences.push_back(Reference);
+			continue;
+		}
+
+		// The reference straddles the plane, split it unless moving it
+		// entirely to one side is cheaper or the budget is exhausted
+		BVHPrimitive Left, Right;
+		SplitReference(Reference, SplitDim, SplitPos, Left, Right);
+
+		float SplitCost = LeftArea * nLeft + RightArea * nRight;
+		float UnsplitLeftCost = BoundingBox3f::Merge(Split.LeftBBox, Reference.BBox).GetSurfaceArea() * nLeft + RightArea * (nRight - 1);
+		float UnsplitRightCost = LeftArea * (nLeft - 1) + BoundingBox3f::Merge(Split.RightBBox, Reference.BBox).GetSurfaceArea() * nRight;
+
+		bool bCanSplit = Budget > 0 && Left.BBox.IsValid() && Right.BBox.IsValid();
+		if (bCanSplit && SplitCost < UnsplitLeftCost && SplitCost < UnsplitRightCost)
+		{
+			LeftReferences.push_back(Left);
+			RightReferences.push_back(Right);
+			Budget--;
+		}
+		else if (UnsplitLeftCost <= UnsplitRightCost)
+		{
+			LeftReferences.push_back(Reference);
+			nRight = std::max(nRight, 1u) - 1;
+		}
+		else
+		{
+			RightReferences.push_back(Reference);
+			nLeft = std::max(nLeft, 1u) - 1;
+		}
+	}
+}
+
+/**
+* Build a spatial split BVH (Stich et al. 2009) : a node is split either by
+* partitioning its references (object split), or by a plane that clips the
+* references straddling it (spatial split). A shape may thus be referred by
+* several leafs, the number of extra references of the subtree is bounded by
+* the budget.
+*/
+static BVHBinnedNode * RecursiveSpatialSplitBuild(
+	BVHBuildContext & Context,
+	std::vector<BVHPrimitive> & References,
+	uint32_t Budget,
+	uint32_t Depth
+)
+{
+	const uint32_t nReferences = uint32_t(References.size());
+	const BVHBin Bounds = ComputeBounds(References.data(), 0, nReferences);
+
+	BVHBinnedNode * pNode = Context.Arenas.local().Alloc<BVHBinnedNode>();
+	pNode->BBox = Bounds.BBox;
+	pNode->nShapes = nReferences;
+
+	// If the number of references at this point is less than the leaf
+	// size, then this will become a leaf.
+	if (nReferences <= Context.LeafSize)
+	{
+		pNode->ppShapes = Context.Arenas.local().Alloc<Shape*>(nReferences, false);
+		for (uint32_t i = 0; i < nReferences; i++)
+		{
+			pNode->ppShapes[i] = References[i].pShape;
+		}
+		return pNode;
+	}
+
+	const BoundingBox3f & Centroid = Bounds.Centroid;
+	const float InvSurfaceArea = 1.0f / Bounds.BBox.GetSurfaceArea();
+
+	// Find the best object split along every axis
+	BVHObjectSplit ObjectSplit;
+	for (uint32_t SplitDim = 0; SplitDim < 3; SplitDim++)
+	{
+		if (Centroid.Max[SplitDim] > Centroid.Min[SplitDim])
+		{
+			BVHObjectSplit Split = FindObjectSplit(References.data(), 0, nReferences, SplitDim, Centroid, InvSurfaceArea);
+			if (Split.Cost < ObjectSplit.Cost)
+			{
+				ObjectSplit = Split;
+			}
+		}
+	}
+
+	// Only try spatial splits when the children of the object split overlap a lot
+	SBVHSpatialSplit SpatialSplit;
+	if (Depth < SBVH_MAX_DEPTH)
+	{
+		BoundingBox3f Overlap = ObjectSplit.LeftBounds.BBox;
+		Overlap.Clip(ObjectSplit.RightBounds.BBox);
+		if (ObjectSplit.Cost == std::numeric_limits<float>::infinity() ||
+			(Overlap.IsValid() && Overlap.GetSurfaceArea() > SBVH_OVERLAP_THRESHOLD * Context.RootSurfaceArea))
+		{
+			SpatialSplit = FindSpatialSplit(References, Bounds.BBox, InvSurfaceArea);
+		}
+	}
+
+	std::vector<BVHPrimitive> LeftReferences, RightReferences;
+	uint32_t RemainingBudget = Budget;
+
+	if (SpatialSplit.Cost < ObjectSplit.Cost)
+	{
+		PerformSpatialSplit(References, SpatialSplit, RemainingBudget, LeftReferences, RightReferences);
+
+		// Unsplitting may have emptied a side
+		if (LeftReferences.empty() || RightReferences.empty())
+		{
+			LeftReferences.clear();
+			RightReferences.clear();
+			RemainingBudget = Budget;
+		}
+	}
+
+	if (LeftReferences.empty())
+	{
+		uint32_t iMid = 0;
+		if (ObjectSplit.Cost < std::numeric_limits<float>::infinity())
+		{
+			BVHPrimitive * pMid = std::partition(
+				References.data(),
+				References.data() + nReferences,
+				[&](const BVHPrimitive & Primitive)
+				{
+					return ComputeBucketIdx(Primitive, ObjectSplit.SplitDim, ObjectSplit.Min, ObjectSplit.InvNorm) <= ObjectSplit.iBucket;
+				}
+			);
+			iMid = uint32_t(pMid - References.data());
+		}
+
+		// All the centroids coincide or we get a bad split, just choose the center...
+		if (iMid == 0 || iMid == nReferences)
+		{
+			iMid = nReferences / 2;
+		}
+
+		LeftReferences.assign(References.begin(), References.begin() + iMid);
+		RightReferences.assign(References.begin() + iMid, References.end());
+	}
+
+	// Release the references of this node before building the children
+	std::vector<BVHPrimitive>().swap(References);
+
+	// Share the remaining budget between the children according to their size
+	uint32_t LeftBudget = uint32_t(uint64_t(RemainingBudget) * LeftReferences.size() / (LeftReferences.size() + RightReferences.size()));
+	uint32_t RightBudget = RemainingBudget - LeftBudget;
+
+	if (nReferences > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { pNode->pChildren[0] = RecursiveSpatialSplitBuild(Context, LeftReferences, LeftBudget, Depth + 1); },
+			[&]() { pNode->pChildren[1] = RecursiveSpatialSplitBuild(Context, RightReferences, RightBudget, Depth + 1); }
+		);
+	}
+	else
+	{
+		pNode->pChildren[0] = RecursiveSpatialSplitBuild(Context, LeftReferences, LeftBudget, Depth + 1);
+		pNode->pChildren[1] = RecursiveSpatialSplitBuild(Context, RightReferences, RightBudget, Depth + 1);
+	}
+
+	pNode->nShapes = pNode->pChildren[0]->nShapes + pNode->pChildren[1]->nShapes;
+	pNode->nNodes = 1 + pNode->pChildren[0]->nNodes + pNode->pChildren[1]->nNodes;
+	return pNode;
+}
+
+/// Gather the shapes of the leafs of a spatial split BVH so that every leaf refers to a contiguous range
+static void GatherLeafShapes(BVHBinnedNode * pNode, uint32_t iStart, std::vector<Shape*> & pShapes)
+{
+	pNode->iStart = iStart;
+
+	if (pNode->pChildren[0] == nullptr)
+	{
+		std::copy(pNode->ppShapes, pNode->ppShapes + pNode->nShapes, pShapes.begin() + iStart);
+		return;
+	}
+
+	BVHBinnedNode * pLeft = pNode->pChildren[0];
+	BVHBinnedNode * pRight = pNode->pChildren[1];
+
+	if (pNode->nShapes > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { GatherLeafShapes(pLeft, iStart, pShapes); },
+			[&]() { GatherLeafShapes(pRight, iStart + pLeft->nShapes, pShapes); }
+		);
+	}
+	else
+	{
+		GatherLeafShapes(pLeft, iStart, pShapes);
+		GatherLeafShapes(pRight, iStart + pLeft->nShapes, pShapes);
+	}
+}
+
+BVHAcceleration::BVHAcceleration(const PropertyList & PropList) : 
+	Acceleration(PropList)
+{
+	m_LeafSize = uint32_t(PropList.GetInteger(XML_ACCELERATION_BVH_LEAF_SIZE, DEFAULT_ACCELERATION_BVH_LEAF_SIZE));
+	m_SplitMethod = PropList.GetString(XML_ACCELERATION_BVH_SPLIT_METHOD, DEFAULT_ACCELERATION_BVH_SPLIT_METHOD);
+	if (m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER &&
+		m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_SAH &&
+		m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_SBVH)
+	{
+		LOG(WARNING) << "No split method \"" << m_SplitMethod << "\", use default split method";
+		m_SplitMethod = DEFAULT_ACCELERATION_BVH_SPLIT_METHOD;
+	}
+	m_DuplicationBudget = PropList.GetFloat(XML_ACCELERATION_BVH_DUPLICATION_BUDGET, DEFAULT_ACCELERATION_BVH_DUPLICATION_BUDGET);
+	if (m_DuplicationBudget < 0.0f)
+	{
+		LOG(WARNING) << "Duplication budget should not be negative but \"" << m_DuplicationBudget << "\" was given, use default duplication budget";
+		m_DuplicationBudget = DEFAULT_ACCELERATION_BVH_DUPLICATION_BUDGET;
+	}
+	m_RebuildThreshold = PropList.GetFloat(XML_ACCELERATION_BVH_REBUILD_THRESHOLD, DEFAULT_ACCELERATION_BVH_REBUILD_THRESHOLD);
+	if (m_RebuildThreshold < 1.0f)
+	{
+		LOG(WARNING) << "Rebuild threshold should not be less than 1 but \"" << m_RebuildThreshold << "\" was given, use default rebuild threshold";
+		m_RebuildThreshold = DEFAULT_ACCELERATION_BVH_REBUILD_THRESHOLD;
+	}
+	m_bInlineTriangle = PropList.GetBoolean(XML_ACCELERATION_BVH_INLINE_TRIANGLE, DEFAULT_ACCELERATION_BVH_INLINE_TRIANGLE);
+	m_TrianglePack = uint32_t(PropList.GetInteger(XML_ACCELERATION_BVH_TRIANGLE_PACK, DEFAULT_ACCELERATION_BVH_TRIANGLE_PACK));
+	m_bWatertight = PropList.GetBoolean(XML_ACCELERATION_BVH_WATERTIGHT, DEFAULT_ACCELERATION_BVH_WATERTIGHT);
+	if (m_TrianglePack != 0 && m_TrianglePack != 4 && m_TrianglePack != 8)
+	{
+		LOG(WARNING) << "Triangle pack should be 0, 4 or 8 but \"" << m_TrianglePack << "\" was given, use default triangle pack";
+		m_TrianglePack = DEFAULT_ACCELERATION_BVH_TRIANGLE_PACK;
+	}
+	if (m_bWatertight && m_TrianglePack == 0)
+	{
+		LOG(WARNING) << "Watertight intersection requires triangle packs, use packs of 4";
+		m_TrianglePack = 4;
+	}
+	m_bCompressed = PropList.GetBoolean(XML_ACCELERATION_BVH_COMPRESSED, DEFAULT_ACCELERATION_BVH_COMPRESSED);
+	if (m_bCompressed && m_LeafSize > BVH_QUANTIZED_MAX_LEAF_SIZE)
+	{
+		LOG(WARNING) << "Leaf size of compressed nodes should not be greater than " << BVH_QUANTIZED_MAX_LEAF_SIZE << " but \"" << m_LeafSize << "\" was given, use " << BVH_QUANTIZED_MAX_LEAF_SIZE;
+		m_LeafSize = BVH_QUANTIZED_MAX_LEAF_SIZE;
+	}
+	m_Traversal = PropList.GetString(XML_ACCELERATION_BVH_TRAVERSAL, DEFAULT_ACCELERATION_BVH_TRAVERSAL);
+	if (m_Traversal != XML_ACCELERATION_BVH_TRAVERSAL_STACK && m_Traversal != XML_ACCELERATION_BVH_TRAVERSAL_STACKLESS)
+	{
+		LOG(WARNING) << "No traversal \"" << m_Traversal << "\", use default traversal";
+		m_Traversal = DEFAULT_ACCELERATION_BVH_TRAVERSAL;
+	}
+	if (m_bCompressed && m_Traversal == XML_ACCELERATION_BVH_TRAVERSAL_STACKLESS)
+	{
+		LOG(WARNING) << "Stackless traversal is not supported by compressed nodes, use stack traversal";
+		m_Traversal = XML_ACCELERATION_BVH_TRAVERSAL_STACK;
+	}
+	m_CacheDirectory = PropList.GetString(XML_ACCELERATION_BVH_CACHE_DIRECTORY, DEFAULT_ACCELERATION_BVH_CACHE_DIRECTORY);
+	if (!m_CacheDirectory.empty())
+	{
+		filesystem::path CachePath(m_CacheDirectory);
+		if (!CachePath.is_absolute())
+		{
+			CachePath = GetFileResolver()->resolve(m_CacheDirectory);
+		}
+		if (!CachePath.is_directory())
+		{
+			LOG(WARNING) << "Cache directory \"" << m_CacheDirectory << "\" does not exist, the BVH will not be cached";
+			m_CacheDirectory.clear();
+		}
+		else
+		{
+			m_CacheDirectory = CachePath.str();
+		}
+	}
+}
+
+BVHAcceleration::~BVHAcceleration()
+{
+	ReleaseFlatTree();
+	FreeAligned(m_pInlineTriangles);
+	FreeAligned(m_pQuantizedTree);
+}
+
+void BVHAcceleration::Build()
+{
+	Timer BVHBuildTimer;
+
+	uint64_t CacheKey = 0;
+	std::string CacheFilename;
+	if (!m_CacheDirectory.empty())
+	{
+		CacheKey = AccelerationCache::ComputeKey(m_pShapes, tfm::format("bvh leafSize=%d splitMethod=%s duplicationBudget=%f",
+			m_LeafSize, m_SplitMethod, m_DuplicationBudget));
+		CacheFilename = AccelerationCache::GetFilename(m_CacheDirectory, CacheKey);
+	}
+
+	if (!CacheFilename.empty() && m_Cache.Load(CacheFilename, CacheKey, uint32_t(sizeof(BVHFlatNode)), uint32_t(m_pShapes.size())))
+	{
+		// The nodes are used in place from the mapped file
+		m_pFlatTree = (BVHFlatNode*)(m_Cache.GetNodes());
+		m_nNodes = m_Cache.GetNodeCount();
+		m_nLeafs = m_Cache.GetLeafCount();
+		m_Cache.ReorderShapes(m_pShapes);
+
+		LOG(INFO) << "Load BVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) from cache \"" << CacheFilename << 
+			"\" in " << BVHBuildTimer.ElapsedString() << ".";
+	}
+	else
+	{
+		std::vector<Shape*> pOriginalShapes;
+		if (!CacheFilename.empty())
+		{
+			pOriginalShapes = m_pShapes;
+		}
+
+		BuildFlatTree();
+
+		size_t nBytes = m_nNodes * sizeof(BVHFlatNode) + m_pShapes.size() * sizeof(Shape*);
+		LOG(INFO) << "Build BVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) in " << 
+			BVHBuildTimer.ElapsedString() << " and take " << MemString(m_nNodes * sizeof(BVHFlatNode)) << 
+			tfm::format(" (%.1f bytes per triangle with the shape pointers).", float(nBytes) / m_pShapes.size());
+
+		if (!CacheFilename.empty() && !AccelerationCache::Save(CacheFilename, CacheKey, m_pFlatTree,
+			uint32_t(sizeof(BVHFlatNode)), m_nNodes, m_nLeafs, pOriginalShapes, m_pShapes))
+		{
+			LOG(WARNING) << "Failed to write the BVH cache \"" << CacheFilename << "\"";
+		}
+	}
+
+	// The costs of the nodes are the reference used to detect the subtrees degraded by refitting
+	if (!m_bCompressed)
+	{
+		m_NodeCosts.resize(m_nNodes);
+		ComputeNodeCost(0, m_NodeCosts.data(), false);
+	}
+
+	if (m_Traversal == XML_ACCELERATION_BVH_TRAVERSAL_STACKLESS)
+	{
+		ComputeParentIndices();
+	}
+
+	BakeTriangles();
+
+	if (m_bCompressed)
+	{
+		Compress();
+	}
+}
+
+void BVHAcceleration::Refit()
+{
+	Timer RefitTimer;
+
+	// The quantized nodes can not be refitted in place, the tree is rebuilt
+	if (m_pQuantizedTree != nullptr)
+	{
+		Decompress();
+		BuildFlatTree();
+		m_BBox = m_pFlatTree[0].BBox;
+
+		LOG(INFO) << "Refit BVH (" << m_nNodes << " nodes, rebuilt) in " << RefitTimer.ElapsedString() << ".";
+
+		BakeTriangles();
+		Compress();
+		return;
+	}
+
+	std::vector<float> Costs(m_nNodes);
+	ComputeNodeCost(0, Costs.data(), true);
+
+	std::vector<uint32_t> iDegradedRoots;
+	FindDegradedSubtrees(0, Costs, iDegradedRoots);
+
+	if (!iDegradedRoots.empty())
+	{
+		RebuildSubtrees(iDegradedRoots);
+
+		if (m_Traversal == XML_ACCELERATION_BVH_TRAVERSAL_STACKLESS)
+		{
+			ComputeParentIndices();
+		}
+	}
+
+	m_BBox = m_pFlatTree[0].BBox;
+
+	LOG(INFO) << "Refit BVH (" << m_nNodes << " nodes, " << iDegradedRoots.size() << " subtrees rebuilt) in " <<
+		RefitTimer.ElapsedString() << ".";
+
+	BakeTriangles();
+}
+
+void BVHAcceleration::BakeTriangles()
+{
+	if (m_TrianglePack != 0)
+	{
+		m_TrianglePacks.Build(m_pShapes, m_TrianglePack, m_bWatertight);
+	}
+	else if (m_bInlineTriangle)
+	{
+		FreeAligned(m_pInlineTriangles);
+		m_pInlineTriangles = BakeInlineTriangles(m_pShapes);
+	}
+}
+
+float BVHAcceleration::ComputeNodeCost(uint32_t iNode, float * pCosts, bool bRefit)
+{
+	BVHFlatNode & Node = m_pFlatTree[iNode];
+
+	// Leaf node -> The cost is the number of intersection tests
+	if (Node.nRightChildOffset == 0)
+	{
+		if (bRefit)
+		{
+			Node.BBox.Reset();
+			for (uint32_t i = Node.iStart; i < Node.iStart + Node.nShapes; i++)
+			{
+				Node.BBox.ExpandBy(m_pShapes[i]->GetBoundingBox());
+			}
+		}
+		pCosts[iNode] = float(Node.nShapes);
+		return pCosts[iNode];
+	}
+
+	uint32_t iLeft = iNode + 1, iRight = iNode + Node.nRightChildOffset;
+	float LeftCost, RightCost;
+
+	if (Node.nShapes > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { LeftCost = ComputeNodeCost(iLeft, pCosts, bRefit); },
+			[&]() { RightCost = ComputeNodeCost(iRight, pCosts, bRefit); }
+		);
+	}
+	else
+	{
+		LeftCost = ComputeNodeCost(iLeft, pCosts, bRefit);
+		RightCost = ComputeNodeCost(iRight, pCosts, bRefit);
+	}
+
+	const BoundingBox3f & LeftBBox = m_pFlatTree[iLeft].BBox;
+	const BoundingBox3f & RightBBox = m_pFlatTree[iRight].BBox;
+	if (bRefit)
+	{
+		Node.BBox = BoundingBox3f::Merge(LeftBBox, RightBBox);
+	}
+
+	float SurfaceArea = Node.BBox.GetSurfaceArea();
+	if (SurfaceArea > 0.0f)
+	{
+		pCosts[iNode] = 0.125f + (LeftBBox.GetSurfaceArea() * LeftCost + RightBBox.GetSurfaceArea() * RightCost) / SurfaceArea;
+	}
+	else
+	{
+		pCosts[iNode] = 0.125f + LeftCost + RightCost;
+	}
+	return pCosts[iNode];
+}
+
+void BVHAcceleration::FindDegradedSubtrees(uint32_t iNode, const std::vector<float> & Costs, std::vector<uint32_t> & iRoots) const
+{
+	const BVHFlatNode & Node = m_pFlatTree[iNode];
+
+	// The cost of a leaf does not depend on its bounds
+	if (Node.nRightChildOffset == 0)
+	{
+		return;
+	}
+
+	if (Costs[iNode] > m_RebuildThreshold * m_NodeCosts[iNode])
+	{
+		iRoots.push_back(iNode);
+		return;
+	}
+
+	FindDegradedSubtrees(iNode + 1, Costs, iRoots);
+	FindDegradedSubtrees(iNode + Node.nRightChildOffset, Costs, iRoots);
+}
+
+void BVHAcceleration::RebuildSubtrees(const std::vector<uint32_t> & iRoots)
+{
+	const uint32_t nRebuilds = uint32_t(iRoots.size());
+
+	// The shapes of every subtree, the references duplicated by spatial splits are merged
+	std::vector<std::vector<Shape*>> SubtreeShapes(nRebuilds);
+	std::vector<uint32_t> iNewStarts(nRebuilds);
+	uint32_t nRemoved = 0;
+	for (uint32_t k = 0; k < nRebuilds; k++)
+	{
+		const BVHFlatNode & Root = m_pFlatTree[iRoots[k]];
+		std::vector<Shape*> & pShapes = SubtreeShapes[k];
+		pShapes.assign(m_pShapes.begin() + Root.iStart, m_pShapes.begin() + Root.iStart + Root.nShapes);
+		if (m_SplitMethod == XML_ACCELERATION_BVH_SPLIT_METHOD_SBVH)
+		{
+			std::sort(pShapes.begin(), pShapes.end());
+			pShapes.erase(std::unique(pShapes.begin(), pShapes.end()), pShapes.end());
+		}
+
+		// Position of the shapes of the subtree in the new shape list
+		iNewStarts[k] = Root.iStart - nRemoved;
+		nRemoved += Root.nShapes - uint32_t(pShapes.size());
+	}
+
+	// Build the new subtrees, the shapes are placed at their final position
+	std::vector<BVHPrimitive> Primitives(m_pShapes.size() - nRemoved);
+	std::vector<BVHBinnedNode*> pSubtrees(nRebuilds);
+
+	BVHBuildContext Context;
+	Context.pPrimitives = Primitives.data();
+	Context.LeafSize = m_LeafSize;
+	Context.bSAH = (m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER);
+
+	tbb::blocked_range<uint32_t> SubtreeRange(0, nRebuilds);
+	auto SubtreeMap = [&](const tbb::blocked_range<uint32_t> & Range)
+	{
+		for (uint32_t k = Range.begin(); k < Range.end(); k++)
+		{
+			const uint32_t iStart = iNewStarts[k];
+			const uint32_t iEnd = iStart + uint32_t(SubtreeShapes[k].size());
+			for (uint32_t i = iStart; i < iEnd; i++)
+			{
+				Shape * pShape = SubtreeShapes[k][i - iStart];
+				Primitives[i].BBox = pShape->GetBoundingBox();
+				Primitives[i].Centroid = pShape->GetCentroid();
+				Primitives[i].pShape = pShape;
+			}
+			pSubtrees[k] = RecursiveBuild(Context, iStart, iEnd, ComputeBounds(Primitives.data(), iStart, iEnd));
+		}
+	};
+
+	/// Uncomment the following line for single threaded building
+	//SubtreeMap(SubtreeRange);
+
+	/// Default: parallel building
+	tbb::parallel_for(SubtreeRange, SubtreeMap);
+
+	// Copy the other nodes in depth-first order, and leave room for the new subtrees
+	std::vector<BVHFlatNode> NewTree;
+	std::vector<float> NewCosts;
+	std::vector<Shape*> NewShapes;
+	std::vector<uint32_t> iNewRoots(nRebuilds);
+	NewTree.reserve(m_nNodes);
+	NewCosts.reserve(m_nNodes);
+	NewShapes.reserve(Primitives.size());
+
+	uint32_t iNextRebuild = 0;
+	std::function<void(uint32_t)> CopyNode = [&](uint32_t iNode)
+	{
+		const BVHFlatNode & Node = m_pFlatTree[iNode];
+
+		if (iNextRebuild < nRebuilds && iRoots[iNextRebuild] == iNode)
+		{
+			uint32_t k = iNextRebuild++;
+			CHECK(NewShapes.size() == iNewStarts[k]);
+
+			iNewRoots[k] = uint32_t(NewTree.size());
+			NewTree.resize(NewTree.size() + pSubtrees[k]->nNodes);
+			NewCosts.resize(NewTree.size());
+			for (uint32_t i = iNewStarts[k]; i < iNewStarts[k] + uint32_t(SubtreeShapes[k].size()); i++)
+			{
+				NewShapes.push_back(Primitives[i].pShape);
+			}
+			return;
+		}
+
+		uint32_t iNewNode = uint32_t(NewTree.size());
+		NewTree.push_back(Node);
+		NewCosts.push_back(m_NodeCosts[iNode]);
+		NewTree[iNewNode].iStart = uint32_t(NewShapes.size());
+
+		if (Node.nRightChildOffset == 0)
+		{
+			NewShapes.insert(NewShapes.end(), m_pShapes.begin() + Node.iStart, m_pShapes.begin() + Node.iStart + Node.nShapes);
+		}
+		else
+		{
+			CopyNode(iNode + 1);
+			NewTree[iNewNode].nRightChildOffset = uint32_t(NewTree.size()) - iNewNode;
+			CopyNode(iNode + Node.nRightChildOffset);
+		}
+
+		NewTree[iNewNode].nShapes = uint32_t(NewShapes.size()) - NewTree[iNewNode].iStart;
+	};
+	CopyNode(0);
+	CHECK(iNextRebuild == nRebuilds && NewShapes.size() == Primitives.size());
+
+	ReleaseFlatTree();
+	m_nNodes = uint32_t(NewTree.size());
+	m_nLeafs = (m_nNodes + 1) / 2;
+	m_pFlatTree = new BVHFlatNode[m_nNodes];
+	std::copy(NewTree.begin(), NewTree.end(), m_pFlatTree);
+	m_pShapes.swap(NewShapes);
+	m_NodeCosts.swap(NewCosts);
+
+	// The new subtrees become the reference of the following refits
+	for (uint32_t k = 0; k < nRebuilds; k++)
+	{
+		FlattenBVHTree(pSubtrees[k], iNewRoots[k]);
+		ComputeNodeCost(iNewRoots[k], m_NodeCosts.data(), false);
+	}
+}
+
+void BVHAcceleration::BuildFlatTree()
+{
+	const uint32_t nShapes = uint32_t(m_pShapes.size());
+
+	// Cache the bounding box and centroid of all the shapes
+	std::vector<BVHPrimitive> Primitives(nShapes);
+
+	tbb::blocked_range<uint32_t> PrimitiveRange(0, nShapes);
+	auto PrimitiveMap = [&](const tbb::blocked_range<uint32_t> & Range)
+	{
+		for (uint32_t i = Range.begin(); i < Range.end(); i++)
+		{
+			Primitives[i].BBox = m_pShapes[i]->GetBoundingBox();
+			Primitives[i].Centroid = m_pShapes[i]->GetCentroid();
+			Primitives[i].pShape = m_pShapes[i];
+		}
+	};
+
+	/// Uncomment the following line for single threaded computing
+	//PrimitiveMap(PrimitiveRange);
+
+	/// Default: parallel computing
+	tbb::parallel_for(PrimitiveRange, PrimitiveMap);
+
+	// Build the tree, subtrees are built concurrently into per-thread arenas
+	BVHBuildContext Context;
+	Context.pPrimitives = Primitives.data();
+	Context.LeafSize = m_LeafSize;
+	Context.bSAH = (m_SplitMethod != XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER);
+
+	if (m_SplitMethod == XML_ACCELERATION_BVH_SPLIT_METHOD_SBVH)
+	{
+		// References are binned by the center of their (clipped) bounding box
+		for (BVHPrimitive & Primitive : Primitives)
+		{
+			Primitive.Centroid = Primitive.BBox.GetCenter();
+		}
+		Context.RootSurfaceArea = ComputeBounds(Primitives.data(), 0, nShapes).BBox.GetSurfaceArea();
+
+		uint32_t Budget = uint32_t(m_DuplicationBudget * nShapes);
+		BVHBinnedNode * pRoot = RecursiveSpatialSplitBuild(Context, Primitives, Budget, 0);
+
+		m_nNodes = pRoot->nNodes;
+		m_nLeafs = (m_nNodes + 1) / 2;
+
+		// A shape may be referred by several leafs
+		m_pShapes.resize(pRoot->nShapes);
+		GatherLeafShapes(pRoot, 0, m_pShapes);
+
+		m_pFlatTree = new BVHFlatNode[m_nNodes];
+		FlattenBVHTree(pRoot, 0);
+
+		LOG(INFO) << "Spatial splits add " << pRoot->nShapes - nShapes << " references to " << nShapes << " shapes.";
+		return;
+	}
+
+	BVHBinnedNode * pRoot = RecursiveBuild(Context, 0, nShapes, ComputeBounds(Primitives.data(), 0, nShapes));
+
+	m_nNodes = pRoot->nNodes;
+	m_nLeafs = (m_nNodes + 1) / 2;
+
+	m_pFlatTree = new BVHFlatNode[m_nNodes];
+	FlattenBVHTree(pRoot, 0);
+
+	// Reorder the shapes so that every leaf refers to a contiguous range
+	auto ReorderMap = [&](const tbb::blocked_range<uint32_t> & Range)
+	{
+		for (uint32_t i = Range.begin(); i < Range.end(); i++)
+		{
+			m_pShapes[i] = Primitives[i].pShape;
+		}
+	};
+
+	/// Uncomment the following line for single threaded computing
+	//ReorderMap(PrimitiveRange);
+
+	/// Default: parallel computing
+	tbb::parallel_for(PrimitiveRange, ReorderMap);
+}
+
+void BVHAcceleration::ComputeParentIndices()
+{
+	m_ParentIndices.resize(m_nNodes);
+	m_ParentIndices[0] = 0;
+
+	tbb::blocked_range<uint32_t> Range(0, m_nNodes);
+	auto Map = [&](const tbb::blocked_range<uint32_t> & Range)
+	{
+		for (uint32_t i = Range.begin(); i < Range.end(); i++)
+		{
+			if (m_pFlatTree[i].nRightChildOffset != 0)
+			{
+				m_ParentIndices[i + 1] = i;
+				m_ParentIndices[i + m_pFlatTree[i].nRightChildOffset] = i;
+			}
+		}
+	};
+
+	/// Uncomment the following line for single threaded computing
+	//Map(Range);
+
+	/// Default: parallel computing
+	tbb::parallel_for(Range, Map);
+}
+
+uint32_t BVHAcceleration::GetNearChild(uint32_t iNode, const Vector3f & Direction) const
+{
+	// The order only depends on the ray direction, so that it is the same on the way down and up
+	uint32_t iLeft = iNode + 1, iRight = iNode + m_pFlatTree[iNode].nRightChildOffset;
+	const BoundingBox3f & LeftBBox = m_pFlatTree[iLeft].BBox;
+	const BoundingBox3f & RightBBox = m_pFlatTree[iRight].BBox;
+	Vector3f Delta = (RightBBox.Min + RightBBox.Max) - (LeftBBox.Min + LeftBBox.Max);
+	return (Delta.dot(Direction) >= 0.0f) ? iLeft : iRight;
+}
+
+void BVHAcceleration::Compress()
+{
+	Timer CompressTimer;
+
+	size_t nFullBytes = m_nNodes * sizeof(BVHFlatNode) + m_pShapes.size() * sizeof(Shape*);
+
+	// Number the triangles of the meshes consecutively, the triangles of a mesh are allocated together
+	std::map<const Mesh*, uint32_t> iMeshes;
+	uint32_t nPrimitives = 0;
+	const Mesh * pLastMesh = nullptr;
+	for (Shape * pShape : m_pShapes)
+	{
+		const Mesh * pMesh = pShape->GetMesh();
+		if (pMesh != pLastMesh && iMeshes.find(pMesh) == iMeshes.end())
+		{
+			iMeshes.emplace(pMesh, uint32_t(m_pPrimitiveMeshes.size()));
+			m_iMeshFirstPrimitives.push_back(nPrimitives);
+			m_pPrimitiveMeshes.push_back(pMesh);
+			m_pPrimitiveTriangles.push_back(static_cast<Triangle*>(pShape) - pShape->GetFacetIndex());
+			nPrimitives += pMesh->GetTriangleCount();
+		}
+		pLastMesh = pMesh;
+	}
+
+	m_PrimitiveIndices.resize(m_pShapes.size());
+
+	tbb::blocked_range<uint32_t> Range(0, uint32_t(m_pShapes.size()));
+	auto Map = [&](const tbb::blocked_range<uint32_t> & Range)
+	{
+		for (uint32_t i = Range.begin(); i < Range.end(); i++)
+		{
+			uint32_t iMesh = iMeshes.find(m_pShapes[i]->GetMesh())->second;
+			m_PrimitiveIndices[i] = m_iMeshFirstPrimitives[iMesh] + m_pShapes[i]->GetFacetIndex();
+		}
+	};
+
+	/// Uncomment the following line for single threaded indexing
+	//Map(Range);
+
+	/// Default: parallel indexing
+	tbb::parallel_for(Range, Map);
+
+	// One quantized node per interior node, the leafs are stored in their parents
+	m_nQuantizedNodes = std::max(m_nNodes - m_nLeafs, 1u);
+	m_pQuantizedTree = AllocAligned<BVHQuantizedNode>(m_nQuantizedNodes);
+
+	if (m_pFlatTree[0].nRightChildOffset == 0)
+	{
+		const BVHFlatNode & Root = m_pFlatTree[0];
+		CompressNode(0, 0);
+		SetQuantizedChild(m_pQuantizedTree[0], 0, Root.BBox, Root.iStart | BVH_QUANTIZED_LEAF_FLAG, Root.nShapes);
+		SetQuantizedChild(m_pQuantizedTree[0], 1, Root.BBox, BVH_QUANTIZED_EMPTY_CHILD, 0);
+	}
+	else
+	{
+		CompressNode(0, 0);
+	}
+
+	// Neither the full precision nodes nor the shape pointers are needed any more
+	ReleaseFlatTree();
+	std::vector<float>().swap(m_NodeCosts);
+	std::vector<Shape*>().swap(m_pShapes);
+
+	size_t nBytes = m_nQuantizedNodes * sizeof(BVHQuantizedNode) + m_PrimitiveIndices.size() * sizeof(uint32_t);
+	LOG(INFO) << "Compress BVH into " << m_nQuantizedNodes << " quantized nodes in " << CompressTimer.ElapsedString() <<
+		" and take " << MemString(m_nQuantizedNodes * sizeof(BVHQuantizedNode)) << tfm::format(" (%.1f bytes per triangle instead of %.1f).",
+		float(nBytes) / m_PrimitiveIndices.size(), float(nFullBytes) / m_PrimitiveIndices.size());
+}
+
+void BVHAcceleration::CompressNode(uint32_t iFlatNode, uint32_t iNode)
+{
+	const BVHFlatNode & FlatNode = m_pFlatTree[iFlatNode];
+	BVHQuantizedNode & Node = m_pQuantizedTree[iNode];
+
+	// The smallest power of two exponent such that 255 steps cover the bounds of the node
+	for (int i = 0; i < 3; i++)
+	{
+		Node.Origin[i] = FlatNode.BBox.Min[i];
+
+		int Exponent = -126;
+		float Extent = FlatNode.BBox.Max[i] - FlatNode.BBox.Min[i];
+		if (Extent > 0.0f)
+		{
+			std::frexp(Extent / 255.0f, &Exponent);
+			Exponent = Clamp(Exponent, -126, 127);
+		}
+		while (Exponent < 127 && Node.Origin[i] + 255.0f * ExponentToScale(int8_t(Exponent)) < FlatNode.BBox.Max[i])
+		{
+			Exponent++;
+		}
+		Node.Exponent[i] = int8_t(Exponent);
+	}
+
+	// A leaf is stored in the child slot of its parent
+	if (FlatNode.nRightChildOffset == 0)
+	{
+		return;
+	}
+
+	uint32_t iFlatChildren[2] = { iFlatNode + 1, iFlatNode + FlatNode.nRightChildOffset };
+
+	// The interior nodes of the left subtree directly follow their parent, then come the ones of the right subtree
+	uint32_t nLeftInteriors = (FlatNode.nRightChildOffset - 2) / 2;
+	uint32_t iChildren[2] = { iNode + 1, iNode + 1 + nLeftInteriors };
+
+	for (uint32_t k = 0; k < 2; k++)
+	{
+		const BVHFlatNode & FlatChild = m_pFlatTree[iFlatChildren[k]];
+		if (FlatChild.nRightChildOffset == 0)
+		{
+			CHECK(FlatChild.nShapes <= BVH_QUANTIZED_MAX_LEAF_SIZE);
+			SetQuantizedChild(Node, k, FlatChild.BBox, FlatChild.iStart | BVH_QUANTIZED_LEAF_FLAG, FlatChild.nShapes);
+		}
+		else
+		{
+			SetQuantizedChild(Node, k, FlatChild.BBox, iChildren[k], 0);
+		}
+	}
+
+	auto CompressChild = [&](uint32_t k)
+	{
+		if (m_pFlatTree[iFlatChildren[k]].nRightChildOffset != 0)
+		{
+			CompressNode(iFlatChildren[k], iChildren[k]);
+		}
+	};
+
+	if (FlatNode.nShapes > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { CompressChild(0); },
+			[&]() { CompressChild(1); }
+		);
+	}
+	else
+	{
+		CompressChild(0);
+		CompressChild(1);
+	}
+}
+
+void BVHAcceleration::SetQuantizedChild(BVHQuantizedNode & Node, uint32_t iSlot, const BoundingBox3f & BBox, uint32_t iChild, uint32_t nShapes) const
+{
+	// Round outwards, the decoded bounds always contain the exact ones
+	for (int i = 0; i < 3; i++)
+	{
+		float Scale = ExponentToScale(Node.Exponent[i]);
+
+		int QMin = Clamp(int(std::floor((BBox.Min[i] - Node.Origin[i]) / Scale)), 0, 255);
+		while (QMin > 0 && Node.Origin[i] + float(QMin) * Scale > BBox.Min[i])
+		{
+			QMin--;
+		}
+
+		int QMax = Clamp(int(std::ceil((BBox.Max[i] - Node.Origin[i]) / Scale)), 0, 255);
+		while (QMax < 255 && Node.Origin[i] + float(QMax) * Scale < BBox.Max[i])
+		{
+			QMax++;
+		}
+
+		Node.QMin[iSlot][i] = uint8_t(QMin);
+		Node.QMax[iSlot][i] = uint8_t(QMax);
+	}
+
+	Node.iChild[iSlot] = iChild;
+	Node.nShapes[iSlot] = uint16_t(nShapes);
+}
+
+void BVHAcceleration::Decompress()
+{
+	// The shapes are restored in the order of the meshes, without the references duplicated by spatial splits
+	m_pShapes.clear();
+	for (size_t k = 0; k < m_pPrimitiveMeshes.size(); k++)
+	{
+		for (uint32_t i = 0; i < m_pPrimitiveMeshes[k]->GetTriangleCount(); i++)
+		{
+			m_pShapes.push_back(m_pPrimitiveTriangles[k] + i);
+		}
+	}
+
+	std::vector<uint32_t>().swap(m_PrimitiveIndices);
+	m_iMeshFirstPrimitives.clear();
+	m_pPrimitiveMeshes.clear();
+	m_pPrimitiveTriangles.clear();
+
+	FreeAligned(m_pQuantizedTree);
+	m_pQuantizedTree = nullptr;
+	m_nQuantizedNodes = 0;
+}
+
+BoundingBox3f BVHAcceleration::GetChildBoundingBox(const BVHQuantizedNode & Node, uint32_t iSlot) const
+{
+	BoundingBox3f BBox;
+	for (int i = 0; i < 3; i++)
+	{
+		float Scale = ExponentToScale(Node.Exponent[i]);
+		BBox.Min[i] = Node.Origin[i] + float(Node.QMin[iSlot][i]) * Scale;
+		BBox.Max[i] = Node.Origin[i] + float(Node.QMax[iSlot][i]) * Scale;
+	}
+	return BBox;
+}
+
+uint32_t BVHAcceleration::FindPrimitiveMesh(uint32_t iPrimitive) const
+{
+	// There are only a few meshes, binary search the last one starting at or before the primitive
+	return uint32_t(std::upper_bound(m_iMeshFirstPrimitives.begin(), m_iMeshFirstPrimitives.end(), iPrimitive) -
+		m_iMeshFirstPrimitives.begin()) - 1;
+}
+
+Shape * BVHAcceleration::GetPrimitive(uint32_t iPrimitive) const
+{
+	uint32_t iMesh = FindPrimitiveMesh(iPrimitive);
+	return m_pPrimitiveTriangles[iMesh] + (iPrimitive - m_iMeshFirstPrimitives[iMesh]);
+}
+
+void BVHAcceleration::ReleaseFlatTree()
+{
+	if (m_Cache.IsLoaded())
+	{
+		m_Cache.Release();
+	}
+	else
+	{
+		delete[] m_pFlatTree;
+	}
+	m_pFlatTree = nullptr;
+}
+
+bool BVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
+{
+	if (m_pQuantizedTree != nullptr)
+	{
+		return RayIntersectCompressed(Ray, Isect, bShadowRay);
+	}
+
+	if (!m_ParentIndices.empty())
+	{
+		return RayIntersectStackless(Ray, Isect, bShadowRay);
+	}
+
+	bool bFoundIntersection = false;       // Was an intersection found so far?
+	Shape * pFoundShape = nullptr;
+	TraversalCounter Counter(bShadowRay);
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	BVHTraversal Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	// Push the root node
+	Stack[iStackPtr].Idx = 0;
+	Stack[iStackPtr].MinT = -std::numeric_limits<float>::max();
+	iStackPtr++;
+
+	while (iStackPtr > 0)
+	{
+		// Pop the next node
+		BVHTraversal TopNode = Stack[--iStackPtr];
+		uint32_t Idx = TopNode.Idx;
+		float MinT = TopNode.MinT;
+
+		BVHFlatNode CurrentFlatNode = m_pFlatTree[Idx];
+
+		// If the node is further than the cloest found intersection, continue
+		if (MinT > Isect.T)
+		{
+			continue;
+		}
+
+		Counter.nNodes++;
+
+		// Leaf node -> Check intersection
+		if (CurrentFlatNode.nRightChildOffset == 0)
+		{
+			Counter.nTriangleTests += CurrentFlatNode.nShapes;
+
+			if (m_TrianglePacks.IsBuilt())
+			{
+				float U, V, T;
+				uint32_t iShape;
+				if (m_TrianglePacks.RayIntersect(PackRay, CurrentFlatNode.iStart, CurrentFlatNode.nShapes, RayCopy.MaxT, iShape, U, V, T))
+				{
+					Shape * pShape = m_pShapes[iShape];
+
+					if (bShadowRay)
+					{
+						return true;
+					}
+
+					RayCopy.MaxT = Isect.T = T;
+					Isect.UV = Point2f(U, V);
+					Isect.pShape = pShape;
+
+					pFoundShape = pShape;
+					bFoundIntersection = true;
+				}
+			}
+			else
+			{
+				for (uint32_t i = 0; i < CurrentFlatNode.nShapes; i++)
+				{
+					float U, V, T;
+					uint32_t iShape = CurrentFlatNode.iStart + i;
+					bool bHit = (m_pInlineTriangles != nullptr) ?
+						m_pInlineTriangles[iShape].RayIntersect(RayCopy, U, V, T) :
+						m_pShapes[iShape]->RayIntersect(RayCopy, U, V, T);
+					if (bHit)
+					{
+						Shape * pShape = m_pShapes[iShape];
+
+						if (bShadowRay)
+						{
+							return true;
+						}
+
+						RayCopy.MaxT = Isect.T = T;
+						Isect.UV = Point2f(U, V);
+						Isect.pShape = pShape;
+
+						pFoundShape = pShape;
+						bFoundIntersection = true;
+					}
+				}
+			}
+		}
+		// Not a leaf
+		else
+		{
+			float HitLeftNearT, HitLeftFarT;
+			float HitRightNearT, HitRightFarT;
+			uint32_t iNearNode, iFarNode;
+			float HitNearNodeNearT, HitFarNodeNearT;
+
+			uint32_t iLeftNode = Idx + 1;
+			uint32_t iRightNode = Idx + CurrentFlatNode.nRightChildOffset;
+
+			const BVHFlatNode & LeftFlatNode = m_pFlatTree[iLeftNode];
+			const BVHFlatNode & RightFlatNode = m_pFlatTree[iRightNode];
+			
+			Counter.nBoxTests += 2;
+			bool bHitLeft = LeftFlatNode.BBox.RayIntersect(RayCopy, HitLeftNearT, HitLeftFarT);
+			bool bHitRight = RightFlatNode.BBox.RayIntersect(RayCopy, HitRightNearT, HitRightFarT);
+
+			if (bHitLeft && bHitRight)
+			{
+				if (HitRightNearT < HitLeftNearT)
+				{
+					iNearNode = iRightNode;
+					iFarNode = iLeftNode;
+					HitNearNodeNearT = HitRightNearT;
+					HitFarNodeNearT = HitLeftNearT;
+				}
+				else
+				{
+					iNearNode = iLeftNode;
+					iFarNode = iRightNode;
+					HitNearNodeNearT = HitLeftNearT;
+					HitFarNodeNearT = HitRightNearT;
+				}
+
+				// Push the farther first and then the near one
+				Stack[iStackPtr++] = BVHTraversal(iFarNode, HitFarNodeNearT);
+				Stack[iStackPtr++] = BVHTraversal(iNearNode, HitNearNodeNearT);
+			}
+			else if (bHitLeft)
+			{
+				Stack[iStackPtr++] = BVHTraversal(iLeftNode, HitLeftNearT);
+			}
+			else if (bHitRight)
+			{
+				Stack[iStackPtr++] = BVHTraversal(iRightNode, HitRightNearT);
+			}
+		}
+	}
+
+	if (bFoundIntersection)
+	{
+		pFoundShape->PostIntersect(Isect);
+		Isect.ComputeScreenSpacePartial(Ray);
+	}
+
+	return bFoundIntersection;
+}
+
+bool BVHAcceleration::Occluded(const Ray3f & Ray) const
+{
+	if (m_pQuantizedTree != nullptr)
+	{
+		return OccludedCompressed(Ray);
+	}
+
+	if (!m_ParentIndices.empty())
+	{
+		return OccludedStackless(Ray);
+	}
+
+	TraversalCounter Counter(true);
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	uint32_t Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	Counter.nBoxTests++;
+	if (!m_pFlatTree[0].BBox.RayIntersect(Ray))
+	{
+		return false;
+	}
+
+	// Push the root node
+	Stack[iStackPtr++] = 0;
+
+	while (iStackPtr > 0)
+	{
+		uint32_t Idx = Stack[--iStackPtr];
+		const BVHFlatNode & CurrentFlatNode = m_pFlatTree[Idx];
+		Counter.nNodes++;
+
+		// Leaf node -> Any intersection terminates the query
+		if (CurrentFlatNode.nRightChildOffset == 0)
+		{
+			Counter.nTriangleTests += CurrentFlatNode.nShapes;
+			if (OccludedLeaf(Ray, PackRay, CurrentFlatNode.iStart, CurrentFlatNode.nShapes))
+			{
+				return true;
+			}
+		}
+		// Not a leaf -> Visit the children in any order
+		else
+		{
+			uint32_t iLeftNode = Idx + 1;
+			uint32_t iRightNode = Idx + CurrentFlatNode.nRightChildOffset;
+
+			Counter.nBoxTests += 2;
+			if (m_pFlatTree[iRightNode].BBox.RayIntersect(Ray))
+			{
+				Stack[iStackPtr++] = iRightNode;
+			}
+			if (m_pFlatTree[iLeftNode].BBox.RayIntersect(Ray))
+			{
+				Stack[iStackPtr++] = iLeftNode;
+			}
+		}
+	}
+
+	return false;
+}
+
+void BVHAcceleration::RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const
+{
+	// The compressed tree traces the rays one by one
+	if (m_pQuantizedTree != nullptr)
+	{
+		Acceleration::RayIntersectPacket(pRays, pIsects, pbHits, nRays);
+		return;
+	}
+
+	// Split the packets which are too large
+	while (nRays > HIKARI_RAY_PACKET_SIZE)
+	{
+		RayIntersectPacket(pRays, pIsects, pbHits, HIKARI_RAY_PACKET_SIZE);
+		pRays += HIKARI_RAY_PACKET_SIZE;
+		pIsects += HIKARI_RAY_PACKET_SIZE;
+		pbHits += HIKARI_RAY_PACKET_SIZE;
+		nRays -= HIKARI_RAY_PACKET_SIZE;
+	}
+
+	if (nRays == 0)
+	{
+		return;
+	}
+
+	// The work of the packet is shared by its rays
+	TraversalCounter Counter(false);
+	Counter.nRays = nRays;
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	BVHPacketTraversal Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	Ray3f RayCopies[HIKARI_RAY_PACKET_SIZE];
+	TrianglePackArray::RayData PackRays[HIKARI_RAY_PACKET_SIZE];
+
+	BVHPacketBounds Bounds;
+	bool bPacketCulling = true;
+
+	for (int i = 0; i < 3; i++)
+	{
+		Bounds.OriginMin[i] = Bounds.InvDirMin[i] = std::numeric_limits<float>::infinity();
+		Bounds.OriginMax[i] = Bounds.InvDirMax[i] = -std::numeric_limits<float>::infinity();
+	}
+	Bounds.MinT = std::numeric_limits<float>::infinity();
+	Bounds.MaxT = -std::numeric_limits<float>::infinity();
+
+	for (uint32_t iRay = 0; iRay < nRays; iRay++)
+	{
+		const Ray3f & Ray = pRays[iRay];
+		RayCopies[iRay] = Ray;
+		pbHits[iRay] = false;
+
+		if (m_TrianglePacks.IsBuilt())
+		{
+			m_TrianglePacks.PrepareRay(Ray, PackRays[iRay]);
+		}
+
+		for (int i = 0; i < 3; i++)
+		{
+			// Axis-parallel rays are handled by the per-ray test only
+			if (!std::isfinite(Ray.DirectionReciprocal[i]))
+			{
+				bPacketCulling = false;
+			}
+			Bounds.OriginMin[i] = std::min(Bounds.OriginMin[i], Ray.Origin[i]);
+			Bounds.OriginMax[i] = std::max(Bounds.OriginMax[i], Ray.Origin[i]);
+			Bounds.InvDirMin[i] = std::min(Bounds.InvDirMin[i], Ray.DirectionReciprocal[i]);
+			Bounds.InvDirMax[i] = std::max(Bounds.InvDirMax[i], Ray.DirectionReciprocal[i]);
+		}
+		Bounds.MinT = std::min(Bounds.MinT, Ray.MinT);
+		Bounds.MaxT = std::max(Bounds.MaxT, Ray.MaxT);
+	}
+
+	// Push the root node
+	Stack[iStackPtr++] = BVHPacketTraversal(0, 0);
+
+	while (iStackPtr > 0)
+	{
+		// Pop the next node
+		BVHPacketTraversal TopNode = Stack[--iStackPtr];
+		uint32_t Idx = TopNode.Idx;
+		const BVHFlatNode & CurrentFlatNode = m_pFlatTree[Idx];
+		Counter.nNodes++;
+		Counter.nBoxTests++;
+
+		// The whole packet misses the node
+		if (bPacketCulling && !PacketIntersectBBox(CurrentFlatNode.BBox, Bounds))
+		{
+			continue;
+		}
+
+		// Skip the rays in front of the first one hitting the node
+		uint32_t iFirstActive = TopNode.iFirstActive;
+		while (iFirstActive < nRays && !CurrentFlatNode.BBox.RayIntersect(RayCopies[iFirstActive]))
+		{
+			Counter.nBoxTests++;
+			iFirstActive++;
+		}
+
+		if (iFirstActive == nRays)
+		{
+			continue;
+		}
+
+		// Leaf node -> Check intersection for the remaining rays
+		if (CurrentFlatNode.nRightChildOffset == 0)
+		{
+			bool bShortened = false;
+			for (uint32_t iRay = iFirstActive; iRay < nRays; iRay++)
+			{
+				if (iRay != iFirstActive && !CurrentFlatNode.BBox.RayIntersect(RayCopies[iRay]))
+				{
+					continue;
+				}
+
+				Counter.nTriangleTests += CurrentFlatNode.nShapes;
+				if (IntersectLeaf(RayCopies[iRay], PackRays[iRay], CurrentFlatNode.iStart, CurrentFlatNode.nShapes, pIsects[iRay]))
+				{
+					pbHits[iRay] = true;
+					bShortened = true;
+				}
+			}
+
+			if (bShortened)
+			{
+				Bounds.MaxT = -std::numeric_limits<float>::infinity();
+				for (uint32_t iRay = 0; iRay < nRays; iRay++)
+				{
+					Bounds.MaxT = std::max(Bounds.MaxT, RayCopies[iRay].MaxT);
+				}
+			}
+		}
+		// Not a leaf -> Visit first the child nearer to the first active ray
+		else
+		{
+			uint32_t iLeftNode = Idx + 1;
+			uint32_t iRightNode = Idx + CurrentFlatNode.nRightChildOffset;
+
+			float HitLeftNearT, HitLeftFarT;
+			float HitRightNearT, HitRightFarT;
+
+			const Ray3f & FirstRay = RayCopies[iFirstActive];
+			Counter.nBoxTests += 2;
+			if (!m_pFlatTree[iLeftNode].BBox.RayIntersect(FirstRay, HitLeftNearT, HitLeftFarT))
+			{
+				HitLeftNearT = std::numeric_limits<float>::infinity();
+			}
+			if (!m_pFlatTree[iRightNode].BBox.RayIntersect(FirstRay, HitRightNearT, HitRightFarT))
+			{
+				HitRightNearT = std::numeric_limits<float>::infinity();
+			}
+
+			// Push the farther first and then the near one
+			if (HitRightNearT < HitLeftNearT)
+			{
+				Stack[iStackPtr++] = BVHPacketTraversal(iLeftNode, iFirstActive);
+				Stack[iStackPtr++] = BVHPacketTraversal(iRightNode, iFirstActive);
+			}
+			else
+			{
+				Stack[iStackPtr++] = BVHPacketTraversal(iRightNode, iFirstActive);
+				Stack[iStackPtr++] = BVHPacketTraversal(iLeftNode, iFirstActive);
+			}
+		}
+	}
+
+	for (uint32_t iRay = 0; iRay < nRays; iRay++)
+	{
+		if (pbHits[iRay])
+		{
+			pIsects[iRay].pShape->PostIntersect(pIsects[iRay]);
+			pIsects[iRay].ComputeScreenSpacePartial(pRays[iRay]);
+		}
+	}
+}
+
+bool BVHAcceleration::IntersectLeaf(Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes, Intersection & Isect) const
+{
+	bool bFoundIntersection = false;
+
+	if (m_TrianglePacks.IsBuilt())
+	{
+		float U, V, T;
+		uint32_t iShape;
+		if (m_TrianglePacks.RayIntersect(PackRay, iStart, nShapes, Ray.MaxT, iShape, U, V, T))
+		{
+			Ray.MaxT = Isect.T = T;
+			Isect.UV = Point2f(U, V);
+			Isect.pShape = m_pShapes[iShape];
+			bFoundIntersection = true;
+		}
+		return bFoundIntersection;
+	}
+
+	for (uint32_t i = 0; i < nShapes; i++)
 	{
-		LOG(WARNING) << "No split method \"" << m_SplitMethod << "\", use default split method";
-		m_SplitMethod = DEFAULT_ACCELERATION_BVH_SPLIT_METHOD;
+		float U, V, T;
+		uint32_t iShape = iStart + i;
+		bool bHit = (m_pInlineTriangles != nullptr) ?
+			m_pInlineTriangles[iShape].RayIntersect(Ray, U, V, T) :
+			m_pShapes[iShape]->RayIntersect(Ray, U, V, T);
+		if (bHit)
+		{
+			Ray.MaxT = Isect.T = T;
+			Isect.UV = Point2f(U, V);
+			Isect.pShape = m_pShapes[iShape];
+			bFoundIntersection = true;
+		}
 	}
+
+	return bFoundIntersection;
 }
 
-BVHAcceleration::~BVHAcceleration()
+bool BVHAcceleration::OccludedLeaf(const Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes) const
 {
-	delete[] m_pFlatTree;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		return m_TrianglePacks.Occluded(PackRay, iStart, nShapes, Ray.MaxT);
+	}
+
+	for (uint32_t i = 0; i < nShapes; i++)
+	{
+		float U, V, T;
+		uint32_t iShape = iStart + i;
+		bool bHit = (m_pInlineTriangles != nullptr) ?
+			m_pInlineTriangles[iShape].RayIntersect(Ray, U, V, T) :
+			m_pShapes[iShape]->RayIntersect(Ray, U, V, T);
+		if (bHit)
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
-void BVHAcceleration::Build()
+bool BVHAcceleration::RayIntersectStackless(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
 {
-	Timer BVHBuildTimer;
+	// Shadow rays do not need the nearest intersection
+	if (bShadowRay)
+	{
+		return OccludedStackless(Ray);
+	}
 
-	const uint32_t STACK_MAX_SIZE = 1024;
-	const uint32_t UNTOUCHED = 0xffffffff;
-	const uint32_t TOUCHED_TWICE = 0xfffffffd;
-	BVHBuildEntry Stack[STACK_MAX_SIZE];
-	uint32_t iStackPtr = 0;
+	enum class ETraversalState
+	{
+		EFromParent,
+		EFromSibling,
+		EFromChild
+	};
 
-	// Push the root node
-	Stack[iStackPtr].iStart = 0;
-	Stack[iStackPtr].iEnd = uint32_t(m_pShapes.size());
-	Stack[iStackPtr].iParent = 0xfffffffc;
-	iStackPtr++;
+	bool bFoundIntersection = false;
+	TraversalCounter Counter(false);
 
-	std::vector<BVHFlatNode> BuildNodes;
-	BuildNodes.reserve(m_pShapes.size() * 2);
+	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
 
-	while (iStackPtr > 0)
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
 	{
-		const BVHBuildEntry & BuildEntry = (Stack[--iStackPtr]);
-		uint32_t iStart = BuildEntry.iStart;
-		uint32_t iEnd = BuildEntry.iEnd;
-		uint32_t nShapes = iEnd - iStart;
-
-		m_nNodes++;
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
 
-		BVHFlatNode FlatNode;
-		FlatNode.iStart = iStart;
-		FlatNode.nShapes = nShapes;
-		FlatNode.nRightChildOffset = UNTOUCHED;
+	uint32_t iCurrent = 0;
+	ETraversalState State = ETraversalState::EFromChild;
 
-		// Calculate the bounding box for this node
-		BoundingBox3f BBox = m_pShapes[iStart]->GetBoundingBox();
-		BoundingBox3f Centroid = m_pShapes[iStart]->GetCentroid();
+	if (m_pFlatTree[0].nRightChildOffset == 0)
+	{
+		Counter.nTriangleTests += m_pFlatTree[0].nShapes;
+		bFoundIntersection = IntersectLeaf(RayCopy, PackRay, m_pFlatTree[0].iStart, m_pFlatTree[0].nShapes, Isect);
+	}
+	else
+	{
+		iCurrent = GetNearChild(0, RayCopy.Direction);
+		State = ETraversalState::EFromParent;
+	}
 
-		for (uint32_t i = iStart + 1; i < iEnd; i++)
+	while (iCurrent != 0 || State != ETraversalState::EFromChild)
+	{
+		if (State == ETraversalState::EFromChild)
 		{
-			BBox.ExpandBy(m_pShapes[i]->GetBoundingBox());
-			Centroid.ExpandBy(m_pShapes[i]->GetCentroid());
+			// Coming back from the near child -> Visit the far one, otherwise go up
+			uint32_t iParent = m_ParentIndices[iCurrent];
+			uint32_t iNear = GetNearChild(iParent, RayCopy.Direction);
+			if (iCurrent == iNear)
+			{
+				iCurrent = (iNear == iParent + 1) ? iParent + m_pFlatTree[iParent].nRightChildOffset : iParent + 1;
+				State = ETraversalState::EFromSibling;
+			}
+			else
+			{
+				iCurrent = iParent;
+			}
+			continue;
 		}
 
-		FlatNode.BBox = BBox;
+		const BVHFlatNode & CurrentFlatNode = m_pFlatTree[iCurrent];
+		Counter.nNodes++;
+		Counter.nBoxTests++;
 
-		// If the number of shapes at this point is less than the leaf
-		// size, then this will become a leaf. (Signified by rightOffset == 0)
-		if (nShapes <= m_LeafSize)
+		float NearT, FarT;
+		bool bHit = CurrentFlatNode.BBox.RayIntersect(RayCopy, NearT, FarT);
+
+		// Hit interior node -> Go down to its near child
+		if (bHit && CurrentFlatNode.nRightChildOffset != 0)
 		{
-			FlatNode.nRightChildOffset = 0;
-			m_nLeafs++;
+			iCurrent = GetNearChild(iCurrent, RayCopy.Direction);
+			State = ETraversalState::EFromParent;
+			continue;
 		}
 
-		BuildNodes.push_back(FlatNode);
-
-		// Child touches parent
-		// Special case: Don't do this for the root.
-		if (BuildEntry.iParent != 0xfffffffc)
+		if (bHit)
 		{
-			BuildNodes[BuildEntry.iParent].nRightChildOffset--;
-
-			// When this is the second touch, this is the right child.
-			// The right child sets up the offset for the flat tree.
-			if (BuildNodes[BuildEntry.iParent].nRightChildOffset == TOUCHED_TWICE)
-			{
-				BuildNodes[BuildEntry.iParent].nRightChildOffset = m_nNodes - 1 - BuildEntry.iParent;
-			}
+			Counter.nTriangleTests += CurrentFlatNode.nShapes;
+			bFoundIntersection |= IntersectLeaf(RayCopy, PackRay, CurrentFlatNode.iStart, CurrentFlatNode.nShapes, Isect);
 		}
 
-		// If this is a leaf, no need to subdivide.
-		if (FlatNode.nRightChildOffset == 0)
+		// Done with the node -> Visit its sibling if it is the near child, otherwise go up
+		uint32_t iParent = m_ParentIndices[iCurrent];
+		if (State == ETraversalState::EFromParent)
 		{
-			continue;
+			iCurrent = (iCurrent == iParent + 1) ? iParent + m_pFlatTree[iParent].nRightChildOffset : iParent + 1;
+			State = ETraversalState::EFromSibling;
+		}
+		else
+		{
+			iCurrent = iParent;
+			State = ETraversalState::EFromChild;
 		}
+	}
 
-		// Set the split dimensions
-		uint32_t SplitDim = Centroid.GetMajorAxis();
-		uint32_t iMid = iStart;
+	if (bFoundIntersection)
+	{
+		Isect.pShape->PostIntersect(Isect);
+		Isect.ComputeScreenSpacePartial(Ray);
+	}
 
-		if (m_SplitMethod == XML_ACCELERATION_BVH_SPLIT_METHOD_CENTER)
-		{
-			// Split on the center of the longest axis
-			float SplitCoord = 0.5f * (Centroid.Min[SplitDim] + Centroid.Max[SplitDim]);
+	return bFoundIntersection;
+}
 
-			// Partition the list of objects on this split
-			// Fix bug: Originally 'i' starts from 'iStart + 1'.  
-			// When 'm_pShapes[iStart]->GetCentroid()[SplitDim] < SplitCoord',
-			// a wrong result would be obtained. (Although it make no 
-			// difference to the final render result.) 
-			for (uint32_t i = iStart; i < iEnd; i++)
-			{
-				if (m_pShapes[i]->GetCentroid()[SplitDim] < SplitCoord)
-				{
-					std::swap(m_pShapes[i], m_pShapes[iMid]);
-					iMid++;
-				}
-			}
+bool BVHAcceleration::OccludedStackless(const Ray3f & Ray) const
+{
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
 
-			// If we get a bad split, just choose the center...
-			if (iMid == iStart || iMid == iEnd)
-			{
-				iMid = iStart + (iEnd - iStart) / 2;
-			}
-		}
-		else if (m_SplitMethod == XML_ACCELERATION_BVH_SPLIT_METHOD_SAH)
-		{
-			constexpr uint32_t BUCKET_NUM = 12;
-			BVHBucket Buckets[BUCKET_NUM];
+	TraversalCounter Counter(true);
 
-			float InvNorm = 1.0f / (Centroid.Max[SplitDim] - Centroid.Min[SplitDim]);
-			float InvSurfaceArea = 1.0f / BBox.GetSurfaceArea();
+	// The children are visited left first, the traversal ends when coming back to the root
+	uint32_t iCurrent = 0;
+	bool bFromChild = false;
 
-			// Divide the bounding box into several buckets
-			for (uint32_t i = iStart; i < iEnd; i++)
+	do
+	{
+		if (bFromChild)
+		{
+			// Coming back from the left child -> Visit the right one, otherwise go up
+			uint32_t iParent = m_ParentIndices[iCurrent];
+			if (iCurrent == iParent + 1)
 			{
-				uint32_t BucketIdx = uint32_t((BUCKET_NUM - 1) * (m_pShapes[i]->GetCentroid()[SplitDim] - Centroid.Min[SplitDim]) * InvNorm);
-				CHECK(BucketIdx >= 0 && BucketIdx < BUCKET_NUM);
-
-				Buckets[BucketIdx].nShape++;
-				if (Buckets[BucketIdx].BBox.IsValid())
-				{
-					Buckets[BucketIdx].BBox.ExpandBy(m_pShapes[i]->GetBoundingBox());
-				}
-				else
-				{
-					Buckets[BucketIdx].BBox = m_pShapes[i]->GetBoundingBox();
-				}
+				iCurrent = iParent + m_pFlatTree[iParent].nRightChildOffset;
+				bFromChild = false;
 			}
-			
-			// Compute the cost
-			float Cost[BUCKET_NUM - 1];
-			for (uint32_t i = 0; i < BUCKET_NUM - 1; i++)
+			else
 			{
-				BoundingBox3f LeftBox, RightBox;
-				uint32_t nLeftShapes = 0, nRightShapes = 0;
-
-				// Left
-				LeftBox = Buckets[0].BBox;
-				for (uint32_t j = 0; j <= i; j++)
-				{
-					LeftBox.ExpandBy(Buckets[j].BBox);
-					nLeftShapes += Buckets[j].nShape;
-				}
-
-				// Right
-				RightBox = Buckets[i + 1].BBox;
-				for (uint32_t j = i + 1; j <= BUCKET_NUM - 1; j++)
-				{
-					RightBox.ExpandBy(Buckets[j].BBox);
-					nRightShapes += Buckets[j].nShape;
-				}
-
-				Cost[i] = 0.125f + (
-					LeftBox.GetSurfaceArea() * nLeftShapes + 
-					RightBox.GetSurfaceArea() * nRightShapes
-					) * InvSurfaceArea;
+				iCurrent = iParent;
 			}
+			continue;
+		}
 
-			// Find bucket whose cost is minimal
-			float MinCost = Cost[0];
-			uint32_t iMinCostSplitBucket = 0;
-			for (uint32_t i = 0; i < BUCKET_NUM - 1; i++)
+		const BVHFlatNode & CurrentFlatNode = m_pFlatTree[iCurrent];
+		Counter.nNodes++;
+		Counter.nBoxTests++;
+		if (CurrentFlatNode.BBox.RayIntersect(Ray))
+		{
+			// Interior node -> Go down to the left child
+			if (CurrentFlatNode.nRightChildOffset != 0)
 			{
-				if (Cost[i] < MinCost)
-				{
-					MinCost = Cost[i];
-					iMinCostSplitBucket = i;
-				}
+				iCurrent++;
+				continue;
 			}
 
-			// Split nodes
-			auto iIterMid = std::partition(
-				m_pShapes.begin() + iStart,
-				m_pShapes.begin() + iEnd,
-				[=](const Shape * pShape)
-				{
-					uint32_t BucketIdx = uint32_t((BUCKET_NUM - 1) * (pShape->GetCentroid()[SplitDim] - Centroid.Min[SplitDim]) * InvNorm);
-					CHECK(BucketIdx >= 0 && BucketIdx < BUCKET_NUM);
-					return BucketIdx <= iMinCostSplitBucket;
-				}
-			);
-			iMid = uint32_t(iIterMid - m_pShapes.begin());
+			// Leaf node -> Any intersection terminates the query
+			Counter.nTriangleTests += CurrentFlatNode.nShapes;
+			if (OccludedLeaf(Ray, PackRay, CurrentFlatNode.iStart, CurrentFlatNode.nShapes))
+			{
+				return true;
+			}
 		}
 
-		// Right child pushed
-		Stack[iStackPtr].iStart = iMid;
-		Stack[iStackPtr].iEnd = iEnd;
-		Stack[iStackPtr].iParent = m_nNodes - 1;
-		iStackPtr++;
-
-		// Left child pushed
-		Stack[iStackPtr].iStart = iStart;
-		Stack[iStackPtr].iEnd = iMid;
-		Stack[iStackPtr].iParent = m_nNodes - 1;
-		iStackPtr++;
-	}
-
-	m_pFlatTree = new BVHFlatNode[m_nNodes];
-	memcpy(m_pFlatTree, BuildNodes.data(), m_nNodes * sizeof(BVHFlatNode));
+		bFromChild = true;
+	} while (iCurrent != 0);
 
-	LOG(INFO) << "Build BVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) in " << 
-		BVHBuildTimer.ElapsedString() << " and take " << MemString(m_nNodes * sizeof(BVHFlatNode)) << ".";
+	return false;
 }
 
-bool BVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
+bool BVHAcceleration::RayIntersectCompressed(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
 {
-	bool bFoundIntersection = false;       // Was an intersection found so far?
-	Shape * pFoundShape = nullptr;
+	// Shadow rays do not need the nearest intersection
+	if (bShadowRay)
+	{
+		return OccludedCompressed(Ray);
+	}
+
+	bool bFoundIntersection = false;
+	TraversalCounter Counter(false);
 
 	const uint32_t STACK_MAX_SIZE = 1024;
 	BVHTraversal Stack[STACK_MAX_SIZE];
 	uint32_t iStackPtr = 0;
 
-	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
+	Ray3f RayCopy(Ray);
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
 
 	// Push the root node
-	Stack[iStackPtr].Idx = 0;
-	Stack[iStackPtr].MinT = -std::numeric_limits<float>::max();
-	iStackPtr++;
+	Stack[iStackPtr++] = BVHTraversal(0, -std::numeric_limits<float>::max());
 
 	while (iStackPtr > 0)
 	{
-		// Pop the next node
 		BVHTraversal TopNode = Stack[--iStackPtr];
-		uint32_t Idx = TopNode.Idx;
-		float MinT = TopNode.MinT;
-
-		BVHFlatNode CurrentFlatNode = m_pFlatTree[Idx];
 
 		// If the node is further than the cloest found intersection, continue
-		if (MinT > Isect.T)
+		if (TopNode.MinT > Isect.T)
 		{
 			continue;
 		}
 
-		// Leaf node -> Check intersection
-		if (CurrentFlatNode.nRightChildOffset == 0)
+		const BVHQuantizedNode & Node = m_pQuantizedTree[TopNode.Idx];
+		Counter.nNodes++;
+		Counter.nBoxTests += 2;
+
+		float NearT[2], FarT;
+		bool bHit[2];
+		for (uint32_t k = 0; k < 2; k++)
 		{
-			for (uint32_t i = 0; i < CurrentFlatNode.nShapes; i++)
-			{
-				float U, V, T;
-				Shape * pShape =  m_pShapes[CurrentFlatNode.iStart + i];
-				if (pShape->RayIntersect(RayCopy, U, V, T))
-				{
-					if (bShadowRay)
-					{
-						return true;
-					}
+			bHit[k] = (Node.iChild[k] != BVH_QUANTIZED_EMPTY_CHILD) && GetChildBoundingBox(Node, k).RayIntersect(RayCopy, NearT[k], FarT);
+		}
 
-					RayCopy.MaxT = Isect.T = T;
-					Isect.UV = Point2f(U, V);
-					Isect.pShape = pShape;
+		uint32_t iNear = (bHit[1] && (!bHit[0] || NearT[1] < NearT[0])) ? 1 : 0;
+		uint32_t iFar = 1 - iNear;
 
-					pFoundShape = pShape;
-					bFoundIntersection = true;
-				}
+		// The leaf children are tested right away (the near one first)
+		for (uint32_t k : { iNear, iFar })
+		{
+			if (bHit[k] && (Node.iChild[k] & BVH_QUANTIZED_LEAF_FLAG) != 0 && NearT[k] <= RayCopy.MaxT)
+			{
+				Counter.nTriangleTests += Node.nShapes[k];
+				bFoundIntersection |= IntersectCompressedLeaf(RayCopy, PackRay, Node.iChild[k] & ~BVH_QUANTIZED_LEAF_FLAG, Node.nShapes[k], Isect);
 			}
 		}
-		// Not a leaf
-		else
+
+		// Push the farther interior child first and then the near one
+		for (uint32_t k : { iFar, iNear })
 		{
-			float HitLeftNearT, HitLeftFarT;
-			float HitRightNearT, HitRightFarT;
-			uint32_t iNearNode, iFarNode;
-			float HitNearNodeNearT, HitFarNodeNearT;
+			if (bHit[k] && (Node.iChild[k] & BVH_QUANTIZED_LEAF_FLAG) == 0)
+			{
+				Stack[iStackPtr++] = BVHTraversal(Node.iChild[k], NearT[k]);
+			}
+		}
+	}
 
-			uint32_t iLeftNode = Idx + 1;
-			uint32_t iRightNode = Idx + CurrentFlatNode.nRightChildOffset;
+	if (bFoundIntersection)
+	{
+		Isect.pShape->PostIntersect(Isect);
+		Isect.ComputeScreenSpacePartial(Ray);
+	}
 
-			const BVHFlatNode & LeftFlatNode = m_pFlatTree[iLeftNode];
-			const BVHFlatNode & RightFlatNode = m_pFlatTree[iRightNode];
-			
-			bool bHitLeft = LeftFlatNode.BBox.RayIntersect(RayCopy, HitLeftNearT, HitLeftFarT);
-			bool bHitRight = RightFlatNode.BBox.RayIntersect(RayCopy, HitRightNearT, HitRightFarT);
+	return bFoundIntersection;
+}
 
-			if (bHitLeft && bHitRight)
-			{
-				if (HitRightNearT < HitLeftNearT)
-				{
-					iNearNode = iRightNode;
-					iFarNode = iLeftNode;
-					HitNearNodeNearT = HitRightNearT;
-					HitFarNodeNearT = HitLeftNearT;
-				}
-				else
-				{
-					iNearNode = iLeftNode;
-					iFarNode = iRightNode;
-					HitNearNodeNearT = HitLeftNearT;
-					HitFarNodeNearT = HitRightNearT;
-				}
+bool BVHAcceleration::OccludedCompressed(const Ray3f & Ray) const
+{
+	TraversalCounter Counter(true);
 
-				// Push the farther first and then the near one
-				Stack[iStackPtr++] = BVHTraversal(iFarNode, HitFarNodeNearT);
-				Stack[iStackPtr++] = BVHTraversal(iNearNode, HitNearNodeNearT);
+	const uint32_t STACK_MAX_SIZE = 1024;
+	uint32_t Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	// Push the root node
+	Stack[iStackPtr++] = 0;
+
+	while (iStackPtr > 0)
+	{
+		const BVHQuantizedNode & Node = m_pQuantizedTree[Stack[--iStackPtr]];
+		Counter.nNodes++;
+		Counter.nBoxTests += 2;
+
+		// Visit the children in any order, any intersection terminates the query
+		for (uint32_t k = 0; k < 2; k++)
+		{
+			if (Node.iChild[k] == BVH_QUANTIZED_EMPTY_CHILD || !GetChildBoundingBox(Node, k).RayIntersect(Ray))
+			{
+				continue;
 			}
-			else if (bHitLeft)
+
+			if ((Node.iChild[k] & BVH_QUANTIZED_LEAF_FLAG) != 0)
 			{
-				Stack[iStackPtr++] = BVHTraversal(iLeftNode, HitLeftNearT);
+				Counter.nTriangleTests += Node.nShapes[k];
+				if (OccludedCompressedLeaf(Ray, PackRay, Node.iChild[k] & ~BVH_QUANTIZED_LEAF_FLAG, Node.nShapes[k]))
+				{
+					return true;
+				}
 			}
-			else if (bHitRight)
+			else
 			{
-				Stack[iStackPtr++] = BVHTraversal(iRightNode, HitRightNearT);
+				Stack[iStackPtr++] = Node.iChild[k];
 			}
 		}
 	}
 
-	if (bFoundIntersection)
+	return false;
+}
+
+bool BVHAcceleration::IntersectCompressedLeaf(Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes, Intersection & Isect) const
+{
+	bool bFoundIntersection = false;
+
+	if (m_TrianglePacks.IsBuilt())
 	{
-		pFoundShape->PostIntersect(Isect);
-		Isect.ComputeScreenSpacePartial(Ray);
+		float U, V, T;
+		uint32_t iShape;
+		if (m_TrianglePacks.RayIntersect(PackRay, iStart, nShapes, Ray.MaxT, iShape, U, V, T))
+		{
+			Ray.MaxT = Isect.T = T;
+			Isect.UV = Point2f(U, V);
+			Isect.pShape = GetPrimitive(m_PrimitiveIndices[iShape]);
+			bFoundIntersection = true;
+		}
+		return bFoundIntersection;
+	}
+
+	for (uint32_t i = 0; i < nShapes; i++)
+	{
+		float U, V, T;
+		uint32_t iShape = iStart + i;
+		uint32_t iPrimitive = m_PrimitiveIndices[iShape];
+		bool bHit;
+		if (m_pInlineTriangles != nullptr)
+		{
+			bHit = m_pInlineTriangles[iShape].RayIntersect(Ray, U, V, T);
+		}
+		else
+		{
+			uint32_t iMesh = FindPrimitiveMesh(iPrimitive);
+			bHit = m_pPrimitiveMeshes[iMesh]->RayIntersect(iPrimitive - m_iMeshFirstPrimitives[iMesh], Ray, U, V, T);
+		}
+
+		if (bHit)
+		{
+			Ray.MaxT = Isect.T = T;
+			Isect.UV = Point2f(U, V);
+			Isect.pShape = GetPrimitive(iPrimitive);
+			bFoundIntersection = true;
+		}
 	}
 
 	return bFoundIntersection;
 }
 
+bool BVHAcceleration::OccludedCompressedLeaf(const Ray3f & Ray, const TrianglePackArray::RayData & PackRay, uint32_t iStart, uint32_t nShapes) const
+{
+	if (m_TrianglePacks.IsBuilt())
+	{
+		return m_TrianglePacks.Occluded(PackRay, iStart, nShapes, Ray.MaxT);
+	}
+
+	for (uint32_t i = 0; i < nShapes; i++)
+	{
+		float U, V, T;
+		uint32_t iShape = iStart + i;
+		bool bHit;
+		if (m_pInlineTriangles != nullptr)
+		{
+			bHit = m_pInlineTriangles[iShape].RayIntersect(Ray, U, V, T);
+		}
+		else
+		{
+			uint32_t iPrimitive = m_PrimitiveIndices[iShape];
+			uint32_t iMesh = FindPrimitiveMesh(iPrimitive);
+			bHit = m_pPrimitiveMeshes[iMesh]->RayIntersect(iPrimitive - m_iMeshFirstPrimitives[iMesh], Ray, U, V, T);
+		}
+
+		if (bHit)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
 std::string BVHAcceleration::ToString() const
 {
 	return tfm::format(
@@ -367,12 +2337,60 @@ std::string BVHAcceleration::ToString() const
 		"  node = %s,\n"
 		"  leafNode = %f\n"
 		"  splitMethod = %s\n"
+		"  duplicationBudget = %f\n"
+		"  inlineTriangle = %s\n"
+		"  trianglePack = %s\n"
+		"  watertight = %s\n"
+		"  cacheDirectory = %s\n"
+		"  rebuildThreshold = %f\n"
+		"  compressed = %s\n"
+		"  traversal = %s\n"
 		"]",
 		m_LeafSize,
 		m_nNodes,
 		m_nLeafs,
-		m_SplitMethod
+		m_SplitMethod,
+		m_DuplicationBudget,
+		m_bInlineTriangle ? "true" : "false",
+		m_TrianglePack,
+		m_bWatertight ? "true" : "false",
+		m_CacheDirectory.empty() ? "none" : m_CacheDirectory,
+		m_RebuildThreshold,
+		m_bCompressed ? "true" : "false",
+		m_Traversal
 	);
 }
 
+void BVHAcceleration::FlattenBVHTree(const BVHBinnedNode * pNode, uint32_t iOffset)
+{
+	// The left child directly follows its parent, the right one follows the whole left subtree
+	BVHFlatNode & FlatNode = m_pFlatTree[iOffset];
+	FlatNode.BBox = pNode->BBox;
+	FlatNode.iStart = pNode->iStart;
+	FlatNode.nShapes = pNode->nShapes;
+
+	if (pNode->pChildren[0] == nullptr)
+	{
+		FlatNode.nRightChildOffset = 0;
+		return;
+	}
+
+	const BVHBinnedNode * pLeft = pNode->pChildren[0];
+	const BVHBinnedNode * pRight = pNode->pChildren[1];
+	FlatNode.nRightChildOffset = 1 + pLeft->nNodes;
+
+	if (pNode->nNodes > BVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { FlattenBVHTree(pLeft, iOffset + 1); },
+			[&]() { FlattenBVHTree(pRight, iOffset + 1 + pLeft->nNodes); }
+		);
+	}
+	else
+	{
+		FlattenBVHTree(pLeft, iOffset + 1);
+		FlattenBVHTree(pRight, iOffset + 1 + pLeft->nNodes);
+	}
+}
+
 NAMESPACE_END
@@ -2,6 +2,8 @@
 #include <core\Timer.hpp>
 #include <core\Shape.hpp>
 #include <tbb\tbb.h>
+#include <array>
+#include <functional>
 
 NAMESPACE_BEGIN
 
@@ -20,10 +22,13 @@ struct BVHBuildNode
 	uint32_t iSplitAxis = 0;
 	uint32_t nFirstShapeOffset = 0;
 	uint32_t nShape = 0;
+	uint32_t nNodes = 1; // Number of nodes in the subtree
+	float Cost = 0.0f; // SAH cost of the subtree (not normalized by the surface area), used by treelet optimization
 
 	void InitLeaf(uint32_t iFirst, uint32_t N, const BoundingBox3f & B)
 	{
 		iSplitAxis = 3;
+		nNodes = 1;
 		nFirstShapeOffset = iFirst;
 		nShape = N;
 		BBox = B;
@@ -39,6 +44,7 @@ struct BVHBuildNode
 		BBox.ExpandBy(pRight->BBox);
 		nShape = 0;
 		nFirstShapeOffset = uint32_t(-1);
+		nNodes = 1 + pLeft->nNodes + pRight->nNodes;
 	}
 };
 
@@ -67,28 +73,255 @@ struct LinearBVHNode
 	uint32_t iAxis = 0;
 };
 
+/// Number of Morton codes counted and scattered by a single task of the radix sort
+constexpr uint32_t HLBVH_RADIX_SORT_BLOCK_SIZE = 16384;
+
+/// Ranges of treelets larger than this are split as separate tasks
+constexpr uint32_t HLBVH_PARALLEL_BUILD_THRESHOLD = 64;
+
+/// Subtrees larger than this are flattened as separate tasks
+constexpr uint32_t HLBVH_PARALLEL_FLATTEN_THRESHOLD = 4096;
+
+/// The children of the nodes above this depth are refitted as separate tasks
+constexpr uint32_t HLBVH_PARALLEL_REFIT_DEPTH = 8;
+
+/// Subtrees larger than this are optimized as separate tasks
+constexpr uint32_t HLBVH_PARALLEL_OPTIMIZE_THRESHOLD = 4096;
+
+/// Treelets are restructured by an exhaustive search over the subsets of their leaves
+constexpr uint32_t HLBVH_MIN_TREELET_SIZE = 3;
+constexpr uint32_t HLBVH_MAX_TREELET_SIZE = 8;
+
+/// Number of bottom-up optimization passes over the whole tree
+constexpr uint32_t HLBVH_TREELET_ROUNDS = 3;
+
+/// SAH cost of traversing an interior node relative to intersecting a shape
+constexpr float HLBVH_TRAVERSAL_COST = 0.125f;
+
 HLBVHAcceleration::HLBVHAcceleration(const PropertyList & PropList) :
 	Acceleration(PropList)
 {
 	m_LeafSize = uint32_t(PropList.GetInteger(XML_ACCELERATION_HLBVH_LEAF_SIZE, DEFAULT_ACCELERATION_HLBVH_LEAF_SIZE));
+	m_RebuildThreshold = PropList.GetFloat(XML_ACCELERATION_HLBVH_REBUILD_THRESHOLD, DEFAULT_ACCELERATION_HLBVH_REBUILD_THRESHOLD);
+	if (m_RebuildThreshold < 1.0f)
+	{
+		LOG(WARNING) << "Rebuild threshold should not be less than 1 but \"" << m_RebuildThreshold << "\" was given, use default rebuild threshold";
+		m_RebuildThreshold = DEFAULT_ACCELERATION_HLBVH_REBUILD_THRESHOLD;
+	}
+	m_TreeletSize = uint32_t(PropList.GetInteger(XML_ACCELERATION_HLBVH_TREELET_SIZE, DEFAULT_ACCELERATION_HLBVH_TREELET_SIZE));
+	if (m_TreeletSize != 0 && (m_TreeletSize < HLBVH_MIN_TREELET_SIZE || m_TreeletSize > HLBVH_MAX_TREELET_SIZE))
+	{
+		LOG(WARNING) << "Treelet size should be 0 or in [" << HLBVH_MIN_TREELET_SIZE << ", " << HLBVH_MAX_TREELET_SIZE << "] but \"" <<
+			m_TreeletSize << "\" was given, use default treelet size";
+		m_TreeletSize = DEFAULT_ACCELERATION_HLBVH_TREELET_SIZE;
+	}
+	m_bInlineTriangle = PropList.GetBoolean(XML_ACCELERATION_HLBVH_INLINE_TRIANGLE, DEFAULT_ACCELERATION_HLBVH_INLINE_TRIANGLE);
+	m_TrianglePack = uint32_t(PropList.GetInteger(XML_ACCELERATION_HLBVH_TRIANGLE_PACK, DEFAULT_ACCELERATION_HLBVH_TRIANGLE_PACK));
+	m_bWatertight = PropList.GetBoolean(XML_ACCELERATION_HLBVH_WATERTIGHT, DEFAULT_ACCELERATION_HLBVH_WATERTIGHT);
+	if (m_TrianglePack != 0 && m_TrianglePack != 4 && m_TrianglePack != 8)
+	{
+		LOG(WARNING) << "Triangle pack should be 0, 4 or 8 but \"" << m_TrianglePack << "\" was given, use default triangle pack";
+		m_TrianglePack = DEFAULT_ACCELERATION_HLBVH_TRIANGLE_PACK;
+	}
+	if (m_bWatertight && m_TrianglePack == 0)
+	{
+		LOG(WARNING) << "Watertight intersection requires triangle packs, use packs of 4";
+		m_TrianglePack = 4;
+	}
+	m_CacheDirectory = PropList.GetString(XML_ACCELERATION_HLBVH_CACHE_DIRECTORY, DEFAULT_ACCELERATION_HLBVH_CACHE_DIRECTORY);
+	if (!m_CacheDirectory.empty())
+	{
+		filesystem::path CachePath(m_CacheDirectory);
+		if (!CachePath.is_absolute())
+		{
+			CachePath = GetFileResolver()->resolve(m_CacheDirectory);
+		}
+		if (!CachePath.is_directory())
+		{
+			LOG(WARNING) << "Cache directory \"" << m_CacheDirectory << "\" does not exist, the HLBVH will not be cached";
+			m_CacheDirectory.clear();
+		}
+		else
+		{
+			m_CacheDirectory = CachePath.str();
+		}
+	}
 }
 
 HLBVHAcceleration::~HLBVHAcceleration()
 {
-	delete[] m_pNodes;
+	ReleaseLinearTree();
+	FreeAligned(m_pInlineTriangles);
 }
 
 void HLBVHAcceleration::Build()
 {
 	Timer HLBVHBuildTimer;
 
-	// Compute bounding box of all shapes centroids
-	BoundingBox3f BBox = m_pShapes[0]->GetBoundingBox();
-	for (uint32_t i = 1; i < m_pShapes.size(); i++)
+	uint64_t CacheKey = 0;
+	std::string CacheFilename;
+	if (!m_CacheDirectory.empty())
+	{
+		CacheKey = AccelerationCache::ComputeKey(m_pShapes, tfm::format("hlbvh leafSize=%d treeletSize=%d", m_LeafSize, m_TreeletSize));
+		CacheFilename = AccelerationCache::GetFilename(m_CacheDirectory, CacheKey);
+	}
+
+	if (!CacheFilename.empty() && m_Cache.Load(CacheFilename, CacheKey, uint32_t(sizeof(LinearBVHNode)), uint32_t(m_pShapes.size())))
+	{
+		// The nodes are used in place from the mapped file
+		m_pNodes = (LinearBVHNode*)(m_Cache.GetNodes());
+		m_nNodes = m_Cache.GetNodeCount();
+		m_nLeafs = m_Cache.GetLeafCount();
+		m_Cache.ReorderShapes(m_pShapes);
+
+		LOG(INFO) << "Load HLBVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) from cache \"" << CacheFilename <<
+			"\" in " << HLBVHBuildTimer.ElapsedString() << ".";
+	}
+	else
+	{
+		std::vector<Shape*> pOriginalShapes;
+		if (!CacheFilename.empty())
+		{
+			pOriginalShapes = m_pShapes;
+		}
+
+		BuildLinearTree();
+
+		LOG(INFO) << "Build HLBVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) in " << 
+			HLBVHBuildTimer.ElapsedString() << " and take " <<  MemString(m_nNodes * sizeof(LinearBVHNode)) << ".";
+
+		if (!CacheFilename.empty() && !AccelerationCache::Save(CacheFilename, CacheKey, m_pNodes,
+			uint32_t(sizeof(LinearBVHNode)), m_nNodes, m_nLeafs, pOriginalShapes, m_pShapes))
+		{
+			LOG(WARNING) << "Failed to write the HLBVH cache \"" << CacheFilename << "\"";
+		}
+	}
+
+	// The cost of the tree is the reference used to detect the degradation caused by refitting
+	m_BuildCost = ComputeNodeCost(0, 0, false);
+
+	BakeTriangles();
+}
+
+void HLBVHAcceleration::Refit()
+{
+	Timer RefitTimer;
+
+	float Cost = ComputeNodeCost(0, 0, true);
+
+	// The Morton order of the treelets is lost when the shapes move, rebuild the whole tree
+	bool bRebuild = Cost > m_RebuildThreshold * m_BuildCost;
+	if (bRebuild)
+	{
+		ReleaseLinearTree();
+		BuildLinearTree();
+		m_BuildCost = ComputeNodeCost(0, 0, false);
+	}
+
+	m_BBox = m_pNodes[0].BBox;
+
+	LOG(INFO) << "Refit HLBVH (" << m_nNodes << " nodes" << (bRebuild ? ", rebuilt" : "") << ") in " <<
+		RefitTimer.ElapsedString() << ".";
+
+	BakeTriangles();
+}
+
+void HLBVHAcceleration::ReleaseLinearTree()
+{
+	if (m_Cache.IsLoaded())
+	{
+		m_Cache.Release();
+	}
+	else
+	{
+		delete[] m_pNodes;
+	}
+	m_pNodes = nullptr;
+}
+
+void HLBVHAcceleration::BakeTriangles()
+{
+	if (m_TrianglePack != 0)
+	{
+		m_TrianglePacks.Build(m_pShapes, m_TrianglePack, m_bWatertight);
+	}
+	else if (m_bInlineTriangle)
+	{
+		FreeAligned(m_pInlineTriangles);
+		m_pInlineTriangles = BakeInlineTriangles(m_pShapes);
+	}
+}
+
+float HLBVHAcceleration::ComputeNodeCost(uint32_t iNode, uint32_t Depth, bool bRefit)
+{
+	LinearBVHNode & Node = m_pNodes[iNode];
+
+	// Leaf node -> The cost is the number of intersection tests
+	if (Node.nShape > 0)
+	{
+		if (bRefit)
+		{
+			Node.BBox.Reset();
+			for (uint32_t i = Node.nShapeOffset; i < Node.nShapeOffset + Node.nShape; i++)
+			{
+				Node.BBox.ExpandBy(m_pShapes[i]->GetBoundingBox());
+			}
+		}
+		return float(Node.nShape);
+	}
+
+	uint32_t iLeft = iNode + 1, iRight = Node.nRightChildOffset;
+	float LeftCost, RightCost;
+
+	if (Depth < HLBVH_PARALLEL_REFIT_DEPTH)
+	{
+		tbb::parallel_invoke(
+			[&]() { LeftCost = ComputeNodeCost(iLeft, Depth + 1, bRefit); },
+			[&]() { RightCost = ComputeNodeCost(iRight, Depth + 1, bRefit); }
+		);
+	}
+	else
+	{
+		LeftCost = ComputeNodeCost(iLeft, Depth + 1, bRefit);
+		RightCost = ComputeNodeCost(iRight, Depth + 1, bRefit);
+	}
+
+	const BoundingBox3f & LeftBBox = m_pNodes[iLeft].BBox;
+	const BoundingBox3f & RightBBox = m_pNodes[iRight].BBox;
+	if (bRefit)
 	{
-		BBox.ExpandBy(m_pShapes[i]->GetBoundingBox());
+		Node.BBox = BoundingBox3f::Merge(LeftBBox, RightBBox);
 	}
 
+	float SurfaceArea = Node.BBox.GetSurfaceArea();
+	if (SurfaceArea > 0.0f)
+	{
+		return HLBVH_TRAVERSAL_COST + (LeftBBox.GetSurfaceArea() * LeftCost + RightBBox.GetSurfaceArea() * RightCost) / SurfaceArea;
+	}
+	return HLBVH_TRAVERSAL_COST + LeftCost + RightCost;
+}
+
+void HLBVHAcceleration::BuildLinearTree()
+{
+	// Compute bounding box of all shapes
+	BoundingBox3f BBox = tbb::parallel_reduce(
+		tbb::blocked_range<uint32_t>(0, uint32_t(m_pShapes.size())),
+		BoundingBox3f(),
+		[&](const tbb::blocked_range<uint32_t> & Range, BoundingBox3f Bounds)
+		{
+			for (uint32_t i = Range.begin(); i < Range.end(); i++)
+			{
+				Bounds.ExpandBy(m_pShapes[i]->GetBoundingBox());
+			}
+			return Bounds;
+		},
+		[](BoundingBox3f Left, const BoundingBox3f & Right)
+		{
+			Left.ExpandBy(Right);
+			return Left;
+		}
+	);
+
 	// Compute Morton indices of shapes
 	Point3f BBoxExtents = BBox.GetExtents();
 	std::vector<MortonShape> MortonShapes(m_pShapes.size());
@@ -188,19 +421,32 @@ void HLBVHAcceleration::Build()
 		FinishedTreelets.push_back(Treelet.pNodes);
 	}
 
-	BVHBuildNode * pRoot = BuildUpperSAH(FinishedTreelets, 0, uint32_t(FinishedTreelets.size()));
+	// A binary tree over the treelets has one interior node less than treelets
+	uint32_t nUpperNodes = uint32_t(FinishedTreelets.size()) - 1;
+	BVHBuildNode * pUpperNodes = m_MemoryArena.Alloc<BVHBuildNode>(std::max(nUpperNodes, 1u), false);
+	BVHBuildNode * pRoot = BuildUpperSAH(FinishedTreelets, 0, uint32_t(FinishedTreelets.size()), pUpperNodes);
+	m_nNodes += nUpperNodes;
 
 	m_pShapes.swap(OrderedShapes);
 
-	uint32_t nOffset = 0;
+	// The treelets split at fixed bits of the Morton codes, recover the quality of a SAH tree by restructuring them
+	if (m_TreeletSize != 0)
+	{
+		Timer OptimizeTimer;
+		for (uint32_t i = 0; i < HLBVH_TREELET_ROUNDS; i++)
+		{
+			OptimizeTreelets(pRoot);
+		}
+
+		LOG(INFO) << "Optimize HLBVH treelets of " << m_TreeletSize << " leafs (SAH cost " <<
+			pRoot->Cost / pRoot->BBox.GetSurfaceArea() << ") in " << OptimizeTimer.ElapsedString() << ".";
+	}
+
 	m_pNodes = new LinearBVHNode[m_nNodes];
-	FlattenBVHTree(pRoot, &nOffset);
-	CHECK(m_nNodes == nOffset);
+	CHECK(m_nNodes == pRoot->nNodes);
+	FlattenBVHTree(pRoot, 0);
 
 	m_MemoryArena.Release();
-
-	LOG(INFO) << "Build HLBVH (" << m_nNodes << " nodes, with " << m_nLeafs << " leafs) in " << 
-		HLBVHBuildTimer.ElapsedString() << " and take " <<  MemString(m_nNodes * sizeof(LinearBVHNode)) << ".";
 }
 
 bool HLBVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
@@ -212,28 +458,41 @@ bool HLBVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bo
 
 	bool bFoundIntersection = false;       // Was an intersection found so far?
 	Shape * pFoundShape = nullptr;
+	TraversalCounter Counter(bShadowRay);
 	
 	Ray3f RayCopy(Ray);
 	bool bDirNeg[3] = { RayCopy.DirectionReciprocal.x() < 0, RayCopy.DirectionReciprocal.y() < 0, RayCopy.DirectionReciprocal.z() < 0 };
 
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
 	uint32_t nToVisitOffset = 0, iCurrentNodeIndex = 0;
 	uint32_t iNodesToVisit[1024];
 
 	while (true)
 	{
 		const LinearBVHNode * pLinearNode = &m_pNodes[iCurrentNodeIndex];
+		Counter.nNodes++;
+		Counter.nBoxTests++;
 
 		if (pLinearNode->BBox.RayIntersect(RayCopy))
 		{
 			// Leaf node
 			if (pLinearNode->nShape > 0)
 			{
-				for (uint32_t i = 0; i < pLinearNode->nShape; i++)
+				Counter.nTriangleTests += pLinearNode->nShape;
+
+				if (m_TrianglePacks.IsBuilt())
 				{
 					float U, V, T;
-					Shape * pShape = m_pShapes[pLinearNode->nShapeOffset + i];
-					if (pShape->RayIntersect(RayCopy, U, V, T))
+					uint32_t iShape;
+					if (m_TrianglePacks.RayIntersect(PackRay, pLinearNode->nShapeOffset, pLinearNode->nShape, RayCopy.MaxT, iShape, U, V, T))
 					{
+						Shape * pShape = m_pShapes[iShape];
+
 						if (bShadowRay)
 						{
 							return true;
@@ -247,6 +506,33 @@ bool HLBVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bo
 						bFoundIntersection = true;
 					}
 				}
+				else
+				{
+					for (uint32_t i = 0; i < pLinearNode->nShape; i++)
+					{
+						float U, V, T;
+						uint32_t iShape = pLinearNode->nShapeOffset + i;
+						bool bHit = (m_pInlineTriangles != nullptr) ?
+							m_pInlineTriangles[iShape].RayIntersect(RayCopy, U, V, T) :
+							m_pShapes[iShape]->RayIntersect(RayCopy, U, V, T);
+						if (bHit)
+						{
+							Shape * pShape = m_pShapes[iShape];
+
+							if (bShadowRay)
+							{
+								return true;
+							}
+
+							RayCopy.MaxT = Isect.T = T;
+							Isect.UV = Point2f(U, V);
+							Isect.pShape = pShape;
+
+							pFoundShape = pShape;
+							bFoundIntersection = true;
+						}
+					}
+				}
 
 				if (nToVisitOffset == 0)
 				{
@@ -289,15 +575,108 @@ bool HLBVHAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bo
 	return bFoundIntersection;
 }
 
+bool HLBVHAcceleration::Occluded(const Ray3f & Ray) const
+{
+	if (m_pNodes == nullptr)
+	{
+		return false;
+	}
+
+	TraversalCounter Counter(true);
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	uint32_t nToVisitOffset = 0, iCurrentNodeIndex = 0;
+	uint32_t iNodesToVisit[1024];
+
+	while (true)
+	{
+		const LinearBVHNode * pLinearNode = &m_pNodes[iCurrentNodeIndex];
+		Counter.nNodes++;
+		Counter.nBoxTests++;
+
+		if (pLinearNode->BBox.RayIntersect(Ray))
+		{
+			// Leaf node -> Any intersection terminates the query
+			if (pLinearNode->nShape > 0)
+			{
+				Counter.nTriangleTests += pLinearNode->nShape;
+
+				if (m_TrianglePacks.IsBuilt())
+				{
+					if (m_TrianglePacks.Occluded(PackRay, pLinearNode->nShapeOffset, pLinearNode->nShape, Ray.MaxT))
+					{
+						return true;
+					}
+				}
+				else
+				{
+					for (uint32_t i = 0; i < pLinearNode->nShape; i++)
+					{
+						float U, V, T;
+						uint32_t iShape = pLinearNode->nShapeOffset + i;
+						bool bHit = (m_pInlineTriangles != nullptr) ?
+							m_pInlineTriangles[iShape].RayIntersect(Ray, U, V, T) :
+							m_pShapes[iShape]->RayIntersect(Ray, U, V, T);
+						if (bHit)
+						{
+							return true;
+						}
+					}
+				}
+
+				if (nToVisitOffset == 0)
+				{
+					break;
+				}
+
+				iCurrentNodeIndex = iNodesToVisit[--nToVisitOffset];
+			}
+			// Interior node -> Visit the children in any order
+			else
+			{
+				iNodesToVisit[nToVisitOffset++] = pLinearNode->nRightChildOffset;
+				iCurrentNodeIndex = iCurrentNodeIndex + 1;
+			}
+		}
+		else
+		{
+			if (nToVisitOffset == 0)
+			{
+				break;
+			}
+			iCurrentNodeIndex = iNodesToVisit[--nToVisitOffset];
+		}
+	}
+
+	return false;
+}
+
 std::string HLBVHAcceleration::ToString() const
 {
 	return tfm::format(
 		"HLBVHAcceleration[\n"
 		"  node = %s,\n"
 		"  leafNode = %f\n"
+		"  inlineTriangle = %s\n"
+		"  trianglePack = %s\n"
+		"  watertight = %s\n"
+		"  cacheDirectory = %s\n"
+		"  rebuildThreshold = %f\n"
+		"  treeletSize = %s\n"
 		"]",
 		m_nNodes,
-		m_nLeafs
+		m_nLeafs,
+		m_bInlineTriangle ? "true" : "false",
+		m_TrianglePack,
+		m_bWatertight ? "true" : "false",
+		m_CacheDirectory.empty() ? "none" : m_CacheDirectory,
+		m_RebuildThreshold,
+		m_TreeletSize
 	);
 }
 
@@ -333,14 +712,21 @@ uint32_t HLBVHAcceleration::EncodeMorton3(const Vector3f & Vec) const
 
 void HLBVHAcceleration::RadixSort(std::vector<MortonShape> & MortonShapes) const
 {
-	// TODO : Could be paralleled
-
 	std::vector<MortonShape> TempVector(MortonShapes.size());
 	constexpr int BIT_PER_PASS = 6;
 	constexpr int BITS = 30;
 	static_assert((BITS % BIT_PER_PASS) == 0, "Radix sort bitsPerPass must evenly divide nBits");
 
 	constexpr int nPasses = BITS / BIT_PER_PASS;
+	constexpr int BUCKET_NUM = 1 << BIT_PER_PASS;
+	constexpr int BIT_MASK = (1 << BIT_PER_PASS) - 1;
+
+	// Every block of shapes is counted and scattered by one task
+	const uint32_t nShapes = uint32_t(MortonShapes.size());
+	const uint32_t nBlocks = std::max((nShapes + HLBVH_RADIX_SORT_BLOCK_SIZE - 1) / HLBVH_RADIX_SORT_BLOCK_SIZE, 1u);
+	std::vector<std::array<uint32_t, BUCKET_NUM>> BlockOffsets(nBlocks);
+
+	tbb::blocked_range<uint32_t> BlockRange(0, nBlocks);
 
 	for (int Pass = 0; Pass < nPasses; ++Pass)
 	{
@@ -351,32 +737,63 @@ void HLBVHAcceleration::RadixSort(std::vector<MortonShape> & MortonShapes) const
 		std::vector<MortonShape> & In = (Pass & 1) ? TempVector : MortonShapes;
 		std::vector<MortonShape> & Out = (Pass & 1) ? MortonShapes : TempVector;
 
-		// Count number of zero bits in array for current radix sort bit
-		constexpr int BUCKET_NUM = 1 << BIT_PER_PASS;
-		int BucketCount[BUCKET_NUM] = { 0 };
-		constexpr int BIT_MASK = (1 << BIT_PER_PASS) - 1;
-
-		for (const MortonShape & MortonShape : In)
+		// Count number of shapes of each bucket in every block
+		auto CountMap = [&](const tbb::blocked_range<uint32_t> & Range)
 		{
-			int BucketIdx = (MortonShape.MortonCode >> LowBit) & BIT_MASK;
-			CHECK(BucketIdx >= 0 && BucketIdx < BUCKET_NUM);
-			++BucketCount[BucketIdx];
-		}
+			for (uint32_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
+			{
+				std::array<uint32_t, BUCKET_NUM> & BucketCount = BlockOffsets[iBlock];
+				BucketCount.fill(0);
+
+				uint32_t iEnd = std::min((iBlock + 1) * HLBVH_RADIX_SORT_BLOCK_SIZE, nShapes);
+				for (uint32_t i = iBlock * HLBVH_RADIX_SORT_BLOCK_SIZE; i < iEnd; i++)
+				{
+					int BucketIdx = (In[i].MortonCode >> LowBit) & BIT_MASK;
+					++BucketCount[BucketIdx];
+				}
+			}
+		};
+
+		/// Uncomment the following line for single threaded counting
+		//CountMap(BlockRange);
+
+		/// Default: parallel counting
+		tbb::parallel_for(BlockRange, CountMap);
 
-		// Compute starting index in output array for each bucket
-		int OutIndex[BUCKET_NUM];
-		OutIndex[0] = 0;
-		for (int i = 1; i < BUCKET_NUM; ++i)
+		// Compute starting index in output array for each bucket of every block,
+		// blocks are scanned in order inside a bucket so that the sort remains stable
+		uint32_t OutIndex = 0;
+		for (int i = 0; i < BUCKET_NUM; ++i)
 		{
-			OutIndex[i] = OutIndex[i - 1] + BucketCount[i - 1];
+			for (uint32_t iBlock = 0; iBlock < nBlocks; iBlock++)
+			{
+				uint32_t BucketCount = BlockOffsets[iBlock][i];
+				BlockOffsets[iBlock][i] = OutIndex;
+				OutIndex += BucketCount;
+			}
 		}
 
 		// Store sorted values in output array
-		for (const MortonShape & MortonShape : In)
+		auto ScatterMap = [&](const tbb::blocked_range<uint32_t> & Range)
 		{
-			int BucketIdx = (MortonShape.MortonCode >> LowBit) & BIT_MASK;
-			Out[OutIndex[BucketIdx]++] = MortonShape;
-		}
+			for (uint32_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
+			{
+				std::array<uint32_t, BUCKET_NUM> & OutIndices = BlockOffsets[iBlock];
+
+				uint32_t iEnd = std::min((iBlock + 1) * HLBVH_RADIX_SORT_BLOCK_SIZE, nShapes);
+				for (uint32_t i = iBlock * HLBVH_RADIX_SORT_BLOCK_SIZE; i < iEnd; i++)
+				{
+					int BucketIdx = (In[i].MortonCode >> LowBit) & BIT_MASK;
+					Out[OutIndices[BucketIdx]++] = In[i];
+				}
+			}
+		};
+
+		/// Uncomment the following line for single threaded scattering
+		//ScatterMap(BlockRange);
+
+		/// Default: parallel scattering
+		tbb::parallel_for(BlockRange, ScatterMap);
 	}
 
 	// Copy final result from TempVector, if needed
@@ -499,7 +916,8 @@ BVHBuildNode * HLBVHAcceleration::EmitHLBVH(
 BVHBuildNode * HLBVHAcceleration::BuildUpperSAH(
 	std::vector<BVHBuildNode*> & TreeletRoots,
 	uint32_t iStart, 
-	uint32_t iEnd
+	uint32_t iEnd,
+	BVHBuildNode * pUpperNodes
 )
 {
 	CHECK(iStart < iEnd);
@@ -510,9 +928,10 @@ BVHBuildNode * HLBVHAcceleration::BuildUpperSAH(
 		return TreeletRoots[iStart];
 	}
 
-	m_nNodes++;
-
-	BVHBuildNode * pNode = m_MemoryArena.Alloc<BVHBuildNode>();
+	// The range owns nNodes - 1 interior nodes : this node first, then the
+	// nodes of the left subtree, then the nodes of the right subtree
+	BVHBuildNode * pNode = pUpperNodes;
+	BVHBuildNode * pChildren[2] = { nullptr, nullptr };
 
 	// Compute bounds of all nodes under this HLBVH node
 	BoundingBox3f BBox = TreeletRoots[iStart]->BBox;
@@ -534,11 +953,8 @@ BVHBuildNode * HLBVHAcceleration::BuildUpperSAH(
 		uint32_t iMid = (iStart + iEnd) / 2;
 		CHECK(iMid > iStart && iMid < iEnd);
 
-		pNode->InitInterior(
-			iSplitDim,
-			BuildUpperSAH(TreeletRoots, iStart, iMid),
-			BuildUpperSAH(TreeletRoots, iMid, iEnd)
-		);
+		BuildUpperSAHChildren(TreeletRoots, iStart, iMid, iEnd, pUpperNodes, pChildren);
+		pNode->InitInterior(iSplitDim, pChildren[0], pChildren[1]);
 
 		return pNode;
 	}
@@ -589,7 +1005,7 @@ BVHBuildNode * HLBVHAcceleration::BuildUpperSAH(
 			nRightShapes += Buckets[j].nShape;
 		}
 
-		Cost[i] = 0.125f + (
+		Cost[i] = HLBVH_TRAVERSAL_COST + (
 			LeftBox.GetSurfaceArea() * nLeftShapes +
 			RightBox.GetSurfaceArea() * nRightShapes
 			) * InvSurfaceArea;
@@ -621,23 +1037,196 @@ BVHBuildNode * HLBVHAcceleration::BuildUpperSAH(
 	uint32_t iMid = uint32_t(MidIter - &TreeletRoots[0]);
 	CHECK(iMid > iStart && iMid < iEnd);
 
-	pNode->InitInterior(
-		iSplitDim,
-		BuildUpperSAH(TreeletRoots, iStart, iMid),
-		BuildUpperSAH(TreeletRoots, iMid, iEnd)
-	);
+	BuildUpperSAHChildren(TreeletRoots, iStart, iMid, iEnd, pUpperNodes, pChildren);
+	pNode->InitInterior(iSplitDim, pChildren[0], pChildren[1]);
 
 	return pNode;
 }
 
-uint32_t HLBVHAcceleration::FlattenBVHTree(BVHBuildNode * pNode, uint32_t * pOffset)
+void HLBVHAcceleration::BuildUpperSAHChildren(
+	std::vector<BVHBuildNode*> & TreeletRoots,
+	uint32_t iStart,
+	uint32_t iMid,
+	uint32_t iEnd,
+	BVHBuildNode * pUpperNodes,
+	BVHBuildNode * pChildren[2]
+)
 {
-	CHECK(*pOffset < m_nNodes);
+	BVHBuildNode * pLeftNodes = pUpperNodes + 1;
+	BVHBuildNode * pRightNodes = pUpperNodes + (iMid - iStart);
 
-	LinearBVHNode * pLinearNode = &m_pNodes[*pOffset];
-	pLinearNode->BBox = pNode->BBox;
+	if (iEnd - iStart > HLBVH_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { pChildren[0] = BuildUpperSAH(TreeletRoots, iStart, iMid, pLeftNodes); },
+			[&]() { pChildren[1] = BuildUpperSAH(TreeletRoots, iMid, iEnd, pRightNodes); }
+		);
+	}
+	else
+	{
+		pChildren[0] = BuildUpperSAH(TreeletRoots, iStart, iMid, pLeftNodes);
+		pChildren[1] = BuildUpperSAH(TreeletRoots, iMid, iEnd, pRightNodes);
+	}
+}
+
+void HLBVHAcceleration::OptimizeTreelets(BVHBuildNode * pNode)
+{
+	// Leaf node -> The cost is the number of intersection tests
+	if (pNode->nShape > 0)
+	{
+		pNode->Cost = pNode->BBox.GetSurfaceArea() * pNode->nShape;
+		return;
+	}
+
+	// The children are optimized first, then the treelet rooted at this node
+	if (pNode->nNodes > HLBVH_PARALLEL_OPTIMIZE_THRESHOLD)
+	{
+		tbb::parallel_invoke(
+			[&]() { OptimizeTreelets(pNode->pChildren[0]); },
+			[&]() { OptimizeTreelets(pNode->pChildren[1]); }
+		);
+	}
+	else
+	{
+		OptimizeTreelets(pNode->pChildren[0]);
+		OptimizeTreelets(pNode->pChildren[1]);
+	}
+
+	pNode->Cost = HLBVH_TRAVERSAL_COST * pNode->BBox.GetSurfaceArea() + pNode->pChildren[0]->Cost + pNode->pChildren[1]->Cost;
+
+	uint32_t nLeafs = (pNode->nNodes + 1) / 2;
+	if (nLeafs >= m_TreeletSize)
+	{
+		RestructureTreelet(pNode);
+	}
+}
+
+void HLBVHAcceleration::RestructureTreelet(BVHBuildNode * pRoot)
+{
+	// Form the treelet by repeatedly opening the interior leaf with the largest surface area
+	BVHBuildNode * pLeaves[HLBVH_MAX_TREELET_SIZE];
+	BVHBuildNode * pInteriors[HLBVH_MAX_TREELET_SIZE - 1];
+	uint32_t nLeaves = 2, nInteriors = 1;
+	pInteriors[0] = pRoot;
+	pLeaves[0] = pRoot->pChildren[0];
+	pLeaves[1] = pRoot->pChildren[1];
+
+	while (nLeaves < m_TreeletSize)
+	{
+		int iBest = -1;
+		float BestArea = -1.0f;
+		for (uint32_t i = 0; i < nLeaves; i++)
+		{
+			if (pLeaves[i]->nShape == 0 && pLeaves[i]->BBox.GetSurfaceArea() > BestArea)
+			{
+				iBest = int(i);
+				BestArea = pLeaves[i]->BBox.GetSurfaceArea();
+			}
+		}
+
+		if (iBest == -1)
+		{
+			break;
+		}
+
+		BVHBuildNode * pNode = pLeaves[iBest];
+		pInteriors[nInteriors++] = pNode;
+		pLeaves[iBest] = pNode->pChildren[0];
+		pLeaves[nLeaves++] = pNode->pChildren[1];
+	}
+
+	// Find the optimal binary tree over every subset of the leaves, a subset is
+	// only made of smaller subsets so they are solved in increasing order
+	const uint32_t nSubsets = 1u << nLeaves;
+	BoundingBox3f BBoxes[1u << HLBVH_MAX_TREELET_SIZE];
+	float Costs[1u << HLBVH_MAX_TREELET_SIZE];
+	uint32_t Partitions[1u << HLBVH_MAX_TREELET_SIZE];
+
+	for (uint32_t iSubset = 1; iSubset < nSubsets; iSubset++)
+	{
+		uint32_t LowestBit = iSubset & (~iSubset + 1);
+		uint32_t iLeaf = 0;
+		while ((1u << iLeaf) != LowestBit)
+		{
+			iLeaf++;
+		}
+
+		// Single leaf
+		if (iSubset == LowestBit)
+		{
+			BBoxes[iSubset] = pLeaves[iLeaf]->BBox;
+			Costs[iSubset] = pLeaves[iLeaf]->Cost;
+			Partitions[iSubset] = 0;
+			continue;
+		}
+
+		BBoxes[iSubset] = BoundingBox3f::Merge(BBoxes[iSubset ^ LowestBit], pLeaves[iLeaf]->BBox);
+
+		// The lowest leaf always goes to the left side so that each partition is tried once
+		float BestCost = std::numeric_limits<float>::infinity();
+		uint32_t BestPartition = LowestBit;
+		for (uint32_t iLeft = (iSubset - 1) & iSubset; iLeft != 0; iLeft = (iLeft - 1) & iSubset)
+		{
+			if ((iLeft & LowestBit) != 0)
+			{
+				float Cost = Costs[iLeft] + Costs[iSubset ^ iLeft];
+				if (Cost < BestCost)
+				{
+					BestCost = Cost;
+					BestPartition = iLeft;
+				}
+			}
+		}
+
+		Costs[iSubset] = HLBVH_TRAVERSAL_COST * BBoxes[iSubset].GetSurfaceArea() + BestCost;
+		Partitions[iSubset] = BestPartition;
+	}
+
+	// Keep the treelet if the restructured one is not better
+	const uint32_t iAllLeaves = nSubsets - 1;
+	if (Costs[iAllLeaves] >= pRoot->Cost)
+	{
+		return;
+	}
+
+	// Rebuild the treelet reusing its interior nodes, the root stays in place
+	uint32_t iNextInterior = 0;
+	std::function<BVHBuildNode*(uint32_t)> EmitTreelet = [&](uint32_t iSubset) -> BVHBuildNode*
+	{
+		if (Partitions[iSubset] == 0)
+		{
+			uint32_t iLeaf = 0;
+			while ((1u << iLeaf) != iSubset)
+			{
+				iLeaf++;
+			}
+			return pLeaves[iLeaf];
+		}
+
+		BVHBuildNode * pNode = pInteriors[iNextInterior++];
+		BVHBuildNode * pLeft = EmitTreelet(Partitions[iSubset]);
+		BVHBuildNode * pRight = EmitTreelet(iSubset ^ Partitions[iSubset]);
+
+		// The split axis orders the children in the traversal
+		Vector3f Delta = pRight->BBox.GetCenter() - pLeft->BBox.GetCenter();
+		uint32_t iAxis = 0;
+		Delta.cwiseAbs().maxCoeff(&iAxis);
 
-	uint32_t Offset = (*pOffset)++;
+		pNode->InitInterior(iAxis, pLeft, pRight);
+		pNode->Cost = Costs[iSubset];
+		return pNode;
+	};
+
+	EmitTreelet(iAllLeaves);
+	CHECK(iNextInterior == nInteriors);
+}
+
+void HLBVHAcceleration::FlattenBVHTree(const BVHBuildNode * pNode, uint32_t iOffset)
+{
+	CHECK(iOffset < m_nNodes);
+
+	LinearBVHNode * pLinearNode = &m_pNodes[iOffset];
+	pLinearNode->BBox = pNode->BBox;
 
 	// Leaf node
 	if (pNode->nShape > 0)
@@ -651,16 +1240,29 @@ uint32_t HLBVHAcceleration::FlattenBVHTree(BVHBuildNode * pNode, uint32_t * pOff
 	// Interior node
 	else
 	{
+		const BVHBuildNode * pLeft = pNode->pChildren[0];
+		const BVHBuildNode * pRight = pNode->pChildren[1];
+
 		pLinearNode->iAxis = pNode->iSplitAxis;
 		pLinearNode->nShape = 0;
-		FlattenBVHTree(pNode->pChildren[0], pOffset);
-		pLinearNode->nRightChildOffset = FlattenBVHTree(pNode->pChildren[1], pOffset);
+		pLinearNode->nRightChildOffset = iOffset + 1 + pLeft->nNodes;
 
-		CHECK(pNode->BBox.IsValid() && pNode->pChildren[0]->BBox.IsValid() && pNode->pChildren[1]->BBox.IsValid());
-		CHECK(pNode->BBox.Contains(pNode->pChildren[0]->BBox) && pNode->BBox.Contains(pNode->pChildren[1]->BBox));
-	}
+		CHECK(pNode->BBox.IsValid() && pLeft->BBox.IsValid() && pRight->BBox.IsValid());
+		CHECK(pNode->BBox.Contains(pLeft->BBox) && pNode->BBox.Contains(pRight->BBox));
 
-	return Offset;
+		if (pNode->nNodes > HLBVH_PARALLEL_FLATTEN_THRESHOLD)
+		{
+			tbb::parallel_invoke(
+				[&]() { FlattenBVHTree(pLeft, iOffset + 1); },
+				[&]() { FlattenBVHTree(pRight, pLinearNode->nRightChildOffset); }
+			);
+		}
+		else
+		{
+			FlattenBVHTree(pLeft, iOffset + 1);
+			FlattenBVHTree(pRight, pLinearNode->nRightChildOffset);
+		}
+	}
 }
 
 NAMESPACE_END
\ No newline at end of file
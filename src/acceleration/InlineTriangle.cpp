@@ -0,0 +1,47 @@
+#include <acceleration\InlineTriangle.hpp>
+#include <core\Shape.hpp>
+#include <core\Mesh.hpp>
+#include <core\MemoryArena.hpp>
+#include <core\Timer.hpp>
+#include <tbb\tbb.h>
+
+NAMESPACE_BEGIN
+
+InlineTriangle * BakeInlineTriangles(const std::vector<Shape*> & pShapes)
+{
+	Timer BakeTimer;
+
+	InlineTriangle * pTriangles = AllocAligned<InlineTriangle>(pShapes.size());
+
+	tbb::blocked_range<int> Range(0, int(pShapes.size()));
+	auto Map = [&](const tbb::blocked_range<int> & Range)
+	{
+		for (int i = Range.begin(); i < Range.end(); i++)
+		{
+			const Mesh * pMesh = pShapes[i]->GetMesh();
+			uint32_t iFacet = pShapes[i]->GetFacetIndex();
+			CHECK(pMesh != nullptr);
+
+			const MatrixXuMap & F = pMesh->GetIndices();
+			const MatrixXfMap & V = pMesh->GetVertexPositions();
+			const Point3f P0 = V.col(F(0, iFacet)), P1 = V.col(F(1, iFacet)), P2 = V.col(F(2, iFacet));
+
+			pTriangles[i].P0 = P0;
+			pTriangles[i].Edge1 = P1 - P0;
+			pTriangles[i].Edge2 = P2 - P0;
+		}
+	};
+
+	/// Uncomment the following line for single threaded baking
+	//Map(Range);
+
+	/// Default: parallel baking
+	tbb::parallel_for(Range, Map);
+
+	LOG(INFO) << "Bake " << pShapes.size() << " inline triangles in " << BakeTimer.ElapsedString() <<
+		" and take " << MemString(pShapes.size() * sizeof(InlineTriangle)) << ".";
+
+	return pTriangles;
+}
+
+NAMESPACE_END
@@ -0,0 +1,653 @@
+#include <acceleration\KDTreeAcceleration.hpp>
+#include <core\Timer.hpp>
+#include <core\Shape.hpp>
+#include <tbb\tbb.h>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(KDTreeAcceleration, XML_ACCELERATION_KDTREE);
+
+/// Bound of a shape along one axis, the split candidate of the SAH
+struct KDTreeEvent
+{
+	enum EType : uint8_t
+	{
+		EEnd = 0,
+		EPlanar = 1,
+		EStart = 2
+	};
+
+	float Pos;
+	uint32_t iShape;
+	uint8_t Axis;
+	uint8_t Type;
+
+	/// Sorted by axis, then by position, the ends coming first
+	bool operator<(const KDTreeEvent & Other) const
+	{
+		if (Axis != Other.Axis)
+		{
+			return Axis < Other.Axis;
+		}
+		if (Pos != Other.Pos)
+		{
+			return Pos < Other.Pos;
+		}
+		return Type < Other.Type;
+	}
+};
+
+struct KDTreeBuildNode
+{
+	uint32_t iAxis = 3; // 3 for a leaf
+	float Split = 0.0f;
+	std::unique_ptr<KDTreeBuildNode> pChildren[2];
+	std::vector<uint32_t> ShapeIndices;
+};
+
+struct KDTreeTraversal
+{
+	uint32_t iNode;
+	float MinT, MaxT;
+};
+
+/// Side of the split plane a shape of the node being split belongs to
+enum EKDTreeSide : uint8_t
+{
+	EKDTreeLeft = 0,
+	EKDTreeRight = 1,
+	EKDTreeBoth = 2
+};
+
+/// Side of the shapes, one array per thread since the shapes straddling a plane are shared by the subtrees
+struct KDTreeSides
+{
+	tbb::enumerable_thread_specific<std::vector<uint8_t>> Sides;
+};
+
+/// Hard limit of the depth of the tree, which bounds the traversal stack
+constexpr uint32_t KDTREE_MAX_DEPTH = 64;
+
+/// Subtrees with more shapes than this are built as separate tasks
+constexpr uint32_t KDTREE_PARALLEL_BUILD_THRESHOLD = 4096;
+
+void KDTreeNode::InitLeaf(const uint32_t * pShapeIndices, uint32_t nShapes, std::vector<uint32_t> & ShapeIndices)
+{
+	Flags = 3 | (nShapes << 2);
+	if (nShapes == 0)
+	{
+		iOneShape = 0;
+	}
+	else if (nShapes == 1)
+	{
+		iOneShape = pShapeIndices[0];
+	}
+	else
+	{
+		iShapeIndexOffset = uint32_t(ShapeIndices.size());
+		ShapeIndices.insert(ShapeIndices.end(), pShapeIndices, pShapeIndices + nShapes);
+	}
+}
+
+void KDTreeNode::InitInterior(uint32_t iAxis, uint32_t iAboveChild, float SplitPos)
+{
+	Split = SplitPos;
+	Flags = iAxis | (iAboveChild << 2);
+}
+
+KDTreeAcceleration::KDTreeAcceleration(const PropertyList & PropList) :
+	Acceleration(PropList)
+{
+	m_IntersectionCost = PropList.GetFloat(XML_ACCELERATION_KDTREE_INTERSECTION_COST, DEFAULT_ACCELERATION_KDTREE_INTERSECTION_COST);
+	if (m_IntersectionCost <= 0.0f)
+	{
+		LOG(WARNING) << "Intersection cost should be positive but \"" << m_IntersectionCost << "\" was given, use default intersection cost";
+		m_IntersectionCost = DEFAULT_ACCELERATION_KDTREE_INTERSECTION_COST;
+	}
+	m_TraversalCost = PropList.GetFloat(XML_ACCELERATION_KDTREE_TRAVERSAL_COST, DEFAULT_ACCELERATION_KDTREE_TRAVERSAL_COST);
+	if (m_TraversalCost <= 0.0f)
+	{
+		LOG(WARNING) << "Traversal cost should be positive but \"" << m_TraversalCost << "\" was given, use default traversal cost";
+		m_TraversalCost = DEFAULT_ACCELERATION_KDTREE_TRAVERSAL_COST;
+	}
+	m_EmptyBonus = PropList.GetFloat(XML_ACCELERATION_KDTREE_EMPTY_BONUS, DEFAULT_ACCELERATION_KDTREE_EMPTY_BONUS);
+	if (m_EmptyBonus < 0.0f || m_EmptyBonus >= 1.0f)
+	{
+		LOG(WARNING) << "Empty bonus should be in [0, 1) but \"" << m_EmptyBonus << "\" was given, use default empty bonus";
+		m_EmptyBonus = DEFAULT_ACCELERATION_KDTREE_EMPTY_BONUS;
+	}
+	m_MaxDepth = PropList.GetInteger(XML_ACCELERATION_KDTREE_MAX_DEPTH, DEFAULT_ACCELERATION_KDTREE_MAX_DEPTH);
+	if (m_MaxDepth < 0 || m_MaxDepth > int(KDTREE_MAX_DEPTH))
+	{
+		LOG(WARNING) << "Max depth should be in [0, " << KDTREE_MAX_DEPTH << "] but \"" << m_MaxDepth << "\" was given, use default max depth";
+		m_MaxDepth = DEFAULT_ACCELERATION_KDTREE_MAX_DEPTH;
+	}
+}
+
+void KDTreeAcceleration::Build()
+{
+	Timer KDTreeBuildTimer;
+
+	m_Nodes.clear();
+	m_ShapeIndices.clear();
+	m_nLeafs = 0;
+	m_nEmptyLeafs = 0;
+
+	uint32_t nShapes = uint32_t(m_pShapes.size());
+	if (nShapes == 0)
+	{
+		return;
+	}
+
+	// The leaves store the number of shapes in 30 bits
+	CHECK(nShapes < (1u << 30));
+
+	// 0 stands for the usual estimate of Pharr et al.
+	uint32_t MaxDepth = (m_MaxDepth > 0) ? uint32_t(m_MaxDepth) :
+		std::min(KDTREE_MAX_DEPTH, uint32_t(std::round(8.0f + 1.3f * std::log2(float(nShapes)))));
+
+	std::vector<KDTreeEvent> Events;
+	Events.reserve(size_t(nShapes) * 6);
+	for (uint32_t i = 0; i < nShapes; i++)
+	{
+		AddEvents(i, m_BBox, Events);
+	}
+	tbb::parallel_sort(Events.begin(), Events.end());
+
+	KDTreeSides Sides;
+	std::unique_ptr<KDTreeBuildNode> pRoot(BuildTree(Events, m_BBox, nShapes, MaxDepth, Sides));
+
+	FlattenTree(pRoot.get());
+
+	LOG(INFO) << "Build kd-tree (" << m_Nodes.size() << " nodes, with " << m_nLeafs << " leafs of which " << m_nEmptyLeafs <<
+		" are empty) in " << KDTreeBuildTimer.ElapsedString() << " and take " <<
+		MemString(m_Nodes.size() * sizeof(KDTreeNode) + m_ShapeIndices.size() * sizeof(uint32_t)) << ".";
+}
+
+void KDTreeAcceleration::Refit()
+{
+	// The split planes can not follow the shapes, rebuild the whole tree
+	Acceleration::Refit();
+	Build();
+}
+
+bool KDTreeAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
+{
+	if (bShadowRay)
+	{
+		return Occluded(Ray);
+	}
+
+	if (m_Nodes.empty())
+	{
+		return false;
+	}
+
+	TraversalCounter Counter(false);
+
+	// Clip the ray to the bounds of the scene
+	float MinT, MaxT;
+	Counter.nBoxTests++;
+	if (!m_BBox.RayIntersect(Ray, MinT, MaxT))
+	{
+		return false;
+	}
+	MinT = std::max(MinT, Ray.MinT);
+	MaxT = std::min(MaxT, Ray.MaxT);
+	if (MinT > MaxT)
+	{
+		return false;
+	}
+
+	bool bFoundIntersection = false;       // Was an intersection found so far?
+	Shape * pFoundShape = nullptr;
+
+	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
+
+	KDTreeTraversal Stack[KDTREE_MAX_DEPTH];
+	uint32_t iStackPtr = 0;
+	uint32_t iNode = 0;
+
+	while (true)
+	{
+		// The nearest intersection is closer than the remaining nodes
+		if (RayCopy.MaxT < MinT)
+		{
+			break;
+		}
+
+		const KDTreeNode & Node = m_Nodes[iNode];
+		Counter.nNodes++;
+
+		if (!Node.IsLeaf())
+		{
+			uint32_t Axis = Node.GetSplitAxis();
+			float PlaneT = (Node.Split - RayCopy.Origin[Axis]) * RayCopy.DirectionReciprocal[Axis];
+
+			bool bBelowFirst = (RayCopy.Origin[Axis] < Node.Split) ||
+				(RayCopy.Origin[Axis] == Node.Split && RayCopy.Direction[Axis] <= 0.0f);
+			uint32_t iFirst = bBelowFirst ? iNode + 1 : Node.GetAboveChild();
+			uint32_t iSecond = bBelowFirst ? Node.GetAboveChild() : iNode + 1;
+
+			// A ray parallel to the plane gives NaN and only visits the first child
+			if (!(PlaneT <= MaxT) || PlaneT <= 0.0f)
+			{
+				iNode = iFirst;
+			}
+			else if (PlaneT < MinT)
+			{
+				iNode = iSecond;
+			}
+			else
+			{
+				Stack[iStackPtr++] = { iSecond, PlaneT, MaxT };
+				iNode = iFirst;
+				MaxT = PlaneT;
+			}
+		}
+		else
+		{
+			uint32_t nShapes = Node.GetShapeCount();
+			const uint32_t * pShapeIndices = (nShapes > 1) ? &m_ShapeIndices[Node.iShapeIndexOffset] : &Node.iOneShape;
+			Counter.nTriangleTests += nShapes;
+
+			for (uint32_t i = 0; i < nShapes; i++)
+			{
+				float U, V, T;
+				Shape * pShape = m_pShapes[pShapeIndices[i]];
+				if (pShape->RayIntersect(RayCopy, U, V, T))
+				{
+					RayCopy.MaxT = Isect.T = T;
+					Isect.UV = Point2f(U, V);
+					Isect.pShape = pShape;
+
+					pFoundShape = pShape;
+					bFoundIntersection = true;
+				}
+			}
+
+			if (iStackPtr == 0)
+			{
+				break;
+			}
+
+			iStackPtr--;
+			iNode = Stack[iStackPtr].iNode;
+			MinT = Stack[iStackPtr].MinT;
+			MaxT = Stack[iStackPtr].MaxT;
+		}
+	}
+
+	if (bFoundIntersection)
+	{
+		pFoundShape->PostIntersect(Isect);
+		Isect.ComputeScreenSpacePartial(Ray);
+	}
+
+	return bFoundIntersection;
+}
+
+bool KDTreeAcceleration::Occluded(const Ray3f & Ray) const
+{
+	if (m_Nodes.empty())
+	{
+		return false;
+	}
+
+	TraversalCounter Counter(true);
+
+	float MinT, MaxT;
+	Counter.nBoxTests++;
+	if (!m_BBox.RayIntersect(Ray, MinT, MaxT))
+	{
+		return false;
+	}
+	MinT = std::max(MinT, Ray.MinT);
+	MaxT = std::min(MaxT, Ray.MaxT);
+	if (MinT > MaxT)
+	{
+		return false;
+	}
+
+	KDTreeTraversal Stack[KDTREE_MAX_DEPTH];
+	uint32_t iStackPtr = 0;
+	uint32_t iNode = 0;
+
+	while (true)
+	{
+		const KDTreeNode & Node = m_Nodes[iNode];
+		Counter.nNodes++;
+
+		if (!Node.IsLeaf())
+		{
+			uint32_t Axis = Node.GetSplitAxis();
+			float PlaneT = (Node.Split - Ray.Origin[Axis]) * Ray.DirectionReciprocal[Axis];
+
+			bool bBelowFirst = (Ray.Origin[Axis] < Node.Split) ||
+				(Ray.Origin[Axis] == Node.Split && Ray.Direction[Axis] <= 0.0f);
+			uint32_t iFirst = bBelowFirst ? iNode + 1 : Node.GetAboveChild();
+			uint32_t iSecond = bBelowFirst ? Node.GetAboveChild() : iNode + 1;
+
+			if (!(PlaneT <= MaxT) || PlaneT <= 0.0f)
+			{
+				iNode = iFirst;
+			}
+			else if (PlaneT < MinT)
+			{
+				iNode = iSecond;
+			}
+			else
+			{
+				Stack[iStackPtr++] = { iSecond, PlaneT, MaxT };
+				iNode = iFirst;
+				MaxT = PlaneT;
+			}
+		}
+		else
+		{
+			// Leaf node -> Any intersection terminates the query
+			uint32_t nShapes = Node.GetShapeCount();
+			const uint32_t * pShapeIndices = (nShapes > 1) ? &m_ShapeIndices[Node.iShapeIndexOffset] : &Node.iOneShape;
+			Counter.nTriangleTests += nShapes;
+
+			for (uint32_t i = 0; i < nShapes; i++)
+			{
+				float U, V, T;
+				if (m_pShapes[pShapeIndices[i]]->RayIntersect(Ray, U, V, T))
+				{
+					return true;
+				}
+			}
+
+			if (iStackPtr == 0)
+			{
+				break;
+			}
+
+			iStackPtr--;
+			iNode = Stack[iStackPtr].iNode;
+			MinT = Stack[iStackPtr].MinT;
+			MaxT = Stack[iStackPtr].MaxT;
+		}
+	}
+
+	return false;
+}
+
+std::string KDTreeAcceleration::ToString() const
+{
+	return tfm::format(
+		"KDTreeAcceleration[\n"
+		"  node = %s,\n"
+		"  leafNode = %s,\n"
+		"  emptyLeafNode = %s,\n"
+		"  intersectionCost = %f,\n"
+		"  traversalCost = %f,\n"
+		"  emptyBonus = %f,\n"
+		"  maxDepth = %s\n"
+		"]",
+		m_Nodes.size(),
+		m_nLeafs,
+		m_nEmptyLeafs,
+		m_IntersectionCost,
+		m_TraversalCost,
+		m_EmptyBonus,
+		m_MaxDepth == 0 ? "auto" : std::to_string(m_MaxDepth)
+	);
+}
+
+KDTreeBuildNode * KDTreeAcceleration::BuildTree(
+	std::vector<KDTreeEvent> & Events,
+	const BoundingBox3f & Voxel,
+	uint32_t nShapes,
+	uint32_t RemainingDepth,
+	KDTreeSides & Sides
+)
+{
+	KDTreeBuildNode * pNode = new KDTreeBuildNode();
+
+	// Sweep the sorted events of each axis, keeping the number of shapes on both sides of the plane
+	Vector3f Extents = Voxel.GetExtents();
+	float SurfaceArea = 2.0f * (Extents.x() * Extents.y() + Extents.y() * Extents.z() + Extents.z() * Extents.x());
+
+	float BestCost = std::numeric_limits<float>::infinity();
+	uint32_t iBestAxis = 3;
+	float BestPos = 0.0f;
+	bool bBestPlanarLeft = false;
+
+	if (nShapes > 0 && RemainingDepth > 0 && SurfaceArea > 0.0f)
+	{
+		float InvSurfaceArea = 1.0f / SurfaceArea;
+		uint32_t nLeft[3] = { 0, 0, 0 };
+		uint32_t nRight[3] = { nShapes, nShapes, nShapes };
+
+		size_t i = 0;
+		while (i < Events.size())
+		{
+			uint32_t Axis = Events[i].Axis;
+			float Pos = Events[i].Pos;
+			uint32_t nEnd = 0, nPlanar = 0, nStart = 0;
+			while (i < Events.size() && Events[i].Axis == Axis && Events[i].Pos == Pos && Events[i].Type == KDTreeEvent::EEnd)
+			{
+				nEnd++;
+				i++;
+			}
+			while (i < Events.size() && Events[i].Axis == Axis && Events[i].Pos == Pos && Events[i].Type == KDTreeEvent::EPlanar)
+			{
+				nPlanar++;
+				i++;
+			}
+			while (i < Events.size() && Events[i].Axis == Axis && Events[i].Pos == Pos && Events[i].Type == KDTreeEvent::EStart)
+			{
+				nStart++;
+				i++;
+			}
+
+			nRight[Axis] -= nPlanar + nEnd;
+
+			uint32_t Axis1 = (Axis + 1) % 3, Axis2 = (Axis + 2) % 3;
+			float Below = Pos - Voxel.Min[Axis], Above = Voxel.Max[Axis] - Pos;
+			float Face = Extents[Axis1] * Extents[Axis2], Perimeter = Extents[Axis1] + Extents[Axis2];
+			float ProbLeft = 2.0f * (Face + Below * Perimeter) * InvSurfaceArea;
+			float ProbRight = 2.0f * (Face + Above * Perimeter) * InvSurfaceArea;
+
+			// The shapes lying in the plane are tried on both sides
+			for (int Side = 0; Side < (nPlanar > 0 ? 2 : 1); Side++)
+			{
+				bool bPlanarLeft = (Side == 0);
+				uint32_t nL = nLeft[Axis] + (bPlanarLeft ? nPlanar : 0);
+				uint32_t nR = nRight[Axis] + (bPlanarLeft ? 0 : nPlanar);
+
+				// A plane on the boundary of the voxel has to cut off something
+				if ((Below <= 0.0f && nR == nShapes) || (Above <= 0.0f && nL == nShapes))
+				{
+					continue;
+				}
+
+				float Bonus = (nL == 0 || nR == 0) ? m_EmptyBonus : 0.0f;
+				float Cost = m_TraversalCost + m_IntersectionCost * (1.0f - Bonus) * (ProbLeft * nL + ProbRight * nR);
+				if (Cost < BestCost)
+				{
+					BestCost = Cost;
+					iBestAxis = Axis;
+					BestPos = Pos;
+					bBestPlanarLeft = bPlanarLeft;
+				}
+			}
+
+			nLeft[Axis] += nStart + nPlanar;
+		}
+	}
+
+	// Leaf node
+	if (iBestAxis == 3 || BestCost >= m_IntersectionCost * nShapes)
+	{
+		pNode->ShapeIndices.reserve(nShapes);
+		for (const KDTreeEvent & Event : Events)
+		{
+			if (Event.Axis != 0)
+			{
+				break;
+			}
+			if (Event.Type != KDTreeEvent::EEnd)
+			{
+				pNode->ShapeIndices.push_back(Event.iShape);
+			}
+		}
+		std::vector<KDTreeEvent>().swap(Events);
+		return pNode;
+	}
+
+	// Classify the shapes, the ones not classified by the events of the split axis straddle the plane
+	std::vector<uint8_t> & Side = Sides.Sides.local();
+	if (Side.size() < m_pShapes.size())
+	{
+		Side.resize(m_pShapes.size());
+	}
+
+	for (const KDTreeEvent & Event : Events)
+	{
+		Side[Event.iShape] = EKDTreeBoth;
+	}
+
+	for (const KDTreeEvent & Event : Events)
+	{
+		if (Event.Axis != iBestAxis)
+		{
+			continue;
+		}
+
+		if (Event.Type == KDTreeEvent::EEnd && Event.Pos <= BestPos)
+		{
+			Side[Event.iShape] = EKDTreeLeft;
+		}
+		else if (Event.Type == KDTreeEvent::EStart && Event.Pos >= BestPos)
+		{
+			Side[Event.iShape] = EKDTreeRight;
+		}
+		else if (Event.Type == KDTreeEvent::EPlanar)
+		{
+			if (Event.Pos < BestPos || (Event.Pos == BestPos && bBestPlanarLeft))
+			{
+				Side[Event.iShape] = EKDTreeLeft;
+			}
+			else
+			{
+				Side[Event.iShape] = EKDTreeRight;
+			}
+		}
+	}
+
+	BoundingBox3f LeftVoxel(Voxel), RightVoxel(Voxel);
+	LeftVoxel.Max[iBestAxis] = BestPos;
+	RightVoxel.Min[iBestAxis] = BestPos;
+
+	// The events of the shapes on one side keep their order, the straddling shapes are clipped
+	std::vector<KDTreeEvent> LeftEvents, RightEvents;
+	std::vector<KDTreeEvent> LeftClippedEvents, RightClippedEvents;
+	LeftEvents.reserve(Events.size());
+	RightEvents.reserve(Events.size());
+	uint32_t nLeftShapes = 0, nRightShapes = 0;
+
+	for (const KDTreeEvent & Event : Events)
+	{
+		uint8_t ShapeSide = Side[Event.iShape];
+		bool bFirstEvent = (Event.Axis == 0 && Event.Type != KDTreeEvent::EEnd);
+		if (ShapeSide == EKDTreeLeft)
+		{
+			LeftEvents.push_back(Event);
+			nLeftShapes += bFirstEvent ? 1 : 0;
+		}
+		else if (ShapeSide == EKDTreeRight)
+		{
+			RightEvents.push_back(Event);
+			nRightShapes += bFirstEvent ? 1 : 0;
+		}
+		else if (bFirstEvent)
+		{
+			AddEvents(Event.iShape, LeftVoxel, LeftClippedEvents);
+			AddEvents(Event.iShape, RightVoxel, RightClippedEvents);
+			nLeftShapes++;
+			nRightShapes++;
+		}
+	}
+	std::vector<KDTreeEvent>().swap(Events);
+
+	auto MergeEvents = [](std::vector<KDTreeEvent> & Events, std::vector<KDTreeEvent> & ClippedEvents)
+	{
+		std::sort(ClippedEvents.begin(), ClippedEvents.end());
+		size_t nSorted = Events.size();
+		Events.insert(Events.end(), ClippedEvents.begin(), ClippedEvents.end());
+		std::inplace_merge(Events.begin(), Events.begin() + nSorted, Events.end());
+		std::vector<KDTreeEvent>().swap(ClippedEvents);
+	};
+	MergeEvents(LeftEvents, LeftClippedEvents);
+	MergeEvents(RightEvents, RightClippedEvents);
+
+	pNode->iAxis = iBestAxis;
+	pNode->Split = BestPos;
+
+	auto BuildLeft = [&]()
+	{
+		pNode->pChildren[0].reset(BuildTree(LeftEvents, LeftVoxel, nLeftShapes, RemainingDepth - 1, Sides));
+	};
+	auto BuildRight = [&]()
+	{
+		pNode->pChildren[1].reset(BuildTree(RightEvents, RightVoxel, nRightShapes, RemainingDepth - 1, Sides));
+	};
+
+	if (nLeftShapes > KDTREE_PARALLEL_BUILD_THRESHOLD && nRightShapes > KDTREE_PARALLEL_BUILD_THRESHOLD)
+	{
+		tbb::parallel_invoke(BuildLeft, BuildRight);
+	}
+	else
+	{
+		BuildLeft();
+		BuildRight();
+	}
+
+	return pNode;
+}
+
+void KDTreeAcceleration::AddEvents(uint32_t iShape, const BoundingBox3f & Voxel, std::vector<KDTreeEvent> & Events) const
+{
+	BoundingBox3f BBox = m_pShapes[iShape]->GetBoundingBox();
+	BBox.Clip(Voxel);
+
+	for (uint8_t Axis = 0; Axis < 3; Axis++)
+	{
+		if (BBox.Min[Axis] == BBox.Max[Axis])
+		{
+			Events.push_back({ BBox.Min[Axis], iShape, Axis, KDTreeEvent::EPlanar });
+		}
+		else
+		{
+			Events.push_back({ BBox.Min[Axis], iShape, Axis, KDTreeEvent::EStart });
+			Events.push_back({ BBox.Max[Axis], iShape, Axis, KDTreeEvent::EEnd });
+		}
+	}
+}
+
+void KDTreeAcceleration::FlattenTree(const KDTreeBuildNode * pNode)
+{
+	uint32_t iNode = uint32_t(m_Nodes.size());
+	m_Nodes.emplace_back();
+
+	if (pNode->iAxis == 3)
+	{
+		m_Nodes[iNode].InitLeaf(pNode->ShapeIndices.data(), uint32_t(pNode->ShapeIndices.size()), m_ShapeIndices);
+		m_nLeafs++;
+		m_nEmptyLeafs += pNode->ShapeIndices.empty() ? 1 : 0;
+	}
+	else
+	{
+		// The below child directly follows its parent
+		FlattenTree(pNode->pChildren[0].get());
+		uint32_t iAboveChild = uint32_t(m_Nodes.size());
+		CHECK(iAboveChild < (1u << 30));
+		m_Nodes[iNode].InitInterior(pNode->iAxis, iAboveChild, pNode->Split);
+		FlattenTree(pNode->pChildren[1].get());
+	}
+}
+
+NAMESPACE_END
@@ -0,0 +1,479 @@
+#include <acceleration\TrianglePack.hpp>
+#include <core\Shape.hpp>
+#include <core\Mesh.hpp>
+#include <core\MemoryArena.hpp>
+#include <core\Timer.hpp>
+#include <tbb\tbb.h>
+#include <immintrin.h>
+
+NAMESPACE_BEGIN
+
+/// Number of floats per lane : three points (first vertex + two edges, or three vertices)
+constexpr uint32_t TRIANGLE_PACK_COMPONENTS = 9;
+
+/**
+* \brief Minimal wrapper of the SIMD registers used by the pack kernels.
+* A 8-wide pack is handled as two SSE halves when AVX is not available.
+*/
+template <uint32_t Width>
+struct PackFloat;
+
+template <>
+struct PackFloat<4>
+{
+	__m128 V;
+
+	PackFloat() = default;
+	PackFloat(__m128 Val) : V(Val) { }
+	explicit PackFloat(float F) : V(_mm_set1_ps(F)) { }
+
+	static PackFloat Load(const float * pData) { return _mm_load_ps(pData); }
+	void Store(float * pData) const { _mm_storeu_ps(pData, V); }
+	int MoveMask() const { return _mm_movemask_ps(V); }
+
+	friend PackFloat operator+(const PackFloat & A, const PackFloat & B) { return _mm_add_ps(A.V, B.V); }
+	friend PackFloat operator-(const PackFloat & A, const PackFloat & B) { return _mm_sub_ps(A.V, B.V); }
+	friend PackFloat operator*(const PackFloat & A, const PackFloat & B) { return _mm_mul_ps(A.V, B.V); }
+	friend PackFloat operator/(const PackFloat & A, const PackFloat & B) { return _mm_div_ps(A.V, B.V); }
+	friend PackFloat operator&(const PackFloat & A, const PackFloat & B) { return _mm_and_ps(A.V, B.V); }
+	friend PackFloat operator|(const PackFloat & A, const PackFloat & B) { return _mm_or_ps(A.V, B.V); }
+	friend PackFloat operator<(const PackFloat & A, const PackFloat & B) { return _mm_cmplt_ps(A.V, B.V); }
+	friend PackFloat operator<=(const PackFloat & A, const PackFloat & B) { return _mm_cmple_ps(A.V, B.V); }
+	friend PackFloat operator>(const PackFloat & A, const PackFloat & B) { return _mm_cmpgt_ps(A.V, B.V); }
+	friend PackFloat operator>=(const PackFloat & A, const PackFloat & B) { return _mm_cmpge_ps(A.V, B.V); }
+	friend PackFloat operator==(const PackFloat & A, const PackFloat & B) { return _mm_cmpeq_ps(A.V, B.V); }
+	friend PackFloat operator!=(const PackFloat & A, const PackFloat & B) { return _mm_cmpneq_ps(A.V, B.V); }
+};
+
+#if defined(__AVX__)
+template <>
+struct PackFloat<8>
+{
+	__m256 V;
+
+	PackFloat() = default;
+	PackFloat(__m256 Val) : V(Val) { }
+	explicit PackFloat(float F) : V(_mm256_set1_ps(F)) { }
+
+	static PackFloat Load(const float * pData) { return _mm256_load_ps(pData); }
+	void Store(float * pData) const { _mm256_storeu_ps(pData, V); }
+	int MoveMask() const { return _mm256_movemask_ps(V); }
+
+	friend PackFloat operator+(const PackFloat & A, const PackFloat & B) { return _mm256_add_ps(A.V, B.V); }
+	friend PackFloat operator-(const PackFloat & A, const PackFloat & B) { return _mm256_sub_ps(A.V, B.V); }
+	friend PackFloat operator*(const PackFloat & A, const PackFloat & B) { return _mm256_mul_ps(A.V, B.V); }
+	friend PackFloat operator/(const PackFloat & A, const PackFloat & B) { return _mm256_div_ps(A.V, B.V); }
+	friend PackFloat operator&(const PackFloat & A, const PackFloat & B) { return _mm256_and_ps(A.V, B.V); }
+	friend PackFloat operator|(const PackFloat & A, const PackFloat & B) { return _mm256_or_ps(A.V, B.V); }
+	friend PackFloat operator<(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_LT_OQ); }
+	friend PackFloat operator<=(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_LE_OQ); }
+	friend PackFloat operator>(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_GT_OQ); }
+	friend PackFloat operator>=(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_GE_OQ); }
+	friend PackFloat operator==(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_EQ_OQ); }
+	friend PackFloat operator!=(const PackFloat & A, const PackFloat & B) { return _mm256_cmp_ps(A.V, B.V, _CMP_NEQ_UQ); }
+};
+#else
+template <>
+struct PackFloat<8>
+{
+	PackFloat<4> Lo, Hi;
+
+	PackFloat() = default;
+	PackFloat(const PackFloat<4> & L, const PackFloat<4> & H) : Lo(L), Hi(H) { }
+	explicit PackFloat(float F) : Lo(F), Hi(F) { }
+
+	static PackFloat Load(const float * pData) { return PackFloat(PackFloat<4>::Load(pData), PackFloat<4>::Load(pData + 4)); }
+	void Store(float * pData) const { Lo.Store(pData); Hi.Store(pData + 4); }
+	int MoveMask() const { return Lo.MoveMask() | (Hi.MoveMask() << 4); }
+
+	friend PackFloat operator+(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo + B.Lo, A.Hi + B.Hi); }
+	friend PackFloat operator-(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo - B.Lo, A.Hi - B.Hi); }
+	friend PackFloat operator*(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo * B.Lo, A.Hi * B.Hi); }
+	friend PackFloat operator/(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo / B.Lo, A.Hi / B.Hi); }
+	friend PackFloat operator&(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo & B.Lo, A.Hi & B.Hi); }
+	friend PackFloat operator|(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo | B.Lo, A.Hi | B.Hi); }
+	friend PackFloat operator<(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo < B.Lo, A.Hi < B.Hi); }
+	friend PackFloat operator<=(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo <= B.Lo, A.Hi <= B.Hi); }
+	friend PackFloat operator>(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo > B.Lo, A.Hi > B.Hi); }
+	friend PackFloat operator>=(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo >= B.Lo, A.Hi >= B.Hi); }
+	friend PackFloat operator==(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo == B.Lo, A.Hi == B.Hi); }
+	friend PackFloat operator!=(const PackFloat & A, const PackFloat & B) { return PackFloat(A.Lo != B.Lo, A.Hi != B.Hi); }
+};
+#endif
+
+/**
+* \brief Moller-Trumbore test of one ray against a pack storing the first
+* vertex and two edges, it follows \ref Mesh::RayIntersect() (same epsilon
+* and bounds). Return the mask of the lanes that are hit.
+*/
+template <uint32_t Width>
+static inline int IntersectPackMollerTrumbore(
+	const float * pPack,
+	const TrianglePackArray::RayData & Ray,
+	float MaxT,
+	int LaneMask,
+	float * pU,
+	float * pV,
+	float * pT
+)
+{
+	using Float = PackFloat<Width>;
+
+	const Float P0x = Float::Load(pPack + 0 * Width), P0y = Float::Load(pPack + 1 * Width), P0z = Float::Load(pPack + 2 * Width);
+	const Float E1x = Float::Load(pPack + 3 * Width), E1y = Float::Load(pPack + 4 * Width), E1z = Float::Load(pPack + 5 * Width);
+	const Float E2x = Float::Load(pPack + 6 * Width), E2y = Float::Load(pPack + 7 * Width), E2z = Float::Load(pPack + 8 * Width);
+	const Float Dx(Ray.Direction.x()), Dy(Ray.Direction.y()), Dz(Ray.Direction.z());
+
+	/* Begin calculating determinant - also used to calculate U parameter */
+	Float PVx = Dy * E2z - Dz * E2y;
+	Float PVy = Dz * E2x - Dx * E2z;
+	Float PVz = Dx * E2y - Dy * E2x;
+
+	/* If determinant is near zero, ray lies in plane of triangle */
+	Float Det = E1x * PVx + E1y * PVy + E1z * PVz;
+	Float Mask = (Det <= Float(-1e-8f)) | (Det >= Float(1e-8f));
+	Float InvDet = Float(1.0f) / Det;
+
+	/* Calculate distance from v[0] to ray origin */
+	Float Tx = Float(Ray.Origin.x()) - P0x;
+	Float Ty = Float(Ray.Origin.y()) - P0y;
+	Float Tz = Float(Ray.Origin.z()) - P0z;
+
+	/* Calculate U parameter and test bounds */
+	Float U = (Tx * PVx + Ty * PVy + Tz * PVz) * InvDet;
+	Mask = Mask & (U >= Float(0.0f)) & (U <= Float(1.0f));
+
+	/* Prepare to test V parameter */
+	Float Qx = Ty * E1z - Tz * E1y;
+	Float Qy = Tz * E1x - Tx * E1z;
+	Float Qz = Tx * E1y - Ty * E1x;
+
+	/* Calculate V parameter and test bounds */
+	Float V = (Dx * Qx + Dy * Qy + Dz * Qz) * InvDet;
+	Mask = Mask & (V >= Float(0.0f)) & (U + V <= Float(1.0f));
+
+	/* Ray intersects triangle -> compute t */
+	Float T = (E2x * Qx + E2y * Qy + E2z * Qz) * InvDet;
+	Mask = Mask & (T >= Float(Ray.MinT)) & (T <= Float(MaxT));
+
+	int HitMask = Mask.MoveMask() & LaneMask;
+	if (HitMask != 0)
+	{
+		U.Store(pU);
+		V.Store(pV);
+		T.Store(pT);
+	}
+	return HitMask;
+}
+
+/**
+* \brief Watertight test (Woop, Benthin and Wald 2013) of one ray against a
+* pack storing the three vertices. The edge functions are recomputed in double
+* precision when they are exactly zero, so rays hitting an edge or a vertex are
+* reported by at least one of the adjacent triangles.
+*/
+template <uint32_t Width>
+static inline int IntersectPackWatertight(
+	const float * pPack,
+	const TrianglePackArray::RayData & Ray,
+	float MaxT,
+	int LaneMask,
+	float * pU,
+	float * pV,
+	float * pT
+)
+{
+	using Float = PackFloat<Width>;
+
+	const float * pA = pPack;
+	const float * pB = pPack + 3 * Width;
+	const float * pC = pPack + 6 * Width;
+
+	/* Translate the vertices to the ray origin, and permute the axes so that Kz is the major axis of the direction */
+	const Float Ox(Ray.Origin[Ray.Kx]), Oy(Ray.Origin[Ray.Ky]), Oz(Ray.Origin[Ray.Kz]);
+	const Float AKx = Float::Load(pA + Ray.Kx * Width) - Ox, AKy = Float::Load(pA + Ray.Ky * Width) - Oy, AKz = Float::Load(pA + Ray.Kz * Width) - Oz;
+	const Float BKx = Float::Load(pB + Ray.Kx * Width) - Ox, BKy = Float::Load(pB + Ray.Ky * Width) - Oy, BKz = Float::Load(pB + Ray.Kz * Width) - Oz;
+	const Float CKx = Float::Load(pC + Ray.Kx * Width) - Ox, CKy = Float::Load(pC + Ray.Ky * Width) - Oy, CKz = Float::Load(pC + Ray.Kz * Width) - Oz;
+
+	/* Shear so that the ray direction becomes the unit Z axis */
+	const Float Sx(Ray.Sx), Sy(Ray.Sy), Sz(Ray.Sz);
+	const Float Ax = AKx - Sx * AKz, Ay = AKy - Sy * AKz;
+	const Float Bx = BKx - Sx * BKz, By = BKy - Sy * BKz;
+	const Float Cx = CKx - Sx * CKz, Cy = CKy - Sy * CKz;
+
+	/* Scaled barycentric coordinates (edge functions) */
+	Float U = Cx * By - Cy * Bx;
+	Float V = Ax * Cy - Ay * Cx;
+	Float W = Bx * Ay - By * Ax;
+
+	/* Fall back to double precision on the edges */
+	const Float Zero(0.0f);
+	int EdgeMask = ((U == Zero) | (V == Zero) | (W == Zero)).MoveMask() & LaneMask;
+	if (EdgeMask != 0)
+	{
+		float LaneAx[Width], LaneAy[Width], LaneBx[Width], LaneBy[Width], LaneCx[Width], LaneCy[Width];
+		float LaneU[Width], LaneV[Width], LaneW[Width];
+		Ax.Store(LaneAx); Ay.Store(LaneAy);
+		Bx.Store(LaneBx); By.Store(LaneBy);
+		Cx.Store(LaneCx); Cy.Store(LaneCy);
+		U.Store(LaneU); V.Store(LaneV); W.Store(LaneW);
+		for (uint32_t i = 0; i < Width; i++)
+		{
+			if ((EdgeMask & (1 << i)) != 0)
+			{
+				LaneU[i] = float(double(LaneCx[i]) * double(LaneBy[i]) - double(LaneCy[i]) * double(LaneBx[i]));
+				LaneV[i] = float(double(LaneAx[i]) * double(LaneCy[i]) - double(LaneAy[i]) * double(LaneCx[i]));
+				LaneW[i] = float(double(LaneBx[i]) * double(LaneAy[i]) - double(LaneBy[i]) * double(LaneAx[i]));
+			}
+		}
+		U = Float::Load(LaneU);
+		V = Float::Load(LaneV);
+		W = Float::Load(LaneW);
+	}
+
+	/* The edge functions must all have the same sign */
+	Float Mask = ((U >= Zero) & (V >= Zero) & (W >= Zero)) | ((U <= Zero) & (V <= Zero) & (W <= Zero));
+
+	/* The ray is parallel to the triangle (or the triangle is degenerated) */
+	Float Det = U + V + W;
+	Mask = Mask & (Det != Zero);
+
+	/* Compute the scaled hit distance */
+	const Float Az = Sz * AKz, Bz = Sz * BKz, Cz = Sz * CKz;
+	Float InvDet = Float(1.0f) / Det;
+	Float T = (U * Az + V * Bz + W * Cz) * InvDet;
+	Mask = Mask & (T >= Float(Ray.MinT)) & (T <= Float(MaxT));
+
+	int HitMask = Mask.MoveMask() & LaneMask;
+	if (HitMask != 0)
+	{
+		/* The barycentric coordinates of the second and the third vertex */
+		(V * InvDet).Store(pU);
+		(W * InvDet).Store(pV);
+		T.Store(pT);
+	}
+	return HitMask;
+}
+
+template <uint32_t Width, bool bWatertight>
+static bool IntersectPacks(
+	const float * pData,
+	const TrianglePackArray::RayData & Ray,
+	uint32_t iStart,
+	uint32_t iEnd,
+	float MaxT,
+	uint32_t & iShape,
+	float & U,
+	float & V,
+	float & T
+)
+{
+	bool bFoundIntersection = false;
+
+	for (uint32_t iPack = iStart / Width; iPack * Width < iEnd; iPack++)
+	{
+		// Mask off the lanes out of the range
+		uint32_t iFirst = iPack * Width;
+		uint32_t iLow = (iStart > iFirst) ? iStart - iFirst : 0;
+		uint32_t iHigh = std::min(iEnd - iFirst, Width);
+		int LaneMask = ((1 << iHigh) - 1) & ~((1 << iLow) - 1);
+
+		float PackU[Width], PackV[Width], PackT[Width];
+		const float * pPack = pData + size_t(iPack) * TRIANGLE_PACK_COMPONENTS * Width;
+
+		int HitMask = bWatertight ?
+			IntersectPackWatertight<Width>(pPack, Ray, MaxT, LaneMask, PackU, PackV, PackT) :
+			IntersectPackMollerTrumbore<Width>(pPack, Ray, MaxT, LaneMask, PackU, PackV, PackT);
+
+		// Keep the nearest lane
+		for (uint32_t i = 0; HitMask != 0; i++, HitMask >>= 1)
+		{
+			if ((HitMask & 1) != 0 && PackT[i] <= MaxT)
+			{
+				MaxT = T = PackT[i];
+				U = PackU[i];
+				V = PackV[i];
+				iShape = iFirst + i;
+				bFoundIntersection = true;
+			}
+		}
+	}
+
+	return bFoundIntersection;
+}
+
+template <uint32_t Width, bool bWatertight>
+static bool OccludedPacks(
+	const float * pData,
+	const TrianglePackArray::RayData & Ray,
+	uint32_t iStart,
+	uint32_t iEnd,
+	float MaxT
+)
+{
+	for (uint32_t iPack = iStart / Width; iPack * Width < iEnd; iPack++)
+	{
+		// Mask off the lanes out of the range
+		uint32_t iFirst = iPack * Width;
+		uint32_t iLow = (iStart > iFirst) ? iStart - iFirst : 0;
+		uint32_t iHigh = std::min(iEnd - iFirst, Width);
+		int LaneMask = ((1 << iHigh) - 1) & ~((1 << iLow) - 1);
+
+		float PackU[Width], PackV[Width], PackT[Width];
+		const float * pPack = pData + size_t(iPack) * TRIANGLE_PACK_COMPONENTS * Width;
+
+		int HitMask = bWatertight ?
+			IntersectPackWatertight<Width>(pPack, Ray, MaxT, LaneMask, PackU, PackV, PackT) :
+			IntersectPackMollerTrumbore<Width>(pPack, Ray, MaxT, LaneMask, PackU, PackV, PackT);
+
+		if (HitMask != 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+TrianglePackArray::~TrianglePackArray()
+{
+	FreeAligned(m_pData);
+}
+
+void TrianglePackArray::Build(const std::vector<Shape*> & pShapes, uint32_t Width, bool bWatertight)
+{
+	CHECK(Width == 4 || Width == 8);
+
+	Timer PackTimer;
+
+	FreeAligned(m_pData);
+
+	m_Width = Width;
+	m_bWatertight = bWatertight;
+	m_nPacks = uint32_t((pShapes.size() + Width - 1) / Width);
+
+	// Padding lanes are left as degenerated triangles
+	size_t nFloats = size_t(m_nPacks) * TRIANGLE_PACK_COMPONENTS * Width;
+	m_pData = AllocAligned<float>(std::max(nFloats, size_t(1)));
+	memset(m_pData, 0, nFloats * sizeof(float));
+
+	tbb::blocked_range<int> Range(0, int(pShapes.size()));
+	auto Map = [&](const tbb::blocked_range<int> & Range)
+	{
+		for (int i = Range.begin(); i < Range.end(); i++)
+		{
+			const Mesh * pMesh = pShapes[i]->GetMesh();
+			uint32_t iFacet = pShapes[i]->GetFacetIndex();
+			CHECK(pMesh != nullptr);
+
+			const MatrixXuMap & F = pMesh->GetIndices();
+			const MatrixXfMap & V = pMesh->GetVertexPositions();
+			const Point3f P0 = V.col(F(0, iFacet)), P1 = V.col(F(1, iFacet)), P2 = V.col(F(2, iFacet));
+
+			Point3f Points[3] = { P0, P1, P2 };
+			if (!m_bWatertight)
+			{
+				Points[1] = P1 - P0;
+				Points[2] = P2 - P0;
+			}
+
+			float * pPack = m_pData + size_t(i / Width) * TRIANGLE_PACK_COMPONENTS * Width;
+			uint32_t iLane = uint32_t(i) % Width;
+			for (uint32_t j = 0; j < 3; j++)
+			{
+				for (uint32_t k = 0; k < 3; k++)
+				{
+					pPack[(j * 3 + k) * Width + iLane] = Points[j][k];
+				}
+			}
+		}
+	};
+
+	/// Uncomment the following line for single threaded baking
+	//Map(Range);
+
+	/// Default: parallel baking
+	tbb::parallel_for(Range, Map);
+
+	LOG(INFO) << "Bake " << pShapes.size() << " triangles into " << m_nPacks << " packs of " << m_Width <<
+		(m_bWatertight ? " (watertight)" : "") << " in " << PackTimer.ElapsedString() << " and take " << MemString(GetUsedMemory()) << ".";
+}
+
+void TrianglePackArray::PrepareRay(const Ray3f & Ray, RayData & Data) const
+{
+	Data.Origin = Ray.Origin;
+	Data.Direction = Ray.Direction;
+	Data.MinT = Ray.MinT;
+
+	if (m_bWatertight)
+	{
+		// Calculate dimension where the ray direction is maximal
+		Vector3f AbsDirection = Ray.Direction.cwiseAbs();
+		Data.Kz = (AbsDirection.x() > AbsDirection.y()) ?
+			(AbsDirection.x() > AbsDirection.z() ? 0 : 2) :
+			(AbsDirection.y() > AbsDirection.z() ? 1 : 2);
+		Data.Kx = (Data.Kz + 1) % 3;
+		Data.Ky = (Data.Kx + 1) % 3;
+
+		// Swap Kx and Ky dimension to preserve winding direction of triangles
+		if (Ray.Direction[Data.Kz] < 0.0f)
+		{
+			std::swap(Data.Kx, Data.Ky);
+		}
+
+		// Calculate shear constants
+		Data.Sx = Ray.Direction[Data.Kx] / Ray.Direction[Data.Kz];
+		Data.Sy = Ray.Direction[Data.Ky] / Ray.Direction[Data.Kz];
+		Data.Sz = 1.0f / Ray.Direction[Data.Kz];
+	}
+}
+
+bool TrianglePackArray::RayIntersect(
+	const RayData & Data,
+	uint32_t iStart,
+	uint32_t nShapes,
+	float MaxT,
+	uint32_t & iShape,
+	float & U,
+	float & V,
+	float & T
+) const
+{
+	uint32_t iEnd = iStart + nShapes;
+	if (m_Width == 8)
+	{
+		return m_bWatertight ?
+			IntersectPacks<8, true>(m_pData, Data, iStart, iEnd, MaxT, iShape, U, V, T) :
+			IntersectPacks<8, false>(m_pData, Data, iStart, iEnd, MaxT, iShape, U, V, T);
+	}
+	else
+	{
+		return m_bWatertight ?
+			IntersectPacks<4, true>(m_pData, Data, iStart, iEnd, MaxT, iShape, U, V, T) :
+			IntersectPacks<4, false>(m_pData, Data, iStart, iEnd, MaxT, iShape, U, V, T);
+	}
+}
+
+bool TrianglePackArray::Occluded(const RayData & Data, uint32_t iStart, uint32_t nShapes, float MaxT) const
+{
+	uint32_t iEnd = iStart + nShapes;
+	if (m_Width == 8)
+	{
+		return m_bWatertight ?
+			OccludedPacks<8, true>(m_pData, Data, iStart, iEnd, MaxT) :
+			OccludedPacks<8, false>(m_pData, Data, iStart, iEnd, MaxT);
+	}
+	else
+	{
+		return m_bWatertight ?
+			OccludedPacks<4, true>(m_pData, Data, iStart, iEnd, MaxT) :
+			OccludedPacks<4, false>(m_pData, Data, iStart, iEnd, MaxT);
+	}
+}
+
+size_t TrianglePackArray::GetUsedMemory() const
+{
+	return size_t(m_nPacks) * TRIANGLE_PACK_COMPONENTS * m_Width * sizeof(float);
+}
+
+NAMESPACE_END
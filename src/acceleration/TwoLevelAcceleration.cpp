@@ -0,0 +1,449 @@
+#include <acceleration\TwoLevelAcceleration.hpp>
+#include <core\Instance.hpp>
+#include <core\Intersection.hpp>
+#include <core\Timer.hpp>
+#include <map>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(TwoLevelAcceleration, XML_ACCELERATION_TWO_LEVEL);
+
+/// Number of buckets used for the SAH split of the top-level BVH
+constexpr uint32_t TLAS_BUCKET_NUM = 12;
+
+struct TLASTraversal
+{
+	uint32_t Idx;
+	float MinT;
+	TLASTraversal() { Idx = 0; MinT = std::numeric_limits<float>::max(); }
+	TLASTraversal(uint32_t Idx, float MinT) : Idx(Idx), MinT(MinT) { }
+};
+
+struct TLASBucket
+{
+	uint32_t nInstances = 0;
+	BoundingBox3f BBox;
+};
+
+/**
+* Transform a world-space ray into the object space of an instance. The
+* direction is not normalized so that the distances along the ray (MinT,
+* MaxT and the T of the intersections) are the same in both spaces.
+*/
+static Ray3f TransformRay(const Transform & WorldToObject, const Ray3f & Ray)
+{
+	Ray3f Result = WorldToObject * Ray;
+	if (Ray.bHasDifferentials)
+	{
+		Result.RxOrigin = WorldToObject * Ray.RxOrigin;
+		Result.RyOrigin = WorldToObject * Ray.RyOrigin;
+		Result.RxDirection = WorldToObject * Ray.RxDirection;
+		Result.RyDirection = WorldToObject * Ray.RyDirection;
+		Result.bHasDifferentials = true;
+	}
+	return Result;
+}
+
+/// Transform an intersection record from the object space of an instance into world space
+static void TransformIntersection(const Transform & ObjectToWorld, Intersection & Isect)
+{
+	Isect.P = ObjectToWorld * Isect.P;
+	Isect.GeometricFrame = Frame(Normal3f(ObjectToWorld * Isect.GeometricFrame.N).normalized());
+	Isect.ShadingFrame = Frame(Normal3f(ObjectToWorld * Isect.ShadingFrame.N).normalized(), ObjectToWorld * Isect.ShadingFrame.S);
+
+	if (Isect.bHasUVPartial)
+	{
+		Isect.dPdU = ObjectToWorld * Isect.dPdU;
+		Isect.dPdV = ObjectToWorld * Isect.dPdV;
+		Isect.dNdU = ObjectToWorld * Normal3f(Isect.dNdU);
+		Isect.dNdV = ObjectToWorld * Normal3f(Isect.dNdV);
+	}
+}
+
+TwoLevelAcceleration::TwoLevelAcceleration(const PropertyList & PropList) : Acceleration(PropList)
+{
+	m_BottomLevel = PropList.GetString(XML_ACCELERATION_TWO_LEVEL_BOTTOM_LEVEL, DEFAULT_ACCELERATION_TWO_LEVEL_BOTTOM_LEVEL);
+
+	if (m_BottomLevel == XML_ACCELERATION_TWO_LEVEL)
+	{
+		throw HikariException("TwoLevelAcceleration: the bottom-level acceleration can not be \"%s\"!", m_BottomLevel);
+	}
+}
+
+TwoLevelAcceleration::~TwoLevelAcceleration()
+{
+	for (auto pPtr : m_pBottomLevels)
+	{
+		delete pPtr;
+	}
+	m_pBottomLevels.clear();
+	m_pBottomLevels.shrink_to_fit();
+}
+
+void TwoLevelAcceleration::AddMesh(Mesh * pMesh)
+{
+	TLASInstance Inst;
+	Inst.pMesh = pMesh;
+	m_Instances.push_back(Inst);
+}
+
+void TwoLevelAcceleration::AddInstance(Instance * pInstance)
+{
+	TLASInstance Inst;
+	Inst.pInstance = pInstance;
+	Inst.pMesh = pInstance->GetMesh();
+	m_Instances.push_back(Inst);
+}
+
+void TwoLevelAcceleration::Build()
+{
+	Timer BuildTimer;
+
+	/* One bottom-level acceleration per mesh, shared by all its instances */
+	std::map<const Mesh*, const Acceleration*> BottomLevels;
+	for (TLASInstance & Inst : m_Instances)
+	{
+		auto Iter = BottomLevels.find(Inst.pMesh);
+		if (Iter == BottomLevels.end())
+		{
+			Acceleration * pBottomLevel = (Acceleration*)(ObjectFactory::CreateInstance(m_BottomLevel, PropertyList()));
+			if (pBottomLevel->GetClassType() != EClassType::EAcceleration)
+			{
+				throw HikariException("TwoLevelAcceleration: \"%s\" is not an acceleration!", m_BottomLevel);
+			}
+			m_pBottomLevels.push_back(pBottomLevel);
+
+			pBottomLevel->AddMesh(Inst.pMesh);
+			pBottomLevel->Build();
+			Iter = BottomLevels.emplace(Inst.pMesh, pBottomLevel).first;
+		}
+
+		Inst.pBottomLevel = Iter->second;
+		Inst.BBox = (Inst.pInstance != nullptr) ? Inst.pInstance->GetBoundingBox() : Inst.pMesh->GetBoundingBox();
+		m_BBox.ExpandBy(Inst.BBox);
+	}
+
+	if (!m_Instances.empty())
+	{
+		m_Nodes.reserve(2 * m_Instances.size() - 1);
+		RecursiveBuild(0, uint32_t(m_Instances.size()));
+	}
+
+	LOG(INFO) << "Build two-level acceleration (" << m_Instances.size() << " instances of " << m_pBottomLevels.size() <<
+		" meshes, " << m_Nodes.size() << " top-level nodes) in " << BuildTimer.ElapsedString() << ".";
+}
+
+void TwoLevelAcceleration::Refit()
+{
+	Timer RefitTimer;
+
+	for (Acceleration * pBottomLevel : m_pBottomLevels)
+	{
+		pBottomLevel->Refit();
+	}
+
+	/* The top level is small, it is always rebuilt over the new bounds of the instances */
+	m_BBox.Reset();
+	for (TLASInstance & Inst : m_Instances)
+	{
+		Inst.BBox = (Inst.pInstance != nullptr) ? Inst.pInstance->GetBoundingBox() : Inst.pMesh->GetBoundingBox();
+		m_BBox.ExpandBy(Inst.BBox);
+	}
+
+	m_Nodes.clear();
+	if (!m_Instances.empty())
+	{
+		RecursiveBuild(0, uint32_t(m_Instances.size()));
+	}
+
+	LOG(INFO) << "Refit two-level acceleration (" << m_pBottomLevels.size() << " bottom levels, " << m_Nodes.size() <<
+		" top-level nodes) in " << RefitTimer.ElapsedString() << ".";
+}
+
+uint32_t TwoLevelAcceleration::RecursiveBuild(uint32_t iStart, uint32_t iEnd)
+{
+	uint32_t iNode = uint32_t(m_Nodes.size());
+	m_Nodes.emplace_back();
+
+	BoundingBox3f BBox, CentroidBBox;
+	for (uint32_t i = iStart; i < iEnd; i++)
+	{
+		BBox.ExpandBy(m_Instances[i].BBox);
+		CentroidBBox.ExpandBy(m_Instances[i].BBox.GetCenter());
+	}
+
+	m_Nodes[iNode].BBox = BBox;
+	m_Nodes[iNode].iStart = iStart;
+	m_Nodes[iNode].nInstances = iEnd - iStart;
+
+	int Axis = CentroidBBox.GetMajorAxis();
+	float AxisMin = CentroidBBox.Min[Axis];
+	float AxisMax = CentroidBBox.Max[Axis];
+
+	/* One instance per leaf, unless their centroids can not be separated */
+	if (iEnd - iStart <= 1 || AxisMax == AxisMin)
+	{
+		return iNode;
+	}
+
+	auto BucketIndex = [&](const TLASInstance & Inst)
+	{
+		uint32_t iBucket = uint32_t(TLAS_BUCKET_NUM * (Inst.BBox.GetCenter()[Axis] - AxisMin) / (AxisMax - AxisMin));
+		return std::min(iBucket, TLAS_BUCKET_NUM - 1);
+	};
+
+	TLASBucket Buckets[TLAS_BUCKET_NUM];
+	for (uint32_t i = iStart; i < iEnd; i++)
+	{
+		TLASBucket & Bucket = Buckets[BucketIndex(m_Instances[i])];
+		Bucket.nInstances++;
+		Bucket.BBox.ExpandBy(m_Instances[i].BBox);
+	}
+
+	/* Find the split with the minimal SAH cost (sweep from both sides) */
+	float RightArea[TLAS_BUCKET_NUM];
+	uint32_t RightCount[TLAS_BUCKET_NUM];
+	BoundingBox3f RightBBox;
+	uint32_t nRight = 0;
+	for (uint32_t i = TLAS_BUCKET_NUM - 1; i > 0; i--)
+	{
+		RightBBox.ExpandBy(Buckets[i].BBox);
+		nRight += Buckets[i].nInstances;
+		RightArea[i] = (nRight > 0) ? RightBBox.GetSurfaceArea() : 0.0f;
+		RightCount[i] = nRight;
+	}
+
+	float MinCost = std::numeric_limits<float>::infinity();
+	uint32_t iMinCostSplit = 0;
+	BoundingBox3f LeftBBox;
+	uint32_t nLeft = 0;
+	for (uint32_t i = 0; i < TLAS_BUCKET_NUM - 1; i++)
+	{
+		LeftBBox.ExpandBy(Buckets[i].BBox);
+		nLeft += Buckets[i].nInstances;
+		if (nLeft == 0 || RightCount[i + 1] == 0)
+		{
+			continue;
+		}
+
+		float Cost = nLeft * LeftBBox.GetSurfaceArea() + RightCount[i + 1] * RightArea[i + 1];
+		if (Cost < MinCost)
+		{
+			MinCost = Cost;
+			iMinCostSplit = i;
+		}
+	}
+
+	TLASInstance * pMid = std::partition(m_Instances.data() + iStart, m_Instances.data() + iEnd,
+		[&](const TLASInstance & Inst) { return BucketIndex(Inst) <= iMinCostSplit; }
+	);
+	uint32_t iMid = uint32_t(pMid - m_Instances.data());
+
+	RecursiveBuild(iStart, iMid);
+	uint32_t iRightNode = RecursiveBuild(iMid, iEnd);
+	m_Nodes[iNode].nRightChildOffset = iRightNode - iNode;
+
+	return iNode;
+}
+
+size_t TwoLevelAcceleration::GetUsedMemoryForShape() const
+{
+	size_t Size = 0;
+	for (const Acceleration * pBottomLevel : m_pBottomLevels)
+	{
+		Size += pBottomLevel->GetUsedMemoryForShape();
+	}
+	return Size;
+}
+
+bool TwoLevelAcceleration::IntersectInstance(const TLASInstance & Inst, const Ray3f & Ray, Intersection & Isect) const
+{
+	if (Inst.pInstance == nullptr)
+	{
+		return Inst.pBottomLevel->RayIntersect(Ray, Isect, false);
+	}
+
+	return Inst.pBottomLevel->RayIntersect(TransformRay(Inst.pInstance->GetWorldToObject(), Ray), Isect, false);
+}
+
+bool TwoLevelAcceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
+{
+	if (bShadowRay)
+	{
+		return Occluded(Ray);
+	}
+
+	if (m_Nodes.empty())
+	{
+		return false;
+	}
+
+	const TLASInstance * pFoundInstance = nullptr;
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	TLASTraversal Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
+
+	float NearT, FarT;
+	if (!m_Nodes[0].BBox.RayIntersect(RayCopy, NearT, FarT) || FarT < RayCopy.MinT || NearT > RayCopy.MaxT)
+	{
+		return false;
+	}
+
+	// Push the root node
+	Stack[iStackPtr++] = TLASTraversal(0, NearT);
+
+	while (iStackPtr > 0)
+	{
+		// Pop the next node
+		TLASTraversal TopNode = Stack[--iStackPtr];
+		const TLASNode & CurrentNode = m_Nodes[TopNode.Idx];
+
+		// If the node is further than the cloest found intersection, continue
+		if (TopNode.MinT > RayCopy.MaxT)
+		{
+			continue;
+		}
+
+		// Leaf node -> Traverse the bottom-level acceleration of the instances
+		if (CurrentNode.nRightChildOffset == 0)
+		{
+			for (uint32_t i = 0; i < CurrentNode.nInstances; i++)
+			{
+				const TLASInstance & Inst = m_Instances[CurrentNode.iStart + i];
+
+				Intersection InstanceIsect;
+				if (IntersectInstance(Inst, RayCopy, InstanceIsect))
+				{
+					Isect = InstanceIsect;
+					RayCopy.MaxT = Isect.T;
+					pFoundInstance = &Inst;
+				}
+			}
+		}
+		// Not a leaf -> Visit the nearer child first
+		else
+		{
+			uint32_t iLeftNode = TopNode.Idx + 1;
+			uint32_t iRightNode = TopNode.Idx + CurrentNode.nRightChildOffset;
+
+			float HitLeftNearT, HitLeftFarT;
+			float HitRightNearT, HitRightFarT;
+
+			bool bHitLeft = m_Nodes[iLeftNode].BBox.RayIntersect(RayCopy, HitLeftNearT, HitLeftFarT) &&
+				HitLeftFarT >= RayCopy.MinT && HitLeftNearT <= RayCopy.MaxT;
+			bool bHitRight = m_Nodes[iRightNode].BBox.RayIntersect(RayCopy, HitRightNearT, HitRightFarT) &&
+				HitRightFarT >= RayCopy.MinT && HitRightNearT <= RayCopy.MaxT;
+
+			if (bHitLeft && bHitRight)
+			{
+				// Push the farther first and then the near one
+				if (HitRightNearT < HitLeftNearT)
+				{
+					Stack[iStackPtr++] = TLASTraversal(iLeftNode, HitLeftNearT);
+					Stack[iStackPtr++] = TLASTraversal(iRightNode, HitRightNearT);
+				}
+				else
+				{
+					Stack[iStackPtr++] = TLASTraversal(iRightNode, HitRightNearT);
+					Stack[iStackPtr++] = TLASTraversal(iLeftNode, HitLeftNearT);
+				}
+			}
+			else if (bHitLeft)
+			{
+				Stack[iStackPtr++] = TLASTraversal(iLeftNode, HitLeftNearT);
+			}
+			else if (bHitRight)
+			{
+				Stack[iStackPtr++] = TLASTraversal(iRightNode, HitRightNearT);
+			}
+		}
+	}
+
+	if (pFoundInstance == nullptr)
+	{
+		return false;
+	}
+
+	/* The bottom-level acceleration has already filled the record in object space */
+	if (pFoundInstance->pInstance != nullptr)
+	{
+		TransformIntersection(pFoundInstance->pInstance->GetObjectToWorld(), Isect);
+	}
+
+	return true;
+}
+
+bool TwoLevelAcceleration::Occluded(const Ray3f & Ray) const
+{
+	if (m_Nodes.empty() || !m_Nodes[0].BBox.RayIntersect(Ray))
+	{
+		return false;
+	}
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	uint32_t Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	// Push the root node
+	Stack[iStackPtr++] = 0;
+
+	while (iStackPtr > 0)
+	{
+		uint32_t Idx = Stack[--iStackPtr];
+		const TLASNode & CurrentNode = m_Nodes[Idx];
+
+		// Leaf node -> Any intersection terminates the query
+		if (CurrentNode.nRightChildOffset == 0)
+		{
+			for (uint32_t i = 0; i < CurrentNode.nInstances; i++)
+			{
+				const TLASInstance & Inst = m_Instances[CurrentNode.iStart + i];
+				bool bOccluded = (Inst.pInstance == nullptr) ?
+					Inst.pBottomLevel->Occluded(Ray) :
+					Inst.pBottomLevel->Occluded(Inst.pInstance->GetWorldToObject() * Ray);
+				if (bOccluded)
+				{
+					return true;
+				}
+			}
+		}
+		// Not a leaf -> Visit the children in any order
+		else
+		{
+			uint32_t iLeftNode = Idx + 1;
+			uint32_t iRightNode = Idx + CurrentNode.nRightChildOffset;
+
+			if (m_Nodes[iRightNode].BBox.RayIntersect(Ray))
+			{
+				Stack[iStackPtr++] = iRightNode;
+			}
+			if (m_Nodes[iLeftNode].BBox.RayIntersect(Ray))
+			{
+				Stack[iStackPtr++] = iLeftNode;
+			}
+		}
+	}
+
+	return false;
+}
+
+std::string TwoLevelAcceleration::ToString() const
+{
+	return tfm::format(
+		"TwoLevelAcceleration[\n"
+		"  bottomLevel = %s,\n"
+		"  instances = %s,\n"
+		"  meshes = %s,\n"
+		"  nodes = %s\n"
+		"]",
+		m_BottomLevel,
+		m_Instances.size(),
+		m_pBottomLevels.size(),
+		m_Nodes.size()
+	);
+}
+
+NAMESPACE_END
@@ -0,0 +1,648 @@
+#include <acceleration\WideBVHAcceleration.hpp>
+#include <core\Timer.hpp>
+#include <core\Shape.hpp>
+#include <core\MemoryArena.hpp>
+#include <tbb\tbb.h>
+#include <immintrin.h>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(QBVHAcceleration, XML_ACCELERATION_QBVH);
+REGISTER_CLASS(OBVHAcceleration, XML_ACCELERATION_OBVH);
+
+constexpr uint32_t WIDE_BVH_LEAF_FLAG = 0x80000000;
+constexpr uint32_t WIDE_BVH_EMPTY_SLOT = 0xffffffff;
+
+/// The children of the nodes above this depth are refitted as separate tasks
+constexpr uint32_t WIDE_BVH_PARALLEL_REFIT_DEPTH = 3;
+
+struct WideBVHTraversal
+{
+	uint32_t iChild;
+	uint32_t nShapes;
+	float MinT;
+};
+
+/// Ray data splatted into SIMD registers for the slab test
+struct WideBVHRay
+{
+	__m128 Origin[3];
+	__m128 InvDirection[3];
+#if defined(__AVX__)
+	__m256 Origin8[3];
+	__m256 InvDirection8[3];
+#endif
+	bool bDirNeg[3];
+};
+
+/// Widen the far distance a bit (1 + 2 * gamma(3)) to keep the slab test conservative
+static const float WIDE_BVH_ROBUST_SCALE = 1.0f + 3.0f * std::numeric_limits<float>::epsilon();
+
+/**
+* \brief Test 4 children boxes against the ray, return the hit mask and the
+* near distance of each child. NaN produced by (0 * inf) is ignored by passing
+* it as the first operand of min/max.
+*/
+static inline int SlabTest4(
+	const float * pNear[3],
+	const float * pFar[3],
+	const WideBVHRay & Ray,
+	float MinT,
+	float MaxT,
+	float * pNearT
+)
+{
+	__m128 NearT = _mm_set1_ps(MinT);
+	__m128 FarT = _mm_set1_ps(std::numeric_limits<float>::infinity());
+	for (int i = 0; i < 3; i++)
+	{
+		__m128 T0 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pNear[i]), Ray.Origin[i]), Ray.InvDirection[i]);
+		__m128 T1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(pFar[i]), Ray.Origin[i]), Ray.InvDirection[i]);
+		NearT = _mm_max_ps(T0, NearT);
+		FarT = _mm_min_ps(T1, FarT);
+	}
+	FarT = _mm_min_ps(_mm_mul_ps(FarT, _mm_set1_ps(WIDE_BVH_ROBUST_SCALE)), _mm_set1_ps(MaxT));
+	_mm_storeu_ps(pNearT, NearT);
+	return _mm_movemask_ps(_mm_cmple_ps(NearT, FarT));
+}
+
+/// Test all the children of a node, a 8-wide node is handled as two 4-wide halves without AVX
+template <uint32_t Width>
+struct WideBVHSlabTest
+{
+	static inline int Test(
+		const float * pNear[3],
+		const float * pFar[3],
+		const WideBVHRay & Ray,
+		float MinT,
+		float MaxT,
+		float * pNearT
+	)
+	{
+		int HitMask = 0;
+		for (uint32_t j = 0; j < Width; j += 4)
+		{
+			const float * pNearQuad[3] = { pNear[0] + j, pNear[1] + j, pNear[2] + j };
+			const float * pFarQuad[3] = { pFar[0] + j, pFar[1] + j, pFar[2] + j };
+			HitMask |= SlabTest4(pNearQuad, pFarQuad, Ray, MinT, MaxT, pNearT + j) << j;
+		}
+		return HitMask;
+	}
+};
+
+#if defined(__AVX__)
+template <>
+struct WideBVHSlabTest<8>
+{
+	static inline int Test(
+		const float * pNear[3],
+		const float * pFar[3],
+		const WideBVHRay & Ray,
+		float MinT,
+		float MaxT,
+		float * pNearT
+	)
+	{
+		__m256 NearT = _mm256_set1_ps(MinT);
+		__m256 FarT = _mm256_set1_ps(std::numeric_limits<float>::infinity());
+		for (int i = 0; i < 3; i++)
+		{
+			__m256 T0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(pNear[i]), Ray.Origin8[i]), Ray.InvDirection8[i]);
+			__m256 T1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_load_ps(pFar[i]), Ray.Origin8[i]), Ray.InvDirection8[i]);
+			NearT = _mm256_max_ps(T0, NearT);
+			FarT = _mm256_min_ps(T1, FarT);
+		}
+		FarT = _mm256_min_ps(_mm256_mul_ps(FarT, _mm256_set1_ps(WIDE_BVH_ROBUST_SCALE)), _mm256_set1_ps(MaxT));
+		_mm256_storeu_ps(pNearT, NearT);
+		return _mm256_movemask_ps(_mm256_cmp_ps(NearT, FarT, _CMP_LE_OQ));
+	}
+};
+#endif
+
+template <uint32_t Width>
+TWideBVHAcceleration<Width>::TWideBVHAcceleration(const PropertyList & PropList) :
+	BVHAcceleration(PropList)
+{
+	if (m_bCompressed)
+	{
+		LOG(WARNING) << "Compressed nodes are not supported by the " << GetName() << ", use full precision nodes";
+		m_bCompressed = false;
+	}
+	if (m_Traversal != XML_ACCELERATION_BVH_TRAVERSAL_STACK)
+	{
+		LOG(WARNING) << "Stackless traversal is not supported by the " << GetName() << ", use stack traversal";
+		m_Traversal = XML_ACCELERATION_BVH_TRAVERSAL_STACK;
+	}
+}
+
+template <uint32_t Width>
+TWideBVHAcceleration<Width>::~TWideBVHAcceleration()
+{
+	FreeAligned(m_pWideTree);
+}
+
+template <uint32_t Width>
+void TWideBVHAcceleration<Width>::Build()
+{
+	BVHAcceleration::Build();
+	Collapse();
+}
+
+template <uint32_t Width>
+void TWideBVHAcceleration<Width>::Refit()
+{
+	Timer RefitTimer;
+
+	BoundingBox3f BBox;
+	float Cost = ComputeWideNodeCost(0, 0, true, BBox);
+
+	// The topology of the wide tree can not be partially rebuilt, rebuild it from scratch
+	bool bRebuild = Cost > m_RebuildThreshold * m_WideCost;
+	if (bRebuild)
+	{
+		// Merge the references duplicated by spatial splits
+		if (m_SplitMethod == XML_ACCELERATION_BVH_SPLIT_METHOD_SBVH)
+		{
+			std::sort(m_pShapes.begin(), m_pShapes.end());
+			m_pShapes.erase(std::unique(m_pShapes.begin(), m_pShapes.end()), m_pShapes.end());
+		}
+
+		FreeAligned(m_pWideTree);
+		m_pWideTree = nullptr;
+		BuildFlatTree();
+		Collapse();
+	}
+
+	m_BBox = BBox;
+
+	LOG(INFO) << "Refit " << GetName() << " (" << m_nWideNodes << " nodes" << (bRebuild ? ", rebuilt" : "") << ") in " <<
+		RefitTimer.ElapsedString() << ".";
+
+	BakeTriangles();
+}
+
+template <uint32_t Width>
+void TWideBVHAcceleration<Width>::Collapse()
+{
+	Timer WideBVHBuildTimer;
+
+	std::vector<WideBVHNode> WideNodes;
+	WideNodes.reserve(m_nNodes / (Width - 1) + 1);
+
+	if (m_pFlatTree[0].nRightChildOffset == 0)
+	{
+		// The whole tree is a single leaf
+		WideNodes.emplace_back();
+		for (uint32_t i = 0; i < Width; i++)
+		{
+			SetChild(WideNodes[0], i, BoundingBox3f(), WIDE_BVH_EMPTY_SLOT, 0);
+		}
+		SetChild(WideNodes[0], 0, m_pFlatTree[0].BBox, m_pFlatTree[0].iStart | WIDE_BVH_LEAF_FLAG, m_pFlatTree[0].nShapes);
+		m_nWideLeafs = 1;
+	}
+	else
+	{
+		CollapseNode(0, WideNodes);
+	}
+
+	m_nWideNodes = uint32_t(WideNodes.size());
+	m_pWideTree = AllocAligned<WideBVHNode>(m_nWideNodes);
+	memcpy(m_pWideTree, WideNodes.data(), m_nWideNodes * sizeof(WideBVHNode));
+
+	// The binary tree is not needed any more
+	ReleaseFlatTree();
+	std::vector<float>().swap(m_NodeCosts);
+
+	BoundingBox3f BBox;
+	m_WideCost = ComputeWideNodeCost(0, 0, false, BBox);
+
+	LOG(INFO) << "Collapse to " << GetName() << " (" << m_nWideNodes << " nodes, with " << m_nWideLeafs << " leafs) in " <<
+		WideBVHBuildTimer.ElapsedString() << " and take " << MemString(m_nWideNodes * sizeof(WideBVHNode)) << ".";
+}
+
+template <uint32_t Width>
+bool TWideBVHAcceleration<Width>::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bShadowRay) const
+{
+	bool bFoundIntersection = false;       // Was an intersection found so far?
+	Shape * pFoundShape = nullptr;
+
+	const uint32_t STACK_MAX_SIZE = 1024;
+	WideBVHTraversal Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	Ray3f RayCopy(Ray); /// Make a copy of the ray (we will need to update its '.MaxT' value)
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	WideBVHRay SIMDRay;
+	for (int i = 0; i < 3; i++)
+	{
+		SIMDRay.Origin[i] = _mm_set1_ps(Ray.Origin[i]);
+		SIMDRay.InvDirection[i] = _mm_set1_ps(Ray.DirectionReciprocal[i]);
+#if defined(__AVX__)
+		SIMDRay.Origin8[i] = _mm256_set1_ps(Ray.Origin[i]);
+		SIMDRay.InvDirection8[i] = _mm256_set1_ps(Ray.DirectionReciprocal[i]);
+#endif
+		SIMDRay.bDirNeg[i] = Ray.DirectionReciprocal[i] < 0.0f;
+	}
+
+	// Push the root node
+	Stack[iStackPtr].iChild = 0;
+	Stack[iStackPtr].nShapes = 0;
+	Stack[iStackPtr].MinT = -std::numeric_limits<float>::max();
+	iStackPtr++;
+
+	while (iStackPtr > 0)
+	{
+		// Pop the next node
+		const WideBVHTraversal TopNode = Stack[--iStackPtr];
+
+		// If the node is further than the cloest found intersection, continue
+		if (TopNode.MinT > RayCopy.MaxT)
+		{
+			continue;
+		}
+
+		// Leaf node -> Check intersection
+		if ((TopNode.iChild & WIDE_BVH_LEAF_FLAG) != 0)
+		{
+			uint32_t iStart = TopNode.iChild & ~WIDE_BVH_LEAF_FLAG;
+			if (m_TrianglePacks.IsBuilt())
+			{
+				float U, V, T;
+				uint32_t iShape;
+				if (m_TrianglePacks.RayIntersect(PackRay, iStart, TopNode.nShapes, RayCopy.MaxT, iShape, U, V, T))
+				{
+					Shape * pShape = m_pShapes[iShape];
+
+					if (bShadowRay)
+					{
+						return true;
+					}
+
+					RayCopy.MaxT = Isect.T = T;
+					Isect.UV = Point2f(U, V);
+					Isect.pShape = pShape;
+
+					pFoundShape = pShape;
+					bFoundIntersection = true;
+				}
+			}
+			else
+			{
+				for (uint32_t i = 0; i < TopNode.nShapes; i++)
+				{
+					float U, V, T;
+					uint32_t iShape = iStart + i;
+					bool bHit = (m_pInlineTriangles != nullptr) ?
+						m_pInlineTriangles[iShape].RayIntersect(RayCopy, U, V, T) :
+						m_pShapes[iShape]->RayIntersect(RayCopy, U, V, T);
+					if (bHit)
+					{
+						Shape * pShape = m_pShapes[iShape];
+
+						if (bShadowRay)
+						{
+							return true;
+						}
+
+						RayCopy.MaxT = Isect.T = T;
+						Isect.UV = Point2f(U, V);
+						Isect.pShape = pShape;
+
+						pFoundShape = pShape;
+						bFoundIntersection = true;
+					}
+				}
+			}
+			continue;
+		}
+
+		// Interior node -> Test all the children at once
+		const WideBVHNode & Node = m_pWideTree[TopNode.iChild];
+
+		const float * pNear[3], * pFar[3];
+		for (int i = 0; i < 3; i++)
+		{
+			pNear[i] = SIMDRay.bDirNeg[i] ? Node.BBoxMax[i] : Node.BBoxMin[i];
+			pFar[i] = SIMDRay.bDirNeg[i] ? Node.BBoxMin[i] : Node.BBoxMax[i];
+		}
+
+		float NearT[Width];
+		int HitMask = WideBVHSlabTest<Width>::Test(pNear, pFar, SIMDRay, RayCopy.MinT, RayCopy.MaxT, NearT);
+
+		if (HitMask == 0)
+		{
+			continue;
+		}
+
+		// Sort the hit children by distance (insertion sort, at most 'Width' entries)
+		uint32_t iHitChildren[Width];
+		uint32_t nHitChildren = 0;
+		for (uint32_t j = 0; j < Width; j++)
+		{
+			if ((HitMask & (1 << j)) == 0)
+			{
+				continue;
+			}
+			uint32_t k = nHitChildren++;
+			while (k > 0 && NearT[iHitChildren[k - 1]] < NearT[j])
+			{
+				iHitChildren[k] = iHitChildren[k - 1];
+				k--;
+			}
+			iHitChildren[k] = j;
+		}
+
+		// Push the farther first and then the near one
+		for (uint32_t j = 0; j < nHitChildren; j++)
+		{
+			uint32_t iSlot = iHitChildren[j];
+			Stack[iStackPtr].iChild = Node.iChild[iSlot];
+			Stack[iStackPtr].nShapes = Node.nShapes[iSlot];
+			Stack[iStackPtr].MinT = NearT[iSlot];
+			iStackPtr++;
+		}
+	}
+
+	if (bFoundIntersection)
+	{
+		pFoundShape->PostIntersect(Isect);
+		Isect.ComputeScreenSpacePartial(Ray);
+	}
+
+	return bFoundIntersection;
+}
+
+template <uint32_t Width>
+bool TWideBVHAcceleration<Width>::Occluded(const Ray3f & Ray) const
+{
+	const uint32_t STACK_MAX_SIZE = 1024;
+	uint32_t Stack[STACK_MAX_SIZE];
+	uint32_t iStackPtr = 0;
+
+	TrianglePackArray::RayData PackRay;
+	if (m_TrianglePacks.IsBuilt())
+	{
+		m_TrianglePacks.PrepareRay(Ray, PackRay);
+	}
+
+	WideBVHRay SIMDRay;
+	for (int i = 0; i < 3; i++)
+	{
+		SIMDRay.Origin[i] = _mm_set1_ps(Ray.Origin[i]);
+		SIMDRay.InvDirection[i] = _mm_set1_ps(Ray.DirectionReciprocal[i]);
+#if defined(__AVX__)
+		SIMDRay.Origin8[i] = _mm256_set1_ps(Ray.Origin[i]);
+		SIMDRay.InvDirection8[i] = _mm256_set1_ps(Ray.DirectionReciprocal[i]);
+#endif
+		SIMDRay.bDirNeg[i] = Ray.DirectionReciprocal[i] < 0.0f;
+	}
+
+	// Push the root node
+	Stack[iStackPtr++] = 0;
+
+	while (iStackPtr > 0)
+	{
+		const WideBVHNode & Node = m_pWideTree[Stack[--iStackPtr]];
+
+		const float * pNear[3], * pFar[3];
+		for (int i = 0; i < 3; i++)
+		{
+			pNear[i] = SIMDRay.bDirNeg[i] ? Node.BBoxMax[i] : Node.BBoxMin[i];
+			pFar[i] = SIMDRay.bDirNeg[i] ? Node.BBoxMin[i] : Node.BBoxMax[i];
+		}
+
+		float NearT[Width];
+		int HitMask = WideBVHSlabTest<Width>::Test(pNear, pFar, SIMDRay, Ray.MinT, Ray.MaxT, NearT);
+
+		// Leafs are tested right away, interior nodes are visited in any order
+		for (uint32_t j = 0; HitMask != 0; j++, HitMask >>= 1)
+		{
+			if ((HitMask & 1) == 0)
+			{
+				continue;
+			}
+
+			if ((Node.iChild[j] & WIDE_BVH_LEAF_FLAG) != 0)
+			{
+				if (OccludedLeaf(Ray, PackRay, Node.iChild[j] & ~WIDE_BVH_LEAF_FLAG, Node.nShapes[j]))
+				{
+					return true;
+				}
+			}
+			else
+			{
+				Stack[iStackPtr++] = Node.iChild[j];
+			}
+		}
+	}
+
+	return false;
+}
+
+template <uint32_t Width>
+void TWideBVHAcceleration<Width>::RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const
+{
+	// The binary tree has been released after the collapse, the rays are traced one by one
+	Acceleration::RayIntersectPacket(pRays, pIsects, pbHits, nRays);
+}
+
+template <uint32_t Width>
+std::string TWideBVHAcceleration<Width>::ToString() const
+{
+	return tfm::format(
+		"%sAcceleration[\n"
+		"  leafSize = %s,\n"
+		"  node = %s,\n"
+		"  leafNode = %s\n"
+		"  splitMethod = %s\n"
+		"  inlineTriangle = %s\n"
+		"  trianglePack = %s\n"
+		"  watertight = %s\n"
+		"  rebuildThreshold = %f\n"
+		"]",
+		GetName(),
+		m_LeafSize,
+		m_nWideNodes,
+		m_nWideLeafs,
+		m_SplitMethod,
+		m_bInlineTriangle ? "true" : "false",
+		m_TrianglePack,
+		m_bWatertight ? "true" : "false",
+		m_RebuildThreshold
+	);
+}
+
+template <uint32_t Width>
+uint32_t TWideBVHAcceleration<Width>::CollapseNode(uint32_t iFlatNode, std::vector<WideBVHNode> & WideNodes)
+{
+	// Gather up to 'Width' descendants of the binary node by repeatedly
+	// opening the interior child with the largest surface area
+	uint32_t iChildren[Width];
+	uint32_t nChildren = 2;
+	iChildren[0] = iFlatNode + 1;
+	iChildren[1] = iFlatNode + m_pFlatTree[iFlatNode].nRightChildOffset;
+
+	while (nChildren < Width)
+	{
+		int iOpen = -1;
+		float MaxArea = -1.0f;
+		for (uint32_t i = 0; i < nChildren; i++)
+		{
+			const BVHFlatNode & Child = m_pFlatTree[iChildren[i]];
+			if (Child.nRightChildOffset != 0 && Child.BBox.GetSurfaceArea() > MaxArea)
+			{
+				MaxArea = Child.BBox.GetSurfaceArea();
+				iOpen = int(i);
+			}
+		}
+
+		// All the children are leafs
+		if (iOpen == -1)
+		{
+			break;
+		}
+
+		uint32_t iOpenNode = iChildren[iOpen];
+		iChildren[iOpen] = iOpenNode + 1;
+		iChildren[nChildren++] = iOpenNode + m_pFlatTree[iOpenNode].nRightChildOffset;
+	}
+
+	uint32_t iWideNode = uint32_t(WideNodes.size());
+	WideNodes.emplace_back();
+
+	for (uint32_t i = 0; i < Width; i++)
+	{
+		if (i >= nChildren)
+		{
+			SetChild(WideNodes[iWideNode], i, BoundingBox3f(), WIDE_BVH_EMPTY_SLOT, 0);
+			continue;
+		}
+
+		const BVHFlatNode & Child = m_pFlatTree[iChildren[i]];
+		if (Child.nRightChildOffset == 0)
+		{
+			SetChild(WideNodes[iWideNode], i, Child.BBox, Child.iStart | WIDE_BVH_LEAF_FLAG, Child.nShapes);
+			m_nWideLeafs++;
+		}
+		else
+		{
+			// Note : 'WideNodes' may be reallocated in the recursion
+			uint32_t iChildNode = CollapseNode(iChildren[i], WideNodes);
+			SetChild(WideNodes[iWideNode], i, Child.BBox, iChildNode, 0);
+		}
+	}
+
+	return iWideNode;
+}
+
+template <uint32_t Width>
+float TWideBVHAcceleration<Width>::ComputeWideNodeCost(uint32_t iNode, uint32_t Depth, bool bRefit, BoundingBox3f & BBox)
+{
+	WideBVHNode & Node = m_pWideTree[iNode];
+
+	BoundingBox3f ChildBBoxes[Width];
+	float ChildCosts[Width];
+
+	auto ChildMap = [&](uint32_t i)
+	{
+		uint32_t iChild = Node.iChild[i];
+		ChildCosts[i] = 0.0f;
+
+		if (iChild == WIDE_BVH_EMPTY_SLOT)
+		{
+			return;
+		}
+
+		if ((iChild & WIDE_BVH_LEAF_FLAG) != 0)
+		{
+			// Leaf child -> The cost is the number of intersection tests
+			ChildCosts[i] = float(Node.nShapes[i]);
+			if (bRefit)
+			{
+				uint32_t iStart = iChild & ~WIDE_BVH_LEAF_FLAG;
+				for (uint32_t j = iStart; j < iStart + Node.nShapes[i]; j++)
+				{
+					ChildBBoxes[i].ExpandBy(m_pShapes[j]->GetBoundingBox());
+				}
+			}
+		}
+		else
+		{
+			ChildCosts[i] = ComputeWideNodeCost(iChild, Depth + 1, bRefit, ChildBBoxes[i]);
+		}
+
+		if (bRefit)
+		{
+			SetChild(Node, i, ChildBBoxes[i], iChild, Node.nShapes[i]);
+		}
+		else
+		{
+			ChildBBoxes[i] = BoundingBox3f(
+				Point3f(Node.BBoxMin[0][i], Node.BBoxMin[1][i], Node.BBoxMin[2][i]),
+				Point3f(Node.BBoxMax[0][i], Node.BBoxMax[1][i], Node.BBoxMax[2][i])
+			);
+		}
+	};
+
+	if (Depth < WIDE_BVH_PARALLEL_REFIT_DEPTH)
+	{
+		tbb::parallel_for(uint32_t(0), Width, ChildMap);
+	}
+	else
+	{
+		for (uint32_t i = 0; i < Width; i++)
+		{
+			ChildMap(i);
+		}
+	}
+
+	BBox.Reset();
+	for (uint32_t i = 0; i < Width; i++)
+	{
+		if (Node.iChild[i] != WIDE_BVH_EMPTY_SLOT)
+		{
+			BBox.ExpandBy(ChildBBoxes[i]);
+		}
+	}
+
+	float SurfaceArea = BBox.GetSurfaceArea();
+	float Cost = 0.125f;
+	for (uint32_t i = 0; i < Width; i++)
+	{
+		if (Node.iChild[i] != WIDE_BVH_EMPTY_SLOT)
+		{
+			Cost += (SurfaceArea > 0.0f) ? ChildBBoxes[i].GetSurfaceArea() * ChildCosts[i] / SurfaceArea : ChildCosts[i];
+		}
+	}
+	return Cost;
+}
+
+template <uint32_t Width>
+void TWideBVHAcceleration<Width>::SetChild(WideBVHNode & Node, uint32_t iSlot, const BoundingBox3f & BBox, uint32_t iChild, uint32_t nShapes) const
+{
+	// An empty slot has an inverted box (Min = +inf, Max = -inf) which is never hit
+	for (int i = 0; i < 3; i++)
+	{
+		Node.BBoxMin[i][iSlot] = BBox.Min[i];
+		Node.BBoxMax[i][iSlot] = BBox.Max[i];
+	}
+	Node.iChild[iSlot] = iChild;
+	Node.nShapes[iSlot] = nShapes;
+}
+
+template <uint32_t Width>
+const char * TWideBVHAcceleration<Width>::GetName() const
+{
+	return Width == 8 ? "OBVH" : "QBVH";
+}
+
+template class TWideBVHAcceleration<4>;
+template class TWideBVHAcceleration<8>;
+
+NAMESPACE_END
@@ -1,13 +1,67 @@
 #include <core\Acceleration.hpp>
 #include <core\Shape.hpp>
+#include <tbb\tbb.h>
 
 NAMESPACE_BEGIN
 
 REGISTER_CLASS(Acceleration, XML_ACCELERATION_BRUTO_LOOP);
 
-Acceleration::Acceleration(const PropertyList & PropList)
+static bool StatisticsEnabled = false;
+static tbb::enumerable_thread_specific<TraversalStatistics> ThreadStatistics;
+
+TraversalStatistics & TraversalStatistics::operator+=(const TraversalStatistics & Other)
 {
+	auto AddCounters = [](Counters & Dst, const Counters & Src)
+	{
+		Dst.nRays += Src.nRays;
+		Dst.nNodes += Src.nNodes;
+		Dst.nBoxTests += Src.nBoxTests;
+		Dst.nTriangleTests += Src.nTriangleTests;
+	};
+
+	AddCounters(ClosestHit, Other.ClosestHit);
+	AddCounters(Shadow, Other.Shadow);
+	return *this;
+}
+
+std::string TraversalStatistics::ToString() const
+{
+	auto CountersToString = [](const Counters & C)
+	{
+		double InvRays = (C.nRays > 0) ? 1.0 / double(C.nRays) : 0.0;
+		return tfm::format("%llu rays, %.2f nodes, %.2f box tests and %.2f triangle tests per ray",
+			(unsigned long long)(C.nRays), C.nNodes * InvRays, C.nBoxTests * InvRays, C.nTriangleTests * InvRays);
+	};
+
+	return tfm::format(
+		"TraversalStatistics[\n"
+		"  closestHit = %s,\n"
+		"  shadow = %s\n"
+		"]",
+		CountersToString(ClosestHit),
+		CountersToString(Shadow)
+	);
+}
 
+TraversalCounter::~TraversalCounter()
+{
+	if (StatisticsEnabled)
+	{
+		TraversalStatistics::Counters & Counters = bShadowRay ?
+			Acceleration::GetThreadStatistics().Shadow : Acceleration::GetThreadStatistics().ClosestHit;
+		Counters.nRays += nRays;
+		Counters.nNodes += nNodes;
+		Counters.nBoxTests += nBoxTests;
+		Counters.nTriangleTests += nTriangleTests;
+	}
+}
+
+Acceleration::Acceleration(const PropertyList & PropList)
+{
+	if (PropList.GetBoolean(XML_ACCELERATION_STATISTICS, DEFAULT_ACCELERATION_STATISTICS))
+	{
+		SetStatisticsEnabled(true);
+	}
 }
 
 void Acceleration::AddMesh(Mesh * pMesh)
@@ -15,23 +69,37 @@ void Acceleration::AddMesh(Mesh * pMesh)
 	m_BBox.ExpandBy(pMesh->GetBoundingBox());
 
 	m_pShapes.reserve(m_pShapes.size() + pMesh->GetTriangleCount());
-	MatrixXu Indices = pMesh->GetIndices();
-	uint32_t * pData = Indices.data();
+	const MatrixXuMap & Indices = pMesh->GetIndices();
 	Triangle * pTri = m_MemoryArena.Alloc<Triangle>(Indices.cols());
 	for (std::ptrdiff_t i = 0; i < Indices.cols(); i++)
 	{
 		pTri[i].m_pMesh = pMesh;
-		pTri[i].m_pFacet = pData + i * 3;
 		pTri[i].m_iFacet = uint32_t(i);
 		m_pShapes.push_back((Shape*)(&pTri[i]));
 	}
 }
 
+void Acceleration::AddInstance(Instance * pInstance)
+{
+	throw HikariException("Acceleration::AddInstance(): instances are only supported by the \"%s\" acceleration!",
+		XML_ACCELERATION_TWO_LEVEL
+	);
+}
+
 void Acceleration::Build()
 {
 	/* Nothing to do here for now */
 }
 
+void Acceleration::Refit()
+{
+	m_BBox.Reset();
+	for (const Shape * pShape : m_pShapes)
+	{
+		m_BBox.ExpandBy(pShape->GetBoundingBox());
+	}
+}
+
 const BoundingBox3f & Acceleration::GetBoundingBox() const
 {
 	return m_BBox;
@@ -79,6 +147,28 @@ bool Acceleration::RayIntersect(const Ray3f & Ray, Intersection & Isect, bool bS
 	return bFoundIntersection;
 }
 
+bool Acceleration::Occluded(const Ray3f & Ray) const
+{
+	for (size_t i = 0; i < m_pShapes.size(); i++)
+	{
+		float U, V, T;
+		if (m_pShapes[i]->RayIntersect(Ray, U, V, T))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void Acceleration::RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const
+{
+	for (uint32_t i = 0; i < nRays; i++)
+	{
+		pbHits[i] = RayIntersect(pRays[i], pIsects[i], false);
+	}
+}
+
 Object::EClassType Acceleration::GetClassType() const
 {
 	return EClassType::EAcceleration;
@@ -89,4 +179,29 @@ std::string Acceleration::ToString() const
 	return "BrutoLoop[]";
 }
 
+void Acceleration::SetStatisticsEnabled(bool bEnabled)
+{
+	StatisticsEnabled = bEnabled;
+}
+
+bool Acceleration::IsStatisticsEnabled()
+{
+	return StatisticsEnabled;
+}
+
+TraversalStatistics & Acceleration::GetThreadStatistics()
+{
+	return ThreadStatistics.local();
+}
+
+TraversalStatistics Acceleration::GetStatistics()
+{
+	TraversalStatistics Statistics;
+	for (const TraversalStatistics & Local : ThreadStatistics)
+	{
+		Statistics += Local;
+	}
+	return Statistics;
+}
+
 NAMESPACE_END
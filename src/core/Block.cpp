@@ -6,6 +6,40 @@
 
 NAMESPACE_BEGIN
 
+void PixelStatistics::Put(float Value)
+{
+	nSamples++;
+	float Delta = Value - Mean;
+	Mean += Delta / float(nSamples);
+	M2 += Delta * (Value - Mean);
+}
+
+void PixelStatistics::Put(const PixelStatistics & Stats)
+{
+	if (Stats.nSamples == 0)
+	{
+		return;
+	}
+
+	/* Chan et al., "Updating Formulae and a Pairwise Algorithm for Computing Sample Variances" */
+	uint32_t nTotalSamples = nSamples + Stats.nSamples;
+	float Delta = Stats.Mean - Mean;
+	Mean += Delta * float(Stats.nSamples) / float(nTotalSamples);
+	M2 += Stats.M2 + Delta * Delta * float(nSamples) * float(Stats.nSamples) / float(nTotalSamples);
+	nSamples = nTotalSamples;
+}
+
+float PixelStatistics::GetRelativeError() const
+{
+	if (nSamples < 2)
+	{
+		return std::numeric_limits<float>::infinity();
+	}
+
+	float Variance = M2 / float(nSamples - 1);
+	return std::sqrt(Variance / float(nSamples)) / std::max(Mean, 1e-2f);
+}
+
 ImageBlock::ImageBlock(const Vector2i & Size, const ReconstructionFilter * pFilter) : 
 	m_Offset(0, 0), m_Size(Size)
 {
@@ -90,6 +124,49 @@ void ImageBlock::FromBitmap(const Bitmap & Bitmap)
 void ImageBlock::Clear()
 {
 	setConstant(Color4f());
+	std::fill(m_Statistics.begin(), m_Statistics.end(), PixelStatistics());
+}
+
+void ImageBlock::EnableStatistics()
+{
+	/* Allocate the statistics for the maximum size of the block */
+	m_StatisticsStride = int(cols()) - 2 * m_BorderSize;
+	m_Statistics.assign(size_t(m_StatisticsStride) * size_t(rows() - 2 * m_BorderSize), PixelStatistics());
+}
+
+bool ImageBlock::IsStatisticsEnabled() const
+{
+	return !m_Statistics.empty();
+}
+
+const PixelStatistics & ImageBlock::GetStatistics(int x, int y) const
+{
+	return m_Statistics[y * m_StatisticsStride + x];
+}
+
+std::unique_ptr<Bitmap> ImageBlock::ToSampleCountBitmap() const
+{
+	std::unique_ptr<Bitmap> Result = std::make_unique<Bitmap>(m_Size);
+	for (int y = 0; y < m_Size.y(); ++y)
+	{
+		for (int x = 0; x < m_Size.x(); ++x)
+		{
+			Result->coeffRef(y, x) = Color3f(IsStatisticsEnabled() ? float(GetStatistics(x, y).nSamples) : 0.0f);
+		}
+	}
+	return Result;
+}
+
+void ImageBlock::Save(std::ostream & Stream) const
+{
+	Stream.write((const char*)(data()), size() * sizeof(Color4f));
+	Stream.write((const char*)(m_Statistics.data()), m_Statistics.size() * sizeof(PixelStatistics));
+}
+
+void ImageBlock::Load(std::istream & Stream)
+{
+	Stream.read((char*)(data()), size() * sizeof(Color4f));
+	Stream.read((char*)(m_Statistics.data()), m_Statistics.size() * sizeof(PixelStatistics));
 }
 
 void ImageBlock::Put(const Point2f & Pos, const Color3f & Value)
@@ -100,6 +177,17 @@ void ImageBlock::Put(const Point2f & Pos, const Color3f & Value)
 		return;
 	}
 
+	/* Record the sample in the statistics of the pixel it was generated for */
+	if (IsStatisticsEnabled())
+	{
+		int x = int(std::floor(Pos.x())) - m_Offset.x();
+		int y = int(std::floor(Pos.y())) - m_Offset.y();
+		if (x >= 0 && y >= 0 && x < m_Size.x() && y < m_Size.y())
+		{
+			m_Statistics[y * m_StatisticsStride + x].Put(Value.GetLuminance());
+		}
+	}
+
 	/* Convert to pixel coordinates within the image block */
 	Point2f ConvertedPos(
 		Pos.x() - 0.5f - (m_Offset.x() - m_BorderSize),
@@ -141,6 +229,18 @@ void ImageBlock::Put(ImageBlock & Block)
 	tbb::mutex::scoped_lock Lock(m_Mutex);
 
 	block(Offset.y(), Offset.x(), Size.y(), Size.x()) += Block.topLeftCorner(Size.y(), Size.x());
+
+	if (IsStatisticsEnabled() && Block.IsStatisticsEnabled())
+	{
+		Vector2i StatisticsOffset = Block.GetOffset() - m_Offset;
+		for (int y = 0; y < Block.GetSize().y(); ++y)
+		{
+			for (int x = 0; x < Block.GetSize().x(); ++x)
+			{
+				m_Statistics[(y + StatisticsOffset.y()) * m_StatisticsStride + x + StatisticsOffset.x()].Put(Block.GetStatistics(x, y));
+			}
+		}
+	}
 }
 
 void ImageBlock::Lock() const
@@ -168,6 +268,13 @@ BlockGenerator::BlockGenerator(const Vector2i & Size, int BlockSize) :
 		int(std::ceil(Size.x() / float(BlockSize))),
 		int(std::ceil(Size.y() / float(BlockSize)))
 	);
+	Reset();
+}
+
+void BlockGenerator::Reset()
+{
+	tbb::mutex::scoped_lock Lock(m_Mutex);
+
 	m_BlocksLeft = m_NumBlocks.x() * m_NumBlocks.y();
 	m_Direction = ERight;
 	m_Block = Point2i(m_NumBlocks / 2);
@@ -217,6 +324,11 @@ bool BlockGenerator::Next(ImageBlock & Block)
 	return true;
 }
 
+int BlockGenerator::GetBlockIndex(const ImageBlock & Block) const
+{
+	return (Block.GetOffset().y() / m_BlockSize) * m_NumBlocks.x() + Block.GetOffset().x() / m_BlockSize;
+}
+
 int BlockGenerator::GetBlockCount() const
 {
 	return m_BlocksLeft;
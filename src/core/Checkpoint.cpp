@@ -0,0 +1,137 @@
+#include <core\Checkpoint.hpp>
+#include <core\Timer.hpp>
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+NAMESPACE_BEGIN
+
+/// Identifier at the beginning of the checkpoint files
+constexpr char CHECKPOINT_MAGIC[8] = { 'H', 'I', 'K', 'A', 'R', 'I', 'C', 'P' };
+
+/// Version of the checkpoint format
+constexpr uint32_t CHECKPOINT_VERSION = 2;
+
+/// Written in the native byte order, read as 0x04030201 on a machine of the other byte order
+constexpr uint32_t CHECKPOINT_BYTE_ORDER = 0x01020304;
+
+static_assert(sizeof(CheckpointHeader) == 56, "Unexpected padding in the checkpoint header");
+
+/// 64-bit FNV-1a hash of a string
+static uint64_t HashString(const std::string & String)
+{
+	uint64_t Hash = 0xCBF29CE484222325ULL;
+	for (char Char : String)
+	{
+		Hash ^= uint64_t(uint8_t(Char));
+		Hash *= 0x100000001B3ULL;
+	}
+	return Hash;
+}
+
+void Checkpoint::Save(const std::string & Filename, const ImageBlock & Result) const
+{
+	LOG(INFO) << "Writing checkpoint \"" << Filename << "\" ... ";
+	cout.flush();
+	Timer CheckpointTimer;
+
+	CheckpointHeader Header;
+	memset(&Header, 0, sizeof(CheckpointHeader));
+	memcpy(Header.Magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+	Header.Version = CHECKPOINT_VERSION;
+	Header.ByteOrder = CHECKPOINT_BYTE_ORDER;
+	Header.Width = Result.GetSize().x();
+	Header.Height = Result.GetSize().y();
+	Header.BorderSize = Result.GetBorderSize();
+	Header.nSampleCount = nSampleCount;
+	Header.nPassSamples = nPassSamples;
+	Header.iPass = iPass;
+	Header.nBlocks = uint32_t(bCompletedBlocks.size());
+	Header.bStatistics = Result.IsStatisticsEnabled() ? 1 : 0;
+	Header.FilterHash = HashString(Filter);
+
+	std::string TempFilename = Filename + ".tmp";
+	{
+		std::ofstream File(TempFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+		if (File.fail())
+		{
+			throw HikariException("Unable to open checkpoint file \"%s\"!", TempFilename);
+		}
+
+		File.write((const char*)(&Header), sizeof(CheckpointHeader));
+		File.write((const char*)(bCompletedBlocks.data()), bCompletedBlocks.size() * sizeof(uint8_t));
+		File.write((const char*)(PixelSampleCounts.data()), PixelSampleCounts.size() * sizeof(uint32_t));
+		Result.Save(File);
+
+		if (File.fail())
+		{
+			throw HikariException("Unable to write checkpoint file \"%s\"!", TempFilename);
+		}
+	}
+
+	std::remove(Filename.c_str());
+	if (std::rename(TempFilename.c_str(), Filename.c_str()) != 0)
+	{
+		throw HikariException("Unable to rename checkpoint file \"%s\" to \"%s\"!", TempFilename, Filename);
+	}
+
+	LOG(INFO) << "Done. (pass = " << iPass << ", took " << CheckpointTimer.ElapsedString() << ")";
+}
+
+void Checkpoint::Load(const std::string & Filename, ImageBlock & Result)
+{
+	std::ifstream File(Filename, std::ios::in | std::ios::binary);
+	if (File.fail())
+	{
+		throw HikariException("Unable to open checkpoint file \"%s\"!", Filename);
+	}
+
+	LOG(INFO) << "Loading checkpoint \"" << Filename << "\" ... ";
+	cout.flush();
+	Timer CheckpointTimer;
+
+	CheckpointHeader Header;
+	File.read((char*)(&Header), sizeof(CheckpointHeader));
+	if (File.fail())
+	{
+		throw HikariException("Checkpoint file \"%s\" is truncated!", Filename);
+	}
+
+	if (memcmp(Header.Magic, CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC)) != 0)
+	{
+		throw HikariException("File \"%s\" is not a checkpoint file!", Filename);
+	}
+
+	if (Header.ByteOrder != CHECKPOINT_BYTE_ORDER)
+	{
+		throw HikariException("Checkpoint file \"%s\" was saved on a machine with another byte order!", Filename);
+	}
+
+	if (Header.Version != CHECKPOINT_VERSION)
+	{
+		throw HikariException("Checkpoint file \"%s\" has version %d but version %d is expected!", Filename, Header.Version, CHECKPOINT_VERSION);
+	}
+
+	if (Header.Width != Result.GetSize().x() || Header.Height != Result.GetSize().y() ||
+		Header.BorderSize != Result.GetBorderSize() || Header.FilterHash != HashString(Filter) || Header.nSampleCount != nSampleCount ||
+		Header.nPassSamples != nPassSamples || Header.nBlocks != uint32_t(bCompletedBlocks.size()) ||
+		(Header.bStatistics != 0) != Result.IsStatisticsEnabled())
+	{
+		throw HikariException("Checkpoint file \"%s\" was saved for another rendering (image size, filter, sample count or adaptive sampling)!", Filename);
+	}
+
+	iPass = Header.iPass;
+	PixelSampleCounts.resize(size_t(Header.Width) * size_t(Header.Height));
+	File.read((char*)(bCompletedBlocks.data()), bCompletedBlocks.size() * sizeof(uint8_t));
+	File.read((char*)(PixelSampleCounts.data()), PixelSampleCounts.size() * sizeof(uint32_t));
+	Result.Load(File);
+
+	if (File.fail())
+	{
+		throw HikariException("Checkpoint file \"%s\" is truncated!", Filename);
+	}
+
+	LOG(INFO) << "Done. (pass = " << iPass << ", took " << CheckpointTimer.ElapsedString() << ")";
+}
+
+NAMESPACE_END
@@ -29,11 +29,27 @@ DiscretePDF1D::DiscretePDF1D(const float * pFunc, int Count) :
 	}
 }
 
+DiscretePDF1D::DiscretePDF1D(const float * pFunc, const float * pCdf, float FuncIntegral, int Count) :
+	m_Func(pFunc, pFunc + Count), m_Cdf(pCdf, pCdf + Count + 1), m_FuncIntegral(FuncIntegral)
+{
+
+}
+
 int DiscretePDF1D::Count() const
 {
 	return int(m_Func.size());
 }
 
+const std::vector<float> & DiscretePDF1D::GetCdf() const
+{
+	return m_Cdf;
+}
+
+float DiscretePDF1D::GetFuncIntegral() const
+{
+	return m_FuncIntegral;
+}
+
 float DiscretePDF1D::SampleContinuous(float Sample, float * pPdf, int * pIdx) const
 {
 	auto Iter = std::lower_bound(m_Cdf.begin(), m_Cdf.end(), Sample);
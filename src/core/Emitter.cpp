@@ -58,11 +58,145 @@ EEmitterType Emitter::GetEmitterType() const
 	return m_Type;
 }
 
+bool Emitter::GetBounds(EmitterBounds & Bounds) const
+{
+	return false;
+}
+
+void Emitter::UpdateSamplingData()
+{
+
+}
+
 bool Emitter::IsDelta() const
 {
 	return m_Type == EEmitterType::EPoint;
 }
 
-NAMESPACE_END
+float EmitterBounds::Importance(const Point3f & P, const Normal3f & N) const
+{
+	/* cos(max(0, A - B)) and sin(max(0, A - B)) */
+	auto CosSubClamped = [](float SinThetaA, float CosThetaA, float SinThetaB, float CosThetaB)
+	{
+		return (CosThetaA > CosThetaB) ? 1.0f : CosThetaA * CosThetaB + SinThetaA * SinThetaB;
+	};
+	auto SinSubClamped = [](float SinThetaA, float CosThetaA, float SinThetaB, float CosThetaB)
+	{
+		return (CosThetaA > CosThetaB) ? 0.0f : SinThetaA * CosThetaB - CosThetaA * SinThetaB;
+	};
+	auto SafeSqrt = [](float Value) { return std::sqrt(std::max(0.0f, Value)); };
+
+	/* Clamp the distance to the center, otherwise the importance of the points close to the bounds explodes */
+	Point3f Center = BBox.GetCenter();
+	float SquaredDistance = std::max((P - Center).squaredNorm(), BBox.GetExtents().norm() * 0.5f);
+
+	/* Angle between the axis of the cone and the direction to the point */
+	Vector3f Wi = (P - Center).normalized();
+	float CosThetaW = W.dot(Wi);
+	if (bTwoSided)
+	{
+		CosThetaW = std::abs(CosThetaW);
+	}
+	if (std::isnan(CosThetaW))
+	{
+		CosThetaW = 1.0f;
+	}
+	float SinThetaW = SafeSqrt(1.0f - CosThetaW * CosThetaW);
+
+	/* Half angle of the cone of directions subtended by the bounds (the bounding sphere) */
+	float Radius = BBox.GetExtents().norm() * 0.5f;
+	float SquaredRadius = Radius * Radius;
+	float CosThetaB = -1.0f;
+	if ((P - Center).squaredNorm() > SquaredRadius)
+	{
+		CosThetaB = SafeSqrt(1.0f - SquaredRadius / (P - Center).squaredNorm());
+	}
+	float SinThetaB = SafeSqrt(1.0f - CosThetaB * CosThetaB);
 
+	/* Minimum angle between the emitting normals and the direction to the point */
+	float SinThetaO = SafeSqrt(1.0f - CosThetaO * CosThetaO);
+	float CosThetaX = CosSubClamped(SinThetaW, CosThetaW, SinThetaO, CosThetaO);
+	float SinThetaX = SinSubClamped(SinThetaW, CosThetaW, SinThetaO, CosThetaO);
+	float CosThetaP = CosSubClamped(SinThetaX, CosThetaX, SinThetaB, CosThetaB);
+	if (CosThetaP <= CosThetaE)
+	{
+		return 0.0f;
+	}
 
+	float Result = Phi * CosThetaP / SquaredDistance;
+
+	/* Maximum cosine at the surface */
+	if (!N.isZero() && !std::isnan(Wi.x()))
+	{
+		float CosThetaI = std::abs(Wi.dot(N));
+		float SinThetaI = SafeSqrt(1.0f - CosThetaI * CosThetaI);
+		Result *= CosSubClamped(SinThetaI, CosThetaI, SinThetaB, CosThetaB);
+	}
+
+	return std::max(Result, 0.0f);
+}
+
+EmitterBounds EmitterBounds::Union(const EmitterBounds & Bounds1, const EmitterBounds & Bounds2)
+{
+	if (Bounds1.Phi == 0.0f)
+	{
+		return Bounds2;
+	}
+	if (Bounds2.Phi == 0.0f)
+	{
+		return Bounds1;
+	}
+
+	EmitterBounds Result;
+	Result.BBox = Bounds1.BBox;
+	Result.BBox.ExpandBy(Bounds2.BBox);
+	Result.Phi = Bounds1.Phi + Bounds2.Phi;
+	Result.CosThetaE = std::min(Bounds1.CosThetaE, Bounds2.CosThetaE);
+	Result.bTwoSided = Bounds1.bTwoSided || Bounds2.bTwoSided;
+
+	/* Smallest cone containing both cones */
+	float ThetaA = std::acos(Clamp(Bounds1.CosThetaO, -1.0f, 1.0f));
+	float ThetaB = std::acos(Clamp(Bounds2.CosThetaO, -1.0f, 1.0f));
+	float ThetaD = std::acos(Clamp(Bounds1.W.dot(Bounds2.W), -1.0f, 1.0f));
+	if (std::min(ThetaD + ThetaB, float(M_PI)) <= ThetaA)
+	{
+		Result.W = Bounds1.W;
+		Result.CosThetaO = Bounds1.CosThetaO;
+		return Result;
+	}
+	if (std::min(ThetaD + ThetaA, float(M_PI)) <= ThetaB)
+	{
+		Result.W = Bounds2.W;
+		Result.CosThetaO = Bounds2.CosThetaO;
+		return Result;
+	}
+
+	float ThetaO = (ThetaA + ThetaD + ThetaB) * 0.5f;
+	Vector3f Wr = Bounds1.W.cross(Bounds2.W);
+	if (ThetaO >= float(M_PI) || Wr.squaredNorm() == 0.0f)
+	{
+		Result.W = Bounds1.W;
+		Result.CosThetaO = -1.0f;
+		return Result;
+	}
+
+	/* Rotate the axis of the first cone toward the axis of the second one */
+	Result.W = Vector3f(Eigen::AngleAxisf(ThetaO - ThetaA, Wr.normalized()) * Bounds1.W);
+	Result.CosThetaO = std::cos(ThetaO);
+	return Result;
+}
+
+std::string EmitterBounds::ToString() const
+{
+	return tfm::format(
+		"EmitterBounds[bbox = %s, w = %s, cosThetaO = %f, cosThetaE = %f, phi = %f, twoSided = %s]",
+		BBox.ToString(),
+		W.ToString(),
+		CosThetaO,
+		CosThetaE,
+		Phi,
+		bTwoSided ? "true" : "false"
+	);
+}
+
+NAMESPACE_END
@@ -0,0 +1,542 @@
+#include <core\EmitterSampler.hpp>
+
+NAMESPACE_BEGIN
+
+/// The largest float smaller than one, used to keep the remapped samples in [0, 1)
+constexpr float OneMinusEpsilon = 0.99999994f;
+
+EmitterSampler * EmitterSampler::Create(const std::string & Name)
+{
+	if (Name == XML_SCENE_EMITTER_SAMPLER_UNIFORM)
+	{
+		return new UniformEmitterSampler();
+	}
+	else if (Name == XML_SCENE_EMITTER_SAMPLER_POWER)
+	{
+		return new PowerEmitterSampler();
+	}
+	else if (Name == XML_SCENE_EMITTER_SAMPLER_BVH)
+	{
+		return new BVHEmitterSampler();
+	}
+	throw HikariException("Unknown emitter sampler \"%s\"!", Name);
+}
+
+void UniformEmitterSampler::Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox)
+{
+	m_pEmitters.assign(pEmitters.begin(), pEmitters.end());
+	m_EmitterToIndex.clear();
+	for (uint32_t i = 0; i < uint32_t(m_pEmitters.size()); i++)
+	{
+		m_EmitterToIndex[m_pEmitters[i]] = i;
+	}
+}
+
+const Emitter * UniformEmitterSampler::Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const
+{
+	if (m_pEmitters.empty())
+	{
+		Pdf = 0.0f;
+		return nullptr;
+	}
+
+	uint32_t nEmitters = uint32_t(m_pEmitters.size());
+	uint32_t iEmitter = std::min(uint32_t(Sample1D * nEmitters), nEmitters - 1);
+	Pdf = 1.0f / float(nEmitters);
+	return m_pEmitters[iEmitter];
+}
+
+float UniformEmitterSampler::Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const
+{
+	if (m_EmitterToIndex.find(pEmitter) == m_EmitterToIndex.end())
+	{
+		return 0.0f;
+	}
+	return 1.0f / float(m_pEmitters.size());
+}
+
+size_t UniformEmitterSampler::GetUsedMemory() const
+{
+	return m_pEmitters.size() * (sizeof(const Emitter*) * 2 + sizeof(uint32_t));
+}
+
+std::string UniformEmitterSampler::ToString() const
+{
+	return tfm::format("UniformEmitterSampler[emitters = %u]", uint32_t(m_pEmitters.size()));
+}
+
+void PowerEmitterSampler::Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox)
+{
+	m_pEmitters.assign(pEmitters.begin(), pEmitters.end());
+	m_EmitterToIndex.clear();
+	m_AliasTable.clear();
+
+	uint32_t nEmitters = uint32_t(m_pEmitters.size());
+	if (nEmitters == 0)
+	{
+		return;
+	}
+
+	float SceneRadius = SceneBBox.GetRadius();
+	std::vector<double> Powers(nEmitters);
+	double TotalPower = 0.0;
+	for (uint32_t i = 0; i < nEmitters; i++)
+	{
+		m_EmitterToIndex[m_pEmitters[i]] = i;
+		float Power = m_pEmitters[i]->GetPower(SceneRadius);
+		Powers[i] = (std::isfinite(Power) && Power > 0.0f) ? double(Power) : 0.0;
+		TotalPower += Powers[i];
+	}
+
+	/* Fall back to the uniform selection if no power is known */
+	if (TotalPower == 0.0)
+	{
+		LOG(WARNING) << "All the emitters have zero power, select them uniformly.";
+		std::fill(Powers.begin(), Powers.end(), 1.0);
+		TotalPower = double(nEmitters);
+	}
+
+	m_AliasTable.resize(nEmitters);
+
+	/* Split the bins into the under-full and the over-full ones */
+	std::vector<double> Scaled(nEmitters);
+	std::vector<uint32_t> Small, Large;
+	for (uint32_t i = 0; i < nEmitters; i++)
+	{
+		m_AliasTable[i].Pdf = float(Powers[i] / TotalPower);
+		m_AliasTable[i].iAlias = i;
+		Scaled[i] = Powers[i] / TotalPower * double(nEmitters);
+		if (Scaled[i] < 1.0)
+		{
+			Small.push_back(i);
+		}
+		else
+		{
+			Large.push_back(i);
+		}
+	}
+
+	/* Fill each under-full bin with the excess of an over-full one */
+	while (!Small.empty() && !Large.empty())
+	{
+		uint32_t iSmall = Small.back(); Small.pop_back();
+		uint32_t iLarge = Large.back(); Large.pop_back();
+
+		m_AliasTable[iSmall].Threshold = float(Scaled[iSmall]);
+		m_AliasTable[iSmall].iAlias = iLarge;
+
+		Scaled[iLarge] = (Scaled[iLarge] + Scaled[iSmall]) - 1.0;
+		if (Scaled[iLarge] < 1.0)
+		{
+			Small.push_back(iLarge);
+		}
+		else
+		{
+			Large.push_back(iLarge);
+		}
+	}
+
+	/* The remaining bins are full (up to the rounding error) */
+	for (uint32_t i : Small)
+	{
+		m_AliasTable[i].Threshold = 1.0f;
+		m_AliasTable[i].iAlias = i;
+	}
+	for (uint32_t i : Large)
+	{
+		m_AliasTable[i].Threshold = 1.0f;
+		m_AliasTable[i].iAlias = i;
+	}
+}
+
+const Emitter * PowerEmitterSampler::Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const
+{
+	if (m_AliasTable.empty())
+	{
+		Pdf = 0.0f;
+		return nullptr;
+	}
+
+	uint32_t nEmitters = uint32_t(m_AliasTable.size());
+	uint32_t iBin = std::min(uint32_t(Sample1D * nEmitters), nEmitters - 1);
+	float SampleRemapped = std::min(Sample1D * nEmitters - iBin, OneMinusEpsilon);
+
+	const AliasBin & Bin = m_AliasTable[iBin];
+	uint32_t iEmitter = (SampleRemapped < Bin.Threshold) ? iBin : Bin.iAlias;
+
+	Pdf = m_AliasTable[iEmitter].Pdf;
+	return m_pEmitters[iEmitter];
+}
+
+float PowerEmitterSampler::Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const
+{
+	auto Iter = m_EmitterToIndex.find(pEmitter);
+	if (Iter == m_EmitterToIndex.end())
+	{
+		return 0.0f;
+	}
+	return m_AliasTable[Iter->second].Pdf;
+}
+
+size_t PowerEmitterSampler::GetUsedMemory() const
+{
+	return m_pEmitters.size() * (sizeof(const Emitter*) * 2 + sizeof(uint32_t) + sizeof(AliasBin));
+}
+
+std::string PowerEmitterSampler::ToString() const
+{
+	return tfm::format("PowerEmitterSampler[emitters = %u]", uint32_t(m_pEmitters.size()));
+}
+
+void EmitterBVH::Build(const std::vector<EmitterBounds> & Bounds)
+{
+	m_Nodes.clear();
+	m_BitTrails.assign(Bounds.size(), uint64_t(-1));
+
+	/* The items which never emit are never selected */
+	std::vector<std::pair<uint32_t, EmitterBounds>> Items;
+	for (uint32_t i = 0; i < uint32_t(Bounds.size()); i++)
+	{
+		if (Bounds[i].Phi > 0.0f)
+		{
+			Items.emplace_back(i, Bounds[i]);
+		}
+	}
+
+	if (!Items.empty())
+	{
+		BuildRecursive(Items, 0, uint32_t(Items.size()), 0, 0);
+	}
+}
+
+bool EmitterBVH::IsEmpty() const
+{
+	return m_Nodes.empty();
+}
+
+uint32_t EmitterBVH::Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const
+{
+	if (m_Nodes.empty())
+	{
+		Pdf = 0.0f;
+		return uint32_t(-1);
+	}
+
+	/* Descend the BVH choosing the child by its importance */
+	uint32_t iNode = 0;
+	Pdf = 1.0f;
+	while (true)
+	{
+		const Node & CurrentNode = m_Nodes[iNode];
+		if (CurrentNode.bLeaf)
+		{
+			if (iNode > 0 || CurrentNode.Bounds.Importance(P, N) > 0.0f)
+			{
+				return CurrentNode.iChildOrItem;
+			}
+			Pdf = 0.0f;
+			return uint32_t(-1);
+		}
+
+		float Importance0 = m_Nodes[iNode + 1].Bounds.Importance(P, N);
+		float Importance1 = m_Nodes[CurrentNode.iChildOrItem].Bounds.Importance(P, N);
+		if (Importance0 == 0.0f && Importance1 == 0.0f)
+		{
+			Pdf = 0.0f;
+			return uint32_t(-1);
+		}
+
+		float Pdf0 = Importance0 / (Importance0 + Importance1);
+		if (Sample1D < Pdf0)
+		{
+			Pdf *= Pdf0;
+			Sample1D = std::min(Sample1D / Pdf0, OneMinusEpsilon);
+			iNode = iNode + 1;
+		}
+		else
+		{
+			Pdf *= 1.0f - Pdf0;
+			Sample1D = std::min((Sample1D - Pdf0) / (1.0f - Pdf0), OneMinusEpsilon);
+			iNode = CurrentNode.iChildOrItem;
+		}
+	}
+}
+
+float EmitterBVH::Pdf(const Point3f & P, const Normal3f & N, uint32_t Index) const
+{
+	if (Index >= m_BitTrails.size() || m_BitTrails[Index] == uint64_t(-1))
+	{
+		return 0.0f;
+	}
+
+	if (m_Nodes[0].bLeaf && m_Nodes[0].Bounds.Importance(P, N) == 0.0f)
+	{
+		return 0.0f;
+	}
+
+	/* Follow the path to the leaf of the item */
+	uint64_t BitTrail = m_BitTrails[Index];
+	uint32_t iNode = 0;
+	float Pdf = 1.0f;
+	while (!m_Nodes[iNode].bLeaf)
+	{
+		const Node & CurrentNode = m_Nodes[iNode];
+		float Importance0 = m_Nodes[iNode + 1].Bounds.Importance(P, N);
+		float Importance1 = m_Nodes[CurrentNode.iChildOrItem].Bounds.Importance(P, N);
+		if (Importance0 == 0.0f && Importance1 == 0.0f)
+		{
+			return 0.0f;
+		}
+
+		if (BitTrail & 1)
+		{
+			Pdf *= Importance1 / (Importance0 + Importance1);
+			iNode = CurrentNode.iChildOrItem;
+		}
+		else
+		{
+			Pdf *= Importance0 / (Importance0 + Importance1);
+			iNode = iNode + 1;
+		}
+		BitTrail >>= 1;
+	}
+
+	return Pdf;
+}
+
+uint32_t EmitterBVH::GetNodeCount() const
+{
+	return uint32_t(m_Nodes.size());
+}
+
+size_t EmitterBVH::GetUsedMemory() const
+{
+	return m_Nodes.size() * sizeof(Node) + m_BitTrails.size() * sizeof(uint64_t);
+}
+
+uint32_t EmitterBVH::BuildRecursive(std::vector<std::pair<uint32_t, EmitterBounds>> & Items, uint32_t iBegin, uint32_t iEnd, uint64_t BitTrail, uint32_t Depth)
+{
+	if (iEnd - iBegin == 1)
+	{
+		uint32_t iNode = uint32_t(m_Nodes.size());
+		m_Nodes.push_back({ Items[iBegin].second, Items[iBegin].first, true });
+		m_BitTrails[Items[iBegin].first] = BitTrail;
+		return iNode;
+	}
+
+	BoundingBox3f BBox, CentroidBBox;
+	for (uint32_t i = iBegin; i < iEnd; i++)
+	{
+		BBox.ExpandBy(Items[i].second.BBox);
+		CentroidBBox.ExpandBy(Items[i].second.BBox.GetCenter());
+	}
+
+	/* Find the split with the minimum cost with the buckets of the centroids */
+	constexpr int nBuckets = 12;
+	float MinCost = std::numeric_limits<float>::infinity();
+	int MinBucket = -1, MinDim = -1;
+
+	/* The bit trail has 64 bits, split at the middle for the (unlikely) deep subtrees */
+	if (Depth < 32)
+	{
+		for (int Dim = 0; Dim < 3; Dim++)
+		{
+			if (CentroidBBox.Max[Dim] == CentroidBBox.Min[Dim])
+			{
+				continue;
+			}
+
+			EmitterBounds BucketBounds[nBuckets];
+			auto GetBucket = [&](const EmitterBounds & Bounds)
+			{
+				float Offset = (Bounds.BBox.GetCenter()[Dim] - CentroidBBox.Min[Dim]) / (CentroidBBox.Max[Dim] - CentroidBBox.Min[Dim]);
+				return Clamp(int(nBuckets * Offset), 0, nBuckets - 1);
+			};
+
+			for (uint32_t i = iBegin; i < iEnd; i++)
+			{
+				int iBucket = GetBucket(Items[i].second);
+				BucketBounds[iBucket] = EmitterBounds::Union(BucketBounds[iBucket], Items[i].second);
+			}
+
+			for (int i = 0; i < nBuckets - 1; i++)
+			{
+				EmitterBounds Bounds0, Bounds1;
+				for (int j = 0; j <= i; j++)
+				{
+					Bounds0 = EmitterBounds::Union(Bounds0, BucketBounds[j]);
+				}
+				for (int j = i + 1; j < nBuckets; j++)
+				{
+					Bounds1 = EmitterBounds::Union(Bounds1, BucketBounds[j]);
+				}
+
+				float Cost = EvaluateCost(Bounds0, BBox, Dim) + EvaluateCost(Bounds1, BBox, Dim);
+				if (Cost > 0.0f && Cost < MinCost)
+				{
+					MinCost = Cost;
+					MinBucket = i;
+					MinDim = Dim;
+				}
+			}
+		}
+	}
+
+	uint32_t iMid;
+	if (MinDim == -1)
+	{
+		/* No valid split (e.g. only point emitters), split at the median of the largest axis */
+		int Axis = CentroidBBox.GetLargestAxis();
+		iMid = (iBegin + iEnd) / 2;
+		std::nth_element(Items.begin() + iBegin, Items.begin() + iMid, Items.begin() + iEnd,
+			[&](const std::pair<uint32_t, EmitterBounds> & Item1, const std::pair<uint32_t, EmitterBounds> & Item2)
+			{
+				return Item1.second.BBox.GetCenter()[Axis] < Item2.second.BBox.GetCenter()[Axis];
+			}
+		);
+	}
+	else
+	{
+		auto Iter = std::partition(Items.begin() + iBegin, Items.begin() + iEnd,
+			[&](const std::pair<uint32_t, EmitterBounds> & Item)
+			{
+				float Offset = (Item.second.BBox.GetCenter()[MinDim] - CentroidBBox.Min[MinDim]) / (CentroidBBox.Max[MinDim] - CentroidBBox.Min[MinDim]);
+				return Clamp(int(nBuckets * Offset), 0, nBuckets - 1) <= MinBucket;
+			}
+		);
+		iMid = uint32_t(Iter - Items.begin());
+		if (iMid == iBegin || iMid == iEnd)
+		{
+			iMid = (iBegin + iEnd) / 2;
+		}
+	}
+
+	uint32_t iNode = uint32_t(m_Nodes.size());
+	m_Nodes.push_back({ EmitterBounds(), 0, false });
+	uint32_t iChild0 = BuildRecursive(Items, iBegin, iMid, BitTrail, Depth + 1);
+	uint32_t iChild1 = BuildRecursive(Items, iMid, iEnd, BitTrail | (uint64_t(1) << Depth), Depth + 1);
+	CHECK_EQ(iChild0, iNode + 1);
+
+	m_Nodes[iNode].Bounds = EmitterBounds::Union(m_Nodes[iChild0].Bounds, m_Nodes[iChild1].Bounds);
+	m_Nodes[iNode].iChildOrItem = iChild1;
+	return iNode;
+}
+
+float EmitterBVH::EvaluateCost(const EmitterBounds & Bounds, const BoundingBox3f & ParentBBox, int Dim)
+{
+	if (Bounds.Phi == 0.0f)
+	{
+		return 0.0f;
+	}
+
+	/* The solid angle measure of the cone of emission */
+	float ThetaO = std::acos(Clamp(Bounds.CosThetaO, -1.0f, 1.0f));
+	float ThetaE = std::acos(Clamp(Bounds.CosThetaE, -1.0f, 1.0f));
+	float ThetaW = std::min(ThetaO + ThetaE, float(M_PI));
+	float SinThetaO = std::sqrt(std::max(0.0f, 1.0f - Bounds.CosThetaO * Bounds.CosThetaO));
+	float MOmega = 2.0f * float(M_PI) * (1.0f - Bounds.CosThetaO) +
+		float(M_PI) / 2.0f * (2.0f * ThetaW * SinThetaO - std::cos(ThetaO - 2.0f * ThetaW) - 2.0f * ThetaO * SinThetaO + Bounds.CosThetaO);
+
+	/* Penalize the thin boxes along the split dimension */
+	Vector3f Extents = ParentBBox.GetExtents();
+	float Kr = (Extents[Dim] > 0.0f) ? Extents.maxCoeff() / Extents[Dim] : 1.0f;
+
+	return Bounds.Phi * MOmega * Kr * Bounds.BBox.GetSurfaceArea();
+}
+
+void BVHEmitterSampler::Build(const std::vector<Emitter*> & pEmitters, const BoundingBox3f & SceneBBox)
+{
+	m_pBoundedEmitters.clear();
+	m_pInfiniteEmitters.clear();
+	m_EmitterToIndex.clear();
+
+	std::vector<EmitterBounds> Bounds;
+	for (Emitter * pEmitter : pEmitters)
+	{
+		EmitterBounds EmitterBound;
+		if (pEmitter->GetBounds(EmitterBound))
+		{
+			m_EmitterToIndex[pEmitter] = uint32_t(m_pBoundedEmitters.size());
+			m_pBoundedEmitters.push_back(pEmitter);
+			Bounds.push_back(EmitterBound);
+		}
+		else
+		{
+			m_pInfiniteEmitters.push_back(pEmitter);
+		}
+	}
+
+	m_BVH.Build(Bounds);
+
+	LOG(INFO) << "Build emitter BVH (" << m_pBoundedEmitters.size() << " bounded emitters, " <<
+		m_pInfiniteEmitters.size() << " infinite emitters, " << m_BVH.GetNodeCount() << " nodes).";
+}
+
+const Emitter * BVHEmitterSampler::Sample(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const
+{
+	/* Select between the infinite emitters and the BVH uniformly */
+	uint32_t nInfinite = uint32_t(m_pInfiniteEmitters.size());
+	float PdfInfinite = float(nInfinite) / float(nInfinite + (m_BVH.IsEmpty() ? 0 : 1));
+
+	if (Sample1D < PdfInfinite)
+	{
+		Sample1D = std::min(Sample1D / PdfInfinite, OneMinusEpsilon);
+		uint32_t iEmitter = std::min(uint32_t(Sample1D * nInfinite), nInfinite - 1);
+		Pdf = PdfInfinite / float(nInfinite);
+		return m_pInfiniteEmitters[iEmitter];
+	}
+
+	if (m_BVH.IsEmpty())
+	{
+		Pdf = 0.0f;
+		return nullptr;
+	}
+
+	Sample1D = std::min((Sample1D - PdfInfinite) / (1.0f - PdfInfinite), OneMinusEpsilon);
+
+	uint32_t iEmitter = m_BVH.Sample(P, N, Sample1D, Pdf);
+	if (iEmitter == uint32_t(-1))
+	{
+		return nullptr;
+	}
+
+	Pdf *= 1.0f - PdfInfinite;
+	return m_pBoundedEmitters[iEmitter];
+}
+
+float BVHEmitterSampler::Pdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const
+{
+	uint32_t nInfinite = uint32_t(m_pInfiniteEmitters.size());
+	float PdfInfinite = float(nInfinite) / float(nInfinite + (m_BVH.IsEmpty() ? 0 : 1));
+
+	auto Iter = m_EmitterToIndex.find(pEmitter);
+	if (Iter == m_EmitterToIndex.end())
+	{
+		if (std::find(m_pInfiniteEmitters.begin(), m_pInfiniteEmitters.end(), pEmitter) != m_pInfiniteEmitters.end())
+		{
+			return PdfInfinite / float(nInfinite);
+		}
+		return 0.0f;
+	}
+
+	return m_BVH.Pdf(P, N, Iter->second) * (1.0f - PdfInfinite);
+}
+
+size_t BVHEmitterSampler::GetUsedMemory() const
+{
+	return (m_pBoundedEmitters.size() + m_pInfiniteEmitters.size()) * sizeof(const Emitter*) +
+		m_EmitterToIndex.size() * (sizeof(const Emitter*) + sizeof(uint32_t)) +
+		m_BVH.GetUsedMemory();
+}
+
+std::string BVHEmitterSampler::ToString() const
+{
+	return tfm::format(
+		"BVHEmitterSampler[boundedEmitters = %u, infiniteEmitters = %u, nodes = %u]",
+		uint32_t(m_pBoundedEmitters.size()),
+		uint32_t(m_pInfiniteEmitters.size()),
+		m_BVH.GetNodeCount()
+	);
+}
+
+NAMESPACE_END
@@ -0,0 +1,76 @@
+#include <core\Instance.hpp>
+#include <core\Mesh.hpp>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(Instance, XML_INSTANCE_MESH);
+
+Instance::Instance(const PropertyList & PropList)
+{
+	m_ObjectToWorld = PropList.GetTransform(XML_INSTANCE_MESH_TO_WORLD, DEFAULT_INSTANCE_TO_WORLD);
+	m_WorldToObject = m_ObjectToWorld.Inverse();
+}
+
+const Transform & Instance::GetObjectToWorld() const
+{
+	return m_ObjectToWorld;
+}
+
+const Transform & Instance::GetWorldToObject() const
+{
+	return m_WorldToObject;
+}
+
+const Mesh * Instance::GetMesh() const
+{
+	return m_pMesh;
+}
+
+Mesh * Instance::GetMesh()
+{
+	return m_pMesh;
+}
+
+BoundingBox3f Instance::GetBoundingBox() const
+{
+	const BoundingBox3f & MeshBBox = m_pMesh->GetBoundingBox();
+
+	BoundingBox3f Result;
+	for (int i = 0; i < 8; i++)
+	{
+		Result.ExpandBy(m_ObjectToWorld * MeshBBox.GetCorner(i));
+	}
+	return Result;
+}
+
+void Instance::SetParent(Object * pParentObj, const std::string & Name)
+{
+	EClassType ClzType = pParentObj->GetClassType();
+	if (ClzType == EClassType::EMesh)
+	{
+		m_pMesh = (Mesh*)(pParentObj);
+	}
+	else
+	{
+		throw HikariException("Instance::SetParent(<%s>, <%s>) is not supported!",
+			ClassTypeName(pParentObj->GetClassType()), Name
+		);
+	}
+}
+
+std::string Instance::ToString() const
+{
+	return tfm::format(
+		"Instance[\n"
+		"  toWorld = %s\n"
+		"]",
+		Indent(m_ObjectToWorld.ToString(), 12)
+	);
+}
+
+Object::EClassType Instance::GetClassType() const
+{
+	return EClassType::EInstance;
+}
+
+NAMESPACE_END
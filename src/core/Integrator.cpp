@@ -7,6 +7,16 @@ void Integrator::Preprocess(const Scene * pScene)
 
 }
 
+bool Integrator::IsPrimaryRayPacketSupported() const
+{
+	return false;
+}
+
+Color3f Integrator::LiPrimary(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray, const Intersection & Isect, bool bHit) const
+{
+	return Li(pScene, pSampler, Ray);
+}
+
 Object::EClassType Integrator::GetClassType() const
 {
 	return EClassType::EIntegrator;
@@ -0,0 +1,131 @@
+#include <core\MappedFile.hpp>
+
+#if defined(__PLATFORM_WINDOWS__)
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+NAMESPACE_BEGIN
+
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+bool MappedFile::Open(const std::string & Filename)
+{
+	Close();
+
+#if defined(__PLATFORM_WINDOWS__)
+	HANDLE hFile = CreateFileA(Filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER FileSize;
+	if (!GetFileSizeEx(hFile, &FileSize) || FileSize.QuadPart == 0)
+	{
+		CloseHandle(hFile);
+		return false;
+	}
+
+	HANDLE hMapping = CreateFileMappingA(hFile, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+	CloseHandle(hFile);
+	if (hMapping == nullptr)
+	{
+		return false;
+	}
+
+	void * pData = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+	CloseHandle(hMapping);
+	if (pData == nullptr)
+	{
+		return false;
+	}
+
+	m_pData = (uint8_t*)(pData);
+	m_Size = size_t(FileSize.QuadPart);
+#else
+	int File = open(Filename.c_str(), O_RDONLY);
+	if (File < 0)
+	{
+		return false;
+	}
+
+	struct stat FileStat;
+	if (fstat(File, &FileStat) != 0 || FileStat.st_size == 0)
+	{
+		close(File);
+		return false;
+	}
+
+	void * pData = mmap(nullptr, size_t(FileStat.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, File, 0);
+	close(File);
+	if (pData == MAP_FAILED)
+	{
+		return false;
+	}
+
+	m_pData = (uint8_t*)(pData);
+	m_Size = size_t(FileStat.st_size);
+#endif
+
+	return true;
+}
+
+void MappedFile::Close()
+{
+	if (m_pData == nullptr)
+	{
+		return;
+	}
+
+#if defined(__PLATFORM_WINDOWS__)
+	UnmapViewOfFile(m_pData);
+#else
+	munmap(m_pData, m_Size);
+#endif
+
+	m_pData = nullptr;
+	m_Size = 0;
+}
+
+bool MappedFile::IsOpen() const
+{
+	return m_pData != nullptr;
+}
+
+void MappedFile::Prefetch() const
+{
+	if (m_pData == nullptr)
+	{
+		return;
+	}
+
+#if !defined(__PLATFORM_WINDOWS__)
+	madvise(m_pData, m_Size, MADV_WILLNEED);
+#endif
+}
+
+uint8_t * MappedFile::GetData()
+{
+	return m_pData;
+}
+
+const uint8_t * MappedFile::GetData() const
+{
+	return m_pData;
+}
+
+size_t MappedFile::GetSize() const
+{
+	return m_Size;
+}
+
+NAMESPACE_END
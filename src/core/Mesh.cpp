@@ -1,15 +1,30 @@
 #include <core\Mesh.hpp>
 #include <core\Shape.hpp>
+#include <core\Instance.hpp>
+#include <mutex>
 
 NAMESPACE_BEGIN
 
+struct Mesh::SharedGeometry
+{
+	MatrixXf V;
+	MatrixXf N;
+	MatrixXf UV;
+	MatrixXu F;
+	BoundingBox3f BBox;
+};
+
+/// Geometry cache, the buffers are released with the last mesh using them
+static std::map<std::string, std::weak_ptr<Mesh::SharedGeometry>> GeometryCache;
+static std::mutex GeometryCacheLock;
+
 Triangle::Triangle()
 {
 
 }
 
-Triangle::Triangle(Mesh * pMesh, uint32_t * pFacet, uint32_t iFacet) :
-	m_pMesh(pMesh), m_pFacet(pFacet), m_iFacet(iFacet)
+Triangle::Triangle(Mesh * pMesh, uint32_t iFacet) :
+	m_pMesh(pMesh), m_iFacet(iFacet)
 {
 
 }
@@ -28,9 +43,9 @@ void Triangle::SamplePosition(const Point2f & Sample, Point3f & P, Normal3f & N)
 	float Beta = Sample.y() * SqrOneMinusEpsilon1;
 	float Gamma = 1.0f - Alpha - Beta;
 
-	const MatrixXu & Indices = m_pMesh->GetIndices();
-	const MatrixXf & Positions = m_pMesh->GetVertexPositions();
-	const MatrixXf & Normals = m_pMesh->GetVertexNormals();
+	const MatrixXuMap & Indices = m_pMesh->GetIndices();
+	const MatrixXfMap & Positions = m_pMesh->GetVertexPositions();
+	const MatrixXfMap & Normals = m_pMesh->GetVertexNormals();
 
 	uint32_t Idx0 = Indices(0, m_iFacet), Idx1 = Indices(1, m_iFacet), Idx2 = Indices(2, m_iFacet);
 	Point3f P0 = Positions.col(Idx0), P1 = Positions.col(Idx1), P2 = Positions.col(Idx2);
@@ -83,10 +98,10 @@ void Triangle::PostIntersect(Intersection & Isect) const
 
 	/* References to all relevant mesh buffers */
 	const Mesh * pMesh = Isect.pShape->GetMesh();
-	const MatrixXf & V = pMesh->GetVertexPositions();
-	const MatrixXf & N = pMesh->GetVertexNormals();
-	const MatrixXf & UV = pMesh->GetVertexTexCoords();
-	const MatrixXu & F = pMesh->GetIndices();
+	const MatrixXfMap & V = pMesh->GetVertexPositions();
+	const MatrixXfMap & N = pMesh->GetVertexNormals();
+	const MatrixXfMap & UV = pMesh->GetVertexTexCoords();
+	const MatrixXuMap & F = pMesh->GetIndices();
 
 	/* Vertex indices of the triangle */
 	uint32_t Idx0 = F(0, m_iFacet), Idx1 = F(1, m_iFacet), Idx2 = F(2, m_iFacet);
@@ -203,10 +218,11 @@ const BSDF * Triangle::GetBSDF() const
 
 std::string Triangle::ToString() const
 {
-	const MatrixXf & V = m_pMesh->GetVertexPositions();
-	uint32_t iV0 = m_pFacet[0];
-	uint32_t iV1 = m_pFacet[1];
-	uint32_t iV2 = m_pFacet[2];
+	const MatrixXfMap & V = m_pMesh->GetVertexPositions();
+	const MatrixXuMap & F = m_pMesh->GetIndices();
+	uint32_t iV0 = F(0, m_iFacet);
+	uint32_t iV1 = F(1, m_iFacet);
+	uint32_t iV2 = F(2, m_iFacet);
 	Point3f P0 = V.col(iV0);
 	Point3f P1 = V.col(iV1);
 	Point3f P2 = V.col(iV2);
@@ -228,6 +244,13 @@ std::string Triangle::ToString() const
 Mesh::~Mesh()
 {
 	delete m_pBSDF;
+
+	for (auto pPtr : m_pInstances)
+	{
+		delete pPtr;
+	}
+	m_pInstances.clear();
+	m_pInstances.shrink_to_fit();
 }
 
 void Mesh::Activate()
@@ -239,6 +262,11 @@ void Mesh::Activate()
 		m_pBSDF = (BSDF*)(ObjectFactory::CreateInstance(DEFAULT_MESH_BSDF, PropertyList()));
 	}
 
+	if (m_pEmitter != nullptr && !m_pInstances.empty())
+	{
+		throw HikariException("Mesh: an area emitter can not be instanced!");
+	}
+
 	if (m_pBSDF->HasBSDFType(EBSDFType::EUVDependent))
 	{
 		if (m_UV.size() == 0)
@@ -247,17 +275,16 @@ void Mesh::Activate()
 		}
 	}
 
-	std::vector<float> Areas(GetTriangleCount());
-	// Create the pdf (defined by the area of each triangle)
-	for (uint32_t i = 0; i < GetTriangleCount(); i++)
+	/* The area distribution may have been loaded with the mesh */
+	if (m_pPDF == nullptr)
 	{
-		float Area = SurfaceArea(i);
-		Areas[i] = Area;
-		m_MeshArea += Area;
+		ComputeAreaDistribution();
 	}
-	m_InvMeshArea = 1.0f / m_MeshArea;
 
-	m_pPDF.reset(new DiscretePDF1D(Areas.data(), int(Areas.size())));
+	if (m_pEmitter != nullptr)
+	{
+		m_pEmitter->UpdateSamplingData();
+	}
 }
 
 uint32_t Mesh::GetTriangleCount() const
@@ -319,6 +346,45 @@ float Mesh::SurfaceArea(uint32_t Index) const
 	return 0.5f * Vector3f((P1 - P0).cross(P2 - P0)).norm();
 }
 
+void Mesh::SetVertexPositions(const MatrixXf & Positions, const MatrixXf & Normals)
+{
+	if (Positions.rows() != 3 || Positions.cols() != m_V.cols())
+	{
+		throw HikariException("Mesh::SetVertexPositions(): expected %d vertex positions but %d were given!", m_V.cols(), Positions.cols());
+	}
+
+	if (Normals.size() != 0 && (Normals.rows() != 3 || Normals.cols() != m_V.cols()))
+	{
+		throw HikariException("Mesh::SetVertexPositions(): expected %d vertex normals but %d were given!", m_V.cols(), Normals.cols());
+	}
+
+	/* The shared buffers are copied, the others are overwritten in place (external buffers are mapped copy-on-write) */
+	DetachSharedGeometry();
+	m_V = Positions;
+	if (Normals.size() != 0)
+	{
+		if (m_N.size() == 0)
+		{
+			m_NStorage.resize(3, m_V.cols());
+			new (&m_N) MatrixXfMap(m_NStorage.data(), 3, m_V.cols());
+		}
+		m_N = Normals;
+	}
+
+	m_BBox.Reset();
+	for (std::ptrdiff_t i = 0; i < m_V.cols(); i++)
+	{
+		m_BBox.ExpandBy(m_V.col(i));
+	}
+
+	ComputeAreaDistribution();
+
+	if (m_pEmitter != nullptr)
+	{
+		m_pEmitter->UpdateSamplingData();
+	}
+}
+
 const BoundingBox3f & Mesh::GetBoundingBox() const
 {
 	return m_BBox;
@@ -383,22 +449,22 @@ bool Mesh::RayIntersect(uint32_t Index, const Ray3f & Ray, float & U, float & V,
 	return T >= Ray.MinT && T <= Ray.MaxT;
 }
 
-const MatrixXf & Mesh::GetVertexPositions() const
+const MatrixXfMap & Mesh::GetVertexPositions() const
 {
 	return m_V;
 }
 
-const MatrixXf & Mesh::GetVertexNormals() const
+const MatrixXfMap & Mesh::GetVertexNormals() const
 {
 	return m_N;
 }
 
-const MatrixXf & Mesh::GetVertexTexCoords() const
+const MatrixXfMap & Mesh::GetVertexTexCoords() const
 {
 	return m_UV;
 }
 
-const MatrixXu & Mesh::GetIndices() const
+const MatrixXuMap & Mesh::GetIndices() const
 {
 	return m_F;
 }
@@ -423,6 +489,11 @@ const BSDF * Mesh::GetBSDF() const
 	return m_pBSDF;
 }
 
+const std::vector<Instance*> & Mesh::GetInstances() const
+{
+	return m_pInstances;
+}
+
 const std::string & Mesh::GetName() const
 {
 	return m_Name;
@@ -450,6 +521,9 @@ void Mesh::AddChild(Object * pChildObj, const std::string & Name)
 			throw HikariException("Mesh: only area light can be attached!");
 		}
 		break;
+	case EClassType::EInstance:
+		m_pInstances.push_back((Instance*)(pChildObj));
+		break;
 	default:
 		throw HikariException("Mesh::AddChild(<%s>, <%s>) is not supported!",
 			ClassTypeName(pChildObj->GetClassType()), Name
@@ -464,12 +538,14 @@ std::string Mesh::ToString() const
 		"  name = \"%s\",\n"
 		"  vertexCount = %i,\n"
 		"  triangleCount = %i,\n"
+		"  instanceCount = %i,\n"
 		"  bsdf = %s,\n"
 		"  emitter = %s\n"
 		"]",
 		m_Name,
 		m_V.cols(),
 		m_F.cols(),
+		m_pInstances.size(),
 		m_pBSDF != nullptr ? Indent(m_pBSDF->ToString()) : std::string("null"),
 		m_pEmitter != nullptr ? Indent(m_pEmitter->ToString()) : std::string("null")
 	);
@@ -482,4 +558,126 @@ Object::EClassType Mesh::GetClassType() const
 
 Mesh::Mesh() { }
 
+void Mesh::ComputeAreaDistribution()
+{
+	std::vector<float> Areas(GetTriangleCount());
+	m_MeshArea = 0.0f;
+	// Create the pdf (defined by the area of each triangle)
+	for (uint32_t i = 0; i < GetTriangleCount(); i++)
+	{
+		float Area = SurfaceArea(i);
+		Areas[i] = Area;
+		m_MeshArea += Area;
+	}
+	m_InvMeshArea = 1.0f / m_MeshArea;
+
+	m_pPDF.reset(new DiscretePDF1D(Areas.data(), int(Areas.size())));
+}
+
+void Mesh::AllocateBuffers(uint32_t nVertices, uint32_t nTriangles, bool bNormals, bool bTexCoords)
+{
+	m_pSharedGeometry.reset();
+	m_VStorage.resize(3, nVertices);
+	m_NStorage.resize(3, bNormals ? nVertices : 0);
+	m_UVStorage.resize(2, bTexCoords ? nVertices : 0);
+	m_FStorage.resize(3, nTriangles);
+
+	/* Eigen maps are re-targeted by constructing them again in place */
+	new (&m_V) MatrixXfMap(m_VStorage.data(), 3, nVertices);
+	new (&m_N) MatrixXfMap(m_NStorage.data(), 3, bNormals ? nVertices : 0);
+	new (&m_UV) MatrixXfMap(m_UVStorage.data(), 2, bTexCoords ? nVertices : 0);
+	new (&m_F) MatrixXuMap(m_FStorage.data(), 3, nTriangles);
+}
+
+void Mesh::SetExternalBuffers(float * pV, float * pN, float * pUV, uint32_t * pF, uint32_t nVertices, uint32_t nTriangles)
+{
+	m_pSharedGeometry.reset();
+	m_VStorage.resize(3, 0);
+	m_NStorage.resize(3, 0);
+	m_UVStorage.resize(2, 0);
+	m_FStorage.resize(3, 0);
+
+	new (&m_V) MatrixXfMap(pV, 3, nVertices);
+	new (&m_N) MatrixXfMap(pN, 3, (pN != nullptr) ? nVertices : 0);
+	new (&m_UV) MatrixXfMap(pUV, 2, (pUV != nullptr) ? nVertices : 0);
+	new (&m_F) MatrixXuMap(pF, 3, nTriangles);
+}
+
+std::string Mesh::GetGeometryKey(const std::string & Type, const filesystem::path & Filename, const Transform & Trans)
+{
+	/* The same file may be referenced with different relative paths, the transformation is compared exactly */
+	std::string Path = Filename.exists() ? Filename.make_absolute().str() : Filename.str();
+	const Eigen::Matrix4f & Matrix = Trans.GetMatrix();
+	return Type + "\n" + Path + "\n" + std::string((const char*)(Matrix.data()), sizeof(float) * Matrix.size());
+}
+
+bool Mesh::AttachSharedGeometry(const std::string & Key)
+{
+	std::shared_ptr<SharedGeometry> pGeometry;
+	{
+		std::lock_guard<std::mutex> Guard(GeometryCacheLock);
+		auto Iter = GeometryCache.find(Key);
+		if (Iter == GeometryCache.end())
+		{
+			return false;
+		}
+		pGeometry = Iter->second.lock();
+	}
+
+	if (pGeometry == nullptr)
+	{
+		return false;
+	}
+
+	SetExternalBuffers(
+		pGeometry->V.data(),
+		(pGeometry->N.size() != 0) ? pGeometry->N.data() : nullptr,
+		(pGeometry->UV.size() != 0) ? pGeometry->UV.data() : nullptr,
+		pGeometry->F.data(),
+		uint32_t(pGeometry->V.cols()),
+		uint32_t(pGeometry->F.cols())
+	);
+	m_BBox = pGeometry->BBox;
+	m_pSharedGeometry = pGeometry;
+	return true;
+}
+
+void Mesh::ShareGeometry(const std::string & Key)
+{
+	CHECK(m_V.data() == m_VStorage.data() && m_F.data() == m_FStorage.data());
+
+	std::shared_ptr<SharedGeometry> pGeometry(new SharedGeometry());
+	pGeometry->V.swap(m_VStorage);
+	pGeometry->N.swap(m_NStorage);
+	pGeometry->UV.swap(m_UVStorage);
+	pGeometry->F.swap(m_FStorage);
+	pGeometry->BBox = m_BBox;
+
+	/* The data did not move, only its owner changed */
+	m_pSharedGeometry = pGeometry;
+
+	std::lock_guard<std::mutex> Guard(GeometryCacheLock);
+	GeometryCache[Key] = pGeometry;
+}
+
+void Mesh::DetachSharedGeometry()
+{
+	if (m_pSharedGeometry == nullptr)
+	{
+		return;
+	}
+
+	m_VStorage = m_V;
+	m_NStorage = m_N;
+	m_UVStorage = m_UV;
+	m_FStorage = m_F;
+
+	new (&m_V) MatrixXfMap(m_VStorage.data(), 3, m_VStorage.cols());
+	new (&m_N) MatrixXfMap(m_NStorage.data(), 3, m_NStorage.cols());
+	new (&m_UV) MatrixXfMap(m_UVStorage.data(), 2, m_UVStorage.cols());
+	new (&m_F) MatrixXuMap(m_FStorage.data(), 3, m_FStorage.cols());
+
+	m_pSharedGeometry.reset();
+}
+
 NAMESPACE_END
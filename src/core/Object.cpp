@@ -38,6 +38,7 @@ std::string Object::ClassTypeName(EClassType Type)
 		case EClassType::EReconstructionFilter: return "ReconstructionFilter";
 		case EClassType::EAcceleration:         return "Acceleration";
 		case EClassType::EShape:                return "Shape";
+		case EClassType::EInstance:             return "Instance";
 		default:                                return "<Unknown>";
 	}
 }
@@ -61,6 +61,7 @@ Object * LoadFromXML(const std::string & Filename)
 		EReconstructionFilter = Object::EClassType::EReconstructionFilter,
 		EAcceleration         = Object::EClassType::EAcceleration,
 		EShape                = Object::EClassType::EShape,
+		EInstance             = Object::EClassType::EInstance,
 
 		/* Properties */
 		EBoolean              = Object::EClassType::EClassTypeCount,
@@ -96,6 +97,7 @@ Object * LoadFromXML(const std::string & Filename)
 	Tags[XML_FILTER]               = EReconstructionFilter;
 	Tags[XML_ACCELERATION]         = EAcceleration;
 	Tags[XML_SHAPE]                = EShape;
+	Tags[XML_INSTANCE]             = EInstance;
 	Tags["boolean"]                = EBoolean;
 	Tags["integer"]                = EInteger;
 	Tags["float"]                  = EFloat;
@@ -112,6 +112,95 @@ float Sampling::SquareToCosineHemispherePdf(const Vector3f & V)
 	return (V.norm() - 1.0f <= 1e-6f && V.z() >= 0.0f) ? V.z() / float(M_PI) : 0.0f;
 }
 
+Point2f Sampling::SquareToSphericalTriangle(const Point2f & Sample, const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2)
+{
+	auto SafeSqrt = [](float Value) { return std::sqrt(std::max(0.0f, Value)); };
+
+	/* Numerically robust angle between two unit vectors */
+	auto AngleBetween = [](const Vector3f & V1, const Vector3f & V2)
+	{
+		if (V1.dot(V2) < 0.0f)
+		{
+			return float(M_PI) - 2.0f * std::asin(std::min(Vector3f(V1 + V2).norm() * 0.5f, 1.0f));
+		}
+		return 2.0f * std::asin(std::min(Vector3f(V2 - V1).norm() * 0.5f, 1.0f));
+	};
+
+	/* Vertices of the spherical triangle */
+	Vector3f A = (P0 - Ref).normalized(), B = (P1 - Ref).normalized(), C = (P2 - Ref).normalized();
+
+	/* Normals of the great circles through the edges */
+	Vector3f NAB = A.cross(B), NBC = B.cross(C), NCA = C.cross(A);
+	if (NAB.squaredNorm() == 0.0f || NBC.squaredNorm() == 0.0f || NCA.squaredNorm() == 0.0f)
+	{
+		return Point2f(1.0f / 3.0f, 1.0f / 3.0f);
+	}
+	NAB.normalize();
+	NBC.normalize();
+	NCA.normalize();
+
+	/* Interior angles at the vertices */
+	float Alpha = AngleBetween(NAB, -NCA);
+	float Beta = AngleBetween(NBC, -NAB);
+	float Gamma = AngleBetween(NCA, -NBC);
+
+	/* Uniformly sample the area of the sub-triangle (A, B, C') */
+	float AreaPi = Alpha + Beta + Gamma;
+	float SubAreaPi = float(M_PI) + Sample.x() * (AreaPi - float(M_PI));
+
+	/* Find the cosine of the arc length between A and C' */
+	float CosAlpha = std::cos(Alpha), SinAlpha = std::sin(Alpha);
+	float SinPhi = std::sin(SubAreaPi) * CosAlpha - std::cos(SubAreaPi) * SinAlpha;
+	float CosPhi = std::cos(SubAreaPi) * CosAlpha + std::sin(SubAreaPi) * SinAlpha;
+	float K1 = CosPhi + CosAlpha;
+	float K2 = SinPhi - SinAlpha * A.dot(B);
+	float CosBp = (K2 + (K2 * CosPhi - K1 * SinPhi) * CosAlpha) / ((K2 * SinPhi + K1 * CosPhi) * SinAlpha);
+	CosBp = Clamp(CosBp, -1.0f, 1.0f);
+
+	/* Find C' on the arc between A and C */
+	float SinBp = SafeSqrt(1.0f - CosBp * CosBp);
+	Vector3f Cp = CosBp * A + SinBp * Vector3f(C - C.dot(A) * A).normalized();
+
+	/* Uniformly sample the arc between B and C' */
+	float CosTheta = 1.0f - Sample.y() * (1.0f - Cp.dot(B));
+	float SinTheta = SafeSqrt(1.0f - CosTheta * CosTheta);
+	Vector3f W = CosTheta * B + SinTheta * Vector3f(Cp - Cp.dot(B) * B).normalized();
+
+	/* Intersect the direction with the triangle to find the barycentric coordinates */
+	Vector3f E1 = P1 - P0, E2 = P2 - P0;
+	Vector3f S1 = W.cross(E2);
+	float Divisor = S1.dot(E1);
+	if (Divisor == 0.0f)
+	{
+		return Point2f(1.0f / 3.0f, 1.0f / 3.0f);
+	}
+	float InvDivisor = 1.0f / Divisor;
+	Vector3f S = Ref - P0;
+	float B1 = Clamp(S.dot(S1) * InvDivisor, 0.0f, 1.0f);
+	float B2 = Clamp(W.dot(S.cross(E1)) * InvDivisor, 0.0f, 1.0f);
+	if (B1 + B2 > 1.0f)
+	{
+		float Sum = B1 + B2;
+		B1 /= Sum;
+		B2 /= Sum;
+	}
+	return Point2f(B1, B2);
+}
+
+float Sampling::SquareToSphericalTrianglePdf(const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2)
+{
+	float SolidAngle = SphericalTriangleSolidAngle(Ref, P0, P1, P2);
+	return (SolidAngle > 0.0f) ? 1.0f / SolidAngle : 0.0f;
+}
+
+float Sampling::SphericalTriangleSolidAngle(const Point3f & Ref, const Point3f & P0, const Point3f & P1, const Point3f & P2)
+{
+	// Ref : Van Oosterom and Strackee, "The Solid Angle of a Plane Triangle"
+	Vector3f A = (P0 - Ref).normalized(), B = (P1 - Ref).normalized(), C = (P2 - Ref).normalized();
+	float SolidAngle = std::abs(2.0f * std::atan2(A.dot(B.cross(C)), 1.0f + A.dot(B) + A.dot(C) + B.dot(C)));
+	return std::isfinite(SolidAngle) ? SolidAngle : 0.0f;
+}
+
 Vector3f Sampling::SquareToBeckmann(const Point2f & Sample, float Alpha)
 {
 	float Ln = std::logf(1.0f - Sample.x());
@@ -3,6 +3,9 @@
 #include <core\Camera.hpp>
 #include <core\Acceleration.hpp>
 #include <core\Integrator.hpp>
+#include <core\Instance.hpp>
+#include <core\Emitter.hpp>
+#include <core\EmitterSampler.hpp>
 
 NAMESPACE_BEGIN
 
@@ -15,6 +18,49 @@ Scene::Scene(const PropertyList & PropList)
 
 	/* Forcely use the background color when the environment emitter is specified */
 	m_bForceBackground = PropList.GetBoolean(XML_SCENE_FORCE_BACKGROUND, DEFAULT_SCENE_FORCE_BACKGROUND);
+
+	/* Strategy to select the emitters for the direct illumination (uniform, power or bvh) */
+	m_EmitterSamplerName = PropList.GetString(XML_SCENE_EMITTER_SAMPLER, DEFAULT_SCENE_EMITTER_SAMPLER);
+
+	/* Number of emitters selected for each shading point */
+	int nEmitterSamples = PropList.GetInteger(XML_SCENE_EMITTER_SAMPLES, DEFAULT_SCENE_EMITTER_SAMPLES);
+	if (nEmitterSamples <= 0)
+	{
+		throw HikariException("The number of emitter samples must be positive!");
+	}
+	m_nEmitterSamples = uint32_t(nEmitterSamples);
+
+	/* Relative error under which a pixel stops receiving samples (0 disables the adaptive sampling) */
+	m_AdaptiveThreshold = PropList.GetFloat(XML_SCENE_ADAPTIVE_THRESHOLD, DEFAULT_SCENE_ADAPTIVE_THRESHOLD);
+	if (m_AdaptiveThreshold < 0.0f)
+	{
+		throw HikariException("The adaptive threshold must be non-negative!");
+	}
+
+	/* Number of samples per pixel of each pass over the image blocks when the image is rendered in several passes */
+	int nPassSamples = PropList.GetInteger(XML_SCENE_PASS_SAMPLES, DEFAULT_SCENE_PASS_SAMPLES);
+	if (nPassSamples <= 0)
+	{
+		throw HikariException("The number of pass samples must be positive!");
+	}
+	m_nPassSamples = uint32_t(nPassSamples);
+
+	/* Wall-clock budget of the rendering in seconds (0 means no budget), a budget implies the progressive rendering */
+	m_TimeBudget = PropList.GetFloat(XML_SCENE_TIME_BUDGET, DEFAULT_SCENE_TIME_BUDGET);
+	if (m_TimeBudget < 0.0f)
+	{
+		throw HikariException("The time budget must be non-negative!");
+	}
+
+	/* Render the image in passes over all the blocks and write it after each pass */
+	m_bProgressive = PropList.GetBoolean(XML_SCENE_PROGRESSIVE, DEFAULT_SCENE_PROGRESSIVE) || m_TimeBudget > 0.0f;
+
+	/* Minimum time between two checkpoints of the rendering in seconds (0 disables the checkpoints) */
+	m_CheckpointInterval = PropList.GetFloat(XML_SCENE_CHECKPOINT_INTERVAL, DEFAULT_SCENE_CHECKPOINT_INTERVAL);
+	if (m_CheckpointInterval < 0.0f)
+	{
+		throw HikariException("The checkpoint interval must be non-negative!");
+	}
 }
 
 Scene::~Scene()
@@ -109,6 +155,51 @@ Emitter * Scene::GetEnvironmentEmitter()
 	return m_pEnvironmentEmitter;
 }
 
+const Emitter * Scene::SampleEmitter(const Point3f & P, const Normal3f & N, float Sample1D, float & Pdf) const
+{
+	return m_pEmitterSampler->Sample(P, N, Sample1D, Pdf);
+}
+
+float Scene::EmitterPdf(const Point3f & P, const Normal3f & N, const Emitter * pEmitter) const
+{
+	return m_pEmitterSampler->Pdf(P, N, pEmitter);
+}
+
+uint32_t Scene::GetEmitterSampleCount() const
+{
+	return m_nEmitterSamples;
+}
+
+float Scene::GetAdaptiveThreshold() const
+{
+	return m_AdaptiveThreshold;
+}
+
+bool Scene::IsAdaptiveSamplingEnabled() const
+{
+	return m_AdaptiveThreshold > 0.0f;
+}
+
+uint32_t Scene::GetPassSampleCount() const
+{
+	return m_nPassSamples;
+}
+
+bool Scene::IsProgressive() const
+{
+	return m_bProgressive;
+}
+
+float Scene::GetTimeBudget() const
+{
+	return m_TimeBudget;
+}
+
+float Scene::GetCheckpointInterval() const
+{
+	return m_CheckpointInterval;
+}
+
 BoundingBox3f Scene::GetBoundingBox() const
 {
 	return m_BBox;
@@ -119,24 +210,45 @@ bool Scene::RayIntersect(const Ray3f & Ray, Intersection & Isect) const
 	return m_pAcceleration->RayIntersect(Ray, Isect, false);
 }
 
+void Scene::RayIntersectPacket(const Ray3f * pRays, Intersection * pIsects, bool * pbHits, uint32_t nRays) const
+{
+	m_pAcceleration->RayIntersectPacket(pRays, pIsects, pbHits, nRays);
+}
+
 bool Scene::ShadowRayIntersect(const Ray3f & Ray) const
 {
-	Intersection Isect;
-	return m_pAcceleration->RayIntersect(Ray, Isect, true);
+	return m_pAcceleration->Occluded(Ray);
 }
 
 void Scene::Activate()
 {
+	bool bHasInstance = std::any_of(m_pMeshes.begin(), m_pMeshes.end(),
+		[](const Mesh * pMesh) { return !pMesh->GetInstances().empty(); }
+	);
+
 	if (m_pAcceleration == nullptr)
 	{
 		/* Create a default acceleration */
 		LOG(WARNING) << "No acceleration was specified, create a default acceleration.";
-		m_pAcceleration = (Acceleration*)(ObjectFactory::CreateInstance(DEFAULT_SCENE_ACCELERATION, PropertyList()));
+		m_pAcceleration = (Acceleration*)(ObjectFactory::CreateInstance(
+			bHasInstance ? DEFAULT_SCENE_INSTANCE_ACCELERATION : DEFAULT_SCENE_ACCELERATION, PropertyList()
+		));
 	}
 
 	for (Mesh * pMesh : m_pMeshes)
 	{
-		m_pAcceleration->AddMesh(pMesh);
+		/* A mesh with instances is only rendered through its instances */
+		if (pMesh->GetInstances().empty())
+		{
+			m_pAcceleration->AddMesh(pMesh);
+		}
+		else
+		{
+			for (Instance * pInstance : pMesh->GetInstances())
+			{
+				m_pAcceleration->AddInstance(pInstance);
+			}
+		}
 	}
 
 	m_pAcceleration->Build();
@@ -144,6 +256,11 @@ void Scene::Activate()
 
 	LOG(INFO) << "Memory used for Shape : " << MemString(m_pAcceleration->GetUsedMemoryForShape());
 
+	m_pEmitterSampler.reset(EmitterSampler::Create(m_EmitterSamplerName));
+	m_pEmitterSampler->Build(m_pEmitters, m_BBox);
+
+	LOG(INFO) << "Memory used for emitter sampling : " << MemString(m_pEmitterSampler->GetUsedMemory());
+
 	if (m_pIntegrator == nullptr)
 	{
 		throw HikariException("No integrator was specified!");
@@ -164,6 +281,15 @@ void Scene::Activate()
 	LOG(INFO) << "\nConfiguration:\n" << ToString();
 }
 
+void Scene::Refit()
+{
+	m_pAcceleration->Refit();
+	m_BBox = m_pAcceleration->GetBoundingBox();
+
+	/* The bounds of the area emitters may have changed as well */
+	m_pEmitterSampler->Build(m_pEmitters, m_BBox);
+}
+
 void Scene::AddChild(Object * pChildObj, const std::string & Name)
 {
 	switch (pChildObj->GetClassType())
@@ -261,6 +387,13 @@ std::string Scene::ToString() const
 		"Scene[\n"
 		"  background = %s,\n"
 		"  forceBackground = %s,\n"
+		"  emitterSampler = %s,\n"
+		"  emitterSamples = %u,\n"
+		"  adaptiveThreshold = %f,\n"
+		"  passSamples = %u,\n"
+		"  progressive = %s,\n"
+		"  timeBudget = %f,\n"
+		"  checkpointInterval = %f,\n"
 		"  acceleration = %s,\n"
 		"  integrator = %s,\n"
 		"  sampler = %s\n"
@@ -272,6 +405,13 @@ std::string Scene::ToString() const
 		"]",
 		m_Background.ToString(),
 		m_bForceBackground ? "true" : "false",
+		m_pEmitterSampler->ToString(),
+		m_nEmitterSamples,
+		m_AdaptiveThreshold,
+		m_nPassSamples,
+		m_bProgressive ? "true" : "false",
+		m_TimeBudget,
+		m_CheckpointInterval,
 		Indent(m_pAcceleration->ToString()),
 		Indent(m_pIntegrator->ToString()),
 		Indent(m_pSampler->ToString()),
@@ -1,13 +1,34 @@
 #include <emitter\AreaLight.hpp>
 #include <core\Mesh.hpp>
+#include <core\Sampling.hpp>
 
 NAMESPACE_BEGIN
 
 REGISTER_CLASS(AreaLight, XML_EMITTER_AREA_LIGHT);
 
+/// The spherical triangles which are too small or too large are sampled by area (numerical robustness)
+constexpr float MinSphericalSampleSolidAngle = 3e-4f;
+constexpr float MaxSphericalSampleSolidAngle = 6.22f;
+
 AreaLight::AreaLight(const PropertyList & PropList)
 {
 	m_Radiance = PropList.GetColor(XML_EMITTER_AREA_LIGHT_RADIANCE);
+
+	/* Sample the area of the mesh (area) or the solid angle of the facets (solidAngle) */
+	std::string Sampling = PropList.GetString(XML_EMITTER_AREA_LIGHT_SAMPLING, DEFAULT_EMITTER_AREA_LIGHT_SAMPLING);
+	if (Sampling == XML_EMITTER_AREA_LIGHT_SAMPLING_AREA)
+	{
+		m_bSolidAngleSampling = false;
+	}
+	else if (Sampling == XML_EMITTER_AREA_LIGHT_SAMPLING_SOLID_ANGLE)
+	{
+		m_bSolidAngleSampling = true;
+	}
+	else
+	{
+		throw HikariException("Unknown sampling method \"%s\" for AreaLight!", Sampling);
+	}
+
 	m_Type = EEmitterType::EArea;
 }
 
@@ -18,6 +39,62 @@ Color3f AreaLight::Sample(EmitterQueryRecord & Record, const Point2f & Sample2D,
 		throw HikariException("There is no shape attached to this AreaLight!");
 	}
 
+	if (m_bSolidAngleSampling)
+	{
+		/* Select a facet by its estimated contribution */
+		float PdfFacet;
+		uint32_t iFacet = m_FacetBVH.Sample(Record.Ref, Normal3f(0.0f), Sample1D, PdfFacet);
+		if (iFacet == uint32_t(-1))
+		{
+			return Color3f(0.0f);
+		}
+
+		const MatrixXfMap & V = m_pMesh->GetVertexPositions();
+		const MatrixXfMap & N = m_pMesh->GetVertexNormals();
+		const MatrixXuMap & F = m_pMesh->GetIndices();
+		uint32_t Idx0 = F(0, iFacet), Idx1 = F(1, iFacet), Idx2 = F(2, iFacet);
+		Point3f P0 = V.col(Idx0), P1 = V.col(Idx1), P2 = V.col(Idx2);
+
+		/* Sample the spherical triangle or the area of the facet */
+		Point2f Barycentric;
+		float SolidAngle = Sampling::SphericalTriangleSolidAngle(Record.Ref, P0, P1, P2);
+		if (SolidAngle >= MinSphericalSampleSolidAngle && SolidAngle <= MaxSphericalSampleSolidAngle)
+		{
+			Barycentric = Sampling::SquareToSphericalTriangle(Sample2D, Record.Ref, P0, P1, P2);
+		}
+		else
+		{
+			float SqrOneMinusEpsilon1 = std::sqrt(1.0f - Sample2D.x());
+			Barycentric = Point2f(1.0f - SqrOneMinusEpsilon1, Sample2D.y() * SqrOneMinusEpsilon1);
+		}
+
+		float Gamma = 1.0f - Barycentric.x() - Barycentric.y();
+		Record.P = Gamma * P0 + Barycentric.x() * P1 + Barycentric.y() * P2;
+		if (N.size() > 0)
+		{
+			Record.N = (Gamma * N.col(Idx0) + Barycentric.x() * N.col(Idx1) + Barycentric.y() * N.col(Idx2)).normalized();
+		}
+		else
+		{
+			Record.N = (P1 - P0).cross(P2 - P0).normalized();
+		}
+
+		Vector3f Wi = Record.P - Record.Ref;
+
+		Record.Distance = Wi.norm();
+		Record.Wi = Wi.normalized();
+		Record.pEmitter = this;
+		Record.iFacet = iFacet;
+		Record.Pdf = PdfFacet * FacetPdf(iFacet, Record.Ref, Record.P);
+
+		if (Record.Pdf == 0.0f || std::isinf(Record.Pdf) || std::isnan(Record.Pdf))
+		{
+			return Color3f(0.0f);
+		}
+
+		return Eval(Record) / Record.Pdf;
+	}
+
 	m_pMesh->SamplePosition(Sample1D, Sample2D, Record.P, Record.N);
 
 	Vector3f Wi = Record.P - Record.Ref;
@@ -42,6 +119,13 @@ float AreaLight::Pdf(const EmitterQueryRecord & Record) const
 		throw HikariException("There is no shape attached to this AreaLight!");
 	}
 
+	if (m_bSolidAngleSampling)
+	{
+		/* The facet must be given by the caller (e.g. the intersected shape) */
+		CHECK(Record.iFacet < m_pMesh->GetTriangleCount());
+		return m_FacetBVH.Pdf(Record.Ref, Normal3f(0.0f), Record.iFacet) * FacetPdf(Record.iFacet, Record.Ref, Record.P);
+	}
+
 	/* Transform the integration variable from the position domain to solid angle domain */
 	float GDenominator = std::abs((-1.0f * Record.Wi).dot(Record.N));
 	
@@ -73,6 +157,160 @@ Color3f AreaLight::Eval(const EmitterQueryRecord & Record) const
 	return Color3f(0.0f);
 }
 
+float AreaLight::GetPower(float SceneRadius) const
+{
+	if (m_pMesh == nullptr)
+	{
+		throw HikariException("There is no shape attached to this AreaLight!");
+	}
+
+	return float(M_PI) * m_Radiance.GetLuminance() * m_pMesh->SurfaceArea();
+}
+
+bool AreaLight::GetBounds(EmitterBounds & Bounds) const
+{
+	if (m_pMesh == nullptr)
+	{
+		throw HikariException("There is no shape attached to this AreaLight!");
+	}
+
+	const MatrixXfMap & V = m_pMesh->GetVertexPositions();
+	const MatrixXfMap & N = m_pMesh->GetVertexNormals();
+	const MatrixXuMap & F = m_pMesh->GetIndices();
+
+	/* The emitting normals are the face normals or the interpolated vertex normals */
+	auto FaceNormal = [&](uint32_t iFacet)
+	{
+		Point3f P0 = V.col(F(0, iFacet)), P1 = V.col(F(1, iFacet)), P2 = V.col(F(2, iFacet));
+		return Vector3f((P1 - P0).cross(P2 - P0));
+	};
+
+	/* Axis of the cone : area weighted average of the normals */
+	Vector3f Axis(0.0f);
+	for (uint32_t i = 0; i < uint32_t(F.cols()); i++)
+	{
+		Axis += FaceNormal(i);
+	}
+	for (uint32_t i = 0; i < uint32_t(N.cols()); i++)
+	{
+		Axis += Vector3f(N.col(i));
+	}
+
+	float CosThetaO = -1.0f;
+	if (Axis.squaredNorm() > 0.0f)
+	{
+		Axis.normalize();
+		CosThetaO = 1.0f;
+		for (uint32_t i = 0; i < uint32_t(F.cols()); i++)
+		{
+			Vector3f Normal = FaceNormal(i);
+			if (Normal.squaredNorm() > 0.0f)
+			{
+				CosThetaO = std::min(CosThetaO, Axis.dot(Normal.normalized()));
+			}
+		}
+		for (uint32_t i = 0; i < uint32_t(N.cols()); i++)
+		{
+			Vector3f Normal = N.col(i);
+			if (Normal.squaredNorm() > 0.0f)
+			{
+				CosThetaO = std::min(CosThetaO, Axis.dot(Normal.normalized()));
+			}
+		}
+	}
+	else
+	{
+		Axis = Vector3f(0.0f, 0.0f, 1.0f);
+	}
+
+	Bounds.BBox = m_pMesh->GetBoundingBox();
+	Bounds.W = Axis;
+	Bounds.CosThetaO = Clamp(CosThetaO, -1.0f, 1.0f);
+	Bounds.CosThetaE = 0.0f;
+	Bounds.Phi = m_Radiance.GetLuminance() * m_pMesh->SurfaceArea();
+	Bounds.bTwoSided = false;
+
+	return true;
+}
+
+void AreaLight::UpdateSamplingData()
+{
+	if (!m_bSolidAngleSampling)
+	{
+		return;
+	}
+
+	const MatrixXfMap & V = m_pMesh->GetVertexPositions();
+	const MatrixXfMap & N = m_pMesh->GetVertexNormals();
+	const MatrixXuMap & F = m_pMesh->GetIndices();
+
+	/* The emission bounds of each facet, the radiance is the same for all of them */
+	std::vector<EmitterBounds> Bounds(F.cols());
+	for (uint32_t i = 0; i < uint32_t(F.cols()); i++)
+	{
+		Point3f P0 = V.col(F(0, i)), P1 = V.col(F(1, i)), P2 = V.col(F(2, i));
+		Vector3f Normal = (P1 - P0).cross(P2 - P0);
+		float Area = 0.5f * Normal.norm();
+		if (Area == 0.0f)
+		{
+			continue;
+		}
+
+		Bounds[i].BBox = BoundingBox3f(P0);
+		Bounds[i].BBox.ExpandBy(P1);
+		Bounds[i].BBox.ExpandBy(P2);
+		Bounds[i].W = Normal.normalized();
+		Bounds[i].CosThetaO = 1.0f;
+
+		/* The cone must also contain the interpolated shading normals */
+		if (N.size() > 0)
+		{
+			Vector3f N0 = N.col(F(0, i)), N1 = N.col(F(1, i)), N2 = N.col(F(2, i));
+			Vector3f Axis = N0.normalized() + N1.normalized() + N2.normalized();
+			if (Axis.squaredNorm() > 0.0f)
+			{
+				Bounds[i].W = Axis.normalized();
+				Bounds[i].CosThetaO = std::min({ Bounds[i].W.dot(N0.normalized()), Bounds[i].W.dot(N1.normalized()), Bounds[i].W.dot(N2.normalized()) });
+			}
+			else
+			{
+				Bounds[i].CosThetaO = -1.0f;
+			}
+		}
+
+		Bounds[i].CosThetaE = 0.0f;
+		Bounds[i].Phi = Area;
+		Bounds[i].bTwoSided = false;
+	}
+
+	m_FacetBVH.Build(Bounds);
+}
+
+float AreaLight::FacetPdf(uint32_t iFacet, const Point3f & Ref, const Point3f & P) const
+{
+	const MatrixXfMap & V = m_pMesh->GetVertexPositions();
+	const MatrixXuMap & F = m_pMesh->GetIndices();
+	Point3f P0 = V.col(F(0, iFacet)), P1 = V.col(F(1, iFacet)), P2 = V.col(F(2, iFacet));
+
+	float SolidAngle = Sampling::SphericalTriangleSolidAngle(Ref, P0, P1, P2);
+	if (SolidAngle >= MinSphericalSampleSolidAngle && SolidAngle <= MaxSphericalSampleSolidAngle)
+	{
+		return 1.0f / SolidAngle;
+	}
+
+	/* Transform the density of the area sampling to solid angle domain */
+	Vector3f Normal = (P1 - P0).cross(P2 - P0);
+	float Area = 0.5f * Normal.norm();
+	Vector3f Wi = P - Ref;
+	float SquaredDistance = Wi.squaredNorm();
+	float CosTheta = std::abs(Wi.dot(Normal.normalized())) / std::sqrt(SquaredDistance);
+	if (CosTheta == 0.0f || Area == 0.0f)
+	{
+		return 0.0f;
+	}
+	return SquaredDistance / (CosTheta * Area);
+}
+
 void AreaLight::SetParent(Object * pParentObj, const std::string & Name)
 {
 	EClassType ClzType = pParentObj->GetClassType();
@@ -91,8 +329,9 @@ void AreaLight::SetParent(Object * pParentObj, const std::string & Name)
 std::string AreaLight::ToString() const
 {
 	return tfm::format(
-		"AreaLight[radiance = %s]",
-		m_Radiance.ToString()
+		"AreaLight[radiance = %s, sampling = %s]",
+		m_Radiance.ToString(),
+		m_bSolidAngleSampling ? XML_EMITTER_AREA_LIGHT_SAMPLING_SOLID_ANGLE : XML_EMITTER_AREA_LIGHT_SAMPLING_AREA
 	);
 }
 
@@ -55,6 +55,11 @@ Color3f ConstantLight::Eval(const EmitterQueryRecord & Record) const
 	return m_Radiance;
 }
 
+float ConstantLight::GetPower(float SceneRadius) const
+{
+	return 4.0f * float(M_PI) * float(M_PI) * SceneRadius * SceneRadius * m_Radiance.GetLuminance();
+}
+
 std::string ConstantLight::ToString() const
 {
 	return tfm::format(
@@ -36,6 +36,12 @@ Color3f DirectionalLight::Eval(const EmitterQueryRecord & Record) const
 	return Color3f(0.0f);
 }
 
+float DirectionalLight::GetPower(float SceneRadius) const
+{
+	/* The power through the disk of the scene bounding sphere */
+	return float(M_PI) * SceneRadius * SceneRadius * m_Irradiance.GetLuminance();
+}
+
 std::string DirectionalLight::ToString() const
 {
 	return tfm::format(
@@ -17,7 +17,8 @@ EnvironmentLight::EnvironmentLight(const PropertyList & PropList)
 	m_ToLocal = m_ToWorld.Inverse();
 
 	std::vector<float> Luminance(m_pEnvironmentMap->size());
-	
+	m_LuminanceIntegral = 0.0f;
+
 	for (std::ptrdiff_t y = 0; y < m_pEnvironmentMap->rows(); y++)
 	{
 		float Theta = float(y + 0.5f) / m_pEnvironmentMap->rows() * float(M_PI);
@@ -26,9 +27,13 @@ EnvironmentLight::EnvironmentLight(const PropertyList & PropList)
 		{
 			// Ref : PBRT P845-850
 			Luminance[y * m_pEnvironmentMap->cols() + x] = m_pEnvironmentMap->coeff(y, x).GetLuminance() * SinTheta;
+			m_LuminanceIntegral += Luminance[y * m_pEnvironmentMap->cols() + x];
 		}
 	}
 
+	/* Integral of the luminance over the sphere of directions */
+	m_LuminanceIntegral *= float(2.0 * M_PI * M_PI) / float(m_pEnvironmentMap->size());
+
 	m_pPdf = new DiscretePDF2D(Luminance.data(), int(m_pEnvironmentMap->cols()), int(m_pEnvironmentMap->rows()));
 }
 
@@ -110,6 +115,11 @@ Color3f EnvironmentLight::Eval(const EmitterQueryRecord & Record) const
 	return Radiance * m_Scale;
 }
 
+float EnvironmentLight::GetPower(float SceneRadius) const
+{
+	return float(M_PI) * SceneRadius * SceneRadius * m_Scale * m_LuminanceIntegral;
+}
+
 std::string EnvironmentLight::ToString() const
 {
 	return tfm::format(
@@ -36,6 +36,22 @@ Color3f PointLight::Eval(const EmitterQueryRecord & Record) const
 	return Color3f(0.0f);
 }
 
+float PointLight::GetPower(float SceneRadius) const
+{
+	return m_Power.GetLuminance();
+}
+
+bool PointLight::GetBounds(EmitterBounds & Bounds) const
+{
+	Bounds.BBox = BoundingBox3f(m_Position);
+	Bounds.W = Vector3f(0.0f, 0.0f, 1.0f);
+	Bounds.CosThetaO = -1.0f;
+	Bounds.CosThetaE = 0.0f;
+	Bounds.Phi = m_Power.GetLuminance() * float(INV_FOURPI);
+	Bounds.bTwoSided = false;
+	return true;
+}
+
 std::string PointLight::ToString() const
 {
 	return tfm::format(
@@ -20,7 +20,18 @@ Color3f AoIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ray3f &
 {
 	/* Find the surface that is visible in the requested direction */
 	Intersection Isect;
-	if (!pScene->RayIntersect(Ray, Isect))
+	bool bHit = pScene->RayIntersect(Ray, Isect);
+	return LiPrimary(pScene, pSampler, Ray, Isect, bHit);
+}
+
+bool AoIntegrator::IsPrimaryRayPacketSupported() const
+{
+	return true;
+}
+
+Color3f AoIntegrator::LiPrimary(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray, const Intersection & Isect, bool bHit) const
+{
+	if (!bHit)
 	{
 		return Color3f(0.0f);
 	}
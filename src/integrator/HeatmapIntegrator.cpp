@@ -0,0 +1,99 @@
+#include <integrator\HeatmapIntegrator.hpp>
+#include <core\Scene.hpp>
+#include <core\Acceleration.hpp>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(HeatmapIntegrator, XML_INTEGRATOR_HEATMAP);
+
+HeatmapIntegrator::HeatmapIntegrator(const PropertyList & PropList)
+{
+	m_MetricName = PropList.GetString(XML_INTEGRATOR_HEATMAP_METRIC, DEFAULT_INTEGRATOR_HEATMAP_METRIC);
+	m_MaxCost = PropList.GetFloat(XML_INTEGRATOR_HEATMAP_MAX_COST, DEFAULT_INTEGRATOR_HEATMAP_MAX_COST);
+
+	if (m_MetricName == XML_INTEGRATOR_HEATMAP_METRIC_NODES)
+	{
+		m_Metric = EMetric::ENodes;
+	}
+	else if (m_MetricName == XML_INTEGRATOR_HEATMAP_METRIC_BOX_TESTS)
+	{
+		m_Metric = EMetric::EBoxTests;
+	}
+	else if (m_MetricName == XML_INTEGRATOR_HEATMAP_METRIC_TRIANGLE_TESTS)
+	{
+		m_Metric = EMetric::ETriangleTests;
+	}
+	else
+	{
+		if (m_MetricName != XML_INTEGRATOR_HEATMAP_METRIC_TOTAL)
+		{
+			LOG(WARNING) << "Metric should be \"" << XML_INTEGRATOR_HEATMAP_METRIC_NODES << "\", \"" <<
+				XML_INTEGRATOR_HEATMAP_METRIC_BOX_TESTS << "\", \"" << XML_INTEGRATOR_HEATMAP_METRIC_TRIANGLE_TESTS <<
+				"\" or \"" << XML_INTEGRATOR_HEATMAP_METRIC_TOTAL << "\" but \"" << m_MetricName << "\" was given, use default metric";
+			m_MetricName = DEFAULT_INTEGRATOR_HEATMAP_METRIC;
+		}
+		m_Metric = EMetric::ETotal;
+	}
+
+	if (m_MaxCost < 0.0f)
+	{
+		LOG(WARNING) << "Max cost should be non-negative but \"" << m_MaxCost << "\" was given, use default max cost";
+		m_MaxCost = DEFAULT_INTEGRATOR_HEATMAP_MAX_COST;
+	}
+}
+
+void HeatmapIntegrator::Preprocess(const Scene * pScene)
+{
+	Acceleration::SetStatisticsEnabled(true);
+}
+
+Color3f HeatmapIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray) const
+{
+	/* The counters of the calling thread only grow with the queries it issues */
+	const TraversalStatistics::Counters & Counters = Acceleration::GetThreadStatistics().ClosestHit;
+	TraversalStatistics::Counters Before = Counters;
+
+	Intersection Isect;
+	pScene->RayIntersect(Ray, Isect);
+
+	float Cost = 0.0f;
+	switch (m_Metric)
+	{
+	case EMetric::ENodes:
+		Cost = float(Counters.nNodes - Before.nNodes);
+		break;
+	case EMetric::EBoxTests:
+		Cost = float(Counters.nBoxTests - Before.nBoxTests);
+		break;
+	case EMetric::ETriangleTests:
+		Cost = float(Counters.nTriangleTests - Before.nTriangleTests);
+		break;
+	default:
+		Cost = float(Counters.nBoxTests - Before.nBoxTests + Counters.nTriangleTests - Before.nTriangleTests);
+		break;
+	}
+
+	if (m_MaxCost == 0.0f)
+	{
+		return Color3f(Cost);
+	}
+
+	/* Blue (no cost) -> green -> red (maxCost and above) */
+	float X = Clamp(Cost / m_MaxCost, 0.0f, 1.0f);
+	if (X < 0.5f)
+	{
+		return Color3f(0.0f, 2.0f * X, 1.0f - 2.0f * X);
+	}
+	return Color3f(2.0f * X - 1.0f, 2.0f - 2.0f * X, 0.0f);
+}
+
+std::string HeatmapIntegrator::ToString() const
+{
+	return tfm::format(
+		"HeatmapIntegrator[metric = %s, maxCost = %.4f]",
+		m_MetricName,
+		m_MaxCost
+	);
+}
+
+NAMESPACE_END
@@ -15,7 +15,18 @@ Color3f NormalIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ray
 {
 	/* Find the surface that is visible in the requested direction */
 	Intersection Isect;
-	if (!pScene->RayIntersect(Ray, Isect))
+	bool bHit = pScene->RayIntersect(Ray, Isect);
+	return LiPrimary(pScene, pSampler, Ray, Isect, bHit);
+}
+
+bool NormalIntegrator::IsPrimaryRayPacketSupported() const
+{
+	return true;
+}
+
+Color3f NormalIntegrator::LiPrimary(const Scene * pScene, Sampler * pSampler, const Ray3f & Ray, const Intersection & Isect, bool bHit) const
+{
+	if (!bHit)
 	{
 		return Color3f(0.0f);
 	}
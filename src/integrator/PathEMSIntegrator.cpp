@@ -25,6 +25,7 @@ Color3f PathEMSIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 	const Emitter * pEnvironmentEmitter = pScene->GetEnvironmentEmitter();
 	Color3f Background = pScene->GetBackground();
 	bool bForceBackground = pScene->GetForceBackground();
+	uint32_t nEmitterSamples = pScene->GetEmitterSampleCount();
 
 	while (Depth < m_Depth)
 	{
@@ -68,9 +69,13 @@ Color3f PathEMSIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 		{
 			bLastPathSpecular = false;
 
-			for (Emitter * pEmitter : pScene->GetEmitters())
+			// Select a few emitters instead of looping over all of them,
+			// each selected emitter is estimated with one shadow ray
+			for (uint32_t i = 0; i < nEmitterSamples; i++)
 			{
-				if (pEmitter == Isect.pEmitter)
+				float PdfEmitter;
+				const Emitter * pEmitter = pScene->SampleEmitter(Isect.P, Isect.ShadingFrame.N, pSampler->Next1D(), PdfEmitter);
+				if (pEmitter == nullptr || pEmitter == Isect.pEmitter || PdfEmitter == 0.0f)
 				{
 					continue;
 				}
@@ -83,7 +88,7 @@ Color3f PathEMSIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 					EmitterRecord.Distance = pScene->GetBoundingBox().GetRadius();
 				}
 
-				Color3f Ldirect = pEmitter->Sample(EmitterRecord, pSampler->Next2D(), pSampler->Next1D());
+				Color3f Ldirect = pEmitter->Sample(EmitterRecord, pSampler->Next2D(), pSampler->Next1D()) / (PdfEmitter * nEmitterSamples);
 				if (!Ldirect.isZero())
 				{
 					Ray3f ShadowRay = Isect.SpawnShadowRay(EmitterRecord.P);
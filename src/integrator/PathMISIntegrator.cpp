@@ -27,6 +27,7 @@ Color3f PathMISIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 	const Emitter * pEnvironmentEmitter = pScene->GetEnvironmentEmitter();
 	Color3f Background = pScene->GetBackground();
 	bool bForceBackground = pScene->GetForceBackground();
+	uint32_t nEmitterSamples = pScene->GetEmitterSampleCount();
 
 	while (Depth < m_Depth)
 	{
@@ -80,8 +81,17 @@ Color3f PathMISIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 			Li += Beta * WeightMATS * Le;
 		}
 
-		for (Emitter * pEmitter : pScene->GetEmitters())
+		// Select a few emitters instead of looping over all of them,
+		// each selected emitter is estimated with one shadow ray
+		for (uint32_t i = 0; i < nEmitterSamples; i++)
 		{
+			float PdfEmitter;
+			const Emitter * pEmitter = pScene->SampleEmitter(Isect.P, Isect.ShadingFrame.N, pSampler->Next1D(), PdfEmitter);
+			if (pEmitter == nullptr || PdfEmitter == 0.0f)
+			{
+				continue;
+			}
+
 			EmitterQueryRecord EmitterRecord(Isect.P);
 
 			if (pEmitter->GetEmitterType() == EEmitterType::EEnvironment || pEmitter->GetEmitterType() == EEmitterType::EDirectional)
@@ -89,8 +99,8 @@ Color3f PathMISIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 				EmitterRecord.Distance = pScene->GetBoundingBox().GetRadius();
 			}
 
-			Color3f Ldirect = pEmitter->Sample(EmitterRecord, pSampler->Next2D(), pSampler->Next1D());
-			PdfLightEMS = EmitterRecord.Pdf;
+			Color3f Ldirect = pEmitter->Sample(EmitterRecord, pSampler->Next2D(), pSampler->Next1D()) / (PdfEmitter * nEmitterSamples);
+			PdfLightEMS = EmitterRecord.Pdf * PdfEmitter * nEmitterSamples;
 
 			if (!Ldirect.isZero())
 			{
@@ -99,7 +109,12 @@ Color3f PathMISIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 				{
 					BSDFQueryRecord BSDFRecord(Isect.ToLocal(-1.0f * TracingRay.Direction), Isect.ToLocal(EmitterRecord.Wi), EMeasure::ESolidAngle, ETransportMode::ERadiance, pSampler, Isect);
 					PdfBSDFEMS = pBSDF->Pdf(BSDFRecord);
-					if (PdfLightEMS + PdfBSDFEMS != 0.0f)
+					if (pEmitter->IsDelta() || pEmitter->GetEmitterType() == EEmitterType::EDirectional)
+					{
+						// The BSDF sampling can never hit a delta emitter
+						WeightEMS = 1.0f;
+					}
+					else if (PdfLightEMS + PdfBSDFEMS != 0.0f)
 					{
 						WeightEMS = PdfLightEMS / (PdfLightEMS + PdfBSDFEMS);
 					}
@@ -123,8 +138,10 @@ Color3f PathMISIntegrator::Li(const Scene * pScene, Sampler * pSampler, const Ra
 		if (bFoundIntersectionNext && IsectNext.pEmitter != nullptr)
 		{
 			EmitterQueryRecord EmitterRecord(IsectNext.pEmitter, Isect.P, IsectNext.P, IsectNext.ShadingFrame.N);
+			EmitterRecord.iFacet = IsectNext.pShape->GetFacetIndex();
 
-			PdfLightMATS = IsectNext.pEmitter->Pdf(EmitterRecord);
+			PdfLightMATS = IsectNext.pEmitter->Pdf(EmitterRecord) *
+				pScene->EmitterPdf(Isect.P, Isect.ShadingFrame.N, IsectNext.pEmitter) * nEmitterSamples;
 			PdfBSDFMATS = pBSDF->Pdf(BSDFRecord);
 
 			if (PdfBSDFMATS + PdfLightMATS != 0.0f)
@@ -0,0 +1,294 @@
+#include <mesh\BinaryMesh.hpp>
+#include <core\Timer.hpp>
+#include <tbb\tbb.h>
+#include <fstream>
+#include <cstring>
+#include <atomic>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(BinaryMesh, XML_MESH_BINARY);
+
+/// Identifier at the beginning of the binary mesh files
+constexpr char BINARY_MESH_MAGIC[8] = { 'H', 'I', 'K', 'A', 'R', 'I', 'M', 'S' };
+
+/// Version of the binary mesh format (the byte order is stored since version 2)
+constexpr uint32_t BINARY_MESH_VERSION = 2;
+
+/// Written in the native byte order, read as 0x04030201 on a machine of the other byte order
+constexpr uint32_t BINARY_MESH_BYTE_ORDER = 0x01020304;
+constexpr uint32_t BINARY_MESH_SWAPPED_BYTE_ORDER = 0x04030201;
+
+/// Alignment (in bytes) of the arrays in the binary mesh files
+constexpr uint64_t BINARY_MESH_ALIGNMENT = 64;
+
+static_assert(sizeof(BinaryMeshHeader) == 104, "Unexpected padding in the binary mesh header");
+
+inline uint64_t AlignBinaryMeshOffset(uint64_t Offset)
+{
+	return (Offset + BINARY_MESH_ALIGNMENT - 1) / BINARY_MESH_ALIGNMENT * BINARY_MESH_ALIGNMENT;
+}
+
+BinaryMesh::BinaryMesh(const PropertyList & PropList)
+{
+	filesystem::path Filename = GetFileResolver()->resolve(PropList.GetString(XML_MESH_BINARY_FILENAME));
+
+	if (!m_File.Open(Filename.str()))
+	{
+		throw HikariException("Unable to open binary mesh file \"%s\"!", Filename);
+	}
+
+	Transform Trans = PropList.GetTransform(XML_MESH_BINARY_TO_WORLD, DEFAULT_MESH_TO_WORLD);
+
+	LOG(INFO) << "Loading mesh \"" << Filename << "\" ... ";
+	cout.flush();
+	Timer BinaryTimer;
+
+	/* Start reading the whole file while the header is validated */
+	m_File.Prefetch();
+
+	uint8_t * pData = m_File.GetData();
+	uint64_t Size = uint64_t(m_File.GetSize());
+
+	if (Size < sizeof(BinaryMeshHeader))
+	{
+		throw HikariException("Binary mesh file \"%s\" is truncated!", Filename);
+	}
+
+	BinaryMeshHeader Header;
+	memcpy(&Header, pData, sizeof(BinaryMeshHeader));
+
+	if (memcmp(Header.Magic, BINARY_MESH_MAGIC, sizeof(BINARY_MESH_MAGIC)) != 0)
+	{
+		throw HikariException("File \"%s\" is not a binary mesh file!", Filename);
+	}
+
+	if (Header.ByteOrder == BINARY_MESH_SWAPPED_BYTE_ORDER)
+	{
+		throw HikariException("Binary mesh file \"%s\" was saved on a machine with another byte order!", Filename);
+	}
+
+	if (Header.Version != BINARY_MESH_VERSION)
+	{
+		throw HikariException("Binary mesh file \"%s\" has version %d but version %d is expected!", Filename, Header.Version, BINARY_MESH_VERSION);
+	}
+
+	if (Header.ByteOrder != BINARY_MESH_BYTE_ORDER)
+	{
+		throw HikariException("Binary mesh file \"%s\" is corrupted or truncated!", Filename);
+	}
+
+	/* Check that an array lies in the file, return nullptr if it is absent */
+	auto GetArray = [&](uint64_t Offset, uint64_t Bytes, bool bRequired) -> uint8_t *
+	{
+		if (Offset == 0)
+		{
+			if (bRequired)
+			{
+				throw HikariException("Binary mesh file \"%s\" does not have positions or indices!", Filename);
+			}
+			return nullptr;
+		}
+		if (Offset % BINARY_MESH_ALIGNMENT != 0 || Offset > Size || Bytes > Size - Offset)
+		{
+			throw HikariException("Binary mesh file \"%s\" is corrupted or truncated!", Filename);
+		}
+		return pData + Offset;
+	};
+
+	uint64_t nVertices = Header.nVertices, nTriangles = Header.nTriangles;
+	float * pPositions = (float*)(GetArray(Header.PositionsOffset, 3 * nVertices * sizeof(float), true));
+	float * pNormals = (float*)(GetArray(Header.NormalsOffset, 3 * nVertices * sizeof(float), false));
+	float * pTexCoords = (float*)(GetArray(Header.TexCoordsOffset, 2 * nVertices * sizeof(float), false));
+	uint32_t * pIndices = (uint32_t*)(GetArray(Header.IndicesOffset, 3 * nTriangles * sizeof(uint32_t), true));
+	float * pAreas = (float*)(GetArray(Header.AreasOffset, nTriangles * sizeof(float), false));
+	float * pCdf = (float*)(GetArray(Header.CdfOffset, (nTriangles + 1) * sizeof(float), false));
+
+	/* Check the indices (this also brings them in memory for the construction of the acceleration structure) */
+	std::atomic<bool> bInvalidIndex(false);
+	tbb::blocked_range<uint64_t> IndexRange(0, 3 * nTriangles);
+	auto CheckMap = [&](const tbb::blocked_range<uint64_t> & Range)
+	{
+		uint32_t MaxIndex = 0;
+		for (uint64_t i = Range.begin(); i < Range.end(); i++)
+		{
+			MaxIndex = std::max(MaxIndex, pIndices[i]);
+		}
+		if (MaxIndex >= nVertices)
+		{
+			bInvalidIndex = true;
+		}
+	};
+
+	/// Uncomment the following line for single threaded checking
+	//CheckMap(IndexRange);
+
+	/// Default: parallel checking
+	tbb::parallel_for(IndexRange, CheckMap);
+
+	if (bInvalidIndex)
+	{
+		throw HikariException("Binary mesh file \"%s\" contains an invalid vertex index!", Filename);
+	}
+
+	SetExternalBuffers(pPositions, pNormals, pTexCoords, pIndices, uint32_t(nVertices), uint32_t(nTriangles));
+
+	if (Trans.GetMatrix() == Eigen::Matrix4f::Identity())
+	{
+		m_BBox = BoundingBox3f(
+			Point3f(Header.BBoxMin[0], Header.BBoxMin[1], Header.BBoxMin[2]),
+			Point3f(Header.BBoxMax[0], Header.BBoxMax[1], Header.BBoxMax[2])
+		);
+
+		/* The area distribution is only valid for untransformed positions */
+		if (pAreas != nullptr && pCdf != nullptr && nTriangles > 0)
+		{
+			m_pPDF.reset(new DiscretePDF1D(pAreas, pCdf, Header.AreaIntegral, int(nTriangles)));
+			m_MeshArea = Header.MeshArea;
+			m_InvMeshArea = 1.0f / m_MeshArea;
+		}
+	}
+	else
+	{
+		/* Transform the positions and the normals in place (the touched pages become private) */
+		tbb::blocked_range<uint32_t> VertexRange(0, uint32_t(nVertices));
+		auto TransformMap = [&](const tbb::blocked_range<uint32_t> & Range)
+		{
+			for (uint32_t i = Range.begin(); i < Range.end(); i++)
+			{
+				m_V.col(i) = Trans * Point3f(m_V.col(i));
+				if (m_N.size() != 0)
+				{
+					m_N.col(i) = (Trans * Normal3f(m_N.col(i))).normalized();
+				}
+			}
+		};
+
+		/// Uncomment the following line for single threaded transformation
+		//TransformMap(VertexRange);
+
+		/// Default: parallel transformation
+		tbb::parallel_for(VertexRange, TransformMap);
+
+		for (uint32_t i = 0; i < uint32_t(nVertices); i++)
+		{
+			m_BBox.ExpandBy(m_V.col(i));
+		}
+	}
+
+	m_Name = Filename.str();
+
+	if (m_N.size() == 0 || m_UV.size() == 0)
+	{
+		LOG(WARNING) << "Mesh \"" << m_Name << "\" does not have normal or texture coordinate. "
+			"Consequently derivative information cannot be computed and "
+			"some algorithm may not take effect. "
+			"(e.g. EWA filter, CurvatureTexture)";
+	}
+
+	LOG(INFO) << "Done. (V = " << m_V.cols() << ", F = " << m_F.cols() << ", took "
+		<< BinaryTimer.ElapsedString() << " and "
+		<< MemString(m_F.size() * sizeof(uint32_t) + sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
+		<< ")";
+}
+
+void BinaryMesh::Save(const Mesh * pMesh, const std::string & Filename, bool bAreaDistribution)
+{
+	const MatrixXfMap & V = pMesh->GetVertexPositions();
+	const MatrixXfMap & N = pMesh->GetVertexNormals();
+	const MatrixXfMap & UV = pMesh->GetVertexTexCoords();
+	const MatrixXuMap & F = pMesh->GetIndices();
+
+	uint64_t nVertices = uint64_t(V.cols()), nTriangles = uint64_t(F.cols());
+
+	/* Compute the area distribution in the same way as Mesh::ComputeAreaDistribution() */
+	std::vector<float> Areas;
+	std::unique_ptr<DiscretePDF1D> pPDF;
+	float MeshArea = 0.0f;
+	if (bAreaDistribution && nTriangles > 0)
+	{
+		Areas.resize(nTriangles);
+		for (uint32_t i = 0; i < uint32_t(nTriangles); i++)
+		{
+			Areas[i] = pMesh->SurfaceArea(i);
+			MeshArea += Areas[i];
+		}
+		pPDF.reset(new DiscretePDF1D(Areas.data(), int(Areas.size())));
+	}
+
+	BinaryMeshHeader Header;
+	memset(&Header, 0, sizeof(BinaryMeshHeader));
+	memcpy(Header.Magic, BINARY_MESH_MAGIC, sizeof(BINARY_MESH_MAGIC));
+	Header.Version = BINARY_MESH_VERSION;
+	Header.ByteOrder = BINARY_MESH_BYTE_ORDER;
+	Header.nVertices = uint32_t(nVertices);
+	Header.nTriangles = uint32_t(nTriangles);
+	const BoundingBox3f & BBox = pMesh->GetBoundingBox();
+	for (int i = 0; i < 3; i++)
+	{
+		Header.BBoxMin[i] = BBox.Min[i];
+		Header.BBoxMax[i] = BBox.Max[i];
+	}
+	Header.MeshArea = MeshArea;
+	Header.AreaIntegral = (pPDF != nullptr) ? pPDF->GetFuncIntegral() : 0.0f;
+
+	/* Lay out the arrays */
+	struct BinaryMeshArray
+	{
+		uint64_t * pOffset;
+		const void * pData;
+		uint64_t Bytes;
+	};
+	BinaryMeshArray Arrays[] =
+	{
+		{ &Header.PositionsOffset, V.data(), uint64_t(V.size()) * sizeof(float) },
+		{ &Header.NormalsOffset, N.data(), uint64_t(N.size()) * sizeof(float) },
+		{ &Header.TexCoordsOffset, UV.data(), uint64_t(UV.size()) * sizeof(float) },
+		{ &Header.IndicesOffset, F.data(), uint64_t(F.size()) * sizeof(uint32_t) },
+		{ &Header.AreasOffset, Areas.data(), uint64_t(Areas.size()) * sizeof(float) },
+		{ &Header.CdfOffset, (pPDF != nullptr) ? pPDF->GetCdf().data() : nullptr, (pPDF != nullptr) ? uint64_t(pPDF->GetCdf().size()) * sizeof(float) : 0 }
+	};
+
+	uint64_t Offset = AlignBinaryMeshOffset(sizeof(BinaryMeshHeader));
+	for (BinaryMeshArray & Array : Arrays)
+	{
+		/* The positions and the indices are always present, even if the mesh is empty */
+		bool bRequired = (Array.pOffset == &Header.PositionsOffset || Array.pOffset == &Header.IndicesOffset);
+		if (Array.Bytes == 0 && !bRequired)
+		{
+			continue;
+		}
+		*Array.pOffset = Offset;
+		Offset = AlignBinaryMeshOffset(Offset + Array.Bytes);
+	}
+
+	std::ofstream File(Filename, std::ios::out | std::ios::binary | std::ios::trunc);
+	if (File.fail())
+	{
+		throw HikariException("Unable to open binary mesh file \"%s\"!", Filename);
+	}
+
+	const char Padding[BINARY_MESH_ALIGNMENT] = { 0 };
+	uint64_t Position = sizeof(BinaryMeshHeader);
+	File.write((const char*)(&Header), sizeof(BinaryMeshHeader));
+	for (BinaryMeshArray & Array : Arrays)
+	{
+		if (*Array.pOffset == 0)
+		{
+			continue;
+		}
+		File.write(Padding, std::streamsize(*Array.pOffset - Position));
+		File.write((const char*)(Array.pData), std::streamsize(Array.Bytes));
+		Position = *Array.pOffset + Array.Bytes;
+	}
+
+	if (File.fail())
+	{
+		throw HikariException("Unable to write binary mesh file \"%s\"!", Filename);
+	}
+
+	LOG(INFO) << "Mesh \"" << pMesh->GetName() << "\" saved to \"" << Filename << "\". (V = "
+		<< nVertices << ", F = " << nTriangles << ", " << MemString(size_t(Position)) << ")";
+}
+
+NAMESPACE_END
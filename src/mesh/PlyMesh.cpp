@@ -0,0 +1,649 @@
+#include <mesh\PlyMesh.hpp>
+#include <core\Timer.hpp>
+#include <core\MappedFile.hpp>
+#include <tbb\tbb.h>
+#include <cstring>
+#include <sstream>
+#include <atomic>
+
+NAMESPACE_BEGIN
+
+REGISTER_CLASS(PlyMesh, XML_MESH_PLY);
+
+/// Number of faces triangulated by a single task
+constexpr size_t PLY_FACE_BLOCK_SIZE = 65536;
+
+inline bool IsLittleEndianHost()
+{
+	const uint16_t Value = 1;
+	uint8_t Byte;
+	memcpy(&Byte, &Value, 1);
+	return Byte == 1;
+}
+
+PlyMesh::PlyMesh(const PropertyList & PropList)
+{
+	filesystem::path Filename = GetFileResolver()->resolve(PropList.GetString(XML_MESH_PLY_FILENAME));
+
+	Transform Trans = PropList.GetTransform(XML_MESH_PLY_TO_WORLD, DEFAULT_MESH_TO_WORLD);
+
+	/* Share the buffers of the meshes loading the same file with the same transformation */
+	std::string GeometryKey = GetGeometryKey(XML_MESH_PLY, Filename, Trans);
+	if (AttachSharedGeometry(GeometryKey))
+	{
+		m_Name = Filename.str();
+		LOG(INFO) << "Mesh \"" << Filename << "\" shares the geometry of a previous declaration. (V = "
+			<< m_V.cols() << ", F = " << m_F.cols() << ")";
+		return;
+	}
+
+	MappedFile File;
+	if (!File.Open(Filename.str()))
+	{
+		throw HikariException("Unable to open PLY file \"%s\"!", Filename);
+	}
+
+	LOG(INFO) << "Loading mesh \"" << Filename << "\" ... ";
+	cout.flush();
+	Timer PlyTimer;
+
+	File.Prefetch();
+	const uint8_t * pData = File.GetData();
+	size_t Size = File.GetSize();
+
+	bool bSwap = false;
+	std::vector<PlyElement> Elements;
+	size_t Offset = ParseHeader((const char*)(pData), Size, Filename.str(), bSwap, Elements);
+
+	/* Find the range of each element in the file */
+	const PlyElement * pVertexElement = nullptr;
+	const PlyElement * pFaceElement = nullptr;
+	for (PlyElement & Element : Elements)
+	{
+		Element.Begin = Offset;
+		if (Element.RecordSize != 0)
+		{
+			if (Element.Count > (Size - Offset) / Element.RecordSize)
+			{
+				throw HikariException("PLY file \"%s\" is truncated!", Filename);
+			}
+			Element.End = Offset + Element.Count * Element.RecordSize;
+		}
+		else
+		{
+			LocateRecords(Element, pData, Size, bSwap, Filename.str());
+		}
+		Offset = Element.End;
+
+		if (Element.Name == "vertex")
+		{
+			pVertexElement = &Element;
+		}
+		else if (Element.Name == "face")
+		{
+			pFaceElement = &Element;
+		}
+	}
+
+	if (pVertexElement == nullptr || pFaceElement == nullptr)
+	{
+		throw HikariException("PLY file \"%s\" does not have vertex or face element!", Filename);
+	}
+
+	/* The offsets of the vertex properties are only known without list property */
+	for (const PlyProperty & Property : pVertexElement->Properties)
+	{
+		if (Property.CountType != EPlyType::EInvalid)
+		{
+			throw HikariException("PLY file \"%s\" has an unsupported list property \"%s\" in its vertex element!", Filename, Property.Name);
+		}
+	}
+
+	if (pVertexElement->RecordSize == 0 || pVertexElement->Count >= size_t(std::numeric_limits<uint32_t>::max()))
+	{
+		throw HikariException("PLY file \"%s\" has an unsupported vertex element (no properties or too many vertices)!", Filename);
+	}
+
+	if (FindProperty(*pVertexElement, "x") == nullptr || FindProperty(*pVertexElement, "y") == nullptr || FindProperty(*pVertexElement, "z") == nullptr)
+	{
+		throw HikariException("PLY file \"%s\" does not have vertex positions!", Filename);
+	}
+
+	size_t iIndexProperty = pFaceElement->Properties.size();
+	for (size_t i = 0; i < pFaceElement->Properties.size(); i++)
+	{
+		const PlyProperty & Property = pFaceElement->Properties[i];
+		if ((Property.Name == "vertex_indices" || Property.Name == "vertex_index") && Property.CountType != EPlyType::EInvalid)
+		{
+			iIndexProperty = i;
+		}
+	}
+
+	if (iIndexProperty == pFaceElement->Properties.size())
+	{
+		throw HikariException("PLY file \"%s\" does not have vertex indices!", Filename);
+	}
+
+	bool bNormals = FindProperty(*pVertexElement, "nx") != nullptr && FindProperty(*pVertexElement, "ny") != nullptr && FindProperty(*pVertexElement, "nz") != nullptr;
+	bool bTexCoords = (FindProperty(*pVertexElement, "u") != nullptr && FindProperty(*pVertexElement, "v") != nullptr) ||
+		(FindProperty(*pVertexElement, "s") != nullptr && FindProperty(*pVertexElement, "t") != nullptr) ||
+		(FindProperty(*pVertexElement, "texture_u") != nullptr && FindProperty(*pVertexElement, "texture_v") != nullptr) ||
+		(FindProperty(*pVertexElement, "texture_s") != nullptr && FindProperty(*pVertexElement, "texture_t") != nullptr);
+
+	std::vector<uint32_t> BlockTriangleOffsets = CountTriangles(*pFaceElement, iIndexProperty, pData, bSwap, Filename.str());
+
+	AllocateBuffers(uint32_t(pVertexElement->Count), BlockTriangleOffsets.back(), bNormals, bTexCoords);
+
+	DecodeVertices(*pVertexElement, pData, bSwap);
+	DecodeFaces(*pFaceElement, iIndexProperty, pData, bSwap, BlockTriangleOffsets, Filename.str());
+	File.Close();
+
+	TransformVertices(Trans);
+
+	m_Name = Filename.str();
+
+	if (!bNormals || !bTexCoords)
+	{
+		LOG(WARNING) << "Mesh \"" << m_Name << "\" does not have normal or texture coordinate. "
+			"Consequently derivative information cannot be computed and "
+			"some algorithm may not take effect. "
+			"(e.g. EWA filter, CurvatureTexture)";
+	}
+
+	LOG(INFO) << "Done. (V = " << m_V.cols() << ", F = " << m_F.cols() << ", took "
+		<< PlyTimer.ElapsedString() << " and "
+		<< MemString(m_F.size() * sizeof(uint32_t) + sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
+		<< ")";
+
+	ShareGeometry(GeometryKey);
+}
+
+PlyMesh::EPlyType PlyMesh::ParseType(const std::string & Name, const std::string & Filename)
+{
+	if (Name == "char" || Name == "int8") { return EPlyType::EInt8; }
+	if (Name == "uchar" || Name == "uint8") { return EPlyType::EUInt8; }
+	if (Name == "short" || Name == "int16") { return EPlyType::EInt16; }
+	if (Name == "ushort" || Name == "uint16") { return EPlyType::EUInt16; }
+	if (Name == "int" || Name == "int32") { return EPlyType::EInt32; }
+	if (Name == "uint" || Name == "uint32") { return EPlyType::EUInt32; }
+	if (Name == "float" || Name == "float32") { return EPlyType::EFloat32; }
+	if (Name == "double" || Name == "float64") { return EPlyType::EFloat64; }
+	throw HikariException("Unknown property type \"%s\" in PLY file \"%s\"!", Name, Filename);
+}
+
+size_t PlyMesh::GetTypeSize(EPlyType Type)
+{
+	switch (Type)
+	{
+	case EPlyType::EInt8:
+	case EPlyType::EUInt8:
+		return 1;
+	case EPlyType::EInt16:
+	case EPlyType::EUInt16:
+		return 2;
+	case EPlyType::EInt32:
+	case EPlyType::EUInt32:
+	case EPlyType::EFloat32:
+		return 4;
+	case EPlyType::EFloat64:
+		return 8;
+	default:
+		return 0;
+	}
+}
+
+template <typename T>
+T PlyMesh::ReadValue(const uint8_t * pData, EPlyType Type, bool bSwap)
+{
+	size_t Size = GetTypeSize(Type);
+	uint8_t Bytes[8];
+	if (bSwap)
+	{
+		for (size_t i = 0; i < Size; i++)
+		{
+			Bytes[i] = pData[Size - 1 - i];
+		}
+	}
+	else
+	{
+		memcpy(Bytes, pData, Size);
+	}
+
+	switch (Type)
+	{
+	case EPlyType::EInt8: { int8_t Value; memcpy(&Value, Bytes, 1); return T(Value); }
+	case EPlyType::EUInt8: { uint8_t Value; memcpy(&Value, Bytes, 1); return T(Value); }
+	case EPlyType::EInt16: { int16_t Value; memcpy(&Value, Bytes, 2); return T(Value); }
+	case EPlyType::EUInt16: { uint16_t Value; memcpy(&Value, Bytes, 2); return T(Value); }
+	case EPlyType::EInt32: { int32_t Value; memcpy(&Value, Bytes, 4); return T(Value); }
+	case EPlyType::EUInt32: { uint32_t Value; memcpy(&Value, Bytes, 4); return T(Value); }
+	case EPlyType::EFloat32: { float Value; memcpy(&Value, Bytes, 4); return T(Value); }
+	case EPlyType::EFloat64: { double Value; memcpy(&Value, Bytes, 8); return T(Value); }
+	default: return T(0);
+	}
+}
+
+const PlyMesh::PlyProperty * PlyMesh::FindProperty(const PlyElement & Element, const std::string & Name)
+{
+	for (const PlyProperty & Property : Element.Properties)
+	{
+		if (Property.Name == Name)
+		{
+			return &Property;
+		}
+	}
+	return nullptr;
+}
+
+size_t PlyMesh::ParseHeader(const char * pData, size_t Size, const std::string & Filename, bool & bSwap, std::vector<PlyElement> & Elements)
+{
+	size_t Offset = 0;
+	bool bFormat = false;
+	for (uint32_t iLine = 0; ; iLine++)
+	{
+		const char * pLineEnd = (const char*)(memchr(pData + Offset, '\n', Size - Offset));
+		if (pLineEnd == nullptr)
+		{
+			throw HikariException("PLY file \"%s\" does not have a valid header!", Filename);
+		}
+
+		std::string Line(pData + Offset, pLineEnd);
+		Offset = size_t(pLineEnd - pData) + 1;
+		if (!Line.empty() && Line.back() == '\r')
+		{
+			Line.pop_back();
+		}
+
+		std::istringstream ISS(Line);
+		std::string Keyword;
+		ISS >> Keyword;
+
+		if (iLine == 0)
+		{
+			if (Keyword != "ply")
+			{
+				throw HikariException("File \"%s\" is not a PLY file!", Filename);
+			}
+		}
+		else if (Keyword == "format")
+		{
+			std::string Format;
+			ISS >> Format;
+			if (Format == "binary_little_endian")
+			{
+				bSwap = !IsLittleEndianHost();
+			}
+			else if (Format == "binary_big_endian")
+			{
+				bSwap = IsLittleEndianHost();
+			}
+			else
+			{
+				throw HikariException("PLY file \"%s\" has the format \"%s\", only binary PLY files are supported!", Filename, Format);
+			}
+			bFormat = true;
+		}
+		else if (Keyword == "element")
+		{
+			Elements.emplace_back();
+			ISS >> Elements.back().Name >> Elements.back().Count;
+			if (ISS.fail())
+			{
+				throw HikariException("Invalid line \"%s\" in the header of PLY file \"%s\"!", Line, Filename);
+			}
+		}
+		else if (Keyword == "property")
+		{
+			if (Elements.empty())
+			{
+				throw HikariException("Invalid line \"%s\" in the header of PLY file \"%s\"!", Line, Filename);
+			}
+
+			PlyProperty Property;
+			std::string Type;
+			ISS >> Type;
+			if (Type == "list")
+			{
+				std::string CountType;
+				ISS >> CountType >> Type;
+				Property.CountType = ParseType(CountType, Filename);
+			}
+			Property.Type = ParseType(Type, Filename);
+			ISS >> Property.Name;
+			if (ISS.fail())
+			{
+				throw HikariException("Invalid line \"%s\" in the header of PLY file \"%s\"!", Line, Filename);
+			}
+			Elements.back().Properties.push_back(Property);
+		}
+		else if (Keyword == "end_header")
+		{
+			break;
+		}
+		else if (Keyword != "comment" && Keyword != "obj_info" && !Keyword.empty())
+		{
+			throw HikariException("Invalid line \"%s\" in the header of PLY file \"%s\"!", Line, Filename);
+		}
+	}
+
+	if (!bFormat)
+	{
+		throw HikariException("PLY file \"%s\" does not specify its format!", Filename);
+	}
+
+	/* The records without list property have a fixed size */
+	for (PlyElement & Element : Elements)
+	{
+		size_t RecordSize = 0;
+		for (PlyProperty & Property : Element.Properties)
+		{
+			if (Property.CountType != EPlyType::EInvalid)
+			{
+				RecordSize = 0;
+				break;
+			}
+			Property.Offset = RecordSize;
+			RecordSize += GetTypeSize(Property.Type);
+		}
+		Element.RecordSize = RecordSize;
+	}
+
+	return Offset;
+}
+
+size_t PlyMesh::GetPropertyOffset(const PlyElement & Element, const uint8_t * pRecord, size_t iProperty, size_t MaxSize, bool bSwap)
+{
+	size_t Offset = 0;
+	for (size_t i = 0; i < iProperty; i++)
+	{
+		const PlyProperty & Property = Element.Properties[i];
+		if (Property.CountType == EPlyType::EInvalid)
+		{
+			Offset += GetTypeSize(Property.Type);
+		}
+		else
+		{
+			size_t CountSize = GetTypeSize(Property.CountType);
+			if (Offset + CountSize > MaxSize)
+			{
+				return size_t(-1);
+			}
+			int64_t Count = ReadValue<int64_t>(pRecord + Offset, Property.CountType, bSwap);
+			if (Count < 0 || uint64_t(Count) > MaxSize)
+			{
+				return size_t(-1);
+			}
+			Offset += CountSize + size_t(Count) * GetTypeSize(Property.Type);
+		}
+
+		if (Offset > MaxSize)
+		{
+			return size_t(-1);
+		}
+	}
+	return Offset;
+}
+
+void PlyMesh::LocateRecords(PlyElement & Element, const uint8_t * pData, size_t Size, bool bSwap, const std::string & Filename)
+{
+	size_t nProperties = Element.Properties.size();
+	Element.End = Element.Begin;
+	if (Element.Count == 0)
+	{
+		return;
+	}
+
+	size_t RecordSize = GetPropertyOffset(Element, pData + Element.Begin, nProperties, Size - Element.Begin, bSwap);
+	if (RecordSize == size_t(-1) || RecordSize == 0)
+	{
+		throw HikariException("PLY file \"%s\" is truncated!", Filename);
+	}
+
+	/* Usually all the records have the same size (e.g. only triangles), which can be checked in parallel */
+	if (Element.Count <= (Size - Element.Begin) / RecordSize)
+	{
+		std::atomic<bool> bUniform(true);
+		tbb::blocked_range<size_t> RecordRange(0, Element.Count);
+		auto CheckMap = [&](const tbb::blocked_range<size_t> & Range)
+		{
+			for (size_t i = Range.begin(); i < Range.end() && bUniform; i++)
+			{
+				if (GetPropertyOffset(Element, pData + Element.Begin + i * RecordSize, nProperties, RecordSize, bSwap) != RecordSize)
+				{
+					bUniform = false;
+				}
+			}
+		};
+
+		/// Uncomment the following line for single threaded checking
+		//CheckMap(RecordRange);
+
+		/// Default: parallel checking
+		tbb::parallel_for(RecordRange, CheckMap);
+
+		if (bUniform)
+		{
+			Element.RecordSize = RecordSize;
+			Element.End = Element.Begin + Element.Count * RecordSize;
+			return;
+		}
+	}
+
+	/* Otherwise the records are found one after the other */
+	Element.RecordOffsets.resize(Element.Count);
+	size_t Offset = Element.Begin;
+	for (size_t i = 0; i < Element.Count; i++)
+	{
+		Element.RecordOffsets[i] = Offset;
+		RecordSize = GetPropertyOffset(Element, pData + Offset, nProperties, Size - Offset, bSwap);
+		if (RecordSize == size_t(-1))
+		{
+			throw HikariException("PLY file \"%s\" is truncated!", Filename);
+		}
+		Offset += RecordSize;
+	}
+	Element.End = Offset;
+}
+
+std::vector<uint32_t> PlyMesh::CountTriangles(const PlyElement & Element, size_t iIndexProperty, const uint8_t * pData, bool bSwap, const std::string & Filename)
+{
+	const PlyProperty & Property = Element.Properties[iIndexProperty];
+	size_t nBlocks = (Element.Count + PLY_FACE_BLOCK_SIZE - 1) / PLY_FACE_BLOCK_SIZE;
+	std::vector<uint64_t> BlockTriangleCounts(nBlocks + 1, 0);
+
+	tbb::blocked_range<size_t> BlockRange(0, nBlocks, 1);
+	auto CountMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
+		{
+			size_t iEnd = std::min(Element.Count, (iBlock + 1) * PLY_FACE_BLOCK_SIZE);
+			uint64_t nBlockTriangles = 0;
+			for (size_t i = iBlock * PLY_FACE_BLOCK_SIZE; i < iEnd; i++)
+			{
+				size_t iRecord = (Element.RecordSize != 0) ? Element.Begin + i * Element.RecordSize : Element.RecordOffsets[i];
+				const uint8_t * pRecord = pData + iRecord;
+				size_t PropertyOffset = GetPropertyOffset(Element, pRecord, iIndexProperty, Element.End - iRecord, bSwap);
+				int64_t nIndices = ReadValue<int64_t>(pRecord + PropertyOffset, Property.CountType, bSwap);
+				nBlockTriangles += (nIndices >= 3) ? uint64_t(nIndices - 2) : 0;
+			}
+			BlockTriangleCounts[iBlock + 1] = nBlockTriangles;
+		}
+	};
+
+	/// Uncomment the following line for single threaded counting
+	//CountMap(BlockRange);
+
+	/// Default: parallel counting
+	tbb::parallel_for(BlockRange, CountMap);
+
+	std::vector<uint32_t> BlockTriangleOffsets(nBlocks + 1, 0);
+	for (size_t iBlock = 0; iBlock < nBlocks; iBlock++)
+	{
+		BlockTriangleCounts[iBlock + 1] += BlockTriangleCounts[iBlock];
+		if (BlockTriangleCounts[iBlock + 1] >= uint64_t(std::numeric_limits<uint32_t>::max()))
+		{
+			throw HikariException("PLY file \"%s\" has too many triangles!", Filename);
+		}
+		BlockTriangleOffsets[iBlock + 1] = uint32_t(BlockTriangleCounts[iBlock + 1]);
+	}
+	return BlockTriangleOffsets;
+}
+
+void PlyMesh::DecodeVertices(const PlyElement & Element, const uint8_t * pData, bool bSwap)
+{
+	const PlyProperty * pPositions[3] = { FindProperty(Element, "x"), FindProperty(Element, "y"), FindProperty(Element, "z") };
+	const PlyProperty * pNormals[3] = { FindProperty(Element, "nx"), FindProperty(Element, "ny"), FindProperty(Element, "nz") };
+	const PlyProperty * pTexCoords[2] = { nullptr, nullptr };
+	const char * TexCoordNames[4][2] = { { "u", "v" }, { "s", "t" }, { "texture_u", "texture_v" }, { "texture_s", "texture_t" } };
+	for (int i = 0; i < 4 && pTexCoords[0] == nullptr; i++)
+	{
+		if (FindProperty(Element, TexCoordNames[i][0]) != nullptr && FindProperty(Element, TexCoordNames[i][1]) != nullptr)
+		{
+			pTexCoords[0] = FindProperty(Element, TexCoordNames[i][0]);
+			pTexCoords[1] = FindProperty(Element, TexCoordNames[i][1]);
+		}
+	}
+
+	bool bNormals = (m_N.size() != 0), bTexCoords = (m_UV.size() != 0);
+	tbb::blocked_range<size_t> VertexRange(0, Element.Count);
+	auto VertexMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t i = Range.begin(); i < Range.end(); i++)
+		{
+			const uint8_t * pRecord = pData + Element.Begin + i * Element.RecordSize;
+			for (int k = 0; k < 3; k++)
+			{
+				m_V(k, i) = ReadValue<float>(pRecord + pPositions[k]->Offset, pPositions[k]->Type, bSwap);
+			}
+			if (bNormals)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					m_N(k, i) = ReadValue<float>(pRecord + pNormals[k]->Offset, pNormals[k]->Type, bSwap);
+				}
+			}
+			if (bTexCoords)
+			{
+				for (int k = 0; k < 2; k++)
+				{
+					m_UV(k, i) = ReadValue<float>(pRecord + pTexCoords[k]->Offset, pTexCoords[k]->Type, bSwap);
+				}
+			}
+		}
+	};
+
+	/// Uncomment the following line for single threaded decoding
+	//VertexMap(VertexRange);
+
+	/// Default: parallel decoding
+	tbb::parallel_for(VertexRange, VertexMap);
+}
+
+void PlyMesh::DecodeFaces(const PlyElement & Element, size_t iIndexProperty, const uint8_t * pData, bool bSwap, const std::vector<uint32_t> & BlockTriangleOffsets, const std::string & Filename)
+{
+	const PlyProperty & Property = Element.Properties[iIndexProperty];
+	size_t CountSize = GetTypeSize(Property.CountType);
+	size_t IndexSize = GetTypeSize(Property.Type);
+	int64_t nVertices = int64_t(m_V.cols());
+	size_t nBlocks = BlockTriangleOffsets.size() - 1;
+
+	tbb::blocked_range<size_t> BlockRange(0, nBlocks, 1);
+	auto FaceMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
+		{
+			size_t iEnd = std::min(Element.Count, (iBlock + 1) * PLY_FACE_BLOCK_SIZE);
+			uint32_t iTriangle = BlockTriangleOffsets[iBlock];
+			for (size_t i = iBlock * PLY_FACE_BLOCK_SIZE; i < iEnd; i++)
+			{
+				size_t iRecord = (Element.RecordSize != 0) ? Element.Begin + i * Element.RecordSize : Element.RecordOffsets[i];
+				const uint8_t * pList = pData + iRecord + GetPropertyOffset(Element, pData + iRecord, iIndexProperty, Element.End - iRecord, bSwap);
+				int64_t nIndices = ReadValue<int64_t>(pList, Property.CountType, bSwap);
+				pList += CountSize;
+
+				int64_t Indices[3];
+				for (int64_t k = 0; k < nIndices; k++)
+				{
+					int64_t Index = ReadValue<int64_t>(pList + k * IndexSize, Property.Type, bSwap);
+					if (Index < 0 || Index >= nVertices)
+					{
+						throw HikariException("Invalid vertex index in PLY file \"%s\"!", Filename);
+					}
+
+					/* Triangulate the polygon as a fan around its first vertex */
+					if (k < 2)
+					{
+						Indices[k] = Index;
+						continue;
+					}
+					Indices[2] = Index;
+					m_F(0, iTriangle) = uint32_t(Indices[0]);
+					m_F(1, iTriangle) = uint32_t(Indices[1]);
+					m_F(2, iTriangle) = uint32_t(Indices[2]);
+					Indices[1] = Indices[2];
+					iTriangle++;
+				}
+			}
+		}
+	};
+
+	/// Uncomment the following line for single threaded triangulation
+	//FaceMap(BlockRange);
+
+	/// Default: parallel triangulation
+	tbb::parallel_for(BlockRange, FaceMap);
+}
+
+void PlyMesh::TransformVertices(const Transform & Trans)
+{
+	const Eigen::Matrix4f & Matrix = Trans.GetMatrix();
+	bool bIdentity = (Matrix == Eigen::Matrix4f::Identity());
+	bool bAffine = (Matrix.row(3) == Eigen::RowVector4f(0.0f, 0.0f, 0.0f, 1.0f));
+	Eigen::Matrix3f Linear = Matrix.topLeftCorner<3, 3>();
+	Eigen::Vector3f Translation = Matrix.topRightCorner<3, 1>();
+	Eigen::Matrix3f NormalLinear = Trans.GetInverseMatrix().topLeftCorner<3, 3>().transpose();
+	bool bNormals = (m_N.size() != 0);
+
+	/* Transform blocks of vertices with matrix products */
+	tbb::blocked_range<Eigen::Index> VertexRange(0, m_V.cols(), 4096);
+	auto TransformMap = [&](const tbb::blocked_range<Eigen::Index> & Range)
+	{
+		auto V = m_V.middleCols(Range.begin(), Range.size());
+		if (!bIdentity)
+		{
+			if (bAffine)
+			{
+				V = (Linear * V).colwise() + Translation;
+			}
+			else
+			{
+				Eigen::RowVectorXf W = (Matrix.bottomLeftCorner<1, 3>() * V).array() + Matrix(3, 3);
+				V = (Linear * V).colwise() + Translation;
+				V.array().rowwise() /= W.array();
+			}
+		}
+
+		if (bNormals)
+		{
+			auto N = m_N.middleCols(Range.begin(), Range.size());
+			if (!bIdentity)
+			{
+				N = NormalLinear * N;
+			}
+			N.colwise().normalize();
+		}
+	};
+
+	/// Uncomment the following line for single threaded transformation
+	//TransformMap(VertexRange);
+
+	/// Default: parallel transformation
+	tbb::parallel_for(VertexRange, TransformMap);
+
+	if (m_V.cols() != 0)
+	{
+		m_BBox = BoundingBox3f(Point3f(m_V.rowwise().minCoeff()), Point3f(m_V.rowwise().maxCoeff()));
+	}
+}
+
+NAMESPACE_END
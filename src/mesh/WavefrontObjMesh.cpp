@@ -1,139 +1,379 @@
 #include <mesh\WavefrontObjMesh.hpp>
 #include <core\Timer.hpp>
-#include <unordered_map>
-#include <fstream>
+#include <core\MappedFile.hpp>
+#include <tbb\tbb.h>
+#include <cstring>
 
 NAMESPACE_BEGIN
 
 REGISTER_CLASS(WavefrontObjMesh, XML_MESH_WAVEFRONG_OBJ);
 
+/// Size of the chunks of the file parsed by a single task (rounded up to whole lines)
+constexpr size_t OBJ_CHUNK_SIZE = 4 * 1024 * 1024;
+
+/// Number of face vertices numbered by a single task
+constexpr size_t OBJ_NUMBERING_BLOCK_SIZE = 65536;
+
+struct WavefrontObjMesh::ObjChunk
+{
+	const char * pBegin = nullptr;
+	const char * pEnd = nullptr;
+
+	std::vector<Vector3f> Positions;
+	std::vector<Vector2f> Texcoords;
+	std::vector<Vector3f> Normals;
+
+	/// Vertices of the triangles, the quads are split into two triangles
+	std::vector<ObjVertex> FaceVertices;
+
+	BoundingBox3f BBox;
+
+	/// Offsets of the chunk in the arrays of the whole file
+	size_t iFirstPosition = 0;
+	size_t iFirstTexcoord = 0;
+	size_t iFirstNormal = 0;
+	size_t iFirstFaceVertex = 0;
+};
+
+/// Same set of white spaces as the one skipped by std::istream
+inline bool IsObjSpace(char C)
+{
+	return C == ' ' || C == '\t' || C == '\r' || C == '\n' || C == '\v' || C == '\f';
+}
+
+inline const char * SkipObjSpaces(const char * pStr, const char * pEnd)
+{
+	while (pStr < pEnd && IsObjSpace(*pStr))
+	{
+		pStr++;
+	}
+	return pStr;
+}
+
+inline const char * SkipObjToken(const char * pStr, const char * pEnd)
+{
+	while (pStr < pEnd && !IsObjSpace(*pStr))
+	{
+		pStr++;
+	}
+	return pStr;
+}
+
+/**
+* \brief Parse the floating point value of a token, the short decimal values
+* are converted directly (with a single correctly rounded operation, so the
+* result is the same as strtof), the others are handed to strtof
+*/
+const char * ParseObjFloat(const char * pStr, const char * pEnd, float & Value)
+{
+	static const float Pow10[] = { 1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f, 1e8f, 1e9f, 1e10f };
+
+	pStr = SkipObjSpaces(pStr, pEnd);
+	const char * pToken = pStr;
+	const char * pTokenEnd = SkipObjToken(pStr, pEnd);
+
+	bool bNegative = false;
+	if (pStr < pTokenEnd && (*pStr == '-' || *pStr == '+'))
+	{
+		bNegative = (*pStr == '-');
+		pStr++;
+	}
+
+	uint64_t Mantissa = 0;
+	int nDigits = 0, nSignificantDigits = 0, Exponent = 0;
+	while (pStr < pTokenEnd && *pStr >= '0' && *pStr <= '9')
+	{
+		Mantissa = Mantissa * 10 + uint64_t(*pStr - '0');
+		nSignificantDigits += (Mantissa != 0) ? 1 : 0;
+		nDigits++;
+		pStr++;
+	}
+	if (pStr < pTokenEnd && *pStr == '.')
+	{
+		pStr++;
+		while (pStr < pTokenEnd && *pStr >= '0' && *pStr <= '9')
+		{
+			Mantissa = Mantissa * 10 + uint64_t(*pStr - '0');
+			nSignificantDigits += (Mantissa != 0) ? 1 : 0;
+			nDigits++;
+			Exponent--;
+			pStr++;
+		}
+	}
+	if (nDigits > 0 && pStr < pTokenEnd && (*pStr == 'e' || *pStr == 'E'))
+	{
+		pStr++;
+		bool bNegativeExponent = false;
+		if (pStr < pTokenEnd && (*pStr == '-' || *pStr == '+'))
+		{
+			bNegativeExponent = (*pStr == '-');
+			pStr++;
+		}
+		int ExplicitExponent = 0, nExponentDigits = 0;
+		while (pStr < pTokenEnd && *pStr >= '0' && *pStr <= '9' && ExplicitExponent < 10000)
+		{
+			ExplicitExponent = ExplicitExponent * 10 + (*pStr - '0');
+			nExponentDigits++;
+			pStr++;
+		}
+		nDigits = (nExponentDigits > 0) ? nDigits : 0;
+		Exponent += bNegativeExponent ? -ExplicitExponent : ExplicitExponent;
+	}
+
+	if (nDigits > 0 && nSignificantDigits <= 19 && pStr == pTokenEnd)
+	{
+		while (Mantissa != 0 && Mantissa % 10 == 0)
+		{
+			Mantissa /= 10;
+			Exponent++;
+		}
+
+		if (Mantissa == 0)
+		{
+			Value = bNegative ? -0.0f : 0.0f;
+			return pTokenEnd;
+		}
+
+		if (Mantissa <= (uint64_t(1) << 24) && Exponent >= -10 && Exponent <= 10)
+		{
+			float Result = float(Mantissa);
+			Result = (Exponent < 0) ? Result / Pow10[-Exponent] : Result * Pow10[Exponent];
+			Value = bNegative ? -Result : Result;
+			return pTokenEnd;
+		}
+	}
+
+	// Everything else (long mantissas, large exponents, inf, nan...)
+	char Buffer[128];
+	size_t nLength = std::min(size_t(pTokenEnd - pToken), sizeof(Buffer) - 1);
+	memcpy(Buffer, pToken, nLength);
+	Buffer[nLength] = '\0';
+	char * pParseEnd = nullptr;
+	Value = strtof(Buffer, &pParseEnd);
+	return pToken + (pParseEnd - Buffer);
+}
+
+/// Parse a (possibly empty) index of a face vertex
+uint32_t ParseObjIndex(const char * pBegin, const char * pEnd)
+{
+	uint32_t Index = 0;
+	for (const char * pStr = pBegin; pStr < pEnd; pStr++)
+	{
+		if (*pStr < '0' || *pStr > '9')
+		{
+			throw HikariException("Could not parse integer value \"%s\"", std::string(pBegin, pEnd));
+		}
+		Index = Index * 10 + uint32_t(*pStr - '0');
+	}
+	return Index;
+}
+
 WavefrontObjMesh::WavefrontObjMesh(const PropertyList & PropList)
 {
-	using VertexMap = std::unordered_map<ObjVertex, uint32_t, ObjVertexHash>;
 	filesystem::path Filename = GetFileResolver()->resolve(PropList.GetString(XML_MESH_WAVEFRONG_OBJ_FILENAME));
 
-	size_t FileSizeKB = Filename.file_size();
-	size_t FileSizeMB = size_t(std::ceil(float(FileSizeKB) / (1024.0f * 1024.0f)));
+	Transform Trans = PropList.GetTransform(XML_MESH_WAVEFRONG_OBJ_TO_WORLD, DEFAULT_MESH_TO_WORLD);
 
-	size_t ApproxVertexNumber = FileSizeMB * 5000;
-	size_t ApproxFacetNumber = ApproxVertexNumber * 2;
+	/* Share the buffers of the meshes loading the same file with the same transformation */
+	std::string GeometryKey = GetGeometryKey(XML_MESH_WAVEFRONG_OBJ, Filename, Trans);
+	if (AttachSharedGeometry(GeometryKey))
+	{
+		m_Name = Filename.str();
+		LOG(INFO) << "Mesh \"" << Filename << "\" shares the geometry of a previous declaration. (V = "
+			<< m_V.cols() << ", F = " << m_F.cols() << ")";
+		return;
+	}
 
-	std::ifstream FileIn(Filename.str());
-	if (FileIn.fail())
+	MappedFile File;
+	if (!File.Open(Filename.str()) && (!Filename.exists() || Filename.file_size() != 0))
 	{
 		throw HikariException("Unable to open OBJ file \"%s\"!", Filename);
 	}
 
-	Transform Trans = PropList.GetTransform(XML_MESH_WAVEFRONG_OBJ_TO_WORLD, DEFAULT_MESH_TO_WORLD);
-
 	LOG(INFO) << "Loading mesh \"" << Filename << "\" ... ";
 	cout.flush();
 	Timer ObjTimer;
 
-	std::vector<Vector3f> Positions;  Positions.reserve(ApproxVertexNumber);
-	std::vector<Vector2f> Texcoords;  Texcoords.reserve(ApproxVertexNumber);
-	std::vector<Vector3f> Normals;    Normals.reserve(ApproxVertexNumber);
-	std::vector<uint32_t> Indices;    Indices.reserve(ApproxFacetNumber * 3);
-	std::vector<ObjVertex> Vertices;  Vertices.reserve(ApproxVertexNumber);
-	VertexMap Map;
+	/* Split the file into chunks of whole lines */
+	const char * pData = (const char*)(File.GetData());
+	size_t Size = File.GetSize();
 
-	std::stringstream Line;
-	std::string LineString;
+	std::vector<ObjChunk> Chunks;
+	size_t iBegin = 0;
+	while (iBegin < Size)
+	{
+		size_t iEnd = std::min(Size, iBegin + OBJ_CHUNK_SIZE);
+		const char * pNewLine = (const char*)(memchr(pData + iEnd - 1, '\n', Size - (iEnd - 1)));
+		iEnd = (pNewLine != nullptr) ? size_t(pNewLine - pData) + 1 : Size;
+
+		Chunks.emplace_back();
+		Chunks.back().pBegin = pData + iBegin;
+		Chunks.back().pEnd = pData + iEnd;
+		iBegin = iEnd;
+	}
 
-	while (std::getline(FileIn, LineString))
+	tbb::blocked_range<int> ChunkRange(0, int(Chunks.size()), 1);
+	auto ParseMap = [&](const tbb::blocked_range<int> & Range)
 	{
-		Line.str("");
-		Line.clear();
-		Line << LineString;
+		for (int i = Range.begin(); i < Range.end(); i++)
+		{
+			ParseChunk(Chunks[i], Trans);
+		}
+	};
 
-		std::string Prefix;
-		Line >> Prefix;
+	/// Uncomment the following line for single threaded parsing
+	//ParseMap(ChunkRange);
 
-		if (Prefix == "v")
+	/// Default: parallel parsing
+	tbb::parallel_for(ChunkRange, ParseMap);
+
+	/* Concatenate the chunks */
+	size_t nPositions = 0, nTexcoords = 0, nNormals = 0, nFaceVertices = 0;
+	for (ObjChunk & Chunk : Chunks)
+	{
+		Chunk.iFirstPosition = nPositions;
+		Chunk.iFirstTexcoord = nTexcoords;
+		Chunk.iFirstNormal = nNormals;
+		Chunk.iFirstFaceVertex = nFaceVertices;
+		nPositions += Chunk.Positions.size();
+		nTexcoords += Chunk.Texcoords.size();
+		nNormals += Chunk.Normals.size();
+		nFaceVertices += Chunk.FaceVertices.size();
+		m_BBox.ExpandBy(Chunk.BBox);
+	}
+
+	std::vector<Vector3f> Positions(nPositions);
+	std::vector<Vector2f> Texcoords(nTexcoords);
+	std::vector<Vector3f> Normals(nNormals);
+	std::vector<ObjVertex> FaceVertices(nFaceVertices);
+
+	auto ConcatenateMap = [&](const tbb::blocked_range<int> & Range)
+	{
+		for (int i = Range.begin(); i < Range.end(); i++)
 		{
-			Point3f Pos;
-			Line >> Pos.x() >> Pos.y() >> Pos.z();
-			Pos = Trans * Pos;
-			m_BBox.ExpandBy(Pos);
-			Positions.push_back(Pos);
+			ObjChunk & Chunk = Chunks[i];
+			std::copy(Chunk.Positions.begin(), Chunk.Positions.end(), Positions.begin() + Chunk.iFirstPosition);
+			std::copy(Chunk.Texcoords.begin(), Chunk.Texcoords.end(), Texcoords.begin() + Chunk.iFirstTexcoord);
+			std::copy(Chunk.Normals.begin(), Chunk.Normals.end(), Normals.begin() + Chunk.iFirstNormal);
+			std::copy(Chunk.FaceVertices.begin(), Chunk.FaceVertices.end(), FaceVertices.begin() + Chunk.iFirstFaceVertex);
+			std::vector<Vector3f>().swap(Chunk.Positions);
+			std::vector<Vector2f>().swap(Chunk.Texcoords);
+			std::vector<Vector3f>().swap(Chunk.Normals);
+			std::vector<ObjVertex>().swap(Chunk.FaceVertices);
 		}
-		else if (Prefix == "vt")
+	};
+
+	/// Uncomment the following line for single threaded concatenation
+	//ConcatenateMap(ChunkRange);
+
+	/// Default: parallel concatenation
+	tbb::parallel_for(ChunkRange, ConcatenateMap);
+
+	File.Close();
+
+	/* Find the first use of each vertex : sort the face vertices by vertex then by position */
+	std::vector<std::pair<ObjVertex, uint32_t>> SortedFaceVertices(nFaceVertices);
+	tbb::blocked_range<size_t> FaceVertexRange(0, nFaceVertices);
+	auto SortMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t i = Range.begin(); i < Range.end(); i++)
 		{
-			Point2f Tex;
-			Line >> Tex.x() >> Tex.y();
-			Texcoords.push_back(Tex);
+			SortedFaceVertices[i] = std::make_pair(FaceVertices[i], uint32_t(i));
 		}
-		else if (Prefix == "vn")
+	};
+	tbb::parallel_for(FaceVertexRange, SortMap);
+	tbb::parallel_sort(SortedFaceVertices.begin(), SortedFaceVertices.end());
+
+	/* Each run of equal vertices starts with the first use */
+	std::vector<uint32_t> iFirstUses(nFaceVertices);
+	auto FirstUseMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t i = Range.begin(); i < Range.end(); i++)
 		{
-			Normal3f Norm;
-			Line >> Norm.x() >> Norm.y() >> Norm.z();
-			Normals.push_back((Trans * Norm).normalized());
+			if (i != 0 && SortedFaceVertices[i - 1].first == SortedFaceVertices[i].first)
+			{
+				continue;
+			}
+			uint32_t iFirstUse = SortedFaceVertices[i].second;
+			for (size_t j = i; j < nFaceVertices && SortedFaceVertices[j].first == SortedFaceVertices[i].first; j++)
+			{
+				iFirstUses[SortedFaceVertices[j].second] = iFirstUse;
+			}
 		}
-		else if (Prefix == "f")
+	};
+	tbb::parallel_for(FaceVertexRange, FirstUseMap);
+	std::vector<std::pair<ObjVertex, uint32_t>>().swap(SortedFaceVertices);
+
+	/* Number the vertices in the order of their first use (prefix sum over blocks) */
+	size_t nBlocks = (nFaceVertices + OBJ_NUMBERING_BLOCK_SIZE - 1) / OBJ_NUMBERING_BLOCK_SIZE;
+	std::vector<uint32_t> BlockVertexOffsets(nBlocks + 1, 0);
+	tbb::blocked_range<size_t> BlockRange(0, nBlocks, 1);
+	auto CountMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
 		{
-			std::string V1, V2, V3, V4;
-			Line >> V1 >> V2 >> V3 >> V4;
-			ObjVertex Verts[6];
-			int nVertices = 3;
-
-			Verts[0] = ObjVertex(V1);
-			Verts[1] = ObjVertex(V2);
-			Verts[2] = ObjVertex(V3);
-
-			if (!V4.empty())
+			size_t iEnd = std::min(nFaceVertices, (iBlock + 1) * OBJ_NUMBERING_BLOCK_SIZE);
+			uint32_t nBlockVertices = 0;
+			for (size_t i = iBlock * OBJ_NUMBERING_BLOCK_SIZE; i < iEnd; i++)
 			{
-				/* This is a quad, split into two triangles */
-				Verts[3] = ObjVertex(V4);
-				Verts[4] = Verts[0];
-				Verts[5] = Verts[2];
-				nVertices = 6;
+				nBlockVertices += (iFirstUses[i] == i) ? 1 : 0;
 			}
+			BlockVertexOffsets[iBlock + 1] = nBlockVertices;
+		}
+	};
+	tbb::parallel_for(BlockRange, CountMap);
+	for (size_t iBlock = 0; iBlock < nBlocks; iBlock++)
+	{
+		BlockVertexOffsets[iBlock + 1] += BlockVertexOffsets[iBlock];
+	}
+	uint32_t nVertices = BlockVertexOffsets[nBlocks];
+
+	AllocateBuffers(nVertices, uint32_t(nFaceVertices / 3), !Normals.empty(), !Texcoords.empty());
 
-			/* Convert to an indexed vertex list */
-			for (int i = 0; i < nVertices; ++i)
+	std::vector<uint32_t> VertexIndices(nFaceVertices);
+	auto VertexMap = [&](const tbb::blocked_range<size_t> & Range)
+	{
+		for (size_t iBlock = Range.begin(); iBlock < Range.end(); iBlock++)
+		{
+			size_t iEnd = std::min(nFaceVertices, (iBlock + 1) * OBJ_NUMBERING_BLOCK_SIZE);
+			uint32_t iVertex = BlockVertexOffsets[iBlock];
+			for (size_t i = iBlock * OBJ_NUMBERING_BLOCK_SIZE; i < iEnd; i++)
 			{
-				const ObjVertex & V = Verts[i];
-				auto Iter = Map.find(V);
-				if (Iter == Map.end())
+				if (iFirstUses[i] != i)
 				{
-					Map[V] = uint32_t(Vertices.size());
-					Indices.push_back(uint32_t(Vertices.size()));
-					Vertices.push_back(V);
+					continue;
 				}
-				else
+
+				const ObjVertex & V = FaceVertices[i];
+				if (V.P - 1 >= nPositions || (!Normals.empty() && V.N - 1 >= nNormals) || (!Texcoords.empty() && V.UV - 1 >= nTexcoords))
 				{
-					Indices.push_back(Iter->second);
+					throw HikariException("Invalid vertex index in OBJ file \"%s\"!", Filename);
 				}
-			}
-		}
-	}
-
-	m_F.resize(3, Indices.size() / 3);
-	memcpy(m_F.data(), Indices.data(), sizeof(uint32_t) * Indices.size());
-
-	m_V.resize(3, Vertices.size());
-	for (uint32_t i = 0; i < Vertices.size(); ++i)
-	{
-		m_V.col(i) = Positions.at(Vertices[i].P - 1);
-	}
 
-	if (!Normals.empty())
-	{
-		m_N.resize(3, Vertices.size());
-		for (uint32_t i = 0; i < Vertices.size(); ++i)
-		{
-			m_N.col(i) = Normals.at(Vertices[i].N - 1);
+				m_V.col(iVertex) = Positions[V.P - 1];
+				if (!Normals.empty())
+				{
+					m_N.col(iVertex) = Normals[V.N - 1];
+				}
+				if (!Texcoords.empty())
+				{
+					m_UV.col(iVertex) = Texcoords[V.UV - 1];
+				}
+				VertexIndices[i] = iVertex++;
+			}
 		}
-	}
+	};
+	tbb::parallel_for(BlockRange, VertexMap);
 
-	if (!Texcoords.empty())
+	uint32_t * pIndices = m_F.data();
+	auto IndexMap = [&](const tbb::blocked_range<size_t> & Range)
 	{
-		m_UV.resize(2, Vertices.size());
-		for (uint32_t i = 0; i < Vertices.size(); ++i)
+		for (size_t i = Range.begin(); i < Range.end(); i++)
 		{
-			m_UV.col(i) = Texcoords.at(Vertices[i].UV - 1);
+			pIndices[i] = VertexIndices[iFirstUses[i]];
 		}
-	}
+	};
+	tbb::parallel_for(FaceVertexRange, IndexMap);
 
 	m_Name = Filename.str();
 
@@ -149,43 +389,123 @@ WavefrontObjMesh::WavefrontObjMesh(const PropertyList & PropList)
 		<< ObjTimer.ElapsedString() << " and "
 		<< MemString(m_F.size() * sizeof(uint32_t) + sizeof(float) * (m_V.size() + m_N.size() + m_UV.size()))
 		<< ")";
-}
 
-WavefrontObjMesh::ObjVertex::ObjVertex() { }
+	ShareGeometry(GeometryKey);
+}
 
-WavefrontObjMesh::ObjVertex::ObjVertex(const std::string & String)
+void WavefrontObjMesh::ParseChunk(ObjChunk & Chunk, const Transform & Trans)
 {
-	std::vector<std::string> Tokens = Tokenize(String, "/", true);
+	const char * pStr = Chunk.pBegin;
+	while (pStr < Chunk.pEnd)
+	{
+		const char * pLineEnd = (const char*)(memchr(pStr, '\n', size_t(Chunk.pEnd - pStr)));
+		pLineEnd = (pLineEnd != nullptr) ? pLineEnd : Chunk.pEnd;
+
+		const char * pPrefix = SkipObjSpaces(pStr, pLineEnd);
+		pStr = SkipObjToken(pPrefix, pLineEnd);
+		size_t nPrefixLength = size_t(pStr - pPrefix);
+
+		if (nPrefixLength == 1 && pPrefix[0] == 'v')
+		{
+			Point3f Pos;
+			pStr = ParseObjFloat(pStr, pLineEnd, Pos.x());
+			pStr = ParseObjFloat(pStr, pLineEnd, Pos.y());
+			pStr = ParseObjFloat(pStr, pLineEnd, Pos.z());
+			Pos = Trans * Pos;
+			Chunk.BBox.ExpandBy(Pos);
+			Chunk.Positions.push_back(Pos);
+		}
+		else if (nPrefixLength == 2 && pPrefix[0] == 'v' && pPrefix[1] == 't')
+		{
+			Point2f Tex;
+			pStr = ParseObjFloat(pStr, pLineEnd, Tex.x());
+			pStr = ParseObjFloat(pStr, pLineEnd, Tex.y());
+			Chunk.Texcoords.push_back(Tex);
+		}
+		else if (nPrefixLength == 2 && pPrefix[0] == 'v' && pPrefix[1] == 'n')
+		{
+			Normal3f Norm;
+			pStr = ParseObjFloat(pStr, pLineEnd, Norm.x());
+			pStr = ParseObjFloat(pStr, pLineEnd, Norm.y());
+			pStr = ParseObjFloat(pStr, pLineEnd, Norm.z());
+			Chunk.Normals.push_back((Trans * Norm).normalized());
+		}
+		else if (nPrefixLength == 1 && pPrefix[0] == 'f')
+		{
+			ObjVertex Verts[4];
+			int nTokens = 0;
+			while (nTokens < 4)
+			{
+				const char * pToken = SkipObjSpaces(pStr, pLineEnd);
+				pStr = SkipObjToken(pToken, pLineEnd);
+				if (pToken == pStr)
+				{
+					break;
+				}
+				Verts[nTokens++] = ParseVertex(pToken, pStr);
+			}
+
+			/* A missing vertex is left invalid */
+			Chunk.FaceVertices.push_back(Verts[0]);
+			Chunk.FaceVertices.push_back(Verts[1]);
+			Chunk.FaceVertices.push_back(Verts[2]);
+
+			if (nTokens == 4)
+			{
+				/* This is a quad, split into two triangles */
+				Chunk.FaceVertices.push_back(Verts[3]);
+				Chunk.FaceVertices.push_back(Verts[0]);
+				Chunk.FaceVertices.push_back(Verts[2]);
+			}
+		}
 
-	if (Tokens.size() < 1 || Tokens.size() > 3)
+		pStr = pLineEnd + 1;
+	}
+}
+
+WavefrontObjMesh::ObjVertex WavefrontObjMesh::ParseVertex(const char * pBegin, const char * pEnd)
+{
+	const char * pSlash1 = std::find(pBegin, pEnd, '/');
+	const char * pSlash2 = (pSlash1 != pEnd) ? std::find(pSlash1 + 1, pEnd, '/') : pEnd;
+	if (pSlash2 != pEnd && std::find(pSlash2 + 1, pEnd, '/') != pEnd)
 	{
-		throw HikariException("Invalid vertex data: \"%s\"", String);
+		throw HikariException("Invalid vertex data: \"%s\"", std::string(pBegin, pEnd));
 	}
 
-	P = ToUInt(Tokens[0]);
+	ObjVertex Vertex;
+	Vertex.P = ParseObjIndex(pBegin, pSlash1);
 
-	if (Tokens.size() >= 2 && !Tokens[1].empty())
+	if (pSlash1 != pEnd && pSlash1 + 1 != pSlash2)
 	{
-		UV = ToUInt(Tokens[1]);
+		Vertex.UV = ParseObjIndex(pSlash1 + 1, pSlash2);
 	}
 
-	if (Tokens.size() >= 3 && !Tokens[2].empty())
+	if (pSlash2 != pEnd && pSlash2 + 1 != pEnd)
 	{
-		N = ToUInt(Tokens[2]);
+		Vertex.N = ParseObjIndex(pSlash2 + 1, pEnd);
 	}
+
+	return Vertex;
 }
 
+WavefrontObjMesh::ObjVertex::ObjVertex() { }
+
 bool WavefrontObjMesh::ObjVertex::operator==(const ObjVertex & Rhs) const
 {
 	return Rhs.P == P && Rhs.N == N && Rhs.UV == UV;
 }
 
-size_t WavefrontObjMesh::ObjVertexHash::operator()(const ObjVertex & Rhs) const
+bool WavefrontObjMesh::ObjVertex::operator<(const ObjVertex & Rhs) const
 {
-	size_t Hash = std::hash<uint32_t>()(Rhs.P);
-	Hash = Hash * 37 + std::hash<uint32_t>()(Rhs.UV);
-	Hash = Hash * 37 + std::hash<uint32_t>()(Rhs.N);
-	return Hash;
+	if (P != Rhs.P)
+	{
+		return P < Rhs.P;
+	}
+	if (UV != Rhs.UV)
+	{
+		return UV < Rhs.UV;
+	}
+	return N < Rhs.N;
 }
 
 NAMESPACE_END
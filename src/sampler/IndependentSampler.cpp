@@ -17,9 +17,12 @@ std::unique_ptr<Sampler> IndependentSampler::Clone() const
 	return Cloned;
 }
 
-void IndependentSampler::Prepare(const ImageBlock & Block)
+void IndependentSampler::Prepare(const ImageBlock & Block, uint32_t iPass)
 {
 	m_Random.seed(Block.GetOffset().x(), Block.GetOffset().y());
+
+	/* Jump far ahead in the sequence so that the passes never overlap */
+	m_Random.advance(int64_t(iPass) << 40);
 }
 
 void IndependentSampler::Generate()
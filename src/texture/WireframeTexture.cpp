@@ -32,8 +32,8 @@ Color3f WireframeTexture::Eval(const Intersection & Isect, bool bFilter) const
 		return m_InteriorColor;
 	}
 
-	const MatrixXf & Positions = pMesh->GetVertexPositions();
-	const MatrixXu & Indices = pMesh->GetIndices();
+	const MatrixXfMap & Positions = pMesh->GetVertexPositions();
+	const MatrixXuMap & Indices = pMesh->GetIndices();
 
 	/* Automatically find the best edge width, i.e. 0.1 * Avg(EdgeLength) */
 	if (m_EdgeWidth == 0.0f)